@@ -64,12 +64,12 @@ main(void)
 {
     board_init();
 
-    /* TODO: Initialise the OS */
+    ws_os_init();
 
     PRINTF("Hello, world!\n");
 
     WS_TIMER_SET_NOW(blinky_timer);
 
-    /* TODO: Start the OS main loop */
+    ws_os_run();
     return 0;
 }
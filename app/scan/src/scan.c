@@ -45,13 +45,15 @@
 
 #define TI_EUI_64_ADDR (0x00280028)
 static uint8_t extended_address[8];
+static ws_mac_ctx_t *mac;
 
 
 WS_TIMER_DECLARE(start_scan_timer);
 
 
 static void
-scan_callback(ws_mac_scan_status_t status,
+scan_callback(ws_mac_ctx_t *ctx,
+              ws_mac_scan_status_t status,
               ws_mac_scan_type_t type,
               ws_list_t *scan_results)
 {
@@ -82,7 +84,7 @@ scan_callback(ws_mac_scan_status_t status,
 static void
 start_scan_timer(void)
 {
-    ws_mac_mlme_scan(WS_MAC_SCAN_TYPE_PASSIVE, 1, 4, scan_callback);
+    ws_mac_mlme_scan(mac, WS_MAC_SCAN_TYPE_PASSIVE, 1, 4, scan_callback);
 }
 
 
@@ -111,15 +113,15 @@ main(void)
 {
     board_init();
 
-    /* TODO: Initialise the OS */
+    ws_os_init();
 
     PRINTF("\n\nScan Demo\n");
 
     read_eui_addr(extended_address);
-    ws_mac_init(extended_address);
+    mac = ws_mac_init(extended_address, &ws_radio_cc2538);
 
     WS_TIMER_SET_NOW(start_scan_timer);
 
-    /* TODO: Start the OS main loop */
+    ws_os_run();
     return 0;
 }
@@ -83,6 +83,7 @@ typedef struct __attribute__((packed))
 
 #define TI_EUI_64_ADDR (0x00280028)
 static uint8_t extended_address[8];
+static ws_mac_ctx_t *mac;
 
 
 #define STATE_LIST \
@@ -133,8 +134,9 @@ WS_TIMER_DECLARE(association_timer);
 WS_TIMER_DECLARE(test_encryption_timer);
 
 static void
-receive_handler(const uint8_t *data, uint8_t len,
-                ws_mac_addr_t *src_addr)
+receive_handler(ws_mac_ctx_t *ctx,
+                const uint8_t *data, uint8_t len,
+                ws_mac_addr_t *src_addr, const ws_pktbuf_meta_t *meta)
 {
     msg_t *msg;
 
@@ -176,7 +178,8 @@ receive_handler(const uint8_t *data, uint8_t len,
 
 
 static void
-confirm_handler(uint8_t handle, ws_mac_mcps_status_t status)
+confirm_handler(ws_mac_ctx_t *ctx,
+                uint8_t handle, ws_mac_mcps_status_t status)
 {
     if (handle != msg_handle)
         return;
@@ -216,7 +219,8 @@ confirm_handler(uint8_t handle, ws_mac_mcps_status_t status)
 
 
 static void
-scan_callback(ws_mac_scan_status_t status,
+scan_callback(ws_mac_ctx_t *ctx,
+              ws_mac_scan_status_t status,
               ws_mac_scan_type_t type,
               ws_list_t *scan_results)
 {
@@ -249,7 +253,8 @@ scan_callback(ws_mac_scan_status_t status,
 
 
 static void
-associate_callback(ws_mac_association_status_t status,
+associate_callback(ws_mac_ctx_t *ctx,
+                   ws_mac_association_status_t status,
                    uint16_t short_addr)
 {
     switch (status)
@@ -286,7 +291,7 @@ association_timer(void)
 
     PRINTF("associating with %04x\n", pan.addr.pan_id);
 
-    ws_mac_mlme_associate(&pan, associate_callback);
+    ws_mac_mlme_associate(mac, &pan, associate_callback);
 }
 
 
@@ -307,7 +312,7 @@ test_encryption_timer(void)
     msg.id = MSG_ID_TEST_ENCRYPTION;
     msg.value = 0;
 
-    msg_handle = ws_mac_mcps_send_data((uint8_t *)&msg, sizeof(msg),
+    msg_handle = ws_mac_mcps_send_data(mac, (uint8_t *)&msg, sizeof(msg),
                                        &pan.addr, true);
 }
 
@@ -384,7 +389,7 @@ send_temp_message_timer(void)
 
         /* Send the message to the coordinator */
         PRINTF("sending: % r\n", (uint8_t *)&msg, sizeof(msg));
-        msg_handle = ws_mac_mcps_send_data((uint8_t *)&msg, sizeof(msg),
+        msg_handle = ws_mac_mcps_send_data(mac, (uint8_t *)&msg, sizeof(msg),
                                            &pan.addr, true);
     }
 }
@@ -483,7 +488,7 @@ main(void)
 
     board_init();
 
-    /* TODO: Initialise the OS */
+    ws_os_init();
 
     PRINTF("\n\nSensor demo: temperature\n");
 
@@ -492,20 +497,20 @@ main(void)
     PRINTF("Using extended address: % r\n", extended_address,
            sizeof(extended_address));
 
-    ws_mac_init(extended_address);
+    mac = ws_mac_init(extended_address, &ws_radio_cc2538);
 
-    ws_mac_security_add_own_key((uint8_t *)"gouda", strlen("gouda"));
+    ws_mac_security_add_own_key(mac, (uint8_t *)"gouda", strlen("gouda"));
 
     ws_aes_init();
 
-    ws_mac_mcps_register_rx_callback(receive_handler);
-    ws_mac_mcps_register_confirm_callback(confirm_handler);
+    ws_mac_mcps_register_rx_callback(mac, receive_handler);
+    ws_mac_mcps_register_confirm_callback(mac, confirm_handler);
 
     set_state(APP_STATE_SCANNING);
-    ws_mac_mlme_scan(WS_MAC_SCAN_TYPE_PASSIVE, 1, 4, scan_callback);
+    ws_mac_mlme_scan(mac, WS_MAC_SCAN_TYPE_PASSIVE, 1, 4, scan_callback);
 
     WS_TIMER_SET_NOW(measure_temp_timer);
 
-    /* TODO: Start the OS main loop */
+    ws_os_run();
     return 0;
 }
@@ -47,21 +47,25 @@
 #define TI_EUI_64_ADDR (0x00280028)
 
 static uint8_t extended_address[8];
+static ws_mac_ctx_t *mac;
 
 
 /* ---------------------------------------------------------------------
  *   WSN
  * --------------------------------------------------------------------- */
 static void
-receive_handler(const uint8_t *data, uint8_t len,
-                ws_mac_addr_t *src_addr)
+receive_handler(ws_mac_ctx_t *ctx,
+                const uint8_t *data, uint8_t len,
+                ws_mac_addr_t *src_addr, const ws_pktbuf_meta_t *meta)
 {
-    PRINTF("received message from: %04x\n", src_addr->short_addr);
+    PRINTF("received message from: %04x (rssi=%d, lqi=%u)\n",
+           src_addr->short_addr, meta->rssi, meta->lqi);
     PRINTF("  % r\n", data, len);
 }
 
 static void
-confirm_handler(uint8_t handle, ws_mac_mcps_status_t status)
+confirm_handler(ws_mac_ctx_t *ctx,
+                uint8_t handle, ws_mac_mcps_status_t status)
 {
     /* We don't send any data, so wouldn't expect to get this callback */
     PRINTF("Got MCPS-DATA.confirm (status=%u,handle=%u)\n", status, handle);
@@ -69,7 +73,7 @@ confirm_handler(uint8_t handle, ws_mac_mcps_status_t status)
 
 
 static void
-associate_handler(ws_mac_addr_t *addr)
+associate_handler(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr)
 {
     PRINTF("New device associated: %04x\n", addr->short_addr);
 }
@@ -113,25 +117,25 @@ main(void)
 {
     board_init();
 
-    /* TODO: Initialise the OS */
+    ws_os_init();
 
     PRINTF("\n\nSimple Coordinator\n");
 
     read_eui_addr(extended_address);
-    ws_mac_init(extended_address);
+    mac = ws_mac_init(extended_address, &ws_radio_cc2538);
 
     /* TODO: Do we need AES for this demo? We don't support encrypted
      * data anyway... */
     ws_aes_init();
 
-    ws_mac_mcps_register_rx_callback(receive_handler);
-    ws_mac_mcps_register_confirm_callback(confirm_handler);
+    ws_mac_mcps_register_rx_callback(mac, receive_handler);
+    ws_mac_mcps_register_confirm_callback(mac, confirm_handler);
 
-    ws_mac_mlme_set_short_address(0xaabb);
-    ws_mac_mlme_start(0xdc00, PHY_CHANNEL, 5, 4, true, associate_handler);
+    ws_mac_mlme_set_short_address(mac, 0xaabb);
+    ws_mac_mlme_start(mac, 0xdc00, PHY_CHANNEL, 5, 4, true, associate_handler);
 
     WS_TIMER_SET_NOW(blinky_timer);
 
-    /* TODO: Start the OS main loop */
+    ws_os_run();
     return 0;
 }
@@ -37,10 +37,8 @@
 #include "sys_ctrl.h"
 #include "interrupt.h"
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 
 typedef enum
@@ -55,6 +53,7 @@ typedef struct
 {
     aes_state_t state;
     ws_aes_callback_t status_cb;
+    void *arg;
     uint8_t M;
     uint16_t m_len;
     uint8_t *c;
@@ -65,21 +64,21 @@ typedef struct
 static aes_t aes;
 
 
-WS_TIMER_DECLARE(aes_timer);
+WS_EVENT_DECLARE(aes_task, WS_EVENT_PRIORITY_APP);
 
 
 static void
 aes_interrupt_handler(void)
 {
-    /* Clear the interrupt and set a timer to process the data */
+    /* Clear the interrupt and process the data from the main loop */
     HWREG(AES_CTRL_INT_CLR) = AES_CTRL_INT_CLR_DMA_IN_DONE |
         AES_CTRL_INT_CLR_RESULT_AV;
-    WS_TIMER_SET_NOW(aes_timer);
+    WS_EVENT_POST(aes_task);
 }
 
 
 static void
-aes_timer(void)
+aes_task(void)
 {
     WS_DEBUG("current state: (%u)\n", aes.state);
 
@@ -102,11 +101,11 @@ aes_timer(void)
         if (CCMAuthEncryptGetResult(aes.M, aes.m_len, aes.tag) !=
             AES_SUCCESS)
         {
-            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL, aes.arg);
         }
         else
         {
-            aes.status_cb(WS_AES_STATUS_SUCCESS, aes.tag);
+            aes.status_cb(WS_AES_STATUS_SUCCESS, aes.tag, aes.arg);
         }
         break;
 
@@ -125,12 +124,12 @@ aes_timer(void)
             WS_ERROR("authentication failed.\n");
             WS_DEBUG("calculated tag: %r\n", aes.tag, aes.M);
             WS_DEBUG("c || T: %r\n", aes.c, aes.c_len);
-            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL, aes.arg);
         }
         else
         {
             WS_DEBUG("calculated tag: %r\n", aes.tag, aes.M);
-            aes.status_cb(WS_AES_STATUS_SUCCESS, aes.tag);
+            aes.status_cb(WS_AES_STATUS_SUCCESS, aes.tag, aes.arg);
         }
         break;
 
@@ -186,21 +185,23 @@ ws_aes_ccm_encrypt(bool encrypt,
                    uint8_t *m, uint8_t m_len,
                    uint8_t *a, uint8_t a_len,
                    uint8_t *key,
-                   ws_aes_callback_t cb)
+                   ws_aes_callback_t cb, void *arg)
 {
     uint8_t ret;
 
-    /* TODO: Real return value */
+    /* TODO: Real return value. The engine is shared between MAC instances,
+     * so the failure goes to this caller and the running job carries on */
     if (aes.state != AES_STATE_IDLE)
     {
         WS_ERROR("AES in use!\n");
-        aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL);
-        aes.state = AES_STATE_IDLE;
+        if (cb != NULL)
+            cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, arg);
         return;
     }
 
     memset(&aes, 0, sizeof(aes));
     aes.status_cb = cb;
+    aes.arg = arg;
     aes.M = M;
     aes.m_len = m_len;
     aes.state = AES_STATE_ENCRYPTING;
@@ -211,7 +212,7 @@ ws_aes_ccm_encrypt(bool encrypt,
     {
         if (aes.status_cb != NULL)
         {
-            aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, aes.arg);
             aes.state = AES_STATE_IDLE;
             return;
         }
@@ -232,7 +233,7 @@ ws_aes_ccm_encrypt(bool encrypt,
     {
         if (aes.status_cb != NULL)
         {
-            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL, aes.arg);
             aes.state = AES_STATE_IDLE;
             return;
         }
@@ -247,21 +248,23 @@ ws_aes_ccm_decrypt(bool decrypt,
                    uint8_t *c, uint8_t c_len,
                    uint8_t *a, uint8_t a_len,
                    uint8_t *key,
-                   ws_aes_callback_t cb)
+                   ws_aes_callback_t cb, void *arg)
 {
     uint8_t ret;
 
-    /* TODO: Real return value */
+    /* TODO: Real return value. The engine is shared between MAC instances,
+     * so the failure goes to this caller and the running job carries on */
     if (aes.state != AES_STATE_IDLE)
     {
         WS_ERROR("AES in use!\n");
-        aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL);
-        aes.state = AES_STATE_IDLE;
+        if (cb != NULL)
+            cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, arg);
         return;
     }
 
     memset(&aes, 0, sizeof(aes));
     aes.status_cb = cb;
+    aes.arg = arg;
     aes.M = M;
     aes.c = c;
     aes.c_len = c_len;
@@ -273,7 +276,7 @@ ws_aes_ccm_decrypt(bool decrypt,
     {
         if (aes.status_cb != NULL)
         {
-            aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, aes.arg);
             aes.state = AES_STATE_IDLE;
             return;
         }
@@ -295,7 +298,7 @@ ws_aes_ccm_decrypt(bool decrypt,
     {
         if (aes.status_cb != NULL)
         {
-            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL);
+            aes.status_cb(WS_AES_STATUS_ENCRYPT_ERROR, NULL, aes.arg);
             aes.state = AES_STATE_IDLE;
             return;
         }
@@ -0,0 +1,440 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Software AES-128 CCM* for host builds, so the MAC security supplicant can
+ * run without the CC2538 crypto engine. Results are handed back from the
+ * event loop, the same as the hardware interrupt does, so callers see the
+ * same ordering on both.
+ */
+
+#include "ws_aes.h"
+
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+
+
+#define AES_BLOCK_LEN (16)
+#define AES_ROUNDS (10)
+
+/* Each MAC instance has at most one operation running */
+#ifndef WS_AES_MAX_JOBS
+#define WS_AES_MAX_JOBS WS_MAC_MAX_INSTANCES
+#endif
+
+
+typedef struct
+{
+    bool used;
+    ws_aes_status_t status;
+    ws_aes_callback_t cb;
+    void *arg;
+    uint8_t tag[AES_BLOCK_LEN];
+} aes_job_t;
+
+static aes_job_t jobs[WS_AES_MAX_JOBS];
+
+
+static const uint8_t sbox[256] =
+{
+    0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+    0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+    0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+    0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+    0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+    0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+    0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+    0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+    0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+    0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+    0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+    0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+    0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+    0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+    0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+    0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+    0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+    0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+    0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+    0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+    0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+    0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+    0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+    0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+    0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+    0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+    0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+    0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+    0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+    0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+    0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+    0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16,
+};
+
+
+WS_EVENT_DECLARE(aes_task, WS_EVENT_PRIORITY_APP);
+
+
+static void
+aes_task(void)
+{
+    uint8_t i;
+
+    /* Completed in the order they were started, as there's one engine */
+    for (i = 0; i < WS_AES_MAX_JOBS; i++)
+    {
+        if (!jobs[i].used)
+            continue;
+
+        jobs[i].used = false;
+        if (jobs[i].cb == NULL)
+        {
+            WS_WARN("nowhere to put the result!\n");
+            continue;
+        }
+
+        jobs[i].cb(jobs[i].status,
+                   jobs[i].status == WS_AES_STATUS_SUCCESS ?
+                   jobs[i].tag : NULL,
+                   jobs[i].arg);
+    }
+}
+
+
+static uint8_t
+xtime(uint8_t x)
+{
+    return (uint8_t)((x << 1) ^ ((x & 0x80) ? 0x1b : 0x00));
+}
+
+
+static void
+expand_key(const uint8_t *key, uint8_t *round_keys)
+{
+    uint8_t rcon = 0x01;
+    uint8_t t[4];
+    uint8_t i;
+
+    memcpy(round_keys, key, AES_BLOCK_LEN);
+
+    for (i = 4; i < 4 * (AES_ROUNDS + 1); i++)
+    {
+        memcpy(t, &round_keys[(i - 1) * 4], 4);
+
+        if ((i % 4) == 0)
+        {
+            uint8_t first = t[0];
+
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[first];
+            rcon = xtime(rcon);
+        }
+
+        round_keys[i * 4 + 0] = round_keys[(i - 4) * 4 + 0] ^ t[0];
+        round_keys[i * 4 + 1] = round_keys[(i - 4) * 4 + 1] ^ t[1];
+        round_keys[i * 4 + 2] = round_keys[(i - 4) * 4 + 2] ^ t[2];
+        round_keys[i * 4 + 3] = round_keys[(i - 4) * 4 + 3] ^ t[3];
+    }
+}
+
+
+/**
+ * Encrypts a single block in place. The state is stored column by column,
+ * as the block arrives.
+ */
+static void
+encrypt_block(const uint8_t *round_keys, uint8_t *s)
+{
+    uint8_t round;
+    uint8_t t[AES_BLOCK_LEN];
+    uint8_t i;
+
+    for (i = 0; i < AES_BLOCK_LEN; i++)
+        s[i] ^= round_keys[i];
+
+    for (round = 1; round <= AES_ROUNDS; round++)
+    {
+        /* SubBytes and ShiftRows together */
+        for (i = 0; i < AES_BLOCK_LEN; i++)
+            t[i] = sbox[s[(i + 4 * (i % 4)) % AES_BLOCK_LEN]];
+
+        /* MixColumns, skipped in the final round */
+        for (i = 0; i < AES_BLOCK_LEN; i += 4)
+        {
+            uint8_t all = t[i] ^ t[i + 1] ^ t[i + 2] ^ t[i + 3];
+
+            if (round == AES_ROUNDS)
+            {
+                memcpy(&s[i], &t[i], 4);
+                continue;
+            }
+
+            s[i + 0] = t[i + 0] ^ all ^ xtime(t[i + 0] ^ t[i + 1]);
+            s[i + 1] = t[i + 1] ^ all ^ xtime(t[i + 1] ^ t[i + 2]);
+            s[i + 2] = t[i + 2] ^ all ^ xtime(t[i + 2] ^ t[i + 3]);
+            s[i + 3] = t[i + 3] ^ all ^ xtime(t[i + 3] ^ t[i + 0]);
+        }
+
+        for (i = 0; i < AES_BLOCK_LEN; i++)
+            s[i] ^= round_keys[round * AES_BLOCK_LEN + i];
+    }
+}
+
+
+/**
+ * Runs data through the CBC-MAC, padding the last block with zeros.
+ */
+static void
+cbc_mac(const uint8_t *round_keys, uint8_t *x, uint8_t *used,
+        const uint8_t *data, uint16_t len)
+{
+    while (len--)
+    {
+        x[(*used)++] ^= *data++;
+        if (*used == AES_BLOCK_LEN)
+        {
+            encrypt_block(round_keys, x);
+            *used = 0;
+        }
+    }
+}
+
+
+static void
+cbc_mac_pad(const uint8_t *round_keys, uint8_t *x, uint8_t *used)
+{
+    if (*used == 0)
+        return;
+    encrypt_block(round_keys, x);
+    *used = 0;
+}
+
+
+/**
+ * Calculates the CCM* authentication tag, before it has been encrypted
+ * with the first block of key stream
+ */
+static void
+ccm_tag(const uint8_t *round_keys, uint8_t M, uint8_t L, const uint8_t *N,
+        const uint8_t *m, uint8_t m_len, const uint8_t *a, uint8_t a_len,
+        uint8_t *tag)
+{
+    uint8_t used = 0;
+    uint8_t a_hdr[2];
+
+    /* B0 is the flags, the nonse and the message length */
+    memset(tag, 0, AES_BLOCK_LEN);
+    tag[0] = (uint8_t)(((a_len > 0) ? 0x40 : 0x00) |
+                       (((M - 2) / 2) << 3) | (L - 1));
+    memcpy(&tag[1], N, 15 - L);
+    tag[AES_BLOCK_LEN - 1] = m_len;
+    encrypt_block(round_keys, tag);
+
+    if (a_len > 0)
+    {
+        a_hdr[0] = 0;
+        a_hdr[1] = a_len;
+        cbc_mac(round_keys, tag, &used, a_hdr, 2);
+        cbc_mac(round_keys, tag, &used, a, a_len);
+        cbc_mac_pad(round_keys, tag, &used);
+    }
+
+    cbc_mac(round_keys, tag, &used, m, m_len);
+    cbc_mac_pad(round_keys, tag, &used);
+}
+
+
+/**
+ * Generates key stream block i (A_i encrypted)
+ */
+static void
+ccm_key_stream(const uint8_t *round_keys, uint8_t L, const uint8_t *N,
+               uint8_t i, uint8_t *s)
+{
+    memset(s, 0, AES_BLOCK_LEN);
+    s[0] = L - 1;
+    memcpy(&s[1], N, 15 - L);
+    s[AES_BLOCK_LEN - 1] = i;
+    encrypt_block(round_keys, s);
+}
+
+
+static void
+ccm_crypt(const uint8_t *round_keys, uint8_t L, const uint8_t *N,
+          uint8_t *data, uint8_t len)
+{
+    uint8_t s[AES_BLOCK_LEN];
+    uint8_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if ((i % AES_BLOCK_LEN) == 0)
+            ccm_key_stream(round_keys, L, N, i / AES_BLOCK_LEN + 1, s);
+        data[i] ^= s[i % AES_BLOCK_LEN];
+    }
+}
+
+
+static aes_job_t *
+start_job(ws_aes_callback_t cb, void *arg)
+{
+    uint8_t i;
+
+    for (i = 0; i < WS_AES_MAX_JOBS; i++)
+    {
+        if (!jobs[i].used)
+        {
+            memset(&jobs[i], 0, sizeof(aes_job_t));
+            jobs[i].used = true;
+            jobs[i].cb = cb;
+            jobs[i].arg = arg;
+            WS_EVENT_POST(aes_task);
+            return &jobs[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+void
+ws_aes_init(void)
+{
+    WS_DEBUG("init\n");
+    memset(jobs, 0, sizeof(jobs));
+}
+
+
+void
+ws_aes_ccm_encrypt(bool encrypt,
+                   uint8_t M, uint8_t L,
+                   uint8_t *N,
+                   uint8_t *m, uint8_t m_len,
+                   uint8_t *a, uint8_t a_len,
+                   uint8_t *key,
+                   ws_aes_callback_t cb, void *arg)
+{
+    uint8_t round_keys[AES_BLOCK_LEN * (AES_ROUNDS + 1)];
+    uint8_t s[AES_BLOCK_LEN];
+    aes_job_t *job;
+    uint8_t i;
+
+    job = start_job(cb, arg);
+    if (job == NULL)
+    {
+        WS_ERROR("AES in use!\n");
+        if (cb != NULL)
+            cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, arg);
+        return;
+    }
+
+    /* CCM* only allows 2 octets of length here */
+    if (L != 2 || M > AES_BLOCK_LEN)
+    {
+        job->status = WS_AES_STATUS_ENCRYPT_ERROR;
+        return;
+    }
+
+    expand_key(key, round_keys);
+
+    if (M > 0)
+    {
+        ccm_tag(round_keys, M, L, N, m, m_len, a, a_len, job->tag);
+        ccm_key_stream(round_keys, L, N, 0, s);
+        for (i = 0; i < M; i++)
+            job->tag[i] ^= s[i];
+    }
+
+    if (encrypt)
+        ccm_crypt(round_keys, L, N, m, m_len);
+
+    job->status = WS_AES_STATUS_SUCCESS;
+}
+
+
+void
+ws_aes_ccm_decrypt(bool decrypt,
+                   uint8_t M, uint8_t L,
+                   uint8_t *N,
+                   uint8_t *c, uint8_t c_len,
+                   uint8_t *a, uint8_t a_len,
+                   uint8_t *key,
+                   ws_aes_callback_t cb, void *arg)
+{
+    uint8_t round_keys[AES_BLOCK_LEN * (AES_ROUNDS + 1)];
+    uint8_t s[AES_BLOCK_LEN];
+    uint8_t m_len;
+    aes_job_t *job;
+    uint8_t i;
+
+    job = start_job(cb, arg);
+    if (job == NULL)
+    {
+        WS_ERROR("AES in use!\n");
+        if (cb != NULL)
+            cb(WS_AES_STATUS_KEY_WRITE_ERROR, NULL, arg);
+        return;
+    }
+
+    if (L != 2 || M > AES_BLOCK_LEN || c_len < M)
+    {
+        job->status = WS_AES_STATUS_ENCRYPT_ERROR;
+        return;
+    }
+
+    /* The tag is carried on the end of the ciphertext */
+    m_len = c_len - M;
+    expand_key(key, round_keys);
+
+    if (decrypt)
+        ccm_crypt(round_keys, L, N, c, m_len);
+
+    job->status = WS_AES_STATUS_SUCCESS;
+    if (M == 0)
+        return;
+
+    ccm_tag(round_keys, M, L, N, c, m_len, a, a_len, job->tag);
+    ccm_key_stream(round_keys, L, N, 0, s);
+    for (i = 0; i < M; i++)
+    {
+        job->tag[i] ^= s[i];
+        if (job->tag[i] != c[m_len + i])
+            job->status = WS_AES_STATUS_ENCRYPT_ERROR;
+    }
+
+    if (job->status != WS_AES_STATUS_SUCCESS)
+    {
+        WS_ERROR("authentication failed.\n");
+        WS_DEBUG("calculated tag: %r\n", job->tag, M);
+    }
+}
@@ -50,9 +50,11 @@ typedef enum
  * and the authentication tag.
  * @param status the status of the AES process
  * @param tag the authentication tag
+ * @param arg the argument given when the operation was started
  */
 typedef void (*ws_aes_callback_t)(ws_aes_status_t status,
-                                  uint8_t *tag);
+                                  uint8_t *tag,
+                                  void *arg);
 
 /**
  * Prepare the AES library.
@@ -76,6 +78,8 @@ ws_aes_init(void);
  * @param a_len     length of authentication data in octets
  * @param key       pointer to the 128 AES key to use
  * @param cb        callback function to run on completetion
+ * @param arg       passed to the callback, so several users can share the
+ *                  AES engine
  */
 extern void
 ws_aes_ccm_encrypt(bool encrypt,
@@ -84,7 +88,7 @@ ws_aes_ccm_encrypt(bool encrypt,
                    uint8_t *m, uint8_t m_len,
                    uint8_t *a, uint8_t a_len,
                    uint8_t *key,
-                   ws_aes_callback_t cb);
+                   ws_aes_callback_t cb, void *arg);
 
 
 /**
@@ -102,6 +106,7 @@ ws_aes_ccm_encrypt(bool encrypt,
  * @param a_len     length of authentication data in octets
  * @param key       pointer to the 128 AES key to use
  * @param cb        callback function to run on completetion
+ * @param arg       passed to the callback
  */
 extern void
 ws_aes_ccm_decrypt(bool decrypt,
@@ -110,7 +115,7 @@ ws_aes_ccm_decrypt(bool decrypt,
                    uint8_t *c, uint8_t c_len,
                    uint8_t *a, uint8_t a_len,
                    uint8_t *key,
-                   ws_aes_callback_t cb);
+                   ws_aes_callback_t cb, void *arg);
 
 
 
@@ -32,10 +32,8 @@
 #include "mac_private.h"
 
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 
 /* Macro to access the private coordinator data associated with a device */
@@ -58,72 +56,70 @@ typedef struct
 } device_coord_data_t;
 
 
-typedef struct
+static void
+update_beacon_stats(ws_mac_ctx_t *ctx, uint8_t sqn)
 {
-    uint8_t beacon_sqn;
-    ws_mac_beacon_rx_callback_t rx_cb;
-    ws_mac_coordinator_associate_callback_t associate_cb;
-    ws_pktbuf_t *beacon;
-} coordinator_t;
+    uint32_t now = WS_RADIO_TIMER_CALL(&ctx->radio, get_time);
+    uint32_t interval = (now - ctx->coord.last_beacon_rx_time) & 0xffffff;
 
-static coordinator_t coord;
+    /* Only consecutive beacons tell us about jitter. A gap means we
+     * missed one. */
+    if (ctx->stats.beacons_rx > 0 &&
+        sqn == (uint8_t)(ctx->coord.last_beacon_rx_sqn + 1))
+    {
+        if (ctx->stats.beacon_interval_min == 0 ||
+            interval < ctx->stats.beacon_interval_min)
+            ctx->stats.beacon_interval_min = interval;
+        if (interval > ctx->stats.beacon_interval_max)
+            ctx->stats.beacon_interval_max = interval;
+    }
 
+    ctx->stats.beacons_rx++;
+    ctx->coord.last_beacon_rx_sqn = sqn;
+    ctx->coord.last_beacon_rx_time = now;
+}
 
-static void
-prepare_association_response(ws_mac_addr_t *dest, mac_device_t *dev,
+
+static bool
+prepare_association_response(ws_mac_ctx_t *ctx, ws_mac_addr_t *dest,
+                             mac_device_t *dev,
                              ws_mac_association_status_t stat)
 {
-    ws_pktbuf_t *pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-    if (pkt == NULL)
-    {
-        WS_ERROR("failed to allocate pktbuf for association response\n");
-        return;
-    }
-
-    mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-    uint8_t *ptr = fcf->data;
+    uint8_t payload[4];
     ws_mac_addr_t src;
-    mac_capability_info_t *info = NULL;
+    ws_pktbuf_t *pkt;
 
-    memset(fcf, 0, sizeof(mac_fcf_t));
-    fcf->frame_type = MAC_FRAME_TYPE_MAC;
-    fcf->security_enabled = 0;
-    fcf->frame_pending = 0;
-    fcf->ack_req = 1;
-    fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
-
-    /* Sequence number */
-    dev->last_sqn = mac_mlme_get_sqn();
-    *ptr++ = dev->last_sqn;
+    payload[0] = MAC_COMMAND_ASSOCIATION_RESPONSE;
+    memcpy(&payload[1], &dev->addr.short_addr, 2);
+    payload[3] = stat;
 
     /* Packet is directed to the device from our extended address */
     src.type = WS_MAC_ADDR_TYPE_EXTENDED;
     src.pan_id = dest->pan_id;
-    memcpy(&src.extended_addr, mac.extended_address,
+    memcpy(&src.extended_addr, ctx->mac.extended_address,
            WS_MAC_ADDR_TYPE_EXTENDED_LEN);
-    WS_DEBUG("appending address\n");
-    ptr += mac_frame_append_address(fcf, dest, &src);
-
-    *ptr++ = MAC_COMMAND_ASSOCIATION_RESPONSE;
-
-    memcpy(ptr, &dev->addr.short_addr, 2);
-    ptr += 2;
 
-    *ptr++ = stat;
-
-    ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
+    dev->last_sqn = mac_mlme_get_sqn(ctx);
+    pkt = mac_mlme_build_command(ctx, dev->last_sqn, true, dest, &src,
+                                 payload, sizeof(payload));
+    if (pkt == NULL)
+        return false;
 
     WS_DEBUG("pending packet (%p) for device (%04x)\n", pkt,
              dev->addr.short_addr);
     CDATA(dev)->pending_data = pkt;
+    return true;
 }
 
 
 static void
-handle_association_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
+handle_association_request(ws_mac_ctx_t *ctx, mac_fcf_t *fcf,
+                           ws_mac_addr_t *src)
 {
     mac_device_t *dev = NULL;
     ws_list_t *ptr;
+    uint16_t short_addr;
+    bool new_device = false;
 
     WS_DEBUG("Got association request!\n");
 
@@ -136,34 +132,53 @@ handle_association_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
         return;
     }
 
-    dev = mac_device_get_by_extended(&src->extended_addr[0]);
+    dev = mac_device_get_by_extended(ctx, &src->extended_addr[0]);
     if (dev != NULL)
     {
         /* A device we've seen before is trying to re-associate. We'll clear
          * any pending data and prepare a new association response. */
         if (CDATA(dev)->pending_data != NULL)
         {
-            WS_DEBUG("dest\n");
-            ws_pktbuf_destroy(CDATA(dev)->pending_data);
+            ws_pktbuf_unref(CDATA(dev)->pending_data);
             CDATA(dev)->pending_data = NULL;
         }
     }
     else
     {
-        /* A new device is trying to associate */
+        /* A new device is trying to associate. The response is held for it
+         * on its device, so without room for one there's no way to answer,
+         * and it will give up waiting. */
+        if (ctx->mac.devices.count == WS_MAC_MAX_DEVICES)
+        {
+            WS_WARN("device table is full\n");
+            ctx->stats.assoc_refused++;
+            return;
+        }
+
         dev = mac_coordinator_create_device(src);
         if (dev == NULL)
         {
-            WS_ERROR("Failed to create device\n");
+            ctx->stats.assoc_refused++;
             return;
         }
 
         dev->addr.type = WS_MAC_ADDR_TYPE_SHORT;
         dev->addr.pan_id = src->pan_id;
-        /* TODO: Randomly assign addresses that aren't taken */
-        dev->addr.short_addr = ws_list_count(&mac.device_list) + 1;
 
-        ws_list_add_after(&mac.device_list, &dev->list);
+        if (!mac_device_add(ctx, dev))
+        {
+            FREE(dev);
+            ctx->stats.assoc_refused++;
+            return;
+        }
+        new_device = true;
+
+        /* No two devices in the table share a handle, so an address made
+         * from it can't be in use. Skip over our own. */
+        short_addr = dev->handle + 1;
+        if (short_addr >= ctx->mac.short_address)
+            short_addr++;
+        mac_device_set_short_addr(ctx, dev, short_addr);
 
         WS_DEBUG("Added new device (%04x)\n", dev->addr.short_addr);
     }
@@ -171,8 +186,19 @@ handle_association_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
     WS_DEBUG("device associating: %p\n", dev);
     CDATA(dev)->state = DEVICE_STATE_ASSOCIATING;
 
-    prepare_association_response(src, dev,
-                                 WS_MAC_ASSOCIATION_SUCCESS);
+    if (!prepare_association_response(ctx, src, dev,
+                                      WS_MAC_ASSOCIATION_SUCCESS))
+    {
+        /* Don't keep a device that can never hear it was accepted */
+        WS_ERROR("no room for the association response\n");
+        ctx->stats.assoc_refused++;
+        if (new_device)
+        {
+            mac_device_remove(ctx, dev);
+            FREE(dev);
+        }
+        return;
+    }
 
     /* TODO: Add a timeout to the new device so we can free some memory if
      * the device never requests the data */
@@ -180,39 +206,49 @@ handle_association_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
 
 
 static void
-handle_data_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
+handle_data_request(ws_mac_ctx_t *ctx, mac_fcf_t *fcf, ws_mac_addr_t *src)
 {
     mac_device_t *dev = NULL;
     ws_list_t *ptr;
 
     WS_DEBUG("got data request\n");
 
-    if (src->pan_id != mac.pan_id)
+    if (src->pan_id != ctx->mac.pan_id)
     {
         WS_WARN("Ignoring data request from (pan=%04x)\n", src->pan_id);
         return;
     }
 
-    if (ws_list_is_empty(&mac.device_list))
+    if (ctx->mac.devices.count == 0)
     {
         WS_DEBUG("No associated devices\n");
         return;
     }
 
     WS_DEBUG("finding device with address: ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     mac_frame_print_address(src);
     PRINTF("\n");
+#endif
 
-    dev = mac_device_get_by_addr(src);
+    dev = mac_device_get_by_addr(ctx, src);
     if (dev != NULL && CDATA(dev)->pending_data != NULL)
     {
         WS_DEBUG("device: %p\n", dev);
         WS_DEBUG("sending data to: ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
         mac_frame_print_address(src);
         PRINTF("\n");
+#endif
         WS_DEBUG("(pkt=%p)\n", CDATA(dev)->pending_data);
-        mac_packet_scheduler_send_data(CDATA(dev)->pending_data);
-        CDATA(dev)->pending_data = NULL;
+
+        /* If it can't be queued, keep it for the device's next request */
+        if (mac_packet_scheduler_send_data(ctx, CDATA(dev)->pending_data,
+                                           MAC_TX_CLASS_INDIRECT))
+        {
+            ws_pktbuf_unref(CDATA(dev)->pending_data);
+            CDATA(dev)->pending_data = NULL;
+        }
     }
     else
     {
@@ -226,16 +262,20 @@ handle_data_request(mac_fcf_t *fcf, ws_mac_addr_t *src)
 
 
 void
-mac_coordinator_init(void)
+mac_coordinator_init(ws_mac_ctx_t *ctx)
 {
-    memset(&coord, 0, sizeof(coord));
-    coord.beacon = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-    WS_DEBUG("coodinator beacon (ptr=%p)\n", coord.beacon);
+    memset(&ctx->coord, 0, sizeof(coordinator_t));
+    ctx->coord.beacon[0] = ws_pktbuf_pool_acquire();
+    ctx->coord.beacon[1] = ws_pktbuf_pool_acquire();
+    ASSERT(ctx->coord.beacon[0] != NULL && ctx->coord.beacon[1] != NULL,
+           "no pktbuf left for the beacon\n");
+    WS_DEBUG("coodinator beacons (ptr=%p, %p)\n", ctx->coord.beacon[0],
+             ctx->coord.beacon[1]);
 }
 
 
 void
-mac_coordinator_handle_packet(ws_pktbuf_t *pkt)
+mac_coordinator_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     uint8_t *ptr;
@@ -258,18 +298,19 @@ mac_coordinator_handle_packet(ws_pktbuf_t *pkt)
     switch (fcf->frame_type)
     {
     case MAC_FRAME_TYPE_BEACON:
-        if (mac.state == MAC_STATE_COORDINATING)
+        if (ctx->mac.state == MAC_STATE_COORDINATING)
         {
             /* TODO: Figure out if we need to realign */
             WS_WARN("Beacon frame detected\n");
         }
-        else if (mac.state == MAC_STATE_ASSOCIATED)
+        else if (ctx->mac.state == MAC_STATE_ASSOCIATED)
         {
             if (src.type == WS_MAC_ADDR_TYPE_SHORT &&
-                src.short_addr == mac.coord_short_address)
+                src.short_addr == ctx->mac.coord_short_address)
             {
                 /* This came from our coordinator, so we need to sync */
-                mac_packet_scheduler_sync();
+                mac_packet_scheduler_sync(ctx);
+                update_beacon_stats(ctx, sqn);
 
                 spec = (mac_superframe_spec_t *)ptr;
                 gts_spec = (mac_gts_spec_t *)spec->data;
@@ -284,9 +325,12 @@ mac_coordinator_handle_packet(ws_pktbuf_t *pkt)
                     {
                         memcpy(&saddr, ptr, 2);
                         ptr += 2;
-                        if (saddr == mac.short_address)
+                        /* A refused request is made again when the
+                         * next beacon still lists our address */
+                        if (saddr == ctx->mac.short_address &&
+                            !mac_mlme_send_data_request(ctx, &src))
                         {
-                            mac_mlme_send_data_request(&src);
+                            WS_WARN("data request refused\n");
                         }
                     }
                 }
@@ -309,11 +353,11 @@ mac_coordinator_handle_packet(ws_pktbuf_t *pkt)
         switch (*ptr)
         {
         case MAC_COMMAND_ASSOCIATION_REQUEST:
-            handle_association_request(fcf, &src);
+            handle_association_request(ctx, fcf, &src);
             break;
 
         case MAC_COMMAND_DATA_REQUEST:
-            handle_data_request(fcf, &src);
+            handle_data_request(ctx, fcf, &src);
             break;
 
         case MAC_COMMAND_BEACON_REQUEST:
@@ -327,43 +371,32 @@ mac_coordinator_handle_packet(ws_pktbuf_t *pkt)
         }
         break;
     }
-
-    WS_DEBUG("dest\n");
-    ws_pktbuf_destroy(pkt);
 }
 
 
 void
-mac_coordinator_handle_status(uint8_t sqn, mac_tx_status_t status)
+mac_coordinator_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn,
+                              ws_mac_addr_t *dest, mac_tx_status_t status)
 {
     mac_device_t *dev;
-    ws_list_t *lptr;
 
     WS_DEBUG("got status (%u) for sqn (%u)\n", status, sqn);
 
-    for (lptr = mac.device_list.next;
-         lptr != &mac.device_list;
-         lptr = lptr->next)
+    dev = mac_device_get_by_addr(ctx, dest);
+    if (dev != NULL && dev->last_sqn == sqn &&
+        CDATA(dev)->state == DEVICE_STATE_ASSOCIATING)
     {
-        dev = ws_list_get_data(lptr, mac_device_t, list);
-        if (dev->last_sqn == sqn)
-        {
-            if (CDATA(dev)->state == DEVICE_STATE_ASSOCIATING)
-            {
-                WS_DEBUG("device associated: %p\n", dev);
-                CDATA(dev)->state = DEVICE_STATE_ASSOCIATED;
+        WS_DEBUG("device associated: %p\n", dev);
+        CDATA(dev)->state = DEVICE_STATE_ASSOCIATED;
 
-                if (coord.associate_cb != NULL)
-                    coord.associate_cb(&dev->addr);
-            }
-            break;
-        }
+        if (ctx->coord.associate_cb != NULL)
+            ctx->coord.associate_cb(ctx, &dev->addr);
     }
 }
 
 
 void
-mac_coordinator_send_data(ws_pktbuf_t *pkt)
+mac_coordinator_send_data(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     /* This input packet will be ready to go, we just need to read the
      * address and pend it for the right device */
@@ -375,7 +408,7 @@ mac_coordinator_send_data(ws_pktbuf_t *pkt)
 
     fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     mac_frame_extract_address(fcf, &dest, NULL);
-    dev = mac_device_get_by_addr(&dest);
+    dev = mac_device_get_by_addr(ctx, &dest);
 
     WS_DEBUG("device: %p\n", dev);
 
@@ -386,16 +419,17 @@ mac_coordinator_send_data(ws_pktbuf_t *pkt)
             /* TODO: This warning assumes the device has a short address */
             WS_WARN("Overwritting previous data for device: %04x\n",
                     dest.short_addr);
-            WS_DEBUG("dest\n");
-            ws_pktbuf_destroy(CDATA(dev)->pending_data);
+            ws_pktbuf_unref(CDATA(dev)->pending_data);
             CDATA(dev)->pending_data = NULL;
         }
 
         WS_DEBUG("pending data for: ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
         mac_frame_print_address(&dest);
         PRINTF("\n");
+#endif
 
-        CDATA(dev)->pending_data = pkt;
+        CDATA(dev)->pending_data = ws_pktbuf_ref(pkt);
 
         WS_DEBUG("data: %r\n",
                  ws_pktbuf_get_data(CDATA(dev)->pending_data),
@@ -409,7 +443,7 @@ mac_coordinator_send_data(ws_pktbuf_t *pkt)
 
 
 ws_pktbuf_t *
-mac_coordinator_request_beacon(void)
+mac_coordinator_request_beacon(ws_mac_ctx_t *ctx)
 {
     mac_fcf_t *fcf = NULL;
     uint8_t *ptr = NULL;
@@ -419,13 +453,22 @@ mac_coordinator_request_beacon(void)
     mac_gts_spec_t *gts_spec = NULL;
     mac_pending_addr_t *pending_addr = NULL;
 
-    ws_list_t *lptr;
     mac_device_t *dev;
+    ws_pktbuf_t *pkt;
     uint8_t pending_count = 0;
+    uint16_t i;
 
-    ws_pktbuf_reset(coord.beacon);
+    /* Beacons are built in turn into two buffers. The slot interrupt builds
+     * one itself if the background build isn't ready in time, and it mustn't
+     * write over the buffer that's half built. */
+    ENTER_CRITICAL();
+    pkt = ctx->coord.beacon[ctx->coord.beacon_next];
+    ctx->coord.beacon_next ^= 1;
+    EXIT_CRITICAL();
 
-    ptr = ws_pktbuf_get_data(coord.beacon);
+    ws_pktbuf_reset(pkt);
+
+    ptr = ws_pktbuf_get_data(pkt);
     ASSERT(ptr != NULL, "corrupted beacon pktbuf!\n");
 
     memset(ptr, 0, WS_RADIO_MAX_PACKET_LEN);
@@ -440,21 +483,21 @@ mac_coordinator_request_beacon(void)
     fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
 
     /* Sequence number */
-    *ptr++ = coord.beacon_sqn++;
+    *ptr++ = ctx->coord.beacon_sqn++;
 
     /* Add our source address */
-    ws_mac_mlme_get_address(&src);
+    ws_mac_mlme_get_address(ctx, &src);
     ptr += mac_frame_append_address(fcf, NULL, &src);
 
     /* Beacon header */
     spec = (mac_superframe_spec_t *)ptr;
     ptr = spec->data;
-    spec->beacon_order = mac.beacon_order;
-    spec->superframe_order = mac.superframe_order;
+    spec->beacon_order = ctx->mac.beacon_order;
+    spec->superframe_order = ctx->mac.superframe_order;
     /* TODO: This is part of GTS */
-    spec->final_cap_slot = 15;
+    spec->final_cap_slot = ctx->ps.sf.cap_slots - 1;
     spec->ble = 0;
-    spec->pan_coordinator = mac.is_pan_coordinator;
+    spec->pan_coordinator = ctx->mac.is_pan_coordinator;
     /* TODO: This is a MAC PIB attribute */
     spec->association_permit = 0;
 
@@ -468,12 +511,12 @@ mac_coordinator_request_beacon(void)
     pending_addr = (mac_pending_addr_t *)ptr;
     ptr = pending_addr->data;
 
-    for (lptr = mac.device_list.next;
-         lptr != &mac.device_list;
-         lptr = lptr->next)
+    /* Handles are given out from the lowest, so this lists the devices
+     * that joined most recently first */
+    for (i = WS_MAC_MAX_DEVICES; i-- > 0; )
     {
-        dev = ws_list_get_data(lptr, mac_device_t, list);
-        if (CDATA(dev)->pending_data != NULL)
+        dev = mac_device_get_by_handle(ctx, i);
+        if (dev != NULL && CDATA(dev)->pending_data != NULL)
         {
             pending_count++;
             memcpy(ptr, &dev->addr.short_addr, 2);
@@ -490,9 +533,9 @@ mac_coordinator_request_beacon(void)
 
     /* TODO: Add beacon payload if present (and if there's room!) */
 
-    ws_pktbuf_increment_end(coord.beacon, (uint32_t)(ptr - (uint8_t *)fcf));
+    ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
 
-    return coord.beacon;
+    return pkt;
 }
 
 
@@ -520,6 +563,7 @@ mac_coordinator_create_device(ws_mac_addr_t *ext_addr)
     ws_list_init(&dev->key_list);
 
     dev->addr.type = WS_MAC_ADDR_TYPE_EXTENDED;
+    dev->addr.short_addr = 0xffff;
     memcpy(dev->addr.extended_addr, ext_addr->extended_addr,
            WS_MAC_ADDR_TYPE_EXTENDED_LEN);
 
@@ -528,26 +572,30 @@ mac_coordinator_create_device(ws_mac_addr_t *ext_addr)
 
 
 void
-mac_coordinator_register_associate_callback(ws_mac_coordinator_associate_callback_t cb)
+mac_coordinator_register_associate_callback(ws_mac_ctx_t *ctx,
+                                            ws_mac_coordinator_associate_callback_t cb)
 {
-    coord.associate_cb = cb;
+    ctx->coord.associate_cb = cb;
 }
 
 
 void
-ws_mac_coordinator_register_callback(ws_mac_beacon_rx_callback_t cb)
+ws_mac_coordinator_register_callback(ws_mac_ctx_t *ctx,
+                                     ws_mac_beacon_rx_callback_t cb)
 {
-    coord.rx_cb = cb;
+    ctx->coord.rx_cb = cb;
 }
 
 
 void
-ws_mac_coordinator_add_data(const uint8_t *data, uint8_t len)
+ws_mac_coordinator_add_data(ws_mac_ctx_t *ctx,
+                            const uint8_t *data, uint8_t len)
 {
     /* Add data to the end of a beacon frame. When the packet scheduler
      * asks us for a beacon, we'll put this data in if it fits. We'll only
      * copy it into the beacon once, but it might take a couple of attempts
      * if we're messing with GTS maintenence */
+    (void)ctx;
     (void)data;
     (void)len;
 }
@@ -32,28 +32,201 @@
 #include "mac_private.h"
 
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+
+
+#define TABLE(ctx) (&(ctx)->mac.devices)
+
+/* Short addresses 0xfffe and 0xffff mean the device doesn't have one */
+#define HAS_SHORT(dev) ((dev)->addr.short_addr < 0xfffe)
+
+#define NEXT_BUCKET(bucket) \
+    ((bucket) + 1 == MAC_DEVICE_BUCKETS ? 0 : (bucket) + 1)
+
+
+static uint32_t
+hash_short(uint16_t short_addr)
+{
+    return ((uint32_t)short_addr * 2654435761u >> 16) % MAC_DEVICE_BUCKETS;
+}
+
+
+static uint32_t
+hash_extended(const uint8_t *extended_addr)
+{
+    uint32_t lo, hi;
+
+    memcpy(&lo, extended_addr, 4);
+    memcpy(&hi, extended_addr + 4, 4);
+
+    return ((lo ^ hi * 0x9e3779b1u) * 2654435761u >> 16) %
+        MAC_DEVICE_BUCKETS;
+}
+
+
+/* The bucket a device would be in if nothing had been there before it */
+static uint32_t
+home_bucket(mac_device_t *dev, bool extended)
+{
+    if (extended)
+        return hash_extended(dev->addr.extended_addr);
+
+    return hash_short(dev->addr.short_addr);
+}
+
+
+static void
+index_insert(uint16_t *index, uint32_t bucket, uint16_t handle)
+{
+    /* There are twice as many buckets as devices, so there is always an
+     * empty one */
+    while (index[bucket] != 0)
+        bucket = NEXT_BUCKET(bucket);
+
+    index[bucket] = handle + 1;
+}
+
+
+static void
+index_remove(ws_mac_ctx_t *ctx, bool extended, mac_device_t *dev)
+{
+    mac_device_table_t *table = TABLE(ctx);
+    uint16_t *index = extended ? table->by_extended : table->by_short;
+    uint32_t bucket = home_bucket(dev, extended);
+    uint32_t hole, home;
+
+    while (index[bucket] != dev->handle + 1)
+        bucket = NEXT_BUCKET(bucket);
+
+    /* Close the gap by moving back any later device in the same run that
+     * would otherwise no longer be found from its home bucket */
+    hole = bucket;
+    for (bucket = NEXT_BUCKET(hole);
+         index[bucket] != 0;
+         bucket = NEXT_BUCKET(bucket))
+    {
+        home = home_bucket(table->devices[index[bucket] - 1], extended);
+
+        /* Leave it if its home is after the hole, up to where it is */
+        if (hole < bucket ? (hole < home && home <= bucket) :
+                            (hole < home || home <= bucket))
+        {
+            continue;
+        }
+
+        index[hole] = index[bucket];
+        hole = bucket;
+    }
+
+    index[hole] = 0;
+}
+
+
+void
+mac_device_init(ws_mac_ctx_t *ctx)
+{
+    mac_device_table_t *table = TABLE(ctx);
+    uint16_t i;
+
+    memset(table, 0, sizeof(*table));
+
+    /* Hand out the lowest handles first */
+    for (i = 0; i < WS_MAC_MAX_DEVICES; i++)
+        table->free[i] = WS_MAC_MAX_DEVICES - 1 - i;
+    table->free_count = WS_MAC_MAX_DEVICES;
+}
+
+
+bool
+mac_device_add(ws_mac_ctx_t *ctx, mac_device_t *dev)
+{
+    mac_device_table_t *table = TABLE(ctx);
+
+    if (table->free_count == 0)
+    {
+        WS_ERROR("device table is full\n");
+        return false;
+    }
+
+    dev->handle = table->free[--table->free_count];
+    table->devices[dev->handle] = dev;
+    table->count++;
+
+    index_insert(table->by_extended, home_bucket(dev, true), dev->handle);
+    if (HAS_SHORT(dev))
+        index_insert(table->by_short, home_bucket(dev, false), dev->handle);
+
+    WS_DEBUG("added device (%u)\n", dev->handle);
+
+    return true;
+}
+
+
+void
+mac_device_remove(ws_mac_ctx_t *ctx, mac_device_t *dev)
+{
+    mac_device_table_t *table = TABLE(ctx);
+
+    ASSERT(table->devices[dev->handle] == dev,
+           "removing a device that isn't in the table\n");
+
+    index_remove(ctx, true, dev);
+    if (HAS_SHORT(dev))
+        index_remove(ctx, false, dev);
+
+    table->devices[dev->handle] = NULL;
+    table->free[table->free_count++] = dev->handle;
+    table->count--;
+
+    WS_DEBUG("removed device (%u)\n", dev->handle);
+}
+
+
+void
+mac_device_set_short_addr(ws_mac_ctx_t *ctx, mac_device_t *dev,
+                          uint16_t short_addr)
+{
+    mac_device_table_t *table = TABLE(ctx);
+
+    ASSERT(table->devices[dev->handle] == dev,
+           "readdressing a device that isn't in the table\n");
+
+    if (HAS_SHORT(dev))
+        index_remove(ctx, false, dev);
+
+    dev->addr.short_addr = short_addr;
+    if (HAS_SHORT(dev))
+        index_insert(table->by_short, home_bucket(dev, false), dev->handle);
+}
 
 
 mac_device_t *
-mac_device_get_by_short(uint16_t short_addr)
+mac_device_get_by_handle(ws_mac_ctx_t *ctx, uint16_t handle)
 {
-    ws_list_t *ptr;
+    if (handle >= WS_MAC_MAX_DEVICES)
+        return NULL;
+
+    return TABLE(ctx)->devices[handle];
+}
+
+
+mac_device_t *
+mac_device_get_by_short(ws_mac_ctx_t *ctx, uint16_t short_addr)
+{
+    mac_device_table_t *table = TABLE(ctx);
+    uint32_t bucket = hash_short(short_addr);
     mac_device_t *dev;
 
     WS_DEBUG("searching for %u\n", short_addr);
 
-    for (ptr = mac.device_list.next;
-         ptr != &mac.device_list;
-         ptr = ptr->next)
+    while (table->by_short[bucket] != 0)
     {
-        dev = ws_list_get_data(ptr, mac_device_t, list);
-        WS_DEBUG("comparing to: %u\n", dev->addr.short_addr);
+        dev = table->devices[table->by_short[bucket] - 1];
         if (dev->addr.short_addr == short_addr)
             return dev;
+
+        bucket = NEXT_BUCKET(bucket);
     }
 
     return NULL;
@@ -61,24 +234,23 @@ mac_device_get_by_short(uint16_t short_addr)
 
 
 mac_device_t *
-mac_device_get_by_extended(uint8_t *extended_addr)
+mac_device_get_by_extended(ws_mac_ctx_t *ctx, uint8_t *extended_addr)
 {
-    ws_list_t *ptr;
+    mac_device_table_t *table = TABLE(ctx);
+    uint32_t bucket = hash_extended(extended_addr);
     mac_device_t *dev;
 
     WS_DEBUG("Searching for %r\n", extended_addr,
              WS_MAC_ADDR_TYPE_EXTENDED_LEN);
 
-    for (ptr = mac.device_list.next;
-         ptr != &mac.device_list;
-         ptr = ptr->next)
+    while (table->by_extended[bucket] != 0)
     {
-        dev = ws_list_get_data(ptr, mac_device_t, list);
-        WS_DEBUG("comparing to: %r\n", dev->addr.extended_addr,
-                 WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+        dev = table->devices[table->by_extended[bucket] - 1];
         if (memcmp(dev->addr.extended_addr, extended_addr,
                    WS_MAC_ADDR_TYPE_EXTENDED_LEN) == 0)
             return dev;
+
+        bucket = NEXT_BUCKET(bucket);
     }
 
     return NULL;
@@ -86,16 +258,16 @@ mac_device_get_by_extended(uint8_t *extended_addr)
 
 
 mac_device_t *
-mac_device_get_by_addr(ws_mac_addr_t *addr)
+mac_device_get_by_addr(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr)
 {
     WS_DEBUG("searching by address type: %u\n", addr->type);
     switch (addr->type)
     {
     case WS_MAC_ADDR_TYPE_SHORT:
-        return mac_device_get_by_short(addr->short_addr);
+        return mac_device_get_by_short(ctx, addr->short_addr);
 
     case WS_MAC_ADDR_TYPE_EXTENDED:
-        return mac_device_get_by_extended(addr->extended_addr);
+        return mac_device_get_by_extended(ctx, addr->extended_addr);
 
     default:
         WS_WARN("unknown address type\n");
@@ -31,11 +31,8 @@
 
 #include "mac_private.h"
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#define NO_DEBUG (1)
-#endif
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 uint8_t
 mac_frame_append_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
@@ -85,7 +82,7 @@ mac_frame_append_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
     if (src != NULL)
     {
         /* Add the source PAN ID if we need to */
-        if (dest->type == WS_MAC_ADDR_TYPE_NONE ||
+        if (dest == NULL || dest->type == WS_MAC_ADDR_TYPE_NONE ||
             dest->pan_id != src->pan_id)
         {
             fcf->pan_id_compression = 0;
@@ -129,12 +126,71 @@ mac_frame_append_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
 }
 
 
+uint8_t
+mac_frame_get_address_len(ws_mac_addr_t *dest, ws_mac_addr_t *src)
+{
+    uint8_t len = 0;
+
+    if (dest != NULL)
+    {
+        if (dest->type == WS_MAC_ADDR_TYPE_SHORT)
+            len += 2 + 2;
+        else if (dest->type == WS_MAC_ADDR_TYPE_EXTENDED)
+            len += 2 + WS_MAC_ADDR_TYPE_EXTENDED_LEN;
+    }
+
+    if (src != NULL)
+    {
+        /* Same rule for the source PAN ID as mac_frame_append_address */
+        if (dest == NULL || dest->type == WS_MAC_ADDR_TYPE_NONE ||
+            dest->pan_id != src->pan_id)
+            len += 2;
+
+        if (src->type == WS_MAC_ADDR_TYPE_SHORT)
+            len += 2;
+        else if (src->type == WS_MAC_ADDR_TYPE_EXTENDED)
+            len += WS_MAC_ADDR_TYPE_EXTENDED_LEN;
+    }
+
+    return len;
+}
+
+
+uint8_t
+mac_frame_prepend_header(ws_pktbuf_t *pkt, const mac_fcf_t *fcf, uint8_t sqn,
+                         ws_mac_addr_t *dest, ws_mac_addr_t *src,
+                         uint8_t aux_len)
+{
+    mac_fcf_t *hdr;
+    uint32_t len;
+
+    ASSERT(pkt != NULL, "NULL pktbuf\n");
+
+    /* FCF, SQN, Addressing, Auxiliary security header */
+    len = sizeof(mac_fcf_t) + 1 + mac_frame_get_address_len(dest, src) +
+        aux_len;
+
+    if (ws_pktbuf_increment_front(pkt, len) != len)
+    {
+        WS_ERROR("no headroom for MAC header (len=%u)\n", len);
+        return 0;
+    }
+
+    hdr = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
+    memcpy(hdr, fcf, sizeof(mac_fcf_t));
+    hdr->data[0] = sqn;
+    mac_frame_append_address(hdr, dest, src);
+
+    return (uint8_t)len;
+}
+
+
 uint8_t *
 mac_frame_extract_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
                           ws_mac_addr_t *src)
 {
     uint8_t *ptr;
-    uint16_t dest_pan;
+    uint16_t dest_pan = 0xffff;
 
     ASSERT(fcf != NULL, "NULL FCF\n");
 
@@ -175,22 +231,21 @@ mac_frame_extract_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
         break;
     }
 
-    if (src != NULL)
+    /* Extract source PAN ID */
+    if (!fcf->pan_id_compression)
     {
-        /* Extract source PAN ID */
-        if (!fcf->pan_id_compression)
-        {
+        if (src != NULL)
             memcpy(&src->pan_id, ptr, 2);
-            ptr += 2;
-        }
-        else
-        {
-            src->pan_id = dest_pan;
-        }
+        ptr += 2;
+    }
+    else if (src != NULL)
+    {
+        src->pan_id = dest_pan;
     }
 
     /* Extract source address */
-    src->type = fcf->src_addr_mode;
+    if (src != NULL)
+        src->type = fcf->src_addr_mode;
     switch (fcf->src_addr_mode)
     {
     case WS_MAC_ADDR_TYPE_NONE:
@@ -223,7 +278,7 @@ mac_frame_print_address(ws_mac_addr_t *addr)
 {
     int i;
 
-#ifndef NO_DEBUG
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     switch (addr->type)
     {
     case WS_MAC_ADDR_TYPE_NONE:
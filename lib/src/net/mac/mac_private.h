@@ -43,6 +43,24 @@
 
 /* See IEEE 802.15.4-2011 6.4.2 Table 51 */
 #define UNIT_BACKOFF_PERIOD (20)
+#define MAC_TURNAROUND_TIME (12)
+
+/* See IEEE 802.15.4-2011 6.4.2 Table 51. The active portion of a
+ * superframe lasts this many symbols shifted left by the superframe order,
+ * and is split into this many slots */
+#define MAC_BASE_SUPERFRAME_DURATION (960)
+#define MAC_NUM_SUPERFRAME_SLOTS (16)
+
+/* See IEEE 802.15.4-2011 6.4.3.2 Table 52, for the 2.4 GHz O-QPSK PHY */
+#define MAC_ACK_WAIT_DURATION \
+    (UNIT_BACKOFF_PERIOD + MAC_TURNAROUND_TIME + WS_RADIO_SHR_DURATION + \
+     6 * 2)
+
+/* Symbols on the air for a frame of len octets, excluding the FCS. This
+ * adds the synchronisation header, the PHY header and the FCS, at 2
+ * symbols per octet. */
+#define MAC_FRAME_DURATION(len) \
+    (WS_RADIO_SHR_DURATION + ((len) + 1 + WS_RADIO_CHECKSUM_LEN) * 2)
 
 
 /* See IEEE 802.15.4-2011 5.2.1.1 */
@@ -178,9 +196,18 @@ typedef enum
 } mac_key_id_mode_t;
 
 
+/* The auxiliary security header as we write it: the security control field
+ * and the frame counter, with an implicit key. See IEEE 802.15.4-2011 7.4 */
+#define MAC_AUX_HEADER_LEN (5)
+
+
+/* MIC length for MAC_SECURITY_LEVEL_ENC_MIC_32 */
+#define MAC_MIC_LEN (4)
+
+
 typedef struct
 {
-    ws_list_t list;
+    uint16_t handle;                /* Slot in the device table */
     ws_mac_addr_t addr;
     uint16_t pan_id;
     uint8_t last_sqn;
@@ -203,6 +230,24 @@ typedef struct
 } mac_key_t;
 
 
+/**
+ * The devices a MAC instance knows about. Each is indexed by both its
+ * extended address and, once it has one, its short address, in open
+ * addressed hash tables with twice as many buckets as devices. A bucket
+ * holds the device's handle plus one, so zero is empty.
+ */
+#define MAC_DEVICE_BUCKETS (2 * WS_MAC_MAX_DEVICES)
+typedef struct
+{
+    mac_device_t *devices[WS_MAC_MAX_DEVICES];
+    uint16_t by_short[MAC_DEVICE_BUCKETS];
+    uint16_t by_extended[MAC_DEVICE_BUCKETS];
+    uint16_t free[WS_MAC_MAX_DEVICES];  /* Stack of unused handles */
+    uint16_t free_count;
+    uint16_t count;
+} mac_device_table_t;
+
+
 typedef enum
 {
     MAC_SECURITY_STATUS_SUCCESS,
@@ -252,7 +297,7 @@ typedef struct
     uint8_t max_backoff_exponent;
     uint8_t max_csma_backoffs;
     uint8_t sqn;
-    ws_list_t device_list;
+    mac_device_table_t devices;
     uint8_t max_frame_retries;
     uint32_t frame_counter;
 
@@ -260,10 +305,232 @@ typedef struct
     uint8_t current_channel;
 } mac_t;
 
-extern mac_t mac;
+
+/*
+ * Per module state. Each MAC instance holds one of each of these in its
+ * ws_mac_ctx_t, so the modules keep no state of their own.
+ */
+/**
+ * Transmitter state machine.
+ * IDLE:    transmitter is waiting for packets to send
+ * SENDING: transmitter has copied outgoing packet into radio FIFO, and
+ *          is waiting for the packet to be transmitted
+ * SENT:    packet was transmitted (CSMA-CA succeeded)
+ */
+typedef enum
+{
+    PACKET_SCHEDULER_TX_STATE_IDLE,
+    PACKET_SCHEDULER_TX_STATE_SENDING,
+    PACKET_SCHEDULER_TX_STATE_SENT,
+} packet_scheduler_tx_state_t;
+
+
+/**
+ * Outgoing frames are queued by class, and a frame is only taken from a
+ * class once every class before it is empty. Each class has its own depth,
+ * so a burst of one kind can't hold up or crowd out the others.
+ * COMMAND:  MAC commands we start, such as association and data requests
+ * INDIRECT: frames a coordinator was holding until a device asked for them
+ * DATA:     MCPS data
+ */
+typedef enum
+{
+    MAC_TX_CLASS_COMMAND,
+    MAC_TX_CLASS_INDIRECT,
+    MAC_TX_CLASS_DATA,
+    MAC_TX_CLASS_COUNT,
+} mac_tx_class_t;
+
+#define MAC_TX_DEPTH_COMMAND (8)
+#define MAC_TX_DEPTH_INDIRECT (8)
+#define MAC_TX_DEPTH_DATA (8)
+
+
+/**
+ * Superframe timing, worked out from macBeaconOrder and macSuperframeOrder
+ * (see IEEE 802.15.4-2011 5.1.1.1). Times are in symbols, counted from the
+ * start of the beacon. Without beacons there is no superframe to follow,
+ * so the CAP never ends.
+ */
+typedef struct
+{
+    bool beacon_enabled;
+    uint32_t beacon_interval;
+    uint32_t slot_duration;
+    uint32_t active_duration;   /* The CAP, then the CFP */
+    uint32_t cap_end;
+    uint32_t cfp_duration;      /* Always 0, as GTSs aren't supported */
+    uint32_t inactive_duration; /* After the active portion, until the
+                                 * next beacon */
+    uint32_t slots_per_beacon;  /* Slot timer ticks per beacon interval,
+                                 * or 0 without beacons. There are up to
+                                 * 16 << 14 of them. */
+    uint8_t cap_slots;          /* Slots from the beacon to the CAP end */
+} mac_superframe_t;
+
+
+/**
+ * Packet scheduler state
+ */
+#define MAC_RX_RING_FRAMES (4)
+#define MAC_RX_RECORD_SIZE \
+    WS_FRAMERING_RECORD_SIZE(sizeof(ws_pktbuf_meta_t) + \
+                             WS_RADIO_MAX_PACKET_LEN)
+typedef struct
+{
+    /* Receiver, a ring of frames filled by the radio ISR. Each record is
+     * the frame's metadata followed by the frame itself. Records aren't
+     * split across the end of the ring, and up to a record's worth of
+     * space there can go unused, so there's room for one more. That way
+     * it always holds MAC_RX_RING_FRAMES frames of any size, and many more
+     * short ones such as ACKs. */
+    ws_framering_t rx_data;
+    uint32_t rx_data_buf[(MAC_RX_RING_FRAMES + 1) * MAC_RX_RECORD_SIZE / 4];
+    bool rx_data_dropped;
+
+    /* Transmitter */
+    packet_scheduler_tx_state_t tx_state;
+    ws_pktbuf_queue_t tx_data[MAC_TX_CLASS_COUNT];
+    ws_pktbuf_t *tx_in_flight;
+    uint8_t tx_in_flight_retries;
+    ws_timer_t ack_timer;
+
+    /* Gives up on the frame in the FIFO, ACK or not, if it hasn't got out
+     * in time. It's armed whenever a frame is loaded. */
+    ws_timer_t tx_timer;
+
+    /* Symbols needed on the air by the frame in the radio, and by its ACK
+     * if it asked for one */
+    uint16_t tx_duration;
+
+    /* The superframe we follow, and the radio timer at its start. Slots
+     * are counted from the beacon, in slot 0. */
+    mac_superframe_t sf;
+    uint32_t superframe_start;
+    uint32_t slot_count;
+    bool radio_asleep;
+
+    /* CSMA-CA, run from csma_timer between backoffs. It's slotted in a
+     * beacon-enabled PAN, and unslotted otherwise. */
+    bool csma_active;
+    uint8_t csma_backoffs;
+    uint8_t csma_backoff_exponent;
+    uint8_t csma_cw;
+    ws_timer_t csma_timer;
+
+    /* Next beacon to send, if it's been built. beacon_timer builds it a
+     * slot before it's due. */
+    ws_pktbuf_t *beacon;
+    ws_timer_t beacon_timer;
+
+    /* Events */
+    ws_event_t task;
+    ws_event_t csma_task;
+} packet_scheduler_state_t;
+
+
+typedef struct
+{
+    ws_mac_mcps_rx_callback_t rx_cb;
+    ws_mac_mcps_confirm_callback_t confirm_cb;
+} mcps_t;
+
+
+typedef struct
+{
+    uint8_t beacon_sqn;
+    uint8_t last_beacon_rx_sqn;
+    uint32_t last_beacon_rx_time;
+    ws_mac_beacon_rx_callback_t rx_cb;
+    ws_mac_coordinator_associate_callback_t associate_cb;
+    ws_pktbuf_t *beacon[2];
+    uint8_t beacon_next;
+} coordinator_t;
+
+
+typedef struct
+{
+    ws_mac_scan_type_t type;
+    ws_mac_scan_callback_t cb;
+    uint32_t channel_duration;
+    uint16_t channels;
+    uint8_t channel;
+    ws_list_t scan_results;
+    ws_timer_t timer;
+} scan_state_t;
+
+
+typedef enum
+{
+    ASSOCIATION_STATE_START,
+    ASSOCIATION_STATE_ASSOC_REQ_SENT,
+    ASSOCIATION_STATE_ASSOC_REQ_ACKED,
+    ASSOCIATION_STATE_DATA_REQ_SENT,
+    ASSOCIATION_STATE_WAIT_ASSOC_RESP,
+} association_state_t;
+
+
+typedef struct
+{
+    association_state_t state;
+    ws_mac_addr_t coord_addr;
+    uint8_t last_sqn;
+    ws_mac_association_callback_t cb;
+    ws_timer_t timer;
+} association_t;
+
+
+typedef void (*mac_security_status_callback_t)
+(ws_mac_ctx_t *ctx,
+ ws_pktbuf_t *pkt,
+ mac_security_status_t status);
+
+
+typedef enum
+{
+    SECURITY_STATE_IDLE,
+    SECURITY_STATE_ENCRYPTING,
+    SECURITY_STATE_DECRYPTING,
+} security_state_t;
+
+
+/* Security supplicant nonse size, see security_supplicant.c */
+#define MAC_NONSE_LEN (13)
+
+typedef struct
+{
+    security_state_t state;
+
+    mac_security_status_callback_t cb;
+
+    ws_pktbuf_t *pkt;
+    mac_device_t *dev;
+    mac_key_t *key;
+
+    uint8_t nonse[MAC_NONSE_LEN];
+} security_t;
+
+
+/**
+ * A MAC instance. Everything the MAC knows lives in here, so any number of
+ * instances can run side by side.
+ */
+struct ws_mac_ctx_t
+{
+    /* A copy of the backend handed to ws_mac_init, so each radio operation
+     * is one indirect call */
+    ws_radio_t radio;
+    mac_t mac;
+    packet_scheduler_state_t ps;
+    mcps_t mcps;
+    coordinator_t coord;
+    scan_state_t scan;
+    association_t assoc;
+    security_t sec;
+    ws_mac_stats_t stats;
+};
 
 
-/* TODO: Add CSMA failure to this */
 typedef enum
 {
     /* Packet was sent and ACK was received */
@@ -272,114 +539,182 @@ typedef enum
     MAC_TX_STATUS_NO_ACK,
     /* Packet did not leave the radio */
     MAC_TX_STATUS_NOT_SENT,
+    /* CSMA-CA found the channel busy macMaxCSMABackoffs + 1 times */
+    MAC_TX_STATUS_CHANNEL_ACCESS_FAILURE,
 } mac_tx_status_t;
 
 
+/*
+ * Functions taking a pktbuf only borrow it for the call. Anything that
+ * keeps the pktbuf afterwards (a queue, the frame in flight, an encryption
+ * in progress) takes its own reference with ws_pktbuf_ref, and whoever
+ * created or received the frame unreferences it when they are done.
+ */
+
+
 /*
  * MCPS
  */
 extern void
-mac_mcps_init(void);
+mac_mcps_init(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_mcps_handle_packet(ws_pktbuf_t *pkt);
+mac_mcps_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
 extern void
-mac_mcps_handle_status(uint8_t sqn, mac_tx_status_t status);
+mac_mcps_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn, mac_tx_status_t status);
 
 
 /*
  * MLME
  */
 extern void
-mac_mlme_init(void);
+mac_mlme_init(ws_mac_ctx_t *ctx);
 
 
 extern uint8_t
-mac_mlme_get_sqn(void);
+mac_mlme_get_sqn(ws_mac_ctx_t *ctx);
 
 
-extern void
-mac_mlme_send_association_request(ws_mac_addr_t *dest);
+/**
+ * Queue an association request for the coordinator at dest
+ * \return false if the command couldn't be queued
+ */
+extern bool
+mac_mlme_send_association_request(ws_mac_ctx_t *ctx, ws_mac_addr_t *dest);
+
+
+/**
+ * Build a MAC command frame, prepending the header to the payload
+ * \param ctx MAC instance
+ * \param sqn sequence number
+ * \param ack_req true to request an acknowledgement
+ * \param dest destination address, or NULL
+ * \param src source address, or NULL
+ * \param payload the command identifier followed by its fields
+ * \param len length, in octets, of the payload
+ * \returns the frame, or NULL if the pktbuf pool is empty
+ */
+extern ws_pktbuf_t *
+mac_mlme_build_command(ws_mac_ctx_t *ctx, uint8_t sqn, bool ack_req,
+                       ws_mac_addr_t *dest, ws_mac_addr_t *src,
+                       const uint8_t *payload, uint8_t len);
+
+
+/**
+ * Queue a broadcast beacon request
+ * \return false if the command couldn't be queued
+ */
+extern bool
+mac_mlme_send_beacon_request(ws_mac_ctx_t *ctx);
+
+
+/**
+ * Queue a data request to poll the coordinator at dest
+ * \return false if the command couldn't be queued
+ */
+extern bool
+mac_mlme_send_data_request(ws_mac_ctx_t *ctx, ws_mac_addr_t *dest);
 
 
 extern void
-mac_mlme_send_beacon_request(void);
+mac_mlme_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
 extern void
-mac_mlme_send_data_request(ws_mac_addr_t *dest);
+mac_mlme_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn, mac_tx_status_t status);
 
 
 extern void
-mac_mlme_handle_packet(ws_pktbuf_t *pkt);
+mac_mlme_scan_init(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_mlme_handle_status(uint8_t sqn, mac_tx_status_t status);
+mac_mlme_scan_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
 extern void
-mac_mlme_scan_handle_packet(ws_pktbuf_t *pkt);
+mac_mlme_association_init(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_mlme_association_handle_packet(ws_pktbuf_t *pkt);
+mac_mlme_association_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
 extern void
-mac_mlme_association_handle_status(uint8_t sqn, mac_tx_status_t status);
+mac_mlme_association_handle_status(ws_mac_ctx_t *ctx,
+                                   uint8_t sqn, mac_tx_status_t status);
 
 
 /*
  * Coordinator
  */
 extern void
-mac_coordinator_init(void);
+mac_coordinator_init(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_coordinator_handle_packet(ws_pktbuf_t *pkt);
+mac_coordinator_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
+/**
+ * \param dest where the frame was sent, which finds the device it was for
+ */
 extern void
-mac_coordinator_handle_status(uint8_t sqn, mac_tx_status_t status);
+mac_coordinator_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn,
+                              ws_mac_addr_t *dest, mac_tx_status_t status);
 
 
 extern void
-mac_coordinator_send_data(ws_pktbuf_t *pkt);
+mac_coordinator_send_data(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
 
 
 extern ws_pktbuf_t *
-mac_coordinator_request_beacon(void);
+mac_coordinator_request_beacon(ws_mac_ctx_t *ctx);
 
 
 extern mac_device_t *
 mac_coordinator_create_device(ws_mac_addr_t *ext_addr);
 
 extern void
-mac_coordinator_register_associate_callback(ws_mac_coordinator_associate_callback_t cb);
+mac_coordinator_register_associate_callback(ws_mac_ctx_t *ctx,
+                                            ws_mac_coordinator_associate_callback_t cb);
 
 
 /*
  * Packet Scheduler
  */
 extern void
-mac_packet_scheduler_init(void);
+mac_packet_scheduler_init(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_packet_scheduler_clear_receiver(void);
+mac_packet_scheduler_clear_receiver(ws_mac_ctx_t *ctx);
 
 
 extern void
-mac_packet_scheduler_sync(void);
+mac_packet_scheduler_sync(ws_mac_ctx_t *ctx);
 
 
+/**
+ * Work out the superframe timing again, and set the slot timer to match,
+ * after macBeaconOrder or macSuperframeOrder have changed
+ */
 extern void
-mac_packet_scheduler_send_data(ws_pktbuf_t *pkt);
+mac_packet_scheduler_set_superframe(ws_mac_ctx_t *ctx);
+
+
+/**
+ * Queue a frame to be sent. The queue takes its own reference.
+ * \param class the queue to put the frame on
+ * \return false if that queue is full, in which case the frame is left
+ * with the caller
+ */
+extern bool
+mac_packet_scheduler_send_data(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt,
+                               mac_tx_class_t class);
 
 
 /*
@@ -398,6 +733,37 @@ mac_frame_append_address(mac_fcf_t *fcf, ws_mac_addr_t *dest,
                          ws_mac_addr_t *src);
 
 
+/**
+ * Get the length of the addressing fields for a pair of addresses, taking
+ * PAN ID compression into account
+ * \param dest destination address, or NULL
+ * \param src source address, or NULL
+ * \returns the length, in octets, \see mac_frame_append_address would add
+ */
+extern uint8_t
+mac_frame_get_address_len(ws_mac_addr_t *dest, ws_mac_addr_t *src);
+
+
+/**
+ * Prepend a MAC header to the payload held in a pktbuf. The header is
+ * written into the space reserved in front of the payload, so the payload
+ * itself is never moved.
+ * \param pkt pktbuf holding the payload
+ * \param fcf the frame control field, the addressing modes and PAN ID
+ * compression are filled in from the addresses
+ * \param sqn sequence number
+ * \param dest destination address to append, or NULL
+ * \param src source address to append, or NULL
+ * \param aux_len octets to leave between the addresses and the payload for
+ * the auxiliary security header
+ * \returns the length of the header, or 0 if there isn't enough headroom
+ */
+extern uint8_t
+mac_frame_prepend_header(ws_pktbuf_t *pkt, const mac_fcf_t *fcf, uint8_t sqn,
+                         ws_mac_addr_t *dest, ws_mac_addr_t *src,
+                         uint8_t aux_len);
+
+
 /**
  * Extract addresses contained in the frame. Contains logic to detect
  * PAN ID compression
@@ -422,16 +788,53 @@ mac_frame_get_data_ptr(mac_fcf_t *fcf, uint8_t *data_len);
 /*
  * Device
  */
+extern void
+mac_device_init(ws_mac_ctx_t *ctx);
+
+
+/**
+ * Add a device to the device table. It is found by its extended address,
+ * and by its short address unless that is 0xfffe or 0xffff.
+ * \return false if the table is full
+ */
+extern bool
+mac_device_add(ws_mac_ctx_t *ctx, mac_device_t *dev);
+
+
+/**
+ * Take a device out of the device table. The caller still owns it.
+ */
+extern void
+mac_device_remove(ws_mac_ctx_t *ctx, mac_device_t *dev);
+
+
+/**
+ * Change the short address of a device in the device table, so it is found
+ * by the new one
+ * \param short_addr the new address, or 0xfffe or 0xffff for none
+ */
+extern void
+mac_device_set_short_addr(ws_mac_ctx_t *ctx, mac_device_t *dev,
+                          uint16_t short_addr);
+
+
+/**
+ * \return the device with the given handle, or NULL if there isn't one
+ */
+extern mac_device_t *
+mac_device_get_by_handle(ws_mac_ctx_t *ctx, uint16_t handle);
+
+
 extern mac_device_t *
-mac_device_get_by_short(uint16_t short_addr);
+mac_device_get_by_short(ws_mac_ctx_t *ctx, uint16_t short_addr);
 
 
 extern mac_device_t *
-mac_device_get_by_extended(uint8_t *extended_addr);
+mac_device_get_by_extended(ws_mac_ctx_t *ctx, uint8_t *extended_addr);
 
 
 extern mac_device_t *
-mac_device_get_by_addr(ws_mac_addr_t *addr);
+mac_device_get_by_addr(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr);
 
 
 extern mac_key_t *
@@ -449,19 +852,13 @@ mac_device_remove_key(mac_device_t *dev, uint8_t index);
 /*
  * Security
  */
-typedef void (*mac_security_status_callback_t)
-(ws_pktbuf_t *pkt,
- mac_security_status_t status);
-
-
 extern mac_security_status_t
-mac_security_encrypt_frame(ws_pktbuf_t *frame,
-                           const uint8_t *data, uint8_t data_len,
+mac_security_encrypt_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
                            mac_security_status_callback_t cb);
 
 
 extern mac_security_status_t
-mac_security_decrypt_frame(ws_pktbuf_t *frame,
+mac_security_decrypt_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
                            mac_security_status_callback_t cb);
 
 
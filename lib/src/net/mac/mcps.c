@@ -32,64 +32,55 @@
 #include "mac_private.h"
 
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
-
-
-static ws_mac_mcps_rx_callback_t rx_cb;
-static ws_mac_mcps_confirm_callback_t confirm_cb;
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 
-static void
-dispatch_packet(ws_pktbuf_t *pkt)
+/* \return false if the frame couldn't be queued, and should be confirmed
+ * as a transaction overflow */
+static bool
+dispatch_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     WS_DEBUG("dispatching packet to be sent (ptr=%p,len=%u)\n",
              pkt, ws_pktbuf_get_len(pkt));
-    switch (mac.state)
+    switch (ctx->mac.state)
     {
     case MAC_STATE_COORDINATING:
-        mac_coordinator_send_data(pkt);
-        break;
+        mac_coordinator_send_data(ctx, pkt);
+        return true;
 
     case MAC_STATE_ASSOCIATED:
-        mac_packet_scheduler_send_data(pkt);
-        break;
+        return mac_packet_scheduler_send_data(ctx, pkt, MAC_TX_CLASS_DATA);
 
     default:
         WS_ERROR("unable to dispatch packet in state (%u)\n",
-                 mac.state);
-        WS_DEBUG("dest\n");
-        ws_pktbuf_destroy(pkt);
-        break;
+                 ctx->mac.state);
+        return true;
     }
 }
 
 
 static void
-pass_up_packet(ws_pktbuf_t *pkt)
+pass_up_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     uint8_t phy_len = ws_pktbuf_get_len(pkt);
     uint8_t *ptr;
     ws_mac_addr_t src;
 
-    ASSERT(rx_cb != NULL, "receive callback altered!\n");
+    ASSERT(ctx->mcps.rx_cb != NULL, "receive callback altered!\n");
 
     mac_frame_extract_address(fcf, NULL, &src);
 
     ptr = mac_frame_get_data_ptr(fcf, &phy_len);
     WS_DEBUG("found data in frame: %r\n", ptr, phy_len);
 
-    rx_cb(ptr, phy_len, &src);
-    WS_DEBUG("dest\n");
-    ws_pktbuf_destroy(pkt);
+    ctx->mcps.rx_cb(ctx, ptr, phy_len, &src, ws_pktbuf_get_meta(pkt));
 }
 
 
 static void
-enc_done(ws_pktbuf_t *pkt,
+enc_done(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt,
          mac_security_status_t status)
 {
     mac_fcf_t *fcf;
@@ -100,120 +91,81 @@ enc_done(ws_pktbuf_t *pkt,
     if (status != MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_ERROR("security failed with status (%u)\n", status);
-        if (confirm_cb != NULL)
+        if (ctx->mcps.confirm_cb != NULL)
         {
             fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
             /* TODO: Translate security error into confirm error */
-            confirm_cb(fcf->data[0], WS_MAC_MCPS_UNSUPPORTED_SECURITY);
+            ctx->mcps.confirm_cb(ctx, fcf->data[0],
+                                 WS_MAC_MCPS_UNSUPPORTED_SECURITY);
         }
-        WS_DEBUG("dest\n");
-        ws_pktbuf_destroy(pkt);
     }
-    else
+    else if (!dispatch_packet(ctx, pkt))
     {
-        dispatch_packet(pkt);
+        if (ctx->mcps.confirm_cb != NULL)
+        {
+            fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
+            ctx->mcps.confirm_cb(ctx, fcf->data[0],
+                                 WS_MAC_MCPS_TRANSACTION_OVERFLOW);
+        }
     }
 }
 
 
 static void
-dec_done(ws_pktbuf_t *pkt,
+dec_done(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt,
          mac_security_status_t status)
 {
     if (status == MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_DEBUG("successfully decrypted packet\n");
-        pass_up_packet(pkt);
+        pass_up_packet(ctx, pkt);
     }
     else
     {
         WS_ERROR("security failed with status (%u)\n", status);
-        WS_DEBUG("dest\n");
-        ws_pktbuf_destroy(pkt);
     }
 }
 
 
-static ws_pktbuf_t *
-build_packet(const uint8_t *data, uint8_t len, ws_mac_addr_t *dest_addr,
+static uint8_t
+build_header(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt, ws_mac_addr_t *dest_addr,
              uint8_t sqn, bool secure)
 {
-    mac_fcf_t *fcf;
-    uint8_t *ptr;
-    ws_pktbuf_t *pkt;
-
-    mac_security_status_t ret;
-
+    mac_fcf_t fcf;
     ws_mac_addr_t src;
 
-    pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-    if (pkt == NULL)
-    {
-        WS_ERROR("Failed to allocated pktbuf for packet\n");
-        return NULL;
-    }
-
-    ptr = ws_pktbuf_get_data(pkt);
-    memset(ptr, 0, ws_pktbuf_get_len(pkt));
+    memset(&fcf, 0, sizeof(mac_fcf_t));
+    fcf.frame_type = MAC_FRAME_TYPE_DATA;
+    fcf.security_enabled = secure;
+    fcf.frame_pending = 0; /* TODO */
+    fcf.ack_req = 1;
+    fcf.frame_version = WS_MAC_MAX_FRAME_VERSION;
 
-    /* FCF */
-    fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-    ptr = fcf->data;
-
-    fcf->frame_type = MAC_FRAME_TYPE_DATA;
-    fcf->security_enabled = secure;
-    fcf->frame_pending = 0; /* TODO */
-    fcf->ack_req = 1;
-    fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
-
-    /* Sequence number */
-    *ptr++ = sqn;
-
-    /* Add addressing information */
-    WS_DEBUG("appending address\n");
-    ws_mac_mlme_get_address(&src);
-    ptr += mac_frame_append_address(fcf, dest_addr, &src);
+    ws_mac_mlme_get_address(ctx, &src);
 
     WS_DEBUG("sending message to: ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     mac_frame_print_address(dest_addr);
     PRINTF("\n");
+#endif
 
-    /* The security supplicant will handle adding the data if we want
-     * to create a secure frame. Otherwise we can add the data ourself */
-    if (secure)
-    {
-        ret = mac_security_encrypt_frame(pkt, data, len, enc_done);
-        if (ret != MAC_SECURITY_STATUS_IN_PROGRESS)
-        {
-            enc_done(pkt, ret);
-        }
-    }
-    else
-    {
-        /* Data */
-        memcpy(ptr, data, len);
-        ptr += len;
-
-        ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
-    }
-
-    WS_DEBUG("packet: %r\n",
-             (uint8_t *)fcf, (ptr - (uint8_t *)fcf));
-
-    return pkt;
+    /* The security supplicant fills in the auxiliary security header and
+     * encrypts the payload in place once we've built the rest */
+    return mac_frame_prepend_header(pkt, &fcf, sqn, dest_addr, &src,
+                                    secure ? MAC_AUX_HEADER_LEN : 0);
 }
 
 
 void
-mac_mcps_init(void)
+mac_mcps_init(ws_mac_ctx_t *ctx)
 {
-    rx_cb = NULL;
-    confirm_cb = NULL;
+    ctx->mcps.rx_cb = NULL;
+    ctx->mcps.confirm_cb = NULL;
 }
 
 
 void
-mac_mcps_handle_packet(ws_pktbuf_t *pkt)
+mac_mcps_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
 
@@ -222,7 +174,7 @@ mac_mcps_handle_packet(ws_pktbuf_t *pkt)
     switch (fcf->frame_type)
     {
     case MAC_FRAME_TYPE_DATA:
-        if (rx_cb == NULL)
+        if (ctx->mcps.rx_cb == NULL)
         {
             WS_WARN("no receive callback for DATA packet\n");
             return;
@@ -230,15 +182,15 @@ mac_mcps_handle_packet(ws_pktbuf_t *pkt)
 
         if (fcf->security_enabled)
         {
-            ret = mac_security_decrypt_frame(pkt, dec_done);
+            ret = mac_security_decrypt_frame(ctx, pkt, dec_done);
             if (ret != MAC_SECURITY_STATUS_IN_PROGRESS)
             {
-                dec_done(pkt, ret);
+                dec_done(ctx, pkt, ret);
             }
         }
         else
         {
-            pass_up_packet(pkt);
+            pass_up_packet(ctx, pkt);
         }
         break;
     }
@@ -246,23 +198,24 @@ mac_mcps_handle_packet(ws_pktbuf_t *pkt)
 
 
 void
-mac_mcps_handle_status(uint8_t sqn, mac_tx_status_t status)
+mac_mcps_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn, mac_tx_status_t status)
 {
-    if (confirm_cb == NULL)
+    if (ctx->mcps.confirm_cb == NULL)
         return;
 
     switch (status)
     {
     case MAC_TX_STATUS_SUCCESS:
-        confirm_cb(sqn, WS_MAC_MCPS_SUCCESS);
+        ctx->mcps.confirm_cb(ctx, sqn, WS_MAC_MCPS_SUCCESS);
         break;
 
     case MAC_TX_STATUS_NO_ACK:
-        confirm_cb(sqn, WS_MAC_MCPS_NO_ACK);
+        ctx->mcps.confirm_cb(ctx, sqn, WS_MAC_MCPS_NO_ACK);
         break;
 
     case MAC_TX_STATUS_NOT_SENT:
-        confirm_cb(sqn, WS_MAC_MCPS_CHANNEL_ACCESS_FAILURE);
+    case MAC_TX_STATUS_CHANNEL_ACCESS_FAILURE:
+        ctx->mcps.confirm_cb(ctx, sqn, WS_MAC_MCPS_CHANNEL_ACCESS_FAILURE);
         break;
 
     default:
@@ -273,44 +226,118 @@ mac_mcps_handle_status(uint8_t sqn, mac_tx_status_t status)
 
 
 void
-ws_mac_mcps_register_rx_callback(ws_mac_mcps_rx_callback_t cb)
+ws_mac_mcps_register_rx_callback(ws_mac_ctx_t *ctx,
+                                 ws_mac_mcps_rx_callback_t cb)
 {
-    rx_cb = cb;
+    ctx->mcps.rx_cb = cb;
 }
 
 
 void
-ws_mac_mcps_register_confirm_callback(ws_mac_mcps_confirm_callback_t cb)
+ws_mac_mcps_register_confirm_callback(ws_mac_ctx_t *ctx,
+                                      ws_mac_mcps_confirm_callback_t cb)
 {
-    confirm_cb = cb;
+    ctx->mcps.confirm_cb = cb;
 }
 
 
-uint8_t
-ws_mac_mcps_send_data(const uint8_t *data, uint8_t len,
-                      ws_mac_addr_t *dest_addr,
-                      bool secure)
+ws_pktbuf_t *
+ws_mac_mcps_alloc_frame(ws_mac_ctx_t *ctx)
 {
-    uint8_t handle;
     ws_pktbuf_t *pkt;
 
-    if (mac.state != MAC_STATE_COORDINATING &&
-        mac.state != MAC_STATE_ASSOCIATED)
+    UNUSED(ctx);
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
     {
-        WS_WARN("ignoring MCPS-DATA.request in state (%u)\n", mac.state);
-        if (confirm_cb == NULL)
-            confirm_cb(0, WS_MAC_MCPS_NOT_ALLOWED);
+        WS_ERROR("Failed to allocate pktbuf for packet\n");
+        return NULL;
+    }
+
+    ws_pktbuf_reserve(pkt, WS_MAC_FRAME_HEADROOM);
+
+    return pkt;
+}
+
+
+/* Handles are the frames' sequence numbers, except that 0 is kept to tell
+ * callers their request was refused */
+static uint8_t
+get_handle(ws_mac_ctx_t *ctx)
+{
+    uint8_t handle = mac_mlme_get_sqn(ctx);
+
+    if (handle == 0)
+        handle = mac_mlme_get_sqn(ctx);
+
+    return handle;
+}
+
+
+/* \see ws_mac_mcps_send_frame, for a handle the caller has allocated */
+static uint8_t
+send_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame, ws_mac_addr_t *dest_addr,
+           bool secure, uint8_t handle)
+{
+    mac_security_status_t ret;
+    uint8_t hdr_len;
+    uint32_t len;
+    uint32_t tail_len;
+
+    if (ctx->mac.state != MAC_STATE_COORDINATING &&
+        ctx->mac.state != MAC_STATE_ASSOCIATED)
+    {
+        WS_WARN("ignoring MCPS-DATA.request in state (%u)\n", ctx->mac.state);
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle, WS_MAC_MCPS_NOT_ALLOWED);
         return 0;
     }
 
-    handle = mac_mlme_get_sqn();
-    pkt = build_packet(data, len, dest_addr, handle, secure);
+    hdr_len = build_header(ctx, frame, dest_addr, handle, secure);
+
+    /* The MIC and FCS have to fit in the PSDU as well */
+    len = ws_pktbuf_get_chain_len(frame) + WS_RADIO_CHECKSUM_LEN;
+    if (secure)
+        len += MAC_MIC_LEN;
+
+    /* Secure frames are encrypted in one piece, so any chained segments
+     * are gathered onto the end of the frame, followed by the MIC */
+    tail_len = ws_pktbuf_get_chain_len(ws_pktbuf_get_next(frame)) +
+        MAC_MIC_LEN;
+
+    if (hdr_len == 0 || len > WS_RADIO_MAX_PACKET_LEN ||
+        (secure && ws_pktbuf_get_free_space_at_end(frame) < tail_len))
+    {
+        WS_WARN("frame too long (len=%u)\n", len);
+        ws_pktbuf_remove_from_front(frame, hdr_len);
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle, WS_MAC_MCPS_FRAME_TOO_LONG);
+        return 0;
+    }
+
+    WS_DEBUG("packet: %r\n", ws_pktbuf_get_data(frame),
+             ws_pktbuf_get_len(frame));
 
     /* If security is not enabled, then we don't need to wait for the
      * encryption to complete before dispatching the packet */
-    if (!secure)
+    if (secure)
     {
-        dispatch_packet(pkt);
+        ret = mac_security_encrypt_frame(ctx, frame, enc_done);
+        if (ret != MAC_SECURITY_STATUS_IN_PROGRESS)
+        {
+            enc_done(ctx, frame, ret);
+        }
+    }
+    else if (!dispatch_packet(ctx, frame))
+    {
+        /* The queue is full, so push back on the caller until some of the
+         * frames already queued have been confirmed */
+        ws_pktbuf_remove_from_front(frame, hdr_len);
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle,
+                                 WS_MAC_MCPS_TRANSACTION_OVERFLOW);
+        return 0;
     }
 
     /* TODO: We have no queuing in here. We should be able to call this
@@ -322,3 +349,106 @@ ws_mac_mcps_send_data(const uint8_t *data, uint8_t len,
 
     return handle;
 }
+
+
+uint8_t
+ws_mac_mcps_send_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
+                       ws_mac_addr_t *dest_addr, bool secure)
+{
+    return send_frame(ctx, frame, dest_addr, secure, get_handle(ctx));
+}
+
+
+uint8_t
+ws_mac_mcps_send_data(ws_mac_ctx_t *ctx, const uint8_t *data, uint8_t len,
+                      ws_mac_addr_t *dest_addr,
+                      bool secure)
+{
+    uint8_t handle;
+    ws_pktbuf_t *pkt;
+
+    /* Even a refused request is confirmed with a handle of its own */
+    handle = get_handle(ctx);
+
+    pkt = ws_mac_mcps_alloc_frame(ctx);
+    if (pkt == NULL)
+    {
+        /* The pktbuf pool is empty, so push back on the caller until some
+         * of the frames already in flight have been confirmed */
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle,
+                                 WS_MAC_MCPS_TRANSACTION_OVERFLOW);
+        return 0;
+    }
+
+    if (ws_pktbuf_add_to_end(pkt, (uint8_t *)data, len) != len)
+    {
+        ws_pktbuf_unref(pkt);
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle, WS_MAC_MCPS_FRAME_TOO_LONG);
+        return 0;
+    }
+
+    handle = send_frame(ctx, pkt, dest_addr, secure, handle);
+
+    /* Whoever is sending or encrypting the frame has their own reference */
+    ws_pktbuf_unref(pkt);
+
+    return handle;
+}
+
+
+uint8_t
+ws_mac_mcps_send_segments(ws_mac_ctx_t *ctx,
+                          const uint8_t *header, uint8_t header_len,
+                          const ws_mac_segment_t *payload, uint8_t count,
+                          ws_mac_addr_t *dest_addr, bool secure)
+{
+    uint8_t handle;
+    ws_pktbuf_t *pkt;
+    ws_pktbuf_t *seg;
+    uint8_t i;
+
+    handle = get_handle(ctx);
+
+    pkt = ws_mac_mcps_alloc_frame(ctx);
+    if (pkt == NULL)
+    {
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle,
+                                 WS_MAC_MCPS_TRANSACTION_OVERFLOW);
+        return 0;
+    }
+
+    /* The header goes in with the MAC header, and the payload segments
+     * are chained on to be read from where they are */
+    if (ws_pktbuf_add_to_end(pkt, (uint8_t *)header, header_len) !=
+        header_len)
+    {
+        ws_pktbuf_unref(pkt);
+        if (ctx->mcps.confirm_cb != NULL)
+            ctx->mcps.confirm_cb(ctx, handle, WS_MAC_MCPS_FRAME_TOO_LONG);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        seg = ws_pktbuf_wrap((uint8_t *)payload[i].data, payload[i].len);
+        if (seg == NULL)
+        {
+            ws_pktbuf_unref(pkt);
+            if (ctx->mcps.confirm_cb != NULL)
+                ctx->mcps.confirm_cb(ctx, handle,
+                                     WS_MAC_MCPS_TRANSACTION_OVERFLOW);
+            return 0;
+        }
+
+        ws_pktbuf_chain(pkt, seg);
+        ws_pktbuf_unref(seg);
+    }
+
+    handle = send_frame(ctx, pkt, dest_addr, secure, handle);
+    ws_pktbuf_unref(pkt);
+
+    return handle;
+}
@@ -32,75 +32,82 @@
 #include "mac_private.h"
 
 
-mac_t mac;
+/* Instances are handed out by ws_mac_init. They're never returned, as a
+ * MAC lives for as long as its radio does. */
+static ws_mac_ctx_t instances[WS_MAC_MAX_INSTANCES];
+static uint32_t instance_count;
 
 
-void
-mac_mlme_send_beacon_request(void)
+ws_pktbuf_t *
+mac_mlme_build_command(ws_mac_ctx_t *ctx, uint8_t sqn, bool ack_req,
+                       ws_mac_addr_t *dest, ws_mac_addr_t *src,
+                       const uint8_t *payload, uint8_t len)
 {
-    ws_pktbuf_t *pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
+    ws_pktbuf_t *pkt;
+    mac_fcf_t fcf;
 
-    mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-    uint8_t *ptr = fcf->data;
-    ws_mac_addr_t dest;
+    UNUSED(ctx);
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+    {
+        WS_ERROR("failed to allocate pktbuf for command (%u)\n", payload[0]);
+        return NULL;
+    }
+
+    /* Payload first, then the header goes in front of it */
+    ws_pktbuf_reserve(pkt, WS_MAC_FRAME_HEADROOM);
+    ws_pktbuf_add_to_end(pkt, (uint8_t *)payload, len);
 
-    memset(fcf, 0, sizeof(mac_fcf_t));
-    fcf->frame_type = MAC_FRAME_TYPE_MAC;
-    fcf->security_enabled = 0;
-    fcf->frame_pending = 0;
-    fcf->ack_req = 0;
-    fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
+    memset(&fcf, 0, sizeof(mac_fcf_t));
+    fcf.frame_type = MAC_FRAME_TYPE_MAC;
+    fcf.security_enabled = 0;
+    fcf.frame_pending = 0;
+    fcf.ack_req = ack_req;
+    fcf.frame_version = WS_MAC_MAX_FRAME_VERSION;
 
-    /* Sequence number */
-    *ptr++ = mac.sqn++;
+    WS_DEBUG("appending address\n");
+    mac_frame_prepend_header(pkt, &fcf, sqn, dest, src, 0);
+
+    return pkt;
+}
+
+
+bool
+mac_mlme_send_beacon_request(ws_mac_ctx_t *ctx)
+{
+    uint8_t payload = MAC_COMMAND_BEACON_REQUEST;
+    ws_mac_addr_t dest;
+    ws_pktbuf_t *pkt;
+    bool queued;
 
     /* Add a broadcast destination address */
     dest.type = WS_MAC_ADDR_TYPE_SHORT;
     dest.pan_id = WS_MAC_BROADCAST_ADDR;
     dest.short_addr = WS_MAC_BROADCAST_ADDR;
-    WS_DEBUG("appending address\n");
-    ptr += mac_frame_append_address(fcf, &dest, NULL);
 
-    *ptr++ = MAC_COMMAND_BEACON_REQUEST;
+    pkt = mac_mlme_build_command(ctx, ctx->mac.sqn++, false, &dest, NULL,
+                                 &payload, 1);
+    if (pkt == NULL)
+        return false;
 
-    ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
+    queued = mac_packet_scheduler_send_data(ctx, pkt, MAC_TX_CLASS_COMMAND);
+    ws_pktbuf_unref(pkt);
 
-    mac_packet_scheduler_send_data(pkt);
+    return queued;
 }
 
 
-void
-mac_mlme_send_association_request(ws_mac_addr_t *dest)
+bool
+mac_mlme_send_association_request(ws_mac_ctx_t *ctx, ws_mac_addr_t *dest)
 {
-    ws_pktbuf_t *pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-
-    mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-    uint8_t *ptr = fcf->data;
+    uint8_t payload[1 + sizeof(mac_capability_info_t)];
+    mac_capability_info_t *info = (mac_capability_info_t *)&payload[1];
     ws_mac_addr_t src;
-    mac_capability_info_t *info;
-
-    memset(fcf, 0, sizeof(mac_fcf_t));
-    fcf->frame_type = MAC_FRAME_TYPE_MAC;
-    fcf->security_enabled = 0;
-    fcf->frame_pending = 0;
-    fcf->ack_req = 1;
-    fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
-
-    /* Sequence number */
-    *ptr++ = mac.sqn++;
-
-    /* Packet is directed to the coordinator from our extended address */
-    src.type = WS_MAC_ADDR_TYPE_EXTENDED;
-    src.pan_id = dest->pan_id;
-    memcpy(&src.extended_addr, mac.extended_address,
-           WS_MAC_ADDR_TYPE_EXTENDED_LEN);
-    WS_DEBUG("appending address\n");
-    ptr += mac_frame_append_address(fcf, dest, &src);
+    ws_pktbuf_t *pkt;
+    bool queued;
 
-    *ptr++ = MAC_COMMAND_ASSOCIATION_REQUEST;
-
-    info = (mac_capability_info_t *)ptr;
-    ptr = info->data;
+    payload[0] = MAC_COMMAND_ASSOCIATION_REQUEST;
 
     /* TODO: Don't hard code our capabilities..! */
     memset(info, 0, sizeof(mac_capability_info_t));
@@ -110,45 +117,47 @@ mac_mlme_send_association_request(ws_mac_addr_t *dest)
     info->security_capable = 0;
     info->allocate_addr = 1;
 
-    ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
+    /* Packet is directed to the coordinator from our extended address */
+    src.type = WS_MAC_ADDR_TYPE_EXTENDED;
+    src.pan_id = dest->pan_id;
+    memcpy(&src.extended_addr, ctx->mac.extended_address,
+           WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+
+    pkt = mac_mlme_build_command(ctx, ctx->mac.sqn++, true, dest, &src,
+                                 payload, sizeof(payload));
+    if (pkt == NULL)
+        return false;
+
+    queued = mac_packet_scheduler_send_data(ctx, pkt, MAC_TX_CLASS_COMMAND);
+    ws_pktbuf_unref(pkt);
 
-    mac_packet_scheduler_send_data(pkt);
+    return queued;
 }
 
 
-void
-mac_mlme_send_data_request(ws_mac_addr_t *dest)
+bool
+mac_mlme_send_data_request(ws_mac_ctx_t *ctx, ws_mac_addr_t *dest)
 {
-    ws_pktbuf_t *pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-
-    mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-    uint8_t *ptr = fcf->data;
+    uint8_t payload = MAC_COMMAND_DATA_REQUEST;
     ws_mac_addr_t src;
-    mac_capability_info_t *info;
-
-    memset(fcf, 0, sizeof(mac_fcf_t));
-    fcf->frame_type = MAC_FRAME_TYPE_MAC;
-    fcf->security_enabled = 0;
-    fcf->frame_pending = 0;
-    fcf->ack_req = 1;
-    fcf->frame_version = WS_MAC_MAX_FRAME_VERSION;
-
-    /* Sequence number */
-    *ptr++ = mac.sqn++;
+    ws_pktbuf_t *pkt;
+    bool queued;
 
     /* Packet is directed to the coordinator from our extended address */
     src.type = WS_MAC_ADDR_TYPE_EXTENDED;
     src.pan_id = dest->pan_id;
-    memcpy(&src.extended_addr, mac.extended_address,
+    memcpy(&src.extended_addr, ctx->mac.extended_address,
            WS_MAC_ADDR_TYPE_EXTENDED_LEN);
-    WS_DEBUG("appending address\n");
-    ptr += mac_frame_append_address(fcf, dest, &src);
 
-    *ptr++ = MAC_COMMAND_DATA_REQUEST;
+    pkt = mac_mlme_build_command(ctx, ctx->mac.sqn++, true, dest, &src,
+                                 &payload, 1);
+    if (pkt == NULL)
+        return false;
 
-    ws_pktbuf_increment_end(pkt, (uint32_t)(ptr - (uint8_t *)fcf));
+    queued = mac_packet_scheduler_send_data(ctx, pkt, MAC_TX_CLASS_COMMAND);
+    ws_pktbuf_unref(pkt);
 
-    mac_packet_scheduler_send_data(pkt);
+    return queued;
 }
 
 
@@ -215,84 +224,95 @@ handle_mac_packet(ws_pktbuf_t *pkt)
 
 /* TODO: merge this into the packet scheduler. It's not needed twice..! */
 void
-mac_mlme_handle_packet(ws_pktbuf_t *pkt)
+mac_mlme_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     uint32_t len = ws_pktbuf_get_len(pkt);
 
-    switch (mac.state)
+    switch (ctx->mac.state)
     {
     default:
         WS_ERROR("Unhandled frame (type=%u) in state (%u)\n",
-                 fcf->frame_type, mac.state);
+                 fcf->frame_type, ctx->mac.state);
         break;
     }
-
-    WS_DEBUG("dest\n");
-    ws_pktbuf_destroy(pkt);
 }
 
 
 void
-mac_mlme_handle_status(uint8_t sqn, mac_tx_status_t status)
+mac_mlme_handle_status(ws_mac_ctx_t *ctx, uint8_t sqn, mac_tx_status_t status)
 {
 
 }
 
 
 uint8_t
-mac_mlme_get_sqn(void)
+mac_mlme_get_sqn(ws_mac_ctx_t *ctx)
 {
-    return mac.sqn++;
+    return ctx->mac.sqn++;
 }
 
 
 /*
  * Public API
  */
-void
-ws_mac_init(uint8_t *extended_address)
+ws_mac_ctx_t *
+ws_mac_init(uint8_t *extended_address, const ws_radio_t *radio)
 {
-    memset(&mac, 0, sizeof(mac));
+    ws_mac_ctx_t *ctx;
+
+    if (instance_count >= WS_MAC_MAX_INSTANCES)
+    {
+        WS_ERROR("no free MAC instances (max=%u)\n", WS_MAC_MAX_INSTANCES);
+        return NULL;
+    }
+
+    ctx = &instances[instance_count++];
+    memset(ctx, 0, sizeof(ws_mac_ctx_t));
+    ctx->radio = *radio;
 
     /* PIB */
-    memcpy(&mac.extended_address, extended_address,
+    memcpy(&ctx->mac.extended_address, extended_address,
            WS_MAC_ADDR_TYPE_EXTENDED_LEN);
-    mac.beacon_order = 15;
-    mac.pan_id = 0xffff;
-    mac.short_address = 0xffff;
-    mac.superframe_order = 15;
-    mac.responseWaitTime = 32;
-    mac.coord_short_address = 0xffff;
-    mac.batt_life_extension = false;
-    mac.min_backoff_exponent = 3;
-    mac.max_backoff_exponent = 5;
-    mac.max_csma_backoffs = 4;
-    mac.sqn = WS_GET_RANDOM8();
-    ws_list_init(&mac.device_list);
-    mac.max_frame_retries = 3;
-
-    mac.current_channel = 11;
-
-    mac.state = MAC_STATE_IDLE;
+    ctx->mac.beacon_order = 15;
+    ctx->mac.pan_id = 0xffff;
+    ctx->mac.short_address = 0xffff;
+    ctx->mac.superframe_order = 15;
+    ctx->mac.responseWaitTime = 32;
+    ctx->mac.coord_short_address = 0xffff;
+    ctx->mac.batt_life_extension = false;
+    ctx->mac.min_backoff_exponent = 3;
+    ctx->mac.max_backoff_exponent = 5;
+    ctx->mac.max_csma_backoffs = 4;
+    ctx->mac.sqn = WS_GET_RANDOM8();
+    mac_device_init(ctx);
+    ctx->mac.max_frame_retries = 3;
+
+    ctx->mac.current_channel = 11;
+
+    ctx->mac.state = MAC_STATE_IDLE;
 
     /* Set up the radio */
-    ws_radio_init();
-    ws_radio_set_power(true);
+    WS_RADIO_CALL(&ctx->radio, init);
+    WS_RADIO_CALL(&ctx->radio, set_power, true);
 
-    ws_radio_set_pan_id(0xffff);
-    ws_radio_set_short_address(0xffff);
-    ws_radio_set_extended_address(extended_address);
+    WS_RADIO_CALL(&ctx->radio, set_pan_id, 0xffff);
+    WS_RADIO_CALL(&ctx->radio, set_short_address, 0xffff);
+    WS_RADIO_CALL(&ctx->radio, set_extended_address, extended_address);
 
     /* Set up the mac components */
-    mac_packet_scheduler_init();
-    mac_mcps_init();
-    mac_coordinator_init();
+    mac_packet_scheduler_init(ctx);
+    mac_mcps_init(ctx);
+    mac_coordinator_init(ctx);
+    mac_mlme_scan_init(ctx);
+    mac_mlme_association_init(ctx);
+
+    return ctx;
 }
 
 
 ws_mac_start_status_t
-ws_mac_mlme_start(uint16_t pan_id, uint8_t channel,
+ws_mac_mlme_start(ws_mac_ctx_t *ctx, uint16_t pan_id, uint8_t channel,
                   uint8_t beacon_order, uint8_t superframe_order,
                   bool pan_coordinator,
                   ws_mac_coordinator_associate_callback_t associate_callback)
@@ -307,83 +327,90 @@ ws_mac_mlme_start(uint16_t pan_id, uint8_t channel,
     if (pan_id == 0xffff)
         return WS_MAC_START_INVALID_PARAMETER;
 
-    if (mac.short_address == 0xffff)
+    if (ctx->mac.short_address == 0xffff)
         return WS_MAC_START_NO_SHORT_ADDRESS;
 
     WS_DEBUG("START\n");
 
-    ws_radio_enter_critical();
+    WS_RADIO_CALL(&ctx->radio, enter_critical);
 
     /* PIB */
-    mac.pan_id = pan_id;
-    mac.beacon_order = beacon_order;
-    mac.superframe_order = superframe_order;
+    ctx->mac.pan_id = pan_id;
+    ctx->mac.beacon_order = beacon_order;
+    ctx->mac.superframe_order = superframe_order;
 
-    mac.state = MAC_STATE_COORDINATING;
-    mac.is_pan_coordinator = pan_coordinator;
+    ctx->mac.state = MAC_STATE_COORDINATING;
+    ctx->mac.is_pan_coordinator = pan_coordinator;
 
     /* Configure the radio */
-    mac.current_channel = channel;
-    ws_radio_set_channel(mac.current_channel);
-    ws_radio_set_pan_id(pan_id);
+    ctx->mac.current_channel = channel;
+    WS_RADIO_CALL(&ctx->radio, set_channel, ctx->mac.current_channel);
+    WS_RADIO_CALL(&ctx->radio, set_pan_id, pan_id);
 
     /* Packet scheduler will start sending timed beacons */
-    ws_radio_timer_set_superframe_order(superframe_order);
-    ws_radio_timer_enable_interrupts();
-    mac_packet_scheduler_sync();
+    mac_packet_scheduler_set_superframe(ctx);
+    WS_RADIO_TIMER_CALL(&ctx->radio, enable_interrupts);
+    mac_packet_scheduler_sync(ctx);
 
-    ws_radio_exit_critical();
+    WS_RADIO_CALL(&ctx->radio, exit_critical);
 
-    mac_coordinator_register_associate_callback(associate_callback);
+    mac_coordinator_register_associate_callback(ctx, associate_callback);
 
     return WS_MAC_START_SUCCESS;
 }
 
 
 uint16_t
-ws_mac_mlme_get_short_address(void)
+ws_mac_mlme_get_short_address(ws_mac_ctx_t *ctx)
 {
-    return mac.short_address;
+    return ctx->mac.short_address;
 }
 
 
 void
-ws_mac_mlme_set_short_address(uint16_t addr)
+ws_mac_mlme_set_short_address(ws_mac_ctx_t *ctx, uint16_t addr)
 {
-    mac.short_address = addr;
-    ws_radio_set_short_address(addr);
+    ctx->mac.short_address = addr;
+    WS_RADIO_CALL(&ctx->radio, set_short_address, addr);
 }
 
 
 uint8_t *
-ws_mac_mlme_get_extended_address(void)
+ws_mac_mlme_get_extended_address(ws_mac_ctx_t *ctx)
 {
-    return mac.extended_address;
+    return ctx->mac.extended_address;
 }
 
 
 uint16_t
-ws_mac_mlme_get_pan_id(void)
+ws_mac_mlme_get_pan_id(ws_mac_ctx_t *ctx)
 {
-    return mac.pan_id;
+    return ctx->mac.pan_id;
 }
 
 
 void
-ws_mac_mlme_get_address(ws_mac_addr_t *addr)
+ws_mac_mlme_get_address(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr)
 {
-    addr->pan_id = mac.pan_id;
-    if (mac.short_address < 0xfffe)
+    addr->pan_id = ctx->mac.pan_id;
+    if (ctx->mac.short_address < 0xfffe)
     {
         addr->type = WS_MAC_ADDR_TYPE_SHORT;
-        addr->short_addr = mac.short_address;
+        addr->short_addr = ctx->mac.short_address;
     }
     else
     {
         addr->type = WS_MAC_ADDR_TYPE_EXTENDED;
-        memcpy(&addr->extended_addr, &mac.extended_address,
+        memcpy(&addr->extended_addr, &ctx->mac.extended_address,
             WS_MAC_ADDR_TYPE_EXTENDED_LEN);
     }
 }
 
 
+void
+ws_mac_mlme_get_stats(ws_mac_ctx_t *ctx, ws_mac_stats_t *stats)
+{
+    memcpy(stats, &ctx->stats, sizeof(ws_mac_stats_t));
+}
+
+
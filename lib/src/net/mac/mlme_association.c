@@ -47,82 +47,77 @@ static uint8_t aes_key[] = {
 #endif
 
 
-typedef enum
-{
-    STATE_START,
-    STATE_ASSOC_REQ_SENT,
-    STATE_ASSOC_REQ_ACKED,
-    STATE_DATA_REQ_SENT,
-    STATE_WAIT_ASSOC_RESP,
-} association_state_t;
-
-
-typedef struct
-{
-    association_state_t state;
-    ws_mac_addr_t coord_addr;
-    uint8_t last_sqn;
-    ws_mac_association_callback_t cb;
-} association_t;
-
-static association_t assoc;
-
-
 /** Time to wait for a message reponse from the coordinator */
 /* TODO: This should be a function of the beacon interval */
 #define MSG_TIMEOUT (1000)
 
 
-WS_TIMER_DECLARE(association_timer);
-
 static void
-association_timer(void)
+association_timer(void *arg)
 {
-    switch (assoc.state)
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+
+    switch (ctx->assoc.state)
     {
-    case STATE_START:
-        assoc.state = STATE_ASSOC_REQ_SENT;
-        assoc.last_sqn = mac.sqn;
-        mac_mlme_send_association_request(&assoc.coord_addr);
+    case ASSOCIATION_STATE_START:
+        ctx->assoc.state = ASSOCIATION_STATE_ASSOC_REQ_SENT;
+        ctx->assoc.last_sqn = ctx->mac.sqn;
+        if (!mac_mlme_send_association_request(ctx, &ctx->assoc.coord_addr))
+        {
+            /* Nothing will come back for a request that was never queued */
+            WS_ERROR("Failed to queue association request\n");
+
+            if (ctx->assoc.cb != NULL)
+                ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_CHANNEL_ACCESS_FAILURE,
+                              0xffff);
+        }
         break;
 
-    case STATE_ASSOC_REQ_SENT:
+    case ASSOCIATION_STATE_ASSOC_REQ_SENT:
         WS_DEBUG("Association timed out with no response\n");
         WS_ERROR("Failed to associate\n");
 
-        if (assoc.cb != NULL)
-            assoc.cb(WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
+        if (ctx->assoc.cb != NULL)
+            ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
         break;
 
-    case STATE_ASSOC_REQ_ACKED:
-        assoc.state = STATE_DATA_REQ_SENT;
-        assoc.last_sqn = mac.sqn;
-        mac_mlme_send_data_request(&assoc.coord_addr);
+    case ASSOCIATION_STATE_ASSOC_REQ_ACKED:
+        ctx->assoc.state = ASSOCIATION_STATE_DATA_REQ_SENT;
+        ctx->assoc.last_sqn = ctx->mac.sqn;
+        if (!mac_mlme_send_data_request(ctx, &ctx->assoc.coord_addr))
+        {
+            /* Nothing will come back for a request that was never queued */
+            WS_ERROR("Failed to queue data request\n");
+
+            if (ctx->assoc.cb != NULL)
+                ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_CHANNEL_ACCESS_FAILURE,
+                              0xffff);
+        }
         break;
 
-    case STATE_DATA_REQ_SENT:
+    case ASSOCIATION_STATE_DATA_REQ_SENT:
         WS_DEBUG("Association timed out with no response\n");
         WS_ERROR("Failed to associate\n");
 
-        if (assoc.cb != NULL)
-            assoc.cb(WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
+        if (ctx->assoc.cb != NULL)
+            ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
         break;
 
-    case STATE_WAIT_ASSOC_RESP:
+    case ASSOCIATION_STATE_WAIT_ASSOC_RESP:
         WS_ERROR("Timed out waiting for association response\n");
-        if (assoc.cb != NULL)
-            assoc.cb(WS_MAC_ASSOCIATION_NO_DATA, 0xffff);
+        if (ctx->assoc.cb != NULL)
+            ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_DATA, 0xffff);
     }
 }
 
 
 static bool
-check_address(ws_mac_addr_t *addr)
+check_address(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr)
 {
-    if (addr->pan_id != assoc.coord_addr.pan_id)
+    if (addr->pan_id != ctx->assoc.coord_addr.pan_id)
         return false;
 
-    if (addr->type != assoc.coord_addr.type)
+    if (addr->type != ctx->assoc.coord_addr.type)
         return false;
 
     switch (addr->type)
@@ -131,10 +126,11 @@ check_address(ws_mac_addr_t *addr)
         return true;
 
     case WS_MAC_ADDR_TYPE_SHORT:
-        return addr->short_addr == assoc.coord_addr.short_addr;
+        return addr->short_addr == ctx->assoc.coord_addr.short_addr;
 
     case WS_MAC_ADDR_TYPE_EXTENDED:
-        return memcmp(addr->extended_addr, &assoc.coord_addr.extended_addr,
+        return memcmp(addr->extended_addr,
+                      &ctx->assoc.coord_addr.extended_addr,
                       WS_MAC_ADDR_TYPE_EXTENDED_LEN) == 0;
 
     default:
@@ -144,16 +140,8 @@ check_address(ws_mac_addr_t *addr)
 }
 
 
-/* TODO: The memory management is a bit ugly here, as I've left it up to
- * the end point for data to clean up. However, this function is an end
- * point in most cases, but not all (it is not a beacon end point).
- * Would be be the case that we could make the pointer point to null?
- * *pkt = NULL in the pktbuf code and then we can check in functions like
- * this one to see if the packet has been cleaned up. If it hasn't, we can
- * clean it up ourself. If it has, very good.
- */
 void
-mac_mlme_association_handle_packet(ws_pktbuf_t *pkt)
+mac_mlme_association_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     uint8_t sqn;
@@ -170,28 +158,27 @@ mac_mlme_association_handle_packet(ws_pktbuf_t *pkt)
     {
     case MAC_FRAME_TYPE_BEACON:
         mac_frame_extract_address(fcf, NULL, &src);
-        if (!check_address(&src))
+        if (!check_address(ctx, &src))
         {
             WS_DEBUG("Ignoring beacon from (%04x, %04x)\n",
                      src.pan_id, src.short_addr);
-            goto cleanup;
+            return;
         }
 
-        mac_packet_scheduler_sync();
-        mac_coordinator_handle_packet(pkt);
-        pkt = NULL;
+        mac_packet_scheduler_sync(ctx);
+        mac_coordinator_handle_packet(ctx, pkt);
         break;
 
     case MAC_FRAME_TYPE_MAC:
-        if (assoc.state == STATE_WAIT_ASSOC_RESP)
+        if (ctx->assoc.state == ASSOCIATION_STATE_WAIT_ASSOC_RESP)
         {
             ptr = mac_frame_extract_address(fcf, NULL, &src);
 
             if (*ptr != MAC_COMMAND_ASSOCIATION_RESPONSE)
             {
                 WS_DEBUG("Ignoring MAC frame (type=%u) in state (%u)\n",
-                         *ptr, assoc.state);
-                goto cleanup;
+                         *ptr, ctx->assoc.state);
+                return;
             }
             *ptr++;
 
@@ -199,126 +186,145 @@ mac_mlme_association_handle_packet(ws_pktbuf_t *pkt)
             {
                 WS_ERROR("Invalid association response!\n");
 
-                if (assoc.cb != NULL)
-                    assoc.cb(WS_MAC_ASSOCIATION_NO_DATA, 0xffff);
+                if (ctx->assoc.cb != NULL)
+                    ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_DATA, 0xffff);
 
-                goto cleanup;
+                return;
             }
 
             /* Save the coordinator address */
-            mac.pan_id = assoc.coord_addr.pan_id;
-            mac.coord_short_address = assoc.coord_addr.short_addr;
-            memcpy(&mac.coord_extended_address, &src.extended_addr,
+            ctx->mac.pan_id = ctx->assoc.coord_addr.pan_id;
+            ctx->mac.coord_short_address = ctx->assoc.coord_addr.short_addr;
+            memcpy(&ctx->mac.coord_extended_address, &src.extended_addr,
                    WS_MAC_ADDR_TYPE_EXTENDED_LEN);
 
             /* Save our new short address. Even if association fails,
              * this value will be valid (0xffff on failure) */
-            memcpy(&mac.short_address, ptr, 2);
+            memcpy(&ctx->mac.short_address, ptr, 2);
             ptr += 2;
-            ws_radio_set_short_address(mac.short_address);
+            WS_RADIO_CALL(&ctx->radio, set_short_address,
+                          ctx->mac.short_address);
 
             /* Check the association status */
             if (*ptr != WS_MAC_ASSOCIATION_SUCCESS)
             {
                 WS_ERROR("Failed to association with error (%02x)\n", *ptr);
 
-                if (assoc.cb != NULL)
-                    assoc.cb(*ptr, 0xffff);
+                if (ctx->assoc.cb != NULL)
+                    ctx->assoc.cb(ctx, *ptr, 0xffff);
 
-                mac.state = MAC_STATE_IDLE;
-                goto cleanup;
+                ctx->mac.state = MAC_STATE_IDLE;
+                return;
             }
 
             WS_DEBUG("Associated to (%04x, %04x) with address (%04x)\n",
-                     assoc.coord_addr.pan_id, assoc.coord_addr.short_addr,
-                     mac.short_address);
+                     ctx->assoc.coord_addr.pan_id,
+                     ctx->assoc.coord_addr.short_addr,
+                     ctx->mac.short_address);
 
-            WS_TIMER_CANCEL(association_timer);
+            ws_timer_cancel(&ctx->assoc.timer);
 
-            dev = (mac_device_t *)MALLOC(sizeof(mac_device_t));
-            if (dev == NULL)
+            /* Associating again to the same coordinator keeps the device
+             * we had for it, with its new address */
+            dev = mac_device_get_by_extended(ctx,
+                                             ctx->mac.coord_extended_address);
+            if (dev != NULL)
             {
-                WS_ERROR("failed to create device\n");
-                mac.short_address = 0xffff;
-                mac.state = MAC_STATE_IDLE;
+                mac_device_remove(ctx, dev);
+            }
+            else
+            {
+                dev = (mac_device_t *)MALLOC(sizeof(mac_device_t));
+                if (dev != NULL)
+                    ws_list_init(&dev->key_list);
+            }
 
-                if (assoc.cb != NULL)
-                    assoc.cb(*ptr, 0xffff);
-                goto cleanup;
+            if (dev != NULL)
+            {
+                memcpy(dev->addr.extended_addr,
+                       ctx->mac.coord_extended_address,
+                       WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+                dev->addr.pan_id = ctx->mac.pan_id;
+                dev->addr.short_addr = ctx->mac.coord_short_address;
+
+                if (!mac_device_add(ctx, dev))
+                {
+                    FREE(dev);
+                    dev = NULL;
+                }
             }
 
-            ws_list_init(&dev->key_list);
-            memcpy(dev->addr.extended_addr, mac.coord_extended_address,
-                   WS_MAC_ADDR_TYPE_EXTENDED_LEN);
-            dev->addr.pan_id = mac.pan_id;
-            dev->addr.short_addr = mac.coord_short_address;
+            if (dev == NULL)
+            {
+                WS_ERROR("failed to create device\n");
+                ctx->mac.short_address = 0xffff;
+                ctx->mac.state = MAC_STATE_IDLE;
 
-            ws_list_add_after(&mac.device_list, &dev->list);
+                if (ctx->assoc.cb != NULL)
+                    ctx->assoc.cb(ctx, *ptr, 0xffff);
+                return;
+            }
 
             /* TODO: Decide exactly how we want to manage keys */
-            mac_device_set_key(dev, 0, mac.own_key);
+            mac_device_set_key(dev, 0, ctx->mac.own_key);
 
-            mac.state = MAC_STATE_ASSOCIATED;
+            ctx->mac.state = MAC_STATE_ASSOCIATED;
 
-            if (assoc.cb != NULL)
-                assoc.cb(WS_MAC_ASSOCIATION_SUCCESS, mac.short_address);
+            if (ctx->assoc.cb != NULL)
+                ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_SUCCESS,
+                              ctx->mac.short_address);
         }
         else
         {
             WS_DEBUG("Ignoring mac frame in association state (%u)\n",
-                     assoc.state);
+                     ctx->assoc.state);
         }
     }
-
-cleanup:
-    if (pkt != NULL)
-    {
-        WS_DEBUG("dest\n");
-        ws_pktbuf_destroy(pkt);
-    }
 }
 
 
 void
-mac_mlme_association_handle_status(uint8_t sqn, mac_tx_status_t status)
+mac_mlme_association_handle_status(ws_mac_ctx_t *ctx,
+                                   uint8_t sqn, mac_tx_status_t status)
 {
     UNUSED(sqn);
 
-    switch (assoc.state)
+    switch (ctx->assoc.state)
     {
-    case STATE_ASSOC_REQ_SENT:
+    case ASSOCIATION_STATE_ASSOC_REQ_SENT:
         WS_DEBUG("assoc req status (%u)\n", status);
-        WS_TIMER_CANCEL(association_timer);
+        ws_timer_cancel(&ctx->assoc.timer);
         if (status == MAC_TX_STATUS_SUCCESS)
         {
-            assoc.state = STATE_ASSOC_REQ_ACKED;
-            WS_TIMER_SET(association_timer,
-                         mac.responseWaitTime * 60);
+            ctx->assoc.state = ASSOCIATION_STATE_ASSOC_REQ_ACKED;
+            ws_timer_set(&ctx->assoc.timer, WS_TIMER_MS_TO_SYMBOLS(
+                             ctx->mac.responseWaitTime * 60));
         }
         else
         {
             WS_ERROR("Failed to associate\n");
 
-            if (assoc.cb != NULL)
-                assoc.cb(WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
+            if (ctx->assoc.cb != NULL)
+                ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
         }
         break;
 
-    case STATE_DATA_REQ_SENT:
+    case ASSOCIATION_STATE_DATA_REQ_SENT:
         WS_DEBUG("data req status (%u)\n", status);
-        WS_TIMER_CANCEL(association_timer);
+        ws_timer_cancel(&ctx->assoc.timer);
         if (status == MAC_TX_STATUS_SUCCESS)
         {
             WS_DEBUG("Waiting for association response\n");
-            assoc.state = STATE_WAIT_ASSOC_RESP;
-            WS_TIMER_SET(association_timer, MSG_TIMEOUT);
+            ctx->assoc.state = ASSOCIATION_STATE_WAIT_ASSOC_RESP;
+            ws_timer_set(&ctx->assoc.timer,
+                         WS_TIMER_MS_TO_SYMBOLS(MSG_TIMEOUT));
         }
         else
         {
             WS_ERROR("Failed to associate\n");
 
-            if (assoc.cb != NULL)
-                assoc.cb(WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
+            if (ctx->assoc.cb != NULL)
+                ctx->assoc.cb(ctx, WS_MAC_ASSOCIATION_NO_ACK, 0xffff);
         }
         break;
 
@@ -330,7 +336,7 @@ mac_mlme_association_handle_status(uint8_t sqn, mac_tx_status_t status)
 
 
 void
-ws_mac_mlme_associate(ws_mac_pan_descriptor_t *pan,
+ws_mac_mlme_associate(ws_mac_ctx_t *ctx, ws_mac_pan_descriptor_t *pan,
                       ws_mac_association_callback_t cb)
 {
     if (cb == NULL)
@@ -341,18 +347,32 @@ ws_mac_mlme_associate(ws_mac_pan_descriptor_t *pan,
     WS_DEBUG("Associating with (%u, %04x)\n",
              pan->channel, pan->addr.pan_id);
 
-    mac.state = MAC_STATE_ASSOCIATING;
+    ctx->mac.state = MAC_STATE_ASSOCIATING;
 
-    /* Prepare the association state */
-    memset(&assoc, 0, sizeof(assoc));
-    memcpy(&assoc.coord_addr, &pan->addr, sizeof(ws_mac_addr_t));
-    assoc.state = STATE_START;
-    assoc.cb = cb;
+    /* Prepare the association state. The timer can't be wiped as it may
+     * still be queued from an earlier attempt, so it's cancelled instead */
+    ws_timer_cancel(&ctx->assoc.timer);
+    ctx->assoc.last_sqn = 0;
+    memcpy(&ctx->assoc.coord_addr, &pan->addr, sizeof(ws_mac_addr_t));
+    ctx->assoc.state = ASSOCIATION_STATE_START;
+    ctx->assoc.cb = cb;
 
-    ws_radio_set_channel(pan->channel);
-    ws_radio_set_pan_id(pan->addr.pan_id);
-    ws_radio_timer_enable_interrupts();
-    ws_radio_timer_set_superframe_order(pan->superframe_spec.superframe_order);
+    WS_RADIO_CALL(&ctx->radio, set_channel, pan->channel);
+    WS_RADIO_CALL(&ctx->radio, set_pan_id, pan->addr.pan_id);
+    WS_RADIO_TIMER_CALL(&ctx->radio, enable_interrupts);
 
-    WS_TIMER_SET_NOW(association_timer);
+    /* Follow the PAN's superframe, so CSMA-CA is slotted if it has one */
+    ctx->mac.beacon_order = pan->superframe_spec.beacon_order;
+    ctx->mac.superframe_order = pan->superframe_spec.superframe_order;
+    mac_packet_scheduler_set_superframe(ctx);
+
+    ws_timer_set(&ctx->assoc.timer, 0);
+}
+
+
+void
+mac_mlme_association_init(ws_mac_ctx_t *ctx)
+{
+    ctx->assoc.timer =
+        (ws_timer_t)WS_TIMER_INITIALISER(association_timer, ctx);
 }
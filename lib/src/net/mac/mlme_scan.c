@@ -31,21 +31,6 @@
 
 #include "mac_private.h"
 
-typedef struct
-{
-    ws_mac_scan_type_t type;
-    ws_mac_scan_callback_t cb;
-    uint32_t channel_duration;
-    uint16_t channels;
-    uint8_t channel;
-    ws_list_t scan_results;
-} scan_state_t;
-
-static scan_state_t scan_state;
-
-
-WS_TIMER_DECLARE(scan_timer);
-
 
 /* if a >  b return  1
  * if a == b return  0
@@ -77,9 +62,9 @@ compare_scan_result(ws_list_t *a, ws_list_t *b)
 
 
 static void
-clear_scan_results(void)
+clear_scan_results(ws_mac_ctx_t *ctx)
 {
-    ws_list_t *ptr = scan_state.scan_results.next;
+    ws_list_t *ptr = ctx->scan.scan_results.next;
     ws_mac_scan_result_t *res;
 
     /* List isn't initialised, so it must be empty */
@@ -89,7 +74,7 @@ clear_scan_results(void)
         return;
     }
 
-    while (ptr != &scan_state.scan_results)
+    while (ptr != &ctx->scan.scan_results)
     {
         res = ws_list_get_data(ptr, ws_mac_scan_result_t, list);
         ptr = ptr->next;
@@ -101,42 +86,48 @@ clear_scan_results(void)
 
 
 static void
-scan_timer(void)
+scan_timer(void *arg)
 {
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+
     /* Figure out the next channel to scan */
-    scan_state.channels >>= 1;
-    scan_state.channel++;
+    ctx->scan.channels >>= 1;
+    ctx->scan.channel++;
 
-    while (!(scan_state.channels & 1) &&
-           scan_state.channel <= WS_RADIO_MAX_CHANNEL)
+    while (!(ctx->scan.channels & 1) &&
+           ctx->scan.channel <= WS_RADIO_MAX_CHANNEL)
     {
-        scan_state.channel++;
-        scan_state.channels >>= 1;
+        ctx->scan.channel++;
+        ctx->scan.channels >>= 1;
     }
 
-    if (scan_state.channels == 0)
+    if (ctx->scan.channels == 0)
     {
         /* Scan is complete! */
         WS_DEBUG("Scan complete\n");
 
-        mac.state = MAC_STATE_IDLE;
+        ctx->mac.state = MAC_STATE_IDLE;
 
-        scan_state.cb(WS_MAC_SCAN_SUCCESS,
-                      scan_state.type,
-                      &scan_state.scan_results);
-        clear_scan_results();
+        ctx->scan.cb(ctx, WS_MAC_SCAN_SUCCESS,
+                     ctx->scan.type,
+                     &ctx->scan.scan_results);
+        clear_scan_results(ctx);
     }
     else
     {
         /* Scan the next channel */
-        WS_DEBUG("Scanning channel %u\n", scan_state.channel);
-        ws_radio_set_channel(scan_state.channel);
-
-        /* Send a beacon request if this is an active scan */
-        if (scan_state.type == WS_MAC_SCAN_TYPE_ACTIVE)
-            mac_mlme_send_beacon_request();
-
-        WS_TIMER_SET(scan_timer, scan_state.channel_duration);
+        WS_DEBUG("Scanning channel %u\n", ctx->scan.channel);
+        WS_RADIO_CALL(&ctx->radio, set_channel, ctx->scan.channel);
+
+        /* Send a beacon request if this is an active scan. If it can't be
+         * queued the channel is still listened to for beacons. */
+        if (ctx->scan.type == WS_MAC_SCAN_TYPE_ACTIVE &&
+            !mac_mlme_send_beacon_request(ctx))
+            WS_WARN("beacon request refused on channel %u\n",
+                    ctx->scan.channel);
+
+        ws_timer_set(&ctx->scan.timer,
+                     WS_TIMER_MS_TO_SYMBOLS(ctx->scan.channel_duration));
     }
 }
 
@@ -144,7 +135,7 @@ scan_timer(void)
 /* TODO: Depending on macAutoRequest, we also need to pass the frame up the
  * stack. In all cases, we want to pass the beacon data payload up the stack */
 void
-mac_mlme_scan_handle_packet(ws_pktbuf_t *pkt)
+mac_mlme_scan_handle_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
     uint8_t *ptr;
@@ -162,11 +153,11 @@ mac_mlme_scan_handle_packet(ws_pktbuf_t *pkt)
     if (res == NULL)
     {
         WS_ERROR("Failed to allocate memory for scan result\n");
-        goto cleanup;
+        return;
     }
 
     /* Sync up the slot timer */
-    mac_packet_scheduler_sync();
+    mac_packet_scheduler_sync(ctx);
 
     /* Extract the source address */
     ptr = mac_frame_extract_address(fcf, NULL, &res->pan_desc.addr);
@@ -176,13 +167,12 @@ mac_mlme_scan_handle_packet(ws_pktbuf_t *pkt)
     {
         WS_ERROR("Security is unsupported\n");
         FREE(res);
-        goto cleanup;
+        return;
     }
 
-    res->pan_desc.channel = scan_state.channel;
-    /* TODO: The bytes to calculate this are sitting at the end of the
-     * pktbuf. We just need to use them */
-    res->pan_desc.link_quality = 0x00;
+    res->pan_desc.channel = ctx->scan.channel;
+    res->pan_desc.link_quality = ws_pktbuf_get_meta(pkt)->lqi;
+    res->pan_desc.timestamp = ws_pktbuf_get_meta(pkt)->timestamp;
 
     /* Pull the superframe specification */
     spec = (mac_superframe_spec_t *)ptr;
@@ -199,28 +189,24 @@ mac_mlme_scan_handle_packet(ws_pktbuf_t *pkt)
              res->pan_desc.superframe_spec.beacon_order,
              res->pan_desc.superframe_spec.superframe_order);
 
-    ws_list_add_sorted(&scan_state.scan_results, &res->list,
+    ws_list_add_sorted(&ctx->scan.scan_results, &res->list,
                        compare_scan_result);
-
-cleanup:
-    WS_DEBUG("dest\n");
-    ws_pktbuf_destroy(pkt);
 }
 
 
 void
-ws_mac_mlme_scan(ws_mac_scan_type_t type, uint16_t channels,
+ws_mac_mlme_scan(ws_mac_ctx_t *ctx, ws_mac_scan_type_t type, uint16_t channels,
                  uint8_t duration, ws_mac_scan_callback_t cb)
 {
-    if (mac.state == MAC_STATE_SCANNING)
+    if (ctx->mac.state == MAC_STATE_SCANNING)
     {
-        cb(WS_MAC_SCAN_IN_PROGRESS, type, NULL);
+        cb(ctx, WS_MAC_SCAN_IN_PROGRESS, type, NULL);
         return;
     }
 
     if (channels == 0)
     {
-        cb(WS_MAC_SCAN_INVALID_PARAMETER, type, NULL);
+        cb(ctx, WS_MAC_SCAN_INVALID_PARAMETER, type, NULL);
         return;
     }
 
@@ -232,41 +218,50 @@ ws_mac_mlme_scan(ws_mac_scan_type_t type, uint16_t channels,
 
     WS_DEBUG("SCAN\n");
 
-    ws_radio_enter_critical();
+    WS_RADIO_CALL(&ctx->radio, enter_critical);
 
-    mac.state = MAC_STATE_SCANNING;
+    ctx->mac.state = MAC_STATE_SCANNING;
 
     /* Stop the radio from filtering out packets */
-    ws_radio_set_pan_id(0xffff);
+    WS_RADIO_CALL(&ctx->radio, set_pan_id, 0xffff);
 
-    memset(&scan_state, 0, sizeof(scan_state));
-    scan_state.type = type;
-    scan_state.channels = channels;
-    scan_state.cb = cb;
+    ctx->scan.type = type;
+    ctx->scan.channels = channels;
+    ctx->scan.cb = cb;
 
-    ws_list_init(&scan_state.scan_results);
+    ws_list_init(&ctx->scan.scan_results);
 
     /* Figure out which channel to start scanning on */
-    scan_state.channel = WS_RADIO_MIN_CHANNEL;
-    while (!(scan_state.channels & 1) &&
-           scan_state.channel <= WS_RADIO_MAX_CHANNEL)
+    ctx->scan.channel = WS_RADIO_MIN_CHANNEL;
+    while (!(ctx->scan.channels & 1) &&
+           ctx->scan.channel <= WS_RADIO_MAX_CHANNEL)
     {
-        WS_DEBUG("Skipping channel %u\n", scan_state.channel);
-        scan_state.channel++;
-        scan_state.channels >>= 1;
+        WS_DEBUG("Skipping channel %u\n", ctx->scan.channel);
+        ctx->scan.channel++;
+        ctx->scan.channels >>= 1;
     }
 
     /* Calculate the scan duration per channel */
-    scan_state.channel_duration = (1 << duration) + 1;
-    scan_state.channel_duration *= WS_RADIO_SLOT_DURATION;
+    ctx->scan.channel_duration = (1 << duration) + 1;
+    ctx->scan.channel_duration *= WS_RADIO_SLOT_DURATION;
+
+    WS_DEBUG("Scanning channel %u\n", ctx->scan.channel);
+    WS_RADIO_CALL(&ctx->radio, set_channel, ctx->scan.channel);
 
-    WS_DEBUG("Scanning channel %u\n", scan_state.channel);
-    ws_radio_set_channel(scan_state.channel);
+    WS_RADIO_CALL(&ctx->radio, exit_critical);
 
-    ws_radio_exit_critical();
+    if (type == WS_MAC_SCAN_TYPE_ACTIVE &&
+        !mac_mlme_send_beacon_request(ctx))
+        WS_WARN("beacon request refused on channel %u\n", ctx->scan.channel);
+
+    ws_timer_set(&ctx->scan.timer,
+                     WS_TIMER_MS_TO_SYMBOLS(ctx->scan.channel_duration));
+}
 
-    if (type == WS_MAC_SCAN_TYPE_ACTIVE)
-        mac_mlme_send_beacon_request();
 
-    WS_TIMER_SET(scan_timer, scan_state.channel_duration);
+void
+mac_mlme_scan_init(ws_mac_ctx_t *ctx)
+{
+    ctx->scan.timer = (ws_timer_t)WS_TIMER_INITIALISER(scan_timer, ctx);
+    ws_list_init(&ctx->scan.scan_results);
 }
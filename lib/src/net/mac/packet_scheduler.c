@@ -31,84 +31,16 @@
 
 #include "mac_private.h"
 
-#include "bsp_led.h"
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
-#include "hw_memmap.h"
-#include "gpio.h"
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
-
-/*#define GPIO_DEBUG 1*/
-
-
-/* Debug GPIO pins */
-#define DEBUG_GPIO_HANDLER_PORT (GPIO_B_BASE)
-#define DEBUG_GPIO_HANDLER_RX (GPIO_PIN_4)
-#define DEBUG_GPIO_HANDLER_TIMER (GPIO_PIN_5)
-#define DEBUG_GPIO_OTHER_PORT (GPIO_A_BASE)
-#define DEBUG_GPIO_OTHER_CSMA (GPIO_PIN_2)
-#define DEBUG_GPIO_OTHER_TX_IN_FLIGHT (GPIO_PIN_4)
-#define DEBUG_GPIO_OTHER_SYNC (GPIO_PIN_5)
-
-
-/**
- * Transmitter state machine.
- * IDLE:    transmitter is waiting for packets to send
- * SENDING: transmitter has copied outgoing packet into radio FIFO, and
- *          is waiting for the packet to be transmitted
- * SENT:    packet was transmitted (CSMA-CA succeeded)
- */
-typedef enum
-{
-    PACKET_SCHEDULER_TX_STATE_IDLE,
-    PACKET_SCHEDULER_TX_STATE_SENDING,
-    PACKET_SCHEDULER_TX_STATE_SENT,
-} packet_scheduler_tx_state_t;
-
-
-/**
- * Wrapper to allow us to store packets in a list
- */
-typedef struct
-{
-    ws_list_t list;
-    ws_pktbuf_t *pkt;
-} packet_scheduler_queue_t;
-
-
-/**
- * Packet scheduler state
- */
-#define INCOMING_RB_LEN (1024)
-typedef struct
-{
-    /* Receiver */
-    ws_ringbuf_t rx_data;
-    uint8_t rx_data_buf[INCOMING_RB_LEN];
-    bool rx_data_dropped;
-
-    /* Transmitter */
-    packet_scheduler_tx_state_t tx_state;
-    ws_list_t tx_data;
-    ws_pktbuf_t *tx_in_flight;
-    uint32_t tx_in_flight_timestamp;
-    uint8_t tx_in_flight_retries;
-
-    uint16_t slot_count;
-    bool csma_active;
-} packet_scheduler_state_t;
-
-static packet_scheduler_state_t ps_state;
-
-
-/**
- * Timers
- */
-WS_TIMER_DECLARE(packet_scheduler_timer);
-WS_TIMER_DECLARE(csma_timer);
+/* Frames each TX queue can hold, by mac_tx_class_t */
+static const uint32_t tx_depth[MAC_TX_CLASS_COUNT] = {
+    MAC_TX_DEPTH_COMMAND,
+    MAC_TX_DEPTH_INDIRECT,
+    MAC_TX_DEPTH_DATA,
+};
 
 
 /* -----------------------------------------------------------------------
@@ -116,112 +48,129 @@ WS_TIMER_DECLARE(csma_timer);
  * -----------------------------------------------------------------------
  */
 static void
-handle_radio_rx_interrupt(const uint8_t *data, uint8_t len)
+handle_radio_rx_interrupt(void *arg, const uint8_t *data, uint8_t len,
+                          const ws_pktbuf_meta_t *meta)
 {
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_HANDLER_PORT, DEBUG_GPIO_HANDLER_RX,
-                 DEBUG_GPIO_HANDLER_RX);
-#endif
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    uint8_t *rec = NULL;
+    uint8_t frame_len;
+
+    WS_TRACE_BEGIN(RX_ISR);
+
+    /* Copy the frame into the ring in one piece, so the task can look at
+     * it where it is. The PHY length comes first, and the FCS is dropped
+     * as the radio has already decoded what it held into the metadata */
+    if (len > WS_RADIO_CHECKSUM_LEN && data[0] == len - 1)
+    {
+        frame_len = data[0] - WS_RADIO_CHECKSUM_LEN;
+        rec = ws_framering_reserve(&ctx->ps.rx_data,
+                                   sizeof(*meta) + frame_len);
+    }
 
-    /* Try to save the received data */
-    uint32_t max_len = ws_ringbuf_get_space(&ps_state.rx_data);
-    if (len > max_len)
+    if (rec == NULL)
     {
-        ps_state.rx_data_dropped = true;
+        ctx->ps.rx_data_dropped = true;
+        ctx->stats.rx_dropped++;
     }
     else
     {
-        ws_ringbuf_write(&ps_state.rx_data, data, (uint32_t)len);
+        memcpy(rec, meta, sizeof(*meta));
+        memcpy(rec + sizeof(*meta), &data[1], frame_len);
+        ws_framering_commit(&ctx->ps.rx_data, sizeof(*meta) + frame_len);
     }
 
-    WS_TIMER_SET_NOW(packet_scheduler_timer);
+    ws_event_post(&ctx->ps.task);
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_HANDLER_PORT, DEBUG_GPIO_HANDLER_RX, 0);
-#endif
+    WS_TRACE_END(RX_ISR);
 }
 
 
 static void
-handle_radio_timer_interrupt(void)
+set_radio_asleep(ws_mac_ctx_t *ctx, bool asleep)
 {
-    ws_pktbuf_t *pkt;
+    if (ctx->ps.radio_asleep == asleep)
+        return;
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_HANDLER_PORT, DEBUG_GPIO_HANDLER_TIMER,
-                 DEBUG_GPIO_HANDLER_TIMER);
-#endif
+    WS_RADIO_CALL(&ctx->radio, set_power, !asleep);
+    ctx->ps.radio_asleep = asleep;
+}
 
-    /* TODO:
-     * This does not allow for GTS, or inactive periods within the superframe.
-     * Currently, all 15 slots are CAP. This should be improved.
-     */
 
-    if (mac.state == MAC_STATE_COORDINATING)
+static void
+handle_radio_timer_interrupt(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    mac_superframe_t *sf = &ctx->ps.sf;
+
+    WS_TRACE_BEGIN(SLOT_TICK);
+
+    /* TODO: This does not allow for GTS, so the CAP runs to the end of
+     * the active portion. */
+    ctx->ps.slot_count++;
+
+    if (sf->beacon_enabled && ctx->ps.slot_count >= sf->slots_per_beacon)
     {
-        if (ps_state.slot_count >= (1 << mac.beacon_order))
-        {
-            ps_state.slot_count = 0;
+        ctx->ps.slot_count = 0;
 
-#ifdef GPIO_DEBUG
-            GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_SYNC,
-                         DEBUG_GPIO_OTHER_SYNC);
-#endif
+        if (ctx->mac.state == MAC_STATE_COORDINATING)
+        {
+            WS_TRACE_MARK(BEACON_SYNC);
 
             /* If there's data left in the transmitter, then we want to
              * dump it out to send a beacon. The packet scheduler will
-             * manage a retransmission. */
-            if (ws_radio_tx_has_data())
+             * load it again. */
+            if (WS_RADIO_CALL(&ctx->radio, tx_has_data))
             {
-                ws_radio_tx_clear();
+                WS_RADIO_CALL(&ctx->radio, tx_clear);
+                ws_event_post(&ctx->ps.task);
             }
 
-            pkt = mac_coordinator_request_beacon();
-            ws_radio_prepare(pkt);
-            ws_radio_transmit();
+            /* The beacon is normally built in the background a slot
+             * ahead, but the first has to be built here, as does any the
+             * main loop was too busy to build */
+            if (ctx->ps.beacon == NULL)
+                ctx->ps.beacon = mac_coordinator_request_beacon(ctx);
+
+            ctx->ps.superframe_start =
+                WS_RADIO_TIMER_CALL(&ctx->radio, get_time);
+            WS_RADIO_CALL(&ctx->radio, prepare, ctx->ps.beacon);
+            WS_RADIO_CALL(&ctx->radio, transmit);
+            ctx->stats.beacons_tx++;
+
+            ctx->ps.beacon = NULL;
+            ws_timer_set(&ctx->ps.beacon_timer,
+                         sf->beacon_interval - sf->slot_duration);
         }
         else
         {
-            ps_state.slot_count++;
-
-#ifdef GPIO_DEBUG
-            if (ps_state.slot_count >= 16)
-            {
-                GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_SYNC, 0);
-            }
-#endif
-
-            if (ps_state.slot_count < 15 &&
-                ws_radio_tx_has_data() && !ps_state.csma_active)
-                WS_TIMER_SET_NOW(csma_timer);
+            /* The beacon should be arriving now. Until we hear it, keep to
+             * the superframe it would have started.
+             * TODO: We should detect syncronisation loss here. */
+            ctx->ps.superframe_start += sf->beacon_interval;
         }
     }
+
+    /* A device has nothing to do in the inactive period, so it sleeps
+     * through it and wakes a slot before the next beacon is due */
+    if (ctx->mac.state == MAC_STATE_ASSOCIATED &&
+        sf->inactive_duration > 0 &&
+        ctx->ps.slot_count >= MAC_NUM_SUPERFRAME_SLOTS &&
+        ctx->ps.slot_count < sf->slots_per_beacon - 1)
+    {
+        set_radio_asleep(ctx, true);
+    }
     else
     {
-#ifdef GPIO_DEBUG
-        if (ps_state.slot_count >= 16)
-        {
-            GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_SYNC,
-                         0);
-        }
-#endif
-
-        if (ps_state.slot_count < 15 && ps_state.slot_count > 0)
-        {
-            if (ws_radio_tx_has_data() && !ps_state.csma_active)
-                WS_TIMER_SET_NOW(csma_timer);
-        }
-
-        /* TODO: We should detect syncronisation loss here. */
-        ps_state.slot_count++;
-
-        if (ps_state.slot_count > 100)
-            ps_state.slot_count = 100;
+        set_radio_asleep(ctx, false);
     }
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_HANDLER_PORT, DEBUG_GPIO_HANDLER_TIMER, 0);
-#endif
+    /* Slot 0 holds the beacon, and the rest of the CAP is open to all */
+    if ((!sf->beacon_enabled ||
+         (ctx->ps.slot_count > 0 && ctx->ps.slot_count < sf->cap_slots)) &&
+        WS_RADIO_CALL(&ctx->radio, tx_has_data) && !ctx->ps.csma_active)
+        ws_event_post(&ctx->ps.csma_task);
+
+    WS_TRACE_END(SLOT_TICK);
 }
 
 
@@ -230,33 +179,33 @@ handle_radio_timer_interrupt(void)
  * -----------------------------------------------------------------------
  */
 static void
-dispatch_packet(ws_pktbuf_t *pkt)
+dispatch_packet(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
 
     switch (fcf->frame_type)
     {
     case MAC_FRAME_TYPE_BEACON:
-        mac_coordinator_handle_packet(pkt);
+        mac_coordinator_handle_packet(ctx, pkt);
         break;
 
     case MAC_FRAME_TYPE_DATA:
-        mac_mcps_handle_packet(pkt);
+        mac_mcps_handle_packet(ctx, pkt);
         break;
 
     case MAC_FRAME_TYPE_MAC:
-        switch (mac.state)
+        switch (ctx->mac.state)
         {
         case MAC_STATE_ASSOCIATING:
-            mac_mlme_association_handle_packet(pkt);
+            mac_mlme_association_handle_packet(ctx, pkt);
             break;
 
         case MAC_STATE_COORDINATING:
-            mac_coordinator_handle_packet(pkt);
+            mac_coordinator_handle_packet(ctx, pkt);
             break;
 
         default:
-            mac_mlme_handle_packet(pkt);
+            mac_mlme_handle_packet(ctx, pkt);
             break;
         }
         break;
@@ -269,33 +218,37 @@ dispatch_packet(ws_pktbuf_t *pkt)
 
 
 static void
-dispatch_status(ws_pktbuf_t *pkt, mac_tx_status_t status)
+dispatch_status(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt, mac_tx_status_t status)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
+    ws_mac_addr_t dest;
 
     switch (fcf->frame_type)
     {
     case MAC_FRAME_TYPE_BEACON:
-        mac_coordinator_handle_status(fcf->data[0], status);
+        /* Beacons are numbered apart from other frames, and belong to no
+         * device */
         break;
 
     case MAC_FRAME_TYPE_DATA:
-        mac_mcps_handle_status(fcf->data[0], status);
+        mac_mcps_handle_status(ctx, fcf->data[0], status);
         break;
 
     case MAC_FRAME_TYPE_MAC:
-        switch (mac.state)
+        switch (ctx->mac.state)
         {
         case MAC_STATE_ASSOCIATING:
-            mac_mlme_association_handle_status(fcf->data[0], status);
+            mac_mlme_association_handle_status(ctx, fcf->data[0], status);
             break;
 
         case MAC_STATE_COORDINATING:
-            mac_coordinator_handle_status(fcf->data[0], status);
+            mac_frame_extract_address(fcf, &dest, NULL);
+            mac_coordinator_handle_status(ctx, fcf->data[0], &dest,
+                                          status);
             break;
 
         default:
-            mac_mlme_handle_status(fcf->data[0], status);
+            mac_mlme_handle_status(ctx, fcf->data[0], status);
             break;
         }
         break;
@@ -308,182 +261,317 @@ dispatch_status(ws_pktbuf_t *pkt, mac_tx_status_t status)
 }
 
 
+/* Take the next frame to send from the first class that has one */
+static ws_pktbuf_t *
+next_tx_frame(ws_mac_ctx_t *ctx)
+{
+    ws_pktbuf_t *pkt;
+    uint32_t class;
+
+    for (class = 0; class < MAC_TX_CLASS_COUNT; class++)
+    {
+        pkt = ws_pktbuf_queue_pop(&ctx->ps.tx_data[class]);
+        if (pkt != NULL)
+            return pkt;
+    }
+
+    return NULL;
+}
+
+
 static void
-clean_tx_state(void)
+clean_tx_state(ws_mac_ctx_t *ctx)
 {
     WS_DEBUG("cleaning tx state\n");
 
-    if (ps_state.tx_in_flight != NULL)
+    if (ctx->ps.tx_in_flight != NULL)
     {
-        WS_DEBUG("dest\n");
-        ws_pktbuf_destroy(ps_state.tx_in_flight);
-        ps_state.tx_in_flight = NULL;
+        ws_pktbuf_unref(ctx->ps.tx_in_flight);
+        ctx->ps.tx_in_flight = NULL;
     }
 
-    ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_IDLE;
-    ws_radio_tx_clear();
+    ctx->ps.tx_state = PACKET_SCHEDULER_TX_STATE_IDLE;
+    ws_timer_cancel(&ctx->ps.ack_timer);
+    ws_timer_cancel(&ctx->ps.tx_timer);
+    WS_RADIO_CALL(&ctx->radio, tx_clear);
+}
+
+
+/* CSMA-CA is started by the slot timer once the CAP opens in a
+ * beacon-enabled PAN. Without beacons there's no CAP to wait for, so it
+ * starts as soon as a frame is loaded. */
+static void
+start_unslotted_csma(ws_mac_ctx_t *ctx)
+{
+    if (!ctx->ps.sf.beacon_enabled && !ctx->ps.csma_active)
+        ws_event_post(&ctx->ps.csma_task);
+}
+
+
+static void
+complete_tx(ws_mac_ctx_t *ctx, mac_tx_status_t status)
+{
+    ws_pktbuf_t *pkt = ws_pktbuf_ref(ctx->ps.tx_in_flight);
+
+    /* Tidy up before reporting, so the layer above finds the scheduler idle
+     * and can queue its next frame from the handler. Our own reference keeps
+     * the frame around until the handler is done with it. */
+    clean_tx_state(ctx);
+    dispatch_status(ctx, pkt, status);
+    ws_pktbuf_unref(pkt);
 }
 
 
 /* -----------------------------------------------------------------------
- *  Background Task
+ *  Background Tasks
  * -----------------------------------------------------------------------
  */
 static void
-packet_scheduler_timer(void)
+beacon_timer(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    uint32_t superframe_start = ctx->ps.superframe_start;
+    ws_pktbuf_t *beacon;
+
+    if (ctx->mac.state != MAC_STATE_COORDINATING)
+        return;
+
+    /* Build the next beacon a slot before it's due, so the pending
+     * addresses are current and the slot interrupt only has to copy it into
+     * the radio. If the interrupt sent one of its own while this was being
+     * built, this one is already out of date. */
+    beacon = mac_coordinator_request_beacon(ctx);
+
+    ENTER_CRITICAL();
+    if (ctx->ps.beacon == NULL &&
+        ctx->ps.superframe_start == superframe_start)
+        ctx->ps.beacon = beacon;
+    EXIT_CRITICAL();
+}
+
+
+/* Look at a received frame where it sits in the receive ring. ACKs and
+ * frames we have no use for are dealt with there, and a frame is only
+ * copied into a pktbuf when it is passed on, as its handler may keep it.
+ */
+static void
+handle_rx_frame(ws_mac_ctx_t *ctx, const ws_pktbuf_meta_t *meta,
+                uint8_t *frame, uint8_t len)
 {
+    mac_fcf_t *fcf = (mac_fcf_t *)frame;
+    mac_fcf_t *in_flight_fcf;
+    void (*handler)(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt);
     ws_pktbuf_t *pkt;
-    uint8_t *buf;
-    uint8_t phy_len;
-    mac_fcf_t *fcf, *in_flight_fcf;
-    uint32_t delta, time;
 
-    /*
-     * Incoming Data
-     */
-    if (ps_state.rx_data_dropped)
+    WS_DEBUG("received a packet (len=%u, state=%u)\n", len, ctx->mac.state);
+
+    if (!meta->crc_ok || len < sizeof(mac_fcf_t) + 1)
     {
-        /* TODO: Keep track of this / do something with this warning */
-        WS_WARN("received frame has been dropped\n");
-        ps_state.rx_data_dropped = false;
+        WS_DEBUG("ignoring corrupt frame\n");
+        return;
     }
 
-    while (ws_ringbuf_has_data(&ps_state.rx_data))
+    /* Packets will get passed to the appropriate upper MAC layer based
+     * on a number of conditions:
+     *
+     * ACK packets get compared to the current in_flight packet.
+     * If they match, we can clean up the in_flight state, and alert the
+     * layer above.
+     *
+     * ctx->mac.state = IDLE
+     *  ignore everything
+     * ctx->mac.state = SCANNING
+     *  beacon frames go to mlme_scan and everything else is ignored
+     * ctx->mac.state = ASSOCIATING
+     *  data is ignored, everything else falls to standard case
+     *
+     * fcf.type = BEACON => coordinator
+     * fcf.type = DATA   => MCPS
+     * fcf.type = MAC    => MLME
+     */
+    if (fcf->frame_type == MAC_FRAME_TYPE_ACK)
     {
-        /* Load a frame from the ring buffer into a pktbuf */
-        pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
-        if (pkt == NULL)
-        {
-            WS_ERROR("failed to allocate memory for received data\n");
-            break;
-        }
-
-        WS_DEBUG("created packet (pkt=%p)\n", pkt);
-
-        buf = ws_pktbuf_get_data(pkt);
-        ws_ringbuf_pop(&ps_state.rx_data, &phy_len);
-        ws_ringbuf_read(&ps_state.rx_data, buf, phy_len);
-        ws_pktbuf_increment_end(pkt, phy_len);
-
-        /* Remove the FCS from the end */
-        ws_pktbuf_remove_from_end(pkt, 2);
-
-        WS_DEBUG("received a packet (len=%u, state=%u)\n",
-                 phy_len, mac.state);
-
-        fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
-
-        /* Packets will get passed to the appropriate upper MAC layer based
-         * on a number of conditions:
-         *
-         * ACK packets get compared to the current in_flight packet.
-         * If they match, we can clean up the in_flight state, and alert the
-         * layer above.
-         *
-         * mac.state = IDLE
-         *  ignore everything
-         * mac.state = SCANNING
-         *  beacon frames go to mlme_scan and everything else is ignored
-         * mac.state = ASSOCIATING
-         *  data is ignored, everything else falls to standard case
-         *
-         * fcf.type = BEACON => coordinator
-         * fcf.type = DATA   => MCPS
-         * fcf.type = MAC    => MLME
-         */
-        if (fcf->frame_type == MAC_FRAME_TYPE_ACK)
+        if (ctx->ps.tx_in_flight != NULL)
         {
-            if (ps_state.tx_in_flight != NULL)
+            in_flight_fcf =
+                (mac_fcf_t *)ws_pktbuf_get_data(ctx->ps.tx_in_flight);
+            if (fcf->data[0] == in_flight_fcf->data[0])
             {
-                in_flight_fcf =
-                    (mac_fcf_t *)ws_pktbuf_get_data(ps_state.tx_in_flight);
-                if (fcf->data[0] == in_flight_fcf->data[0])
-                {
-                    WS_DEBUG("received ACK for (sqn=%u)\n", fcf->data[0]);
-
-                    dispatch_status(ps_state.tx_in_flight,
-                                    MAC_TX_STATUS_SUCCESS);
-
-                    clean_tx_state();
-                }
-                else
-                {
-                    WS_DEBUG("ignoring ACK (sqn=%u) frame expected (%u)\n",
-                             fcf->data[0], in_flight_fcf->data[0]);
-                }
+                WS_DEBUG("received ACK for (sqn=%u)\n", fcf->data[0]);
+
+                complete_tx(ctx, MAC_TX_STATUS_SUCCESS);
             }
             else
             {
-                WS_DEBUG("ignoring ACK (sqn=%u) frame\n", fcf->data[0]);
+                WS_DEBUG("ignoring ACK (sqn=%u) frame expected (%u)\n",
+                         fcf->data[0], in_flight_fcf->data[0]);
             }
-
-            WS_DEBUG("dest\n");
-            ws_pktbuf_destroy(pkt);
         }
         else
         {
-            switch (mac.state)
-            {
-            case MAC_STATE_IDLE:
-                WS_DEBUG("ignoring (type=%u) in IDLE state\n",
-                         fcf->frame_type);
-                break;
-
-            case MAC_STATE_SCANNING:
-                if (fcf->frame_type == MAC_FRAME_TYPE_BEACON)
-                {
-                    mac_mlme_scan_handle_packet(pkt);
-                }
-                else
-                {
-                    WS_DEBUG("ignoring (type=%u) in SCANNING state\n",
-                             fcf->frame_type);
-                }
-                break;
-
-            case MAC_STATE_ASSOCIATING:
-                if (fcf->frame_type == MAC_FRAME_TYPE_BEACON ||
-                    fcf->frame_type == MAC_FRAME_TYPE_MAC)
-                {
-                    mac_mlme_association_handle_packet(pkt);
-                }
-                else
-                {
-                    WS_DEBUG("ignoring (type=%u) in ASSOCIATING state\n",
-                             fcf->frame_type);
-                }
-                break;
-
-            default:
-                dispatch_packet(pkt);
-                break;
-            }
+            WS_DEBUG("ignoring ACK (sqn=%u) frame\n", fcf->data[0]);
         }
+        return;
+    }
+
+    switch (ctx->mac.state)
+    {
+    case MAC_STATE_IDLE:
+        WS_DEBUG("ignoring (type=%u) in IDLE state\n", fcf->frame_type);
+        return;
+
+    case MAC_STATE_SCANNING:
+        if (fcf->frame_type != MAC_FRAME_TYPE_BEACON)
+        {
+            WS_DEBUG("ignoring (type=%u) in SCANNING state\n",
+                     fcf->frame_type);
+            return;
+        }
+        handler = mac_mlme_scan_handle_packet;
+        break;
+
+    case MAC_STATE_ASSOCIATING:
+        if (fcf->frame_type != MAC_FRAME_TYPE_BEACON &&
+            fcf->frame_type != MAC_FRAME_TYPE_MAC)
+        {
+            WS_DEBUG("ignoring (type=%u) in ASSOCIATING state\n",
+                     fcf->frame_type);
+            return;
+        }
+        handler = mac_mlme_association_handle_packet;
+        break;
+
+    default:
+        handler = dispatch_packet;
+        break;
+    }
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+    {
+        /* Usually the pktbuf pool is empty because frames aren't being
+         * consumed fast enough */
+        WS_WARN("no pktbuf for received frame\n");
+        ctx->stats.rx_dropped++;
+        return;
+    }
+
+    ws_pktbuf_add_to_end(pkt, frame, len);
+    *ws_pktbuf_get_meta(pkt) = *meta;
+
+    /* Handlers only borrow the frame, and take their own reference if they
+     * need it for longer */
+    handler(ctx, pkt);
+    ws_pktbuf_unref(pkt);
+}
+
+
+static uint32_t
+sending_timeout(ws_mac_ctx_t *ctx)
+{
+    /* CSMA-CA is started by the slot timer, and gets every CAP slot of a
+     * beacon interval before the frame is given up on */
+    if (ctx->ps.sf.beacon_enabled)
+        return ctx->ps.sf.beacon_interval;
+
+    /* Without beacons it starts straight away, and gives up by itself after
+     * macMaxCSMABackoffs + 1 backoffs of under 2^macMaxBE periods each, so
+     * this is only a backstop */
+    return ((uint32_t)(ctx->mac.max_csma_backoffs + 1) <<
+            ctx->mac.max_backoff_exponent) * UNIT_BACKOFF_PERIOD +
+        ctx->ps.tx_duration;
+}
+
+
+static void
+tx_timer(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+
+    if (ctx->ps.tx_state != PACKET_SCHEDULER_TX_STATE_SENDING)
+        return;
+
+    if (ctx->ps.tx_in_flight == NULL)
+    {
+        /* Nothing to report to, or to send again */
+        WS_ERROR("failed to transmit packet\n");
+        WS_TRACE_END(TX_IN_FLIGHT);
+
+        ctx->stats.tx_not_sent++;
+        clean_tx_state(ctx);
+        ws_event_post(&ctx->ps.task);
+        return;
+    }
+
+    /* If the packet has not left the radio in a reasonable amount of time
+     * then we alert the next higher layer with the failure. */
+    WS_ERROR("failed to transmit packet (%u/%u)\n",
+             ctx->ps.tx_in_flight_retries, ctx->mac.max_frame_retries);
+    if (ctx->ps.tx_in_flight_retries < ctx->mac.max_frame_retries)
+    {
+        WS_RADIO_CALL(&ctx->radio, prepare, ctx->ps.tx_in_flight);
+        ws_timer_set(&ctx->ps.tx_timer, sending_timeout(ctx));
+        ctx->ps.tx_in_flight_retries++;
+        ctx->stats.tx_retries++;
+        start_unslotted_csma(ctx);
+    }
+    else
+    {
+        WS_TRACE_END(TX_IN_FLIGHT);
+
+        ctx->stats.tx_not_sent++;
+        complete_tx(ctx, MAC_TX_STATUS_NOT_SENT);
+    }
+}
+
+
+static void
+packet_scheduler_task(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    ws_pktbuf_t *pkt;
+    mac_fcf_t *fcf;
+    uint8_t *rec;
+    uint32_t rec_len;
+
+    /*
+     * Incoming Data
+     */
+    if (ctx->ps.rx_data_dropped)
+    {
+        /* Already counted in the stats. Usually the receive ring is full
+         * because frames aren't being consumed fast enough */
+        WS_WARN("received frame has been dropped\n");
+        ctx->ps.rx_data_dropped = false;
+    }
+
+    while ((rec = ws_framering_peek(&ctx->ps.rx_data, &rec_len)) != NULL)
+    {
+        ctx->stats.rx_frames++;
+
+        handle_rx_frame(ctx, (ws_pktbuf_meta_t *)rec,
+                        rec + sizeof(ws_pktbuf_meta_t),
+                        rec_len - sizeof(ws_pktbuf_meta_t));
+
+        ws_framering_release(&ctx->ps.rx_data);
     }
 
     /*
      * Outgoing Data
      */
-    switch (ps_state.tx_state)
+    switch (ctx->ps.tx_state)
     {
     case PACKET_SCHEDULER_TX_STATE_IDLE:
     {
-        packet_scheduler_queue_t *data;
-
-        if (!ws_list_is_empty(&ps_state.tx_data))
+        /* Pull the next pktbuf off the queues */
+        pkt = next_tx_frame(ctx);
+        if (pkt != NULL)
         {
-            ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_SENDING;
+            ctx->ps.tx_state = PACKET_SCHEDULER_TX_STATE_SENDING;
 
-            ASSERT(ps_state.tx_in_flight == NULL,
+            ASSERT(ctx->ps.tx_in_flight == NULL,
                    "have data in_flight in IDLE state!\n");
 
-            /* Pull the next pktbuf out of the list */
-            data = ws_list_get_data(ps_state.tx_data.next,
-                                   packet_scheduler_queue_t, list);
-            ws_list_remove(&data->list);
-            pkt = data->pkt;
-            FREE(data);
-
             fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
 
             WS_DEBUG("adding frame (type=%u) to TX FIFO\n", fcf->frame_type);
@@ -492,116 +580,101 @@ packet_scheduler_timer(void)
                      ws_pktbuf_get_len(pkt));
 
             /* Copy the packet to the RF FIFO */
-            ws_radio_prepare(pkt);
+            WS_RADIO_CALL(&ctx->radio, prepare, pkt);
+            ctx->ps.tx_duration =
+                MAC_FRAME_DURATION(ws_pktbuf_get_chain_len(pkt));
+            ctx->stats.tx_frames++;
 
-#ifdef GPIO_DEBUG
-            GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                         DEBUG_GPIO_OTHER_TX_IN_FLIGHT,
-                         DEBUG_GPIO_OTHER_TX_IN_FLIGHT);
-#endif
+            WS_TRACE_BEGIN(TX_IN_FLIGHT);
 
             if (fcf->ack_req)
             {
                 /* If acknowledgement is requested, we'll prepare the in flight
-                 * state */
-                ps_state.tx_in_flight = pkt;
-                ps_state.tx_in_flight_timestamp = ws_radio_timer_get_time();
-                ps_state.tx_in_flight_retries = 0;
+                 * state, which takes over the queue's reference */
+                ctx->ps.tx_in_flight = pkt;
+                ctx->ps.tx_in_flight_retries = 0;
+                ctx->ps.tx_duration += MAC_ACK_WAIT_DURATION;
 
                 WS_DEBUG("acknowledgement requested\n");
             }
             else
             {
-                /* Otherwise we'll tidy up the packet */
-                WS_DEBUG("dest\n");
-                ws_pktbuf_destroy(pkt);
+                /* Otherwise the queue's reference is no longer needed */
+                ws_pktbuf_unref(pkt);
                 pkt = NULL;
 
                 WS_DEBUG("acknowledgement not requested\n");
             }
+
+            /* Every frame is timed from here, so one that never gets out
+             * is given up on */
+            ws_timer_set(&ctx->ps.tx_timer, sending_timeout(ctx));
+            start_unslotted_csma(ctx);
         }
         break;
     }
 
     case PACKET_SCHEDULER_TX_STATE_SENDING:
-        /* TODO: This should be a function of the current beacon interval.
-         * This is roughly calculated for a BO of 5 */
-        time = ps_state.tx_in_flight_timestamp + 4000;
-        time &= 0xffffff;
-        delta = ws_radio_timer_get_time() - time;
-
-        if (delta < 0x800000)
+        /* Until the frame gets out, tx_timer looks after it */
+        if (!WS_RADIO_CALL(&ctx->radio, tx_has_data) &&
+            !ctx->ps.csma_active)
         {
-            /* If the packet has not left the radio in a reasonable amount of
-             * time then we alert the next higher layer with the failure. */
-            WS_ERROR("failed to transmit packet (%u/%u)\n",
-                     ps_state.tx_in_flight_retries, mac.max_frame_retries);
-            if (ps_state.tx_in_flight_retries < mac.max_frame_retries)
+            /* A beacon took the FIFO before the frame got out, so load it
+             * again. Frames without an ACK aren't kept, and are lost. */
+            if (ctx->ps.tx_in_flight != NULL)
             {
-                ws_radio_prepare(ps_state.tx_in_flight);
-                ps_state.tx_in_flight_timestamp = ws_radio_timer_get_time();
-                ps_state.tx_in_flight_retries++;
-                ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_SENDING;
-
-#ifdef GPIO_DEBUG
-                GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                             DEBUG_GPIO_OTHER_TX_IN_FLIGHT,
-                             DEBUG_GPIO_OTHER_TX_IN_FLIGHT);
-#endif
+                WS_RADIO_CALL(&ctx->radio, prepare, ctx->ps.tx_in_flight);
             }
             else
             {
-#ifdef GPIO_DEBUG
-                GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                         DEBUG_GPIO_OTHER_TX_IN_FLIGHT, 0);
-#endif
-
-                dispatch_status(ps_state.tx_in_flight,
-                                MAC_TX_STATUS_NOT_SENT);
-
-                clean_tx_state();
+                WS_TRACE_END(TX_IN_FLIGHT);
+                ctx->stats.tx_not_sent++;
+                clean_tx_state(ctx);
+                ws_event_post(&ctx->ps.task);
             }
         }
         break;
 
     case PACKET_SCHEDULER_TX_STATE_SENT:
-        /* TODO: This should be a function of the SIFS PIB attribute.
-         * This is roughly a slot period, which is too long. */
-        time = ps_state.tx_in_flight_timestamp + 60;
-        time &= 0xffffff;
-        delta = ws_radio_timer_get_time() - time;
+        /* Waiting for the ACK, which ack_timer looks after */
+        break;
+    }
+}
 
-        if (delta < 0x800000)
-        {
-            /* If the ACK message was not received in a reasonable amount of
-             * time then we should schedule a retransmission */
-            WS_ERROR("No ACK received (%u/%u)\n",
-                     ps_state.tx_in_flight_retries, mac.max_frame_retries);
-            if (ps_state.tx_in_flight_retries < mac.max_frame_retries)
-            {
-                ws_radio_prepare(ps_state.tx_in_flight);
-                ps_state.tx_in_flight_timestamp = ws_radio_timer_get_time();
-                ps_state.tx_in_flight_retries++;
-                ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_SENDING;
-
-#ifdef GPIO_DEBUG
-                GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                             DEBUG_GPIO_OTHER_TX_IN_FLIGHT,
-                             DEBUG_GPIO_OTHER_TX_IN_FLIGHT);
-#endif
-            }
-            else
-            {
-                WS_ERROR("failed to send within (max_retry=%u) retries\n",
-                         mac.max_frame_retries);
 
-                dispatch_status(ps_state.tx_in_flight,
-                                MAC_TX_STATUS_NO_ACK);
+static void
+ack_timer(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+
+    /* The ACK came in just as the timer went off */
+    if (ctx->ps.tx_state != PACKET_SCHEDULER_TX_STATE_SENT)
+        return;
 
-                clean_tx_state();
-            }
-        }
-        break;
+    WS_ERROR("No ACK received (%u/%u)\n",
+             ctx->ps.tx_in_flight_retries, ctx->mac.max_frame_retries);
+    if (ctx->ps.tx_in_flight_retries < ctx->mac.max_frame_retries)
+    {
+        WS_RADIO_CALL(&ctx->radio, prepare, ctx->ps.tx_in_flight);
+        ws_timer_set(&ctx->ps.tx_timer, sending_timeout(ctx));
+        ctx->ps.tx_in_flight_retries++;
+        ctx->stats.tx_retries++;
+        ctx->ps.tx_state = PACKET_SCHEDULER_TX_STATE_SENDING;
+
+        WS_TRACE_BEGIN(TX_IN_FLIGHT);
+
+        /* Contend for the channel again straight away, rather than at the
+         * next slot */
+        if (!ctx->ps.csma_active)
+            ws_event_post(&ctx->ps.csma_task);
+    }
+    else
+    {
+        WS_ERROR("failed to send within (max_retry=%u) retries\n",
+                 ctx->mac.max_frame_retries);
+
+        ctx->stats.tx_no_ack++;
+        complete_tx(ctx, MAC_TX_STATUS_NO_ACK);
     }
 }
 
@@ -611,98 +684,172 @@ packet_scheduler_timer(void)
  * -----------------------------------------------------------------------
  */
 static bool
-csma_contend_for_access(void)
+csma_is_slotted(ws_mac_ctx_t *ctx)
 {
-    uint8_t cw = MAC_CW_0;
+    return ctx->ps.sf.beacon_enabled;
+}
 
-    /* Ensure the channel is clear for the duration of the contention
-     * window */
-    while (cw--)
-    {
-        if (!ws_radio_cca())
-            return false;
-    }
 
-    return true;
+static bool
+csma_fits_in_cap(ws_mac_ctx_t *ctx)
+{
+    uint32_t offset;
+
+    offset = WS_RADIO_TIMER_CALL(&ctx->radio, get_time) -
+        ctx->ps.superframe_start;
+    offset &= 0xffffff;
+
+    return offset + MAC_CW_0 * UNIT_BACKOFF_PERIOD + ctx->ps.tx_duration <=
+        ctx->ps.sf.cap_end;
 }
 
+
 static void
-csma_timer(void)
+csma_backoff(ws_mac_ctx_t *ctx)
 {
-    uint8_t n_backoffs = 0;
-    uint8_t backoff_exponent;
-    uint8_t rand;
     uint32_t backoff_delay;
+    uint32_t offset;
+
+    /* Wait a random number of backoff periods, up to 2^BE - 1 of them */
+    backoff_delay = (uint32_t)WS_GET_RANDOM8();
+    backoff_delay >>= (8 - ctx->ps.csma_backoff_exponent);
+    backoff_delay *= UNIT_BACKOFF_PERIOD;
+
+    /* Slotted CSMA-CA counts whole backoff periods from the start of the
+     * superframe, so every device samples the channel at the same points */
+    if (csma_is_slotted(ctx))
+    {
+        offset = WS_RADIO_TIMER_CALL(&ctx->radio, get_time) -
+            ctx->ps.superframe_start;
+        offset &= 0xffffff;
+        backoff_delay += (UNIT_BACKOFF_PERIOD -
+                          offset % UNIT_BACKOFF_PERIOD) % UNIT_BACKOFF_PERIOD;
+    }
+
+    ws_timer_set(&ctx->ps.csma_timer, backoff_delay);
+}
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_CSMA,
-                 DEBUG_GPIO_OTHER_CSMA);
-#endif
 
-    ps_state.csma_active = true;
+static void
+csma_timer(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    bool slotted = csma_is_slotted(ctx);
 
-    if (mac.batt_life_extension)
+    /* The FIFO may have been emptied during the backoff, for a beacon or
+     * because the frame was given up on. Whatever is loaded next gets a
+     * fresh attempt. */
+    if (!WS_RADIO_CALL(&ctx->radio, tx_has_data))
     {
-        WS_WARN("battery life extension is unsupported\n");
+        WS_DEBUG("nothing left to send after backoff\n");
+        ctx->ps.csma_active = false;
+        WS_TRACE_END(CSMA);
         return;
     }
-    else
+
+    /* If the CCAs, the frame and its ACK won't all fit in what's left of
+     * the CAP, then the attempt starts again in the next superframe. The
+     * slot timer picks it up once the CAP opens. */
+    if (slotted && ctx->ps.csma_cw == MAC_CW_0 && !csma_fits_in_cap(ctx))
     {
-        backoff_exponent = mac.min_backoff_exponent;
+        WS_DEBUG("not enough CAP left, deferring\n");
+        ctx->ps.csma_active = false;
+        WS_TRACE_END(CSMA);
+        return;
     }
 
-    while (n_backoffs < mac.max_csma_backoffs)
+    if (!WS_RADIO_CALL(&ctx->radio, cca))
     {
-        /* Calculate the backoff delay */
-        backoff_delay = (uint32_t)WS_GET_RANDOM8();
-        backoff_delay >>= (8 - backoff_exponent);
-        backoff_delay *= UNIT_BACKOFF_PERIOD;
-
-        backoff_delay += ws_radio_timer_get_time();
+        ctx->stats.csma_busy++;
 
-        /* Symbols are shorter than our system timer, and this delay isn't
-         * going to be very long so we'll just busy loop */
-        while (ws_radio_timer_get_time() < backoff_delay)
-            ;
+        /* Back off for longer, up to the maximum BE */
+        ctx->ps.csma_cw = MAC_CW_0;
+        ctx->ps.csma_backoffs++;
+        if (ctx->ps.csma_backoff_exponent < ctx->mac.max_backoff_exponent)
+            ctx->ps.csma_backoff_exponent++;
 
-        /* Try to obtain the channel */
-        if (csma_contend_for_access())
+        if (ctx->ps.csma_backoffs <= ctx->mac.max_csma_backoffs)
         {
-            ws_radio_transmit();
-            ps_state.csma_active = false;
-#ifdef GPIO_DEBUG
-            GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                         DEBUG_GPIO_OTHER_TX_IN_FLIGHT, 0);
-            GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_CSMA, 0);
-#endif
-
-            if (ps_state.tx_in_flight != NULL)
-            {
-                ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_SENT;
-            }
-            else
-            {
-                /* TODO: If we could inform the upper layer that the packet
-                 * has left the radio, that would be good. Might require an
-                 * ack_req boolean so we can store the in_flight pktbuf in
-                 * both cases. */
-                ps_state.tx_state = PACKET_SCHEDULER_TX_STATE_IDLE;
-            }
-
-            WS_DEBUG("transmitted frame\n");
+            csma_backoff(ctx);
             return;
         }
 
-        n_backoffs++;
+        /* CSMA failed, so the frame is given up on and the layer above
+         * told, if it's waiting to hear */
+        WS_DEBUG("csma failed!\n");
+        ctx->ps.csma_active = false;
+        ctx->stats.csma_failures++;
+        ctx->stats.tx_not_sent++;
+        WS_TRACE_END(TX_IN_FLIGHT);
+        WS_TRACE_END(CSMA);
+
+        if (ctx->ps.tx_in_flight != NULL)
+            complete_tx(ctx, MAC_TX_STATUS_CHANNEL_ACCESS_FAILURE);
+        else
+            clean_tx_state(ctx);
+
+        /* Load the next frame */
+        ws_event_post(&ctx->ps.task);
+        return;
+    }
+
+    /* Slotted CSMA-CA needs the channel clear for the whole contention
+     * window, sampled once a backoff period */
+    if (slotted && --ctx->ps.csma_cw > 0)
+    {
+        ws_timer_set(&ctx->ps.csma_timer, UNIT_BACKOFF_PERIOD);
+        return;
     }
 
-    /* CSMA failed */
-    WS_DEBUG("csma failed!\n");
-    ps_state.csma_active = false;
+    WS_RADIO_CALL(&ctx->radio, transmit);
+    ws_timer_cancel(&ctx->ps.tx_timer);
+    ctx->ps.csma_active = false;
+    WS_TRACE_END(TX_IN_FLIGHT);
+    WS_TRACE_END(CSMA);
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_CSMA, 0);
-#endif
+    if (ctx->ps.tx_in_flight != NULL)
+    {
+        /* Allow for the frame's airtime, and then macAckWaitDuration */
+        ctx->ps.tx_state = PACKET_SCHEDULER_TX_STATE_SENT;
+        ws_timer_set(&ctx->ps.ack_timer, ctx->ps.tx_duration);
+    }
+    else
+    {
+        /* TODO: If we could inform the upper layer that the packet
+         * has left the radio, that would be good. Might require an
+         * ack_req boolean so we can store the in_flight pktbuf in
+         * both cases. */
+        ctx->ps.tx_state = PACKET_SCHEDULER_TX_STATE_IDLE;
+
+        /* Nothing else will wake the scheduler to load the next frame */
+        ws_event_post(&ctx->ps.task);
+    }
+
+    WS_DEBUG("transmitted frame\n");
+}
+
+
+static void
+csma_task(void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+
+    WS_TRACE_BEGIN(CSMA);
+
+    ctx->ps.csma_active = true;
+    ctx->ps.csma_backoffs = 0;
+    ctx->ps.csma_cw = MAC_CW_0;
+    ctx->ps.csma_backoff_exponent = ctx->mac.min_backoff_exponent;
+
+    /* Battery life extension keeps the first backoffs short, so a device
+     * is done soon after the beacon and can turn its receiver off */
+    if (csma_is_slotted(ctx) && ctx->mac.batt_life_extension &&
+        ctx->ps.csma_backoff_exponent > 2)
+        ctx->ps.csma_backoff_exponent = 2;
+
+    /* Each backoff is left to the timer, so received frames and ACKs are
+     * handled in the meantime and the CPU can sleep */
+    csma_backoff(ctx);
 }
 
 
@@ -711,87 +858,125 @@ csma_timer(void)
  * -----------------------------------------------------------------------
  */
 void
-mac_packet_scheduler_init(void)
+mac_packet_scheduler_init(ws_mac_ctx_t *ctx)
 {
+    uint32_t i;
+
     WS_DEBUG("init\n");
 
-    memset(&ps_state, 0, sizeof(packet_scheduler_state_t));
-
-    ws_ringbuf_init(&ps_state.rx_data, ps_state.rx_data_buf, INCOMING_RB_LEN);
-    ws_list_init(&ps_state.tx_data);
-
-    ws_radio_set_rx_callback(handle_radio_rx_interrupt);
-    ws_radio_timer_init(handle_radio_timer_interrupt);
-
-    /* Prepare debug GPIO. These are used in combination with a logic
-     * analyser to show the packet scheduler timing */
-#ifdef GPIO_DEBUG
-    GPIODirModeSet(DEBUG_GPIO_OTHER_PORT,
-                   DEBUG_GPIO_OTHER_CSMA | DEBUG_GPIO_OTHER_TX_IN_FLIGHT |
-                   DEBUG_GPIO_OTHER_SYNC,
-                   GPIO_DIR_MODE_OUT);
-    GPIODirModeSet(DEBUG_GPIO_HANDLER_PORT,
-                   DEBUG_GPIO_HANDLER_RX | DEBUG_GPIO_HANDLER_TIMER,
-                   GPIO_DIR_MODE_OUT);
-
-    GPIOPinWrite(DEBUG_GPIO_OTHER_PORT,
-                 DEBUG_GPIO_OTHER_CSMA | DEBUG_GPIO_OTHER_TX_IN_FLIGHT |
-                 DEBUG_GPIO_OTHER_SYNC,
-                 0x00);
-    GPIOPinWrite(DEBUG_GPIO_HANDLER_PORT,
-                 DEBUG_GPIO_HANDLER_RX | DEBUG_GPIO_HANDLER_TIMER,
-                 0x00);
-#endif
+    memset(&ctx->ps, 0, sizeof(packet_scheduler_state_t));
+
+    ws_framering_init(&ctx->ps.rx_data, (uint8_t *)ctx->ps.rx_data_buf,
+                      sizeof(ctx->ps.rx_data_buf));
+    for (i = 0; i < MAC_TX_CLASS_COUNT; i++)
+        ws_pktbuf_queue_init(&ctx->ps.tx_data[i]);
+
+    ctx->ps.task = (ws_event_t)
+        WS_EVENT_INITIALISER(packet_scheduler_task, ctx, WS_EVENT_PRIORITY_RX);
+    ctx->ps.csma_task = (ws_event_t)
+        WS_EVENT_INITIALISER(csma_task, ctx, WS_EVENT_PRIORITY_TX);
+    ctx->ps.csma_timer = (ws_timer_t)WS_TIMER_INITIALISER(csma_timer, ctx);
+    ctx->ps.ack_timer = (ws_timer_t)WS_TIMER_INITIALISER(ack_timer, ctx);
+    ctx->ps.tx_timer = (ws_timer_t)WS_TIMER_INITIALISER(tx_timer, ctx);
+    ctx->ps.beacon_timer = (ws_timer_t)WS_TIMER_INITIALISER(beacon_timer, ctx);
+
+    WS_RADIO_CALL(&ctx->radio, set_rx_callback,
+                  handle_radio_rx_interrupt, ctx);
+    WS_RADIO_TIMER_CALL(&ctx->radio, init,
+                        handle_radio_timer_interrupt, ctx);
+    mac_packet_scheduler_set_superframe(ctx);
 }
 
 
 void
-mac_packet_scheduler_clear_receiver(void)
+mac_packet_scheduler_clear_receiver(ws_mac_ctx_t *ctx)
 {
     WS_DEBUG("clearing received data\n");
 
-    ws_radio_enter_critical();
-    ws_ringbuf_flush(&ps_state.rx_data);
-    ws_radio_exit_critical();
+    ws_framering_flush(&ctx->ps.rx_data);
 }
 
 
 void
-mac_packet_scheduler_sync(void)
+mac_packet_scheduler_sync(ws_mac_ctx_t *ctx)
 {
-    ps_state.slot_count = 0;
-    ws_radio_timer_syncronise();
+    ctx->ps.slot_count = 0;
+    ctx->ps.superframe_start = WS_RADIO_TIMER_CALL(&ctx->radio, get_time);
+    WS_RADIO_TIMER_CALL(&ctx->radio, syncronise);
 
-#ifdef GPIO_DEBUG
-    GPIOPinWrite(DEBUG_GPIO_OTHER_PORT, DEBUG_GPIO_OTHER_SYNC,
-                 DEBUG_GPIO_OTHER_SYNC);
-#endif
+    WS_TRACE_MARK(BEACON_SYNC);
 }
 
 
 void
-mac_packet_scheduler_send_data(ws_pktbuf_t *pkt)
+mac_packet_scheduler_set_superframe(ws_mac_ctx_t *ctx)
 {
-    WS_DEBUG("send data\n");
+    mac_superframe_t *sf = &ctx->ps.sf;
+    uint8_t bo = ctx->mac.beacon_order;
+    uint8_t so = ctx->mac.superframe_order;
+
+    /* Without beacons the superframe order has no meaning, and the slot
+     * timer runs as slowly as it can. The active portion can't be longer
+     * than the beacon interval. */
+    sf->beacon_enabled = bo < 15;
+    if (!sf->beacon_enabled)
+        so = 15;
+    else if (so > bo)
+        so = bo;
+
+    sf->slot_duration = (uint32_t)WS_RADIO_SLOT_DURATION << so;
+    sf->active_duration = (uint32_t)MAC_BASE_SUPERFRAME_DURATION << so;
+    sf->cap_slots = MAC_NUM_SUPERFRAME_SLOTS;
+    sf->cap_end = sf->active_duration;
+    sf->cfp_duration = 0;
+
+    if (sf->beacon_enabled)
+    {
+        sf->beacon_interval = (uint32_t)MAC_BASE_SUPERFRAME_DURATION << bo;
+        sf->slots_per_beacon =
+            (uint32_t)MAC_NUM_SUPERFRAME_SLOTS << (bo - so);
+        sf->inactive_duration = sf->beacon_interval - sf->active_duration;
+    }
+    else
+    {
+        sf->beacon_interval = 0;
+        sf->slots_per_beacon = 0;
+        sf->cap_end = UINT32_MAX;
+        sf->inactive_duration = 0;
+    }
+
+    WS_DEBUG("superframe (BI=%u, SD=%u, slots=%u)\n", sf->beacon_interval,
+             sf->active_duration, sf->slots_per_beacon);
+
+    WS_RADIO_TIMER_CALL(&ctx->radio, set_superframe_order, so);
+}
+
+
+bool
+mac_packet_scheduler_send_data(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt,
+                               mac_tx_class_t class)
+{
+    ws_pktbuf_queue_t *queue = &ctx->ps.tx_data[class];
 
-    packet_scheduler_queue_t *data =
-        (packet_scheduler_queue_t *)MALLOC(sizeof(packet_scheduler_queue_t));
-    if (data == NULL)
+    WS_DEBUG("send data (class=%u)\n", class);
+
+    if (ws_pktbuf_queue_get_len(queue) >= tx_depth[class])
     {
-        WS_ERROR("failed to allocate memory for tx data\n");
-        return;
+        WS_WARN("TX queue (class=%u) is full\n", class);
+        ctx->stats.tx_overflows++;
+        return false;
     }
 
     WS_DEBUG("frame: %r\n",
-                     ws_pktbuf_get_data(pkt),
-                     ws_pktbuf_get_len(pkt));
+             ws_pktbuf_get_data(pkt),
+             ws_pktbuf_get_len(pkt));
 
-    data->pkt = pkt;
-
-    ws_list_add_before(&ps_state.tx_data, &data->list);
+    ws_pktbuf_queue_push(queue, pkt);
 
     WS_DEBUG("pending list size (count=%u)\n",
-             ws_list_count(&ps_state.tx_data));
+             ws_pktbuf_queue_get_len(queue));
+
+    ws_event_post(&ctx->ps.task);
 
-    WS_TIMER_SET_NOW(packet_scheduler_timer);
+    return true;
 }
@@ -35,47 +35,17 @@
 /* These AES parameters are defined in IEEE 802.15.4-2011 and have an effect
  * on the variable sizes used throughout this supplicant. Making the functions
  * less generic (setting these values at compile time) reduces the memory
- * footprint and complexity of this supplicant */
+ * footprint and complexity of this supplicant. The buffer sizes that depend
+ * on them are in mac_private.h */
 #define AES_L (2)
-#define MAC_NONSE_LEN (13)
 
-#define SECURITY_BUF_LEN (256)
 
-
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
-
-
-typedef enum
-{
-    SECURITY_STATE_IDLE,
-    SECURITY_STATE_ENCRYPTING,
-    SECURITY_STATE_DECRYPTING,
-} security_state_t;
-
-
-typedef struct
-{
-    security_state_t state;
-
-    mac_security_status_callback_t cb;
-
-    ws_pktbuf_t *pkt;
-    mac_device_t *dev;
-    mac_key_t *key;
-
-    uint8_t nonse[MAC_NONSE_LEN];
-    uint8_t buf[SECURITY_BUF_LEN];
-    uint8_t buf_len;
-} security_t;
-
-static security_t sec;
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 
 static void
-prepare_nonse(uint32_t frame_counter, uint8_t *ext_src_addr,
+prepare_nonse(ws_mac_ctx_t *ctx, uint32_t frame_counter, uint8_t *ext_src_addr,
               mac_security_level_t sec_level)
 {
     /* N = src_addr_ext || frame_ctr || sec_level */
@@ -86,81 +56,90 @@ prepare_nonse(uint32_t frame_counter, uint8_t *ext_src_addr,
     /* Swap the endianness of the address */
     for (i = 0; i < WS_MAC_ADDR_TYPE_EXTENDED_LEN; i++)
     {
-        sec.nonse[i] =
+        ctx->sec.nonse[i] =
             ext_src_addr[WS_MAC_ADDR_TYPE_EXTENDED_LEN-1-i];
     }
 
     offset += WS_MAC_ADDR_TYPE_EXTENDED_LEN;
 
-    memcpy(&sec.nonse[offset], &frame_counter, 4);
+    memcpy(&ctx->sec.nonse[offset], &frame_counter, 4);
     offset += 4;
 
-    memcpy(&sec.nonse[offset], &sec_level, 1);
+    memcpy(&ctx->sec.nonse[offset], &sec_level, 1);
 }
 
 
 static void
-aes_cb(ws_aes_status_t status, uint8_t *MIC)
+clear_state(ws_mac_ctx_t *ctx)
 {
-    mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(sec.pkt);
-    uint8_t len = ws_pktbuf_get_len(sec.pkt);
-    uint8_t *ptr;
+    ws_pktbuf_unref(ctx->sec.pkt);
+    ctx->sec.pkt = NULL;
+    ctx->sec.state = SECURITY_STATE_IDLE;
+}
+
+
+static void
+aes_cb(ws_aes_status_t status, uint8_t *MIC, void *arg)
+{
+    ws_mac_ctx_t *ctx = (ws_mac_ctx_t *)arg;
+    ws_pktbuf_t *pkt = ctx->sec.pkt;
+    mac_security_status_callback_t cb = ctx->sec.cb;
+    security_state_t state = ctx->sec.state;
 
     WS_DEBUG("AES status (%u)\n", status);
 
-    ASSERT(sec.cb != NULL, "unable to pass status back to caller!\n");
+    ASSERT(cb != NULL, "unable to pass status back to caller!\n");
+
+    /* The caller may well start another operation from its callback, such
+     * as replying to what we just decrypted, so we're done with the state
+     * before calling it. Our reference to the frame is dropped afterwards. */
+    ctx->sec.state = SECURITY_STATE_IDLE;
+    ctx->sec.pkt = NULL;
 
     if (status != WS_AES_STATUS_SUCCESS)
     {
         WS_ERROR("AES error.\n");
-        sec.cb(sec.pkt, MAC_SECURITY_STATUS_AES_ERROR);
+        cb(ctx, pkt, MAC_SECURITY_STATUS_AES_ERROR);
     }
     else
     {
-        if (sec.state == SECURITY_STATE_ENCRYPTING)
+        if (state == SECURITY_STATE_ENCRYPTING)
         {
-            WS_DEBUG("getting data ptr from pkt of len %u\n", len);
-            ptr = mac_frame_get_data_ptr(fcf, &len);
-            WS_DEBUG("ciphertext: %r\n", sec.buf, sec.buf_len);
+            /* The payload was encrypted in place, so only the tag is
+             * left to add. Room for it was checked before we started. */
             WS_DEBUG("tag: %r\n", MIC, 4);
-            memcpy(ptr, sec.buf, sec.buf_len);
-            ptr += sec.buf_len;
-            memcpy(ptr, MIC, 4);
-            ws_pktbuf_increment_end(sec.pkt, sec.buf_len + 4);
-            sec.cb(sec.pkt, MAC_SECURITY_STATUS_SUCCESS);
+            ws_pktbuf_add_to_end(pkt, MIC, MAC_MIC_LEN);
+            cb(ctx, pkt, MAC_SECURITY_STATUS_SUCCESS);
         }
-        else if (sec.state == SECURITY_STATE_DECRYPTING)
+        else if (state == SECURITY_STATE_DECRYPTING)
         {
             /* XXX: The TI library does the comparison of the tag to the
              * message for us. */
             WS_DEBUG("calculated MIC: %r\n", MIC, 4);
 
-            ptr = mac_frame_get_data_ptr(fcf, &len);
-
-            /* XXX: This packet wont change length, as l(m) == l(c).
-             * We'll keep the tag on the end. */
-            memcpy(ptr, sec.buf, sec.buf_len);
-            sec.cb(sec.pkt, MAC_SECURITY_STATUS_SUCCESS);
+            /* XXX: The plaintext was written over the ciphertext, so this
+             * packet wont change length, as l(m) == l(c). We'll keep the
+             * tag on the end. */
+            cb(ctx, pkt, MAC_SECURITY_STATUS_SUCCESS);
         }
         else
         {
             WS_ERROR("invalid security state in AES callback!\n");
-            sec.cb(sec.pkt, MAC_SECURITY_STATUS_ERROR);
+            cb(ctx, pkt, MAC_SECURITY_STATUS_ERROR);
         }
     }
 
-    sec.state = SECURITY_STATE_IDLE;
-    sec.pkt = NULL;
+    ws_pktbuf_unref(pkt);
 }
 
 
 static mac_security_status_t
-prepare_state(ws_pktbuf_t *pkt,
+prepare_state(ws_mac_ctx_t *ctx, ws_pktbuf_t *pkt,
               mac_security_status_callback_t cb)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(pkt);
 
-    if (sec.state != SECURITY_STATE_IDLE)
+    if (ctx->sec.state != SECURITY_STATE_IDLE)
     {
         WS_WARN("supplicant busy!\n");
         return MAC_SECURITY_STATUS_BUSY;
@@ -168,7 +147,7 @@ prepare_state(ws_pktbuf_t *pkt,
 
     /* We should have tidied this up earlier, so we either got into a funny
      * state, or we didn't tidy it up */
-    ASSERT(sec.pkt == NULL, "unclean supplicant state\n");
+    ASSERT(ctx->sec.pkt == NULL, "unclean supplicant state\n");
 
     /* Security supplicant doesn't do anything useful without the callback */
     ASSERT(cb != NULL, "callback is required\n");
@@ -182,28 +161,28 @@ prepare_state(ws_pktbuf_t *pkt,
     }
 
     /* Set up the supplicant state */
-    memset(&sec, 0, sizeof(sec));
-    sec.pkt = pkt;
-    sec.cb = cb;
+    memset(&ctx->sec, 0, sizeof(security_t));
+    ctx->sec.pkt = ws_pktbuf_ref(pkt);
+    ctx->sec.cb = cb;
 
     return MAC_SECURITY_STATUS_SUCCESS;
 }
 
 
 static mac_security_status_t
-prepare_key(ws_mac_addr_t *other_device)
+prepare_key(ws_mac_ctx_t *ctx, ws_mac_addr_t *other_device)
 {
     /* Find the device */
-    sec.dev = mac_device_get_by_addr(other_device);
-    if (sec.dev == NULL)
+    ctx->sec.dev = mac_device_get_by_addr(ctx, other_device);
+    if (ctx->sec.dev == NULL)
     {
         WS_ERROR("unknown device\n");
         return MAC_SECURITY_STATUS_NO_KEY;
     }
 
     /* Load the device key */
-    sec.key = mac_device_get_key(sec.dev, 0);
-    if (sec.key == NULL)
+    ctx->sec.key = mac_device_get_key(ctx->sec.dev, 0);
+    if (ctx->sec.key == NULL)
     {
         WS_ERROR("no key for device\n");
         return MAC_SECURITY_STATUS_NO_KEY;
@@ -226,8 +205,7 @@ derive_key_from_psk(uint8_t *key, const uint8_t *psk, uint16_t psk_len)
 
 
 mac_security_status_t
-mac_security_encrypt_frame(ws_pktbuf_t *frame,
-                           const uint8_t *data, uint8_t data_len,
+mac_security_encrypt_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
                            mac_security_status_callback_t cb)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(frame);
@@ -240,92 +218,95 @@ mac_security_encrypt_frame(ws_pktbuf_t *frame,
 
     uint8_t *a;
     uint8_t a_len;
+    uint8_t m_len;
 
-    ret = prepare_state(frame, cb);
+    ret = prepare_state(ctx, frame, cb);
     if (ret != MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_ERROR("failed to prepare supplicant state\n");
         return ret;
     }
 
-    sec.state = SECURITY_STATE_ENCRYPTING;
+    ctx->sec.state = SECURITY_STATE_ENCRYPTING;
+
+    /* The AES engine works in place, and the ciphertext can't be written
+     * over payload segments that belong to the caller. So they're copied
+     * in after the header, which is the only copy the payload needs. */
+    if (ws_pktbuf_get_next(frame) != NULL && ws_pktbuf_gather(frame) == 0)
+    {
+        WS_ERROR("no room to gather the payload\n");
+        clear_state(ctx);
+        return MAC_SECURITY_STATUS_ERROR;
+    }
 
     ptr = mac_frame_extract_address(fcf, &dst, NULL);
     WS_DEBUG("encrypting data for ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     mac_frame_print_address(&dst);
     PRINTF("\n");
+#endif
 
-    ret = prepare_key(&dst);
+    ret = prepare_key(ctx, &dst);
     if (ret != MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_ERROR("failed to load device key\n");
-        sec.state = SECURITY_STATE_IDLE;
-        sec.pkt = NULL;
+        clear_state(ctx);
         return ret;
     }
 
-    /* Create the auxillary security header */
+    /* Create the auxillary security header in the space left for it */
     sec_ctrl = (mac_security_control_t *)ptr;
     sec_ctrl->security_level = MAC_SECURITY_LEVEL_ENC_MIC_32;
     sec_ctrl->key_id_mode = MAC_KEY_ID_MODE_IMPLICIT;
     ptr += sizeof(mac_security_control_t);
 
     /* Copy the frame counter in the correct endianness */
-    ptr[0] = ((uint8_t *)(&mac.frame_counter))[3];
-    ptr[1] = ((uint8_t *)(&mac.frame_counter))[2];
-    ptr[2] = ((uint8_t *)(&mac.frame_counter))[1];
-    ptr[3] = ((uint8_t *)(&mac.frame_counter))[0];
+    ptr[0] = ((uint8_t *)(&ctx->mac.frame_counter))[3];
+    ptr[1] = ((uint8_t *)(&ctx->mac.frame_counter))[2];
+    ptr[2] = ((uint8_t *)(&ctx->mac.frame_counter))[1];
+    ptr[3] = ((uint8_t *)(&ctx->mac.frame_counter))[0];
     ptr += 4;
 
-    /* The pktbuf should now hold the MAC header including the security
-     * header, but no data yet */
-    ws_pktbuf_increment_end(sec.pkt, (uint32_t)(ptr - (uint8_t *)fcf));
-
     /* Create the nonse */
-    prepare_nonse(mac.frame_counter, mac.extended_address,
+    prepare_nonse(ctx, ctx->mac.frame_counter, ctx->mac.extended_address,
                   MAC_SECURITY_LEVEL_ENC_MIC_32);
 
     /* Important that the frame counter is the same for the MHR and the
      * nonse, so we increment after everything has used the frame counter
      */
-    mac.frame_counter++;
+    ctx->mac.frame_counter++;
 
     /* Point to the auth data */
     a = (uint8_t *)fcf;
     a_len = (uint8_t)(ptr - a);
-
-
-    /* Copy the message into our data buffer */
-    /* TODO: We should use the pktbuf, rather than a seperate buffer... */
-    memset(sec.buf, 0, 256);
-    memcpy(sec.buf, data, data_len);
-    sec.buf_len = data_len;
+    /* The payload following the header is encrypted where it is */
+    m_len = ws_pktbuf_get_len(frame) - a_len;
 
     /* Debug info. This is really useful for comparing the encryption
      * output against a reference implementation */
-    WS_DEBUG("plaintext: %r\n", sec.buf, sec.buf_len);
-    WS_DEBUG("message len %u\n", sec.buf_len);
+    WS_DEBUG("plaintext: %r\n", ptr, m_len);
+    WS_DEBUG("message len %u\n", m_len);
     WS_DEBUG("a: %r\n", a, a_len);
     WS_DEBUG("a len %u\n", a_len);
-    WS_DEBUG("nonse: %r\n", sec.nonse, MAC_NONSE_LEN);
+    WS_DEBUG("nonse: %r\n", ctx->sec.nonse, MAC_NONSE_LEN);
     WS_DEBUG("M: %u\n", 4);
     WS_DEBUG("L: %u\n", AES_L);
-    WS_DEBUG("key: %r\n", sec.key->key, WS_MAC_KEY_LEN);
-    WS_DEBUG("extended addr: %r\n", mac.extended_address,
+    WS_DEBUG("key: %r\n", ctx->sec.key->key, WS_MAC_KEY_LEN);
+    WS_DEBUG("extended addr: %r\n", ctx->mac.extended_address,
              WS_MAC_ADDR_TYPE_EXTENDED_LEN);
 
     /* Perform the encryption */
-    ws_aes_ccm_encrypt(true, 4, AES_L, sec.nonse,
-                       sec.buf, sec.buf_len,
+    ws_aes_ccm_encrypt(true, 4, AES_L, ctx->sec.nonse,
+                       ptr, m_len,
                        a, a_len,
-                       sec.key->key,
-                       aes_cb);
+                       ctx->sec.key->key,
+                       aes_cb, ctx);
 
     return MAC_SECURITY_STATUS_IN_PROGRESS;
 }
 
 mac_security_status_t
-mac_security_decrypt_frame(ws_pktbuf_t *frame,
+mac_security_decrypt_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
                            mac_security_status_callback_t cb)
 {
     mac_fcf_t *fcf = (mac_fcf_t *)ws_pktbuf_get_data(frame);
@@ -339,27 +320,29 @@ mac_security_decrypt_frame(ws_pktbuf_t *frame,
 
     uint8_t *a;
     uint8_t a_len;
+    uint8_t c_len;
 
-    ret = prepare_state(frame, cb);
+    ret = prepare_state(ctx, frame, cb);
     if (ret != MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_ERROR("failed to prepare supplicant state\n");
         return ret;
     }
 
-    sec.state = SECURITY_STATE_DECRYPTING;
+    ctx->sec.state = SECURITY_STATE_DECRYPTING;
 
     ptr = mac_frame_extract_address(fcf, NULL, &src);
     WS_DEBUG("decrypting data from ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     mac_frame_print_address(&src);
     PRINTF("\n");
+#endif
 
-    ret = prepare_key(&src);
+    ret = prepare_key(ctx, &src);
     if (ret != MAC_SECURITY_STATUS_SUCCESS)
     {
         WS_ERROR("failed to load device key\n");
-        sec.state = SECURITY_STATE_IDLE;
-        sec.pkt = NULL;
+        clear_state(ctx);
         return ret;
     }
 
@@ -371,7 +354,7 @@ mac_security_decrypt_frame(ws_pktbuf_t *frame,
         /* TODO... */
         WS_ERROR("Unsupported security level (%u)\n",
                  sec_ctrl->security_level);
-        sec.state = SECURITY_STATE_IDLE;
+        clear_state(ctx);
         return MAC_SECURITY_STATUS_ERROR;
     }
     if (sec_ctrl->key_id_mode != MAC_KEY_ID_MODE_IMPLICIT)
@@ -379,7 +362,7 @@ mac_security_decrypt_frame(ws_pktbuf_t *frame,
         /* TODO... */
         WS_ERROR("Unsupported key ID mode (%u)\n",
                  sec_ctrl->key_id_mode);
-        sec.state = SECURITY_STATE_IDLE;
+        clear_state(ctx);
         return MAC_SECURITY_STATUS_ERROR;
     }
     ptr += sizeof(mac_security_control_t);
@@ -392,57 +375,56 @@ mac_security_decrypt_frame(ws_pktbuf_t *frame,
     ptr += 4;
 
     /* Create the nonse */
-    prepare_nonse(frame_counter, sec.dev->addr.extended_addr,
+    prepare_nonse(ctx, frame_counter, ctx->sec.dev->addr.extended_addr,
                   MAC_SECURITY_LEVEL_ENC_MIC_32);
 
     /* Point to the authentication data */
     a = (uint8_t *)fcf;
     a_len =  ptr - ((uint8_t *)fcf);
 
-    /* Copy the ciphertext from the message into the buffer */
-    sec.buf_len = ws_pktbuf_get_len(sec.pkt) - a_len;
-    memset(sec.buf, 0, 256);
-    memcpy(sec.buf, ptr, sec.buf_len);
+    /* The ciphertext and tag following the header are decrypted where
+     * they are */
+    c_len = ws_pktbuf_get_len(ctx->sec.pkt) - a_len;
 
     /* Debug info */
-    WS_DEBUG("whole message: %r\n", a, ws_pktbuf_get_len(sec.pkt));
-    WS_DEBUG("message len: %u\n", ws_pktbuf_get_len(sec.pkt));
-    WS_DEBUG("ciphertext: %r\n", sec.buf, sec.buf_len);
-    WS_DEBUG("message len %u\n", sec.buf_len);
+    WS_DEBUG("whole message: %r\n", a, ws_pktbuf_get_len(ctx->sec.pkt));
+    WS_DEBUG("message len: %u\n", ws_pktbuf_get_len(ctx->sec.pkt));
+    WS_DEBUG("ciphertext: %r\n", ptr, c_len);
+    WS_DEBUG("message len %u\n", c_len);
     WS_DEBUG("a: %r\n", a, a_len);
     WS_DEBUG("a len %u\n", a_len);
-    WS_DEBUG("nonse: %r\n", sec.nonse, MAC_NONSE_LEN);
+    WS_DEBUG("nonse: %r\n", ctx->sec.nonse, MAC_NONSE_LEN);
     WS_DEBUG("M: %u\n", 4);
     WS_DEBUG("L: %u\n", AES_L);
-    WS_DEBUG("key: %r\n", sec.key->key, WS_MAC_KEY_LEN);
-    WS_DEBUG("extended addr: %r\n", sec.dev->addr.extended_addr,
+    WS_DEBUG("key: %r\n", ctx->sec.key->key, WS_MAC_KEY_LEN);
+    WS_DEBUG("extended addr: %r\n", ctx->sec.dev->addr.extended_addr,
              WS_MAC_ADDR_TYPE_EXTENDED_LEN);
 
     /* Perform the decryption */
-    ws_aes_ccm_decrypt(true, 4, AES_L, sec.nonse,
-                       sec.buf, sec.buf_len,
+    ws_aes_ccm_decrypt(true, 4, AES_L, ctx->sec.nonse,
+                       ptr, c_len,
                        a, a_len,
-                       sec.key->key,
-                       aes_cb);
+                       ctx->sec.key->key,
+                       aes_cb, ctx);
 
     return MAC_SECURITY_STATUS_IN_PROGRESS;
 }
 
 
 void
-ws_mac_security_add_own_key(uint8_t *psk, uint16_t psk_len)
+ws_mac_security_add_own_key(ws_mac_ctx_t *ctx, uint8_t *psk, uint16_t psk_len)
 {
     WS_DEBUG("Installing own key");
 
     /* Derive the key from the PSK */
-    derive_key_from_psk(mac.own_key, psk, psk_len);
+    derive_key_from_psk(ctx->mac.own_key, psk, psk_len);
 
     WS_DEBUG("Key installed\n");
 }
 
 
 void
-ws_mac_security_add_device_key(ws_mac_addr_t *addr,
+ws_mac_security_add_device_key(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr,
                                uint8_t *psk, uint16_t psk_len)
 {
     mac_device_t *dev;
@@ -450,14 +432,16 @@ ws_mac_security_add_device_key(ws_mac_addr_t *addr,
     uint8_t key[WS_MAC_KEY_LEN];
 
     WS_DEBUG("Installing key for: ");
+#if WS_LOG_LEVEL >= WS_LOG_LEVEL_DEBUG
     mac_frame_print_address(addr);
     PRINTF("\n");
+#endif
 
     /* Derive the key from the PSK */
     derive_key_from_psk(key, psk, psk_len);
 
     /* Gain reference to a device */
-    dev = mac_device_get_by_extended(addr->extended_addr);
+    dev = mac_device_get_by_extended(ctx, addr->extended_addr);
     if (dev == NULL)
     {
         /* Unable to find the device, so we'll need to create one! */
@@ -47,6 +47,48 @@
 #define WS_MAC_KEY_LEN (16) /* encryption key length in octets */
 
 
+/**
+ * Space reserved in front of the payload of a frame from
+ * ws_mac_mcps_alloc_frame, for the largest MAC header we build: frame
+ * control, sequence number, extended addresses with both PAN IDs and the
+ * auxiliary security header. See IEEE 802.15.4-2011 5.2.1
+ */
+#define WS_MAC_FRAME_HEADROOM (2 + 1 + (2 + 8) * 2 + 5)
+
+
+/**
+ * Space a secured frame needs after its payload for the MIC
+ */
+#define WS_MAC_FRAME_TAILROOM (4)
+
+
+/**
+ * Number of MAC instances that can be created with ws_mac_init. A node only
+ * needs one, but a gateway with several radios or a host simulation of a
+ * whole PAN needs one per radio.
+ */
+#ifndef WS_MAC_MAX_INSTANCES
+#define WS_MAC_MAX_INSTANCES (1)
+#endif
+
+
+/**
+ * Number of other devices each MAC instance can know about. A coordinator
+ * needs one for each device associated to it, and lookups take the same
+ * time however many there are.
+ */
+#ifndef WS_MAC_MAX_DEVICES
+#define WS_MAC_MAX_DEVICES (32)
+#endif
+
+
+/**
+ * A MAC instance, as returned by ws_mac_init. Every MAC function takes one
+ * of these, and it is passed back to every callback.
+ */
+typedef struct ws_mac_ctx_t ws_mac_ctx_t;
+
+
 typedef enum
 {
     WS_MAC_ADDR_TYPE_NONE = 0x00,
@@ -173,114 +215,237 @@ typedef struct
 
 
 
-typedef void (*ws_mac_mcps_rx_callback_t)(const uint8_t *data, uint8_t len,
-                                          ws_mac_addr_t *src_addr);
+/**
+ * A piece of payload for \see ws_mac_mcps_send_segments
+ */
+typedef struct
+{
+    const uint8_t *data;
+    uint8_t len;
+} ws_mac_segment_t;
+
+
+/**
+ * Passes received data up the stack
+ * \param ctx MAC instance
+ * \param data the payload of the frame
+ * \param len the size, in octets, of the payload
+ * \param src_addr the sender of the frame
+ * \param meta what the radio measured while receiving the frame, such as
+ *             its RSSI and link quality
+ */
+typedef void (*ws_mac_mcps_rx_callback_t)(ws_mac_ctx_t *ctx,
+                                          const uint8_t *data, uint8_t len,
+                                          ws_mac_addr_t *src_addr,
+                                          const ws_pktbuf_meta_t *meta);
 
 
-typedef void (*ws_mac_mcps_confirm_callback_t)(uint8_t handle,
+typedef void (*ws_mac_mcps_confirm_callback_t)(ws_mac_ctx_t *ctx,
+                                               uint8_t handle,
                                                ws_mac_mcps_status_t status);
 
 
-typedef void (*ws_mac_beacon_rx_callback_t)(uint8_t seq_num,
+typedef void (*ws_mac_beacon_rx_callback_t)(ws_mac_ctx_t *ctx,
+                                            uint8_t seq_num,
                                             ws_mac_pan_descriptor_t *pan_desc,
                                             bool data_pending,
                                             const uint8_t *beacon_data,
                                             uint8_t len);
 
 
-typedef void (*ws_mac_coordinator_associate_callback_t)(ws_mac_addr_t *addr);
+typedef void (*ws_mac_coordinator_associate_callback_t)(ws_mac_ctx_t *ctx,
+                                                        ws_mac_addr_t *addr);
 
 
-typedef void (*ws_mac_scan_callback_t)(ws_mac_scan_status_t status,
+typedef void (*ws_mac_scan_callback_t)(ws_mac_ctx_t *ctx,
+                                       ws_mac_scan_status_t status,
                                        ws_mac_scan_type_t type,
                                        ws_list_t *scan_results);
 
 
 typedef void
-(*ws_mac_association_callback_t)(ws_mac_association_status_t status,
+(*ws_mac_association_callback_t)(ws_mac_ctx_t *ctx,
+                                 ws_mac_association_status_t status,
                                  uint16_t short_addr);
 
 
-extern void
-ws_mac_init(uint8_t *extended_address);
+/**
+ * Counters kept by each MAC instance. Times are in symbols.
+ */
+typedef struct
+{
+    uint32_t tx_frames;             /* Frames loaded into the radio */
+    uint32_t tx_retries;            /* Frames loaded again after a failure */
+    uint32_t tx_no_ack;             /* Frames given up on without an ACK */
+    uint32_t tx_not_sent;           /* Frames that never left the radio */
+    uint32_t tx_overflows;          /* Frames refused by a full TX queue */
+    uint32_t csma_failures;         /* CSMA-CA attempts that found no gap */
+    uint32_t csma_busy;             /* CCAs that found the channel busy */
+    uint32_t rx_frames;             /* Frames taken from the radio */
+    uint32_t rx_dropped;            /* Frames lost to a full RX buffer */
+    uint32_t assoc_refused;         /* Association requests there was no
+                                     * room to accept */
+    uint32_t beacons_tx;
+    uint32_t beacons_rx;            /* From our coordinator */
+    uint32_t beacon_interval_min;   /* Between consecutive beacons */
+    uint32_t beacon_interval_max;
+} ws_mac_stats_t;
+
+
+/**
+ * Create a MAC instance and prepare the radio for it.
+ * \param extended_address the IEEE address of this instance
+ * \param radio the radio backend the instance drives, such as
+ *              ws_radio_cc2538. Each instance needs a radio of its own.
+ * \return the new instance, or NULL if all WS_MAC_MAX_INSTANCES are in use
+ */
+extern ws_mac_ctx_t *
+ws_mac_init(uint8_t *extended_address, const ws_radio_t *radio);
 
 
 /*
  * MCPS
  */
 extern void
-ws_mac_mcps_register_rx_callback(ws_mac_mcps_rx_callback_t cb);
+ws_mac_mcps_register_rx_callback(ws_mac_ctx_t *ctx,
+                                 ws_mac_mcps_rx_callback_t cb);
 
 
 extern void
-ws_mac_mcps_register_confirm_callback(ws_mac_mcps_confirm_callback_t cb);
+ws_mac_mcps_register_confirm_callback(ws_mac_ctx_t *ctx,
+                                      ws_mac_mcps_confirm_callback_t cb);
 
 
 extern uint8_t
-ws_mac_mcps_send_data(const uint8_t *data, uint8_t len,
+ws_mac_mcps_send_data(ws_mac_ctx_t *ctx, const uint8_t *data, uint8_t len,
                       ws_mac_addr_t *dest_addr,
                       bool secure);
 
 
+/**
+ * Get an empty frame for \see ws_mac_mcps_send_frame. There is room in
+ * front for the MAC header, so the payload can be written straight into the
+ * pktbuf with ws_pktbuf_add_to_end or ws_pktbuf_increment_end. Secured
+ * frames need to leave WS_MAC_FRAME_TAILROOM octets free at the end.
+ * \param ctx MAC instance
+ * \return the frame, or NULL if the pktbuf pool is empty
+ */
+extern ws_pktbuf_t *
+ws_mac_mcps_alloc_frame(ws_mac_ctx_t *ctx);
+
+
+/**
+ * Send the payload held in a frame from \see ws_mac_mcps_alloc_frame. The
+ * MAC header is written in front of the payload in place, so the payload is
+ * not copied. The MAC keeps its own reference to the frame, so the caller
+ * still unreferences it afterwards.
+ * \param ctx MAC instance
+ * \param frame the frame, holding just the payload. More payload can be
+ *              chained on with \see ws_pktbuf_chain
+ * \param dest_addr destination address
+ * \param secure true to encrypt and authenticate the frame
+ * \return the handle passed to the confirm callback, or 0 if the request
+ * was refused. A refused request has already been confirmed, with a handle
+ * other than 0, by the time this returns. Frames are refused with
+ * WS_MAC_MCPS_TRANSACTION_OVERFLOW while the data TX queue is full.
+ */
+extern uint8_t
+ws_mac_mcps_send_frame(ws_mac_ctx_t *ctx, ws_pktbuf_t *frame,
+                       ws_mac_addr_t *dest_addr, bool secure);
+
+
+/**
+ * Send a header followed by a number of payload segments as one frame,
+ * such as a fixed message header and an array of samples, without
+ * assembling them first. The header is copied in beside the MAC header,
+ * while the segments are read from where they are when the frame is sent
+ * (or, for secure frames, when it is encrypted), so they must stay valid
+ * and unchanged until the frame is confirmed.
+ * \param ctx MAC instance
+ * \param header the data to put first in the payload
+ * \param header_len the size, in octets, of the header
+ * \param payload the segments to follow the header
+ * \param count the number of segments
+ * \param dest_addr destination address
+ * \param secure true to encrypt and authenticate the frame
+ * \return the handle passed to the confirm callback, or 0 if the request
+ * was refused, in which case it has already been confirmed
+ */
+extern uint8_t
+ws_mac_mcps_send_segments(ws_mac_ctx_t *ctx,
+                          const uint8_t *header, uint8_t header_len,
+                          const ws_mac_segment_t *payload, uint8_t count,
+                          ws_mac_addr_t *dest_addr, bool secure);
+
+
 /*
  * MLME
  */
 extern void
-ws_mac_mlme_scan(ws_mac_scan_type_t type, uint16_t channels,
+ws_mac_mlme_scan(ws_mac_ctx_t *ctx, ws_mac_scan_type_t type, uint16_t channels,
                  uint8_t duration, ws_mac_scan_callback_t cb);
 
 
 extern ws_mac_start_status_t
-ws_mac_mlme_start(uint16_t pan_id, uint8_t channel,
+ws_mac_mlme_start(ws_mac_ctx_t *ctx, uint16_t pan_id, uint8_t channel,
                   uint8_t beacon_order, uint8_t superframe_order,
                   bool pan_coordinator,
                   ws_mac_coordinator_associate_callback_t associate_callback);
 
 
 extern void
-ws_mac_mlme_associate(ws_mac_pan_descriptor_t *pan,
+ws_mac_mlme_associate(ws_mac_ctx_t *ctx, ws_mac_pan_descriptor_t *pan,
                       ws_mac_association_callback_t cb);
 
 
 extern uint16_t
-ws_mac_mlme_get_short_address(void);
+ws_mac_mlme_get_short_address(ws_mac_ctx_t *ctx);
 
 
 extern void
-ws_mac_mlme_set_short_address(uint16_t addr);
+ws_mac_mlme_set_short_address(ws_mac_ctx_t *ctx, uint16_t addr);
 
 
 extern uint8_t *
-ws_mac_mlme_get_extended_address(void);
+ws_mac_mlme_get_extended_address(ws_mac_ctx_t *ctx);
 
 
 extern uint16_t
-ws_mac_mlme_get_pan_id(void);
+ws_mac_mlme_get_pan_id(ws_mac_ctx_t *ctx);
 
 
 extern void
-ws_mac_mlme_get_address(ws_mac_addr_t *addr);
+ws_mac_mlme_get_address(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr);
+
+
+/**
+ * Copy out the counters for an instance. \see ws_mac_stats_t
+ */
+extern void
+ws_mac_mlme_get_stats(ws_mac_ctx_t *ctx, ws_mac_stats_t *stats);
 
 
 /*
  * Coordinator
  */
 extern void
-ws_mac_coordinator_register_callback(ws_mac_beacon_rx_callback_t cb);
+ws_mac_coordinator_register_callback(ws_mac_ctx_t *ctx,
+                                     ws_mac_beacon_rx_callback_t cb);
 
 
 extern void
-ws_mac_coordinator_add_data(const uint8_t *data, uint8_t len);
+ws_mac_coordinator_add_data(ws_mac_ctx_t *ctx,
+                            const uint8_t *data, uint8_t len);
 
 
 /*
  * Security Supplicant
  */
 extern void
-ws_mac_security_add_own_key(uint8_t *psk, uint16_t psk_len);
+ws_mac_security_add_own_key(ws_mac_ctx_t *ctx, uint8_t *psk, uint16_t psk_len);
 
 extern void
-ws_mac_security_add_device_key(ws_mac_addr_t *addr,
+ws_mac_security_add_device_key(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr,
                                uint8_t *psk, uint16_t psk_len);
 
 
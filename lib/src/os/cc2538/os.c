@@ -0,0 +1,206 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_os.h"
+#include "radio/cc2538/mactimer.h"
+#include "radio/cc2538/rfcore.h"
+
+#include "hw_types.h"
+#include "hw_memmap.h"
+#include "hw_soc_adc.h"
+
+#include "interrupt.h"
+#include "cpu.h"
+
+#include "bsp_led.h"
+
+
+/* TODO: This should be folded into the application specific HAL */
+
+
+typedef struct
+{
+    /* Critical sections can be nested, so interrupts are only enabled again
+     * when leaving the outermost one, and only if they were enabled when it
+     * was entered */
+    uint32_t critical_depth;
+    bool interrupts_were_disabled;
+
+    volatile bool running;
+} os_t;
+
+static os_t os;
+
+
+void
+ws_assert(int line, char *file, char *fmt, ...)
+{
+    va_list arg;
+
+    PRINTF("A: %s:%l ", file, line);
+
+    va_start(arg, fmt);
+    VPRINTF(fmt, arg);
+    va_end(arg);
+
+    bspLedSet(BSP_LED_ALL);
+
+    ws_enter_critical();
+
+    while(1)
+        ;
+}
+
+void
+ws_enter_critical(void)
+{
+    bool was_disabled = IntMasterDisable();
+
+    if (os.critical_depth++ == 0)
+        os.interrupts_were_disabled = was_disabled;
+}
+
+
+void
+ws_exit_critical(void)
+{
+    ASSERT(os.critical_depth > 0, "unbalanced critical section\n");
+
+    if (--os.critical_depth == 0 && !os.interrupts_were_disabled)
+        IntMasterEnable();
+}
+
+
+void
+ws_os_init(void)
+{
+    os.running = false;
+
+    /* The MAC timer is the clock for the OS timers, so has to be running
+     * before the MAC is */
+    cc2538_mactimer_start();
+
+    /* The seed comes from the receiver, so this has to be done before the
+     * MAC sets the radio up */
+    cc2538_rfcore_seed_random();
+
+    ws_log_init();
+    ws_trace_init();
+    ws_pool_init();
+    ws_pktbuf_pool_init();
+    ws_timer_init();
+    ws_event_init();
+}
+
+
+void
+ws_os_run(void)
+{
+    os.running = true;
+
+    while (os.running)
+    {
+        if (ws_os_poll() > 0)
+            continue;
+
+        /* Sleep until the next interrupt. Interrupts are disabled while we
+         * check, so one arriving just before the WFI still wakes us */
+        IntMasterDisable();
+        if (os.running && !ws_event_is_pending())
+            CPUwfi();
+        IntMasterEnable();
+    }
+}
+
+
+uint32_t
+ws_os_poll(void)
+{
+    uint32_t count;
+
+    /* Events first, as they're deferred interrupt handlers */
+    count = ws_event_process();
+    count += ws_timer_process();
+
+    return count;
+}
+
+
+void
+ws_os_stop(void)
+{
+    os.running = false;
+}
+
+
+uint8_t
+ws_os_get_random8(void)
+{
+    uint8_t r;
+
+    /* Clock the LFSR on once, which is done before the next read */
+    ws_enter_critical();
+    HWREG(SOC_ADC_ADCCON1) = (HWREG(SOC_ADC_ADCCON1) &
+                              ~SOC_ADC_ADCCON1_RCTRL_M) |
+        (1 << SOC_ADC_ADCCON1_RCTRL_S);
+    r = (uint8_t)HWREG(SOC_ADC_RNDL);
+    ws_exit_critical();
+
+    return r;
+}
+
+
+uint32_t
+ws_os_timer_get_hw_time(void)
+{
+    return cc2538_mactimer_get_time() & WS_TIMER_HW_MASK;
+}
+
+
+void
+ws_os_timer_set_wakeup(uint32_t hw_time)
+{
+    cc2538_mactimer_set_compare(hw_time);
+}
+
+
+void
+ws_os_log_written(void)
+{
+    /* The application drains the log with ws_log_read when it has time */
+}
+
+
+void
+ws_os_event_wakeup(void)
+{
+    /* Events are posted from interrupts, which have already woken us */
+}
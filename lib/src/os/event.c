@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_event.h"
+
+
+/**
+ * A FIFO of pending events for each priority
+ */
+typedef struct
+{
+    ws_event_t *head[WS_EVENT_PRIORITY_COUNT];
+    ws_event_t *tail[WS_EVENT_PRIORITY_COUNT];
+    uint32_t count;
+} event_scheduler_t;
+
+static event_scheduler_t events;
+
+
+/* Must be called from within a critical section */
+static ws_event_t *
+pop(void)
+{
+    ws_event_t *e;
+    uint32_t prio;
+
+    for (prio = 0; prio < WS_EVENT_PRIORITY_COUNT; prio++)
+    {
+        e = events.head[prio];
+        if (e == NULL)
+            continue;
+
+        events.head[prio] = e->next;
+        if (events.head[prio] == NULL)
+            events.tail[prio] = NULL;
+
+        e->next = NULL;
+        e->pending = false;
+        events.count--;
+
+        return e;
+    }
+
+    return NULL;
+}
+
+
+void
+ws_event_init(void)
+{
+    ENTER_CRITICAL();
+
+    while (pop() != NULL)
+        ;
+
+    EXIT_CRITICAL();
+}
+
+
+bool
+ws_event_post(ws_event_t *e)
+{
+    ASSERT(e != NULL, "posting NULL event\n");
+    ASSERT(e->priority < WS_EVENT_PRIORITY_COUNT,
+           "invalid event priority (%u)\n", e->priority);
+
+    ENTER_CRITICAL();
+
+    /* It'll run soon anyway */
+    if (e->pending)
+    {
+        EXIT_CRITICAL();
+        return false;
+    }
+
+    e->pending = true;
+    e->next = NULL;
+
+    if (events.tail[e->priority] == NULL)
+        events.head[e->priority] = e;
+    else
+        events.tail[e->priority]->next = e;
+    events.tail[e->priority] = e;
+
+    events.count++;
+
+    ws_os_event_wakeup();
+
+    EXIT_CRITICAL();
+
+    return true;
+}
+
+
+uint32_t
+ws_event_process(void)
+{
+    ws_event_t *e;
+    uint32_t budget;
+    uint32_t count = 0;
+
+    ENTER_CRITICAL();
+
+    budget = events.count;
+
+    while (budget-- > 0 && (e = pop()) != NULL)
+    {
+        EXIT_CRITICAL();
+        e->cb(e->arg);
+        count++;
+        ENTER_CRITICAL();
+    }
+
+    EXIT_CRITICAL();
+
+    return count;
+}
+
+
+bool
+ws_event_is_pending(void)
+{
+    return events.count > 0;
+}
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_log.h"
+
+
+/* Call sites, gathered by the linker. These are weak so an image that never
+ * logs still links. */
+extern const ws_log_site_t __start_ws_log_sites[] __attribute__((weak));
+extern const ws_log_site_t __stop_ws_log_sites[] __attribute__((weak));
+
+
+#define MAX_RECORD_LEN \
+    (sizeof(ws_log_record_t) + WS_LOG_MAX_ARGS * sizeof(ws_log_arg_t))
+
+/* Longest line ws_log_flush will print */
+#define MAX_LINE_LEN (256)
+
+
+typedef struct
+{
+    ws_ringbuf_t rb;
+    uint8_t buf[WS_LOG_BUFFER_LEN];
+    uint32_t dropped;
+} log_t;
+
+static log_t log_state;
+
+
+static const char *level_names[] = {"", "ERR", "WRN", "INF", "DBG"};
+
+
+void
+ws_log_init(void)
+{
+    ENTER_CRITICAL();
+
+    ws_ringbuf_init(&log_state.rb, log_state.buf, WS_LOG_BUFFER_LEN);
+    log_state.dropped = 0;
+
+    EXIT_CRITICAL();
+}
+
+
+void
+ws_log_write(const ws_log_site_t *site, uint32_t nargs, ...)
+{
+    uint8_t record[MAX_RECORD_LEN];
+    ws_log_record_t *hdr = (ws_log_record_t *)record;
+    ws_log_arg_t *args = (ws_log_arg_t *)(hdr + 1);
+    uint32_t len;
+    uint32_t i;
+    va_list ap;
+
+    ASSERT(nargs <= WS_LOG_MAX_ARGS, "too many log arguments\n");
+
+    hdr->sync = WS_LOG_SYNC;
+    hdr->nargs = (uint8_t)nargs;
+    hdr->id = (uint16_t)(site - __start_ws_log_sites);
+
+    va_start(ap, nargs);
+    for (i = 0; i < nargs; i++)
+        args[i] = va_arg(ap, ws_log_arg_t);
+    va_end(ap);
+
+    len = sizeof(ws_log_record_t) + nargs * sizeof(ws_log_arg_t);
+
+    ENTER_CRITICAL();
+
+    /* The timestamp is taken inside the critical section so records are
+     * always in order */
+    hdr->timestamp = ws_timer_get_time();
+
+    /* Never write part of a record */
+    if (ws_ringbuf_get_space(&log_state.rb) < len)
+        log_state.dropped++;
+    else
+        ws_ringbuf_write(&log_state.rb, record, len);
+
+    ws_os_log_written();
+
+    EXIT_CRITICAL();
+}
+
+
+uint32_t
+ws_log_read(uint8_t *buf, uint32_t len)
+{
+    ws_log_record_t hdr;
+    uint32_t record_len;
+    uint32_t count = 0;
+
+    ENTER_CRITICAL();
+
+    while (ws_ringbuf_peek(&log_state.rb, (uint8_t *)&hdr,
+                           sizeof(hdr)) == sizeof(hdr))
+    {
+        record_len = sizeof(hdr) + hdr.nargs * sizeof(ws_log_arg_t);
+        if (count + record_len > len)
+            break;
+
+        ws_ringbuf_read(&log_state.rb, buf + count, record_len);
+        count += record_len;
+    }
+
+    EXIT_CRITICAL();
+
+    return count;
+}
+
+
+void
+ws_log_flush(void)
+{
+    uint8_t record[MAX_RECORD_LEN];
+    ws_log_record_t *hdr = (ws_log_record_t *)record;
+    const ws_log_site_t *site;
+    char line[MAX_LINE_LEN];
+
+    while (ws_log_read(record, sizeof(record)) > 0)
+    {
+        site = &__start_ws_log_sites[hdr->id];
+        if (site >= __stop_ws_log_sites)
+            continue;
+
+        ws_log_format(line, sizeof(line), site->fmt,
+                      (ws_log_arg_t *)(hdr + 1), hdr->nargs);
+
+        PRINTF("%s %s:%u %s", level_names[site->level], site->file,
+               site->line, line);
+    }
+}
+
+
+uint32_t
+ws_log_get_dropped(void)
+{
+    return log_state.dropped;
+}
+
+
+/* -----------------------------------------------------------------------
+ *  Formatting
+ * -----------------------------------------------------------------------
+ */
+typedef struct
+{
+    char *buf;
+    uint32_t len;
+    uint32_t pos;
+} out_t;
+
+
+static void
+put(out_t *out, char c)
+{
+    if (out->pos + 1 < out->len)
+        out->buf[out->pos] = c;
+    out->pos++;
+}
+
+
+static void
+put_padded(out_t *out, const char *s, uint32_t s_len, uint32_t width,
+           bool left, char pad)
+{
+    uint32_t i;
+
+    if (!left)
+    {
+        for (i = s_len; i < width; i++)
+            put(out, pad);
+    }
+
+    for (i = 0; i < s_len; i++)
+        put(out, s[i]);
+
+    if (left)
+    {
+        for (i = s_len; i < width; i++)
+            put(out, ' ');
+    }
+}
+
+
+static uint32_t
+to_digits(char *digits, uint64_t value, uint32_t base, bool upper)
+{
+    const char *chars = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    uint32_t n = 0, i;
+
+    do
+    {
+        tmp[n++] = chars[value % base];
+        value /= base;
+    }
+    while (value > 0);
+
+    for (i = 0; i < n; i++)
+        digits[i] = tmp[n - i - 1];
+
+    return n;
+}
+
+
+uint32_t
+ws_log_format(char *buf, uint32_t len, const char *fmt,
+              const ws_log_arg_t *args, uint32_t nargs)
+{
+    out_t out = { buf, len, 0 };
+    char digits[24];
+    uint32_t arg = 0;
+    uint32_t width, n, i;
+    bool left, spaced, is_long;
+    char pad;
+    uint64_t value;
+    int64_t svalue;
+    const uint8_t *data;
+    const char *s;
+
+#define NEXT_ARG() (arg < nargs ? args[arg++] : 0)
+
+    for (; *fmt != '\0'; fmt++)
+    {
+        if (*fmt != '%')
+        {
+            put(&out, *fmt);
+            continue;
+        }
+
+        fmt++;
+
+        left = false;
+        spaced = false;
+        pad = ' ';
+        width = 0;
+        is_long = false;
+
+        /* Flags */
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+                left = true;
+            else if (*fmt == '0')
+                pad = '0';
+            else if (*fmt == ' ')
+                spaced = true;
+            else if (*fmt != '+' && *fmt != '#')
+                break;
+        }
+
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (uint32_t)(*fmt++ - '0');
+
+        /* Length modifiers. Arguments are all stored as words, so only
+         * 64 bit integers make any difference */
+        while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z' || *fmt == 't')
+        {
+            if (*fmt == 'l' && sizeof(long) == sizeof(uint64_t))
+                is_long = true;
+            fmt++;
+        }
+
+        switch (*fmt)
+        {
+        case 'd':
+        case 'i':
+            if (is_long)
+                svalue = (int64_t)NEXT_ARG();
+            else
+                svalue = (int32_t)NEXT_ARG();
+
+            n = 0;
+            if (svalue < 0)
+            {
+                digits[n++] = '-';
+                value = (uint64_t)(-svalue);
+            }
+            else
+            {
+                value = (uint64_t)svalue;
+            }
+            n += to_digits(digits + n, value, 10, false);
+            put_padded(&out, digits, n, width, left, pad);
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+            value = NEXT_ARG();
+            if (!is_long)
+                value &= 0xffffffff;
+            n = to_digits(digits, value, *fmt == 'u' ? 10 : 16,
+                          *fmt == 'X');
+            put_padded(&out, digits, n, width, left, pad);
+            break;
+
+        case 'p':
+            value = NEXT_ARG();
+            digits[0] = '0';
+            digits[1] = 'x';
+            n = 2 + to_digits(digits + 2, value, 16, false);
+            put_padded(&out, digits, n, width, left, ' ');
+            break;
+
+        case 'c':
+            digits[0] = (char)NEXT_ARG();
+            put_padded(&out, digits, 1, width, left, ' ');
+            break;
+
+        case 's':
+            s = (const char *)NEXT_ARG();
+            if (s == NULL)
+                s = "(null)";
+            put_padded(&out, s, (uint32_t)strlen(s), width, left, ' ');
+            break;
+
+        case 'r':
+            /* Buffer as hex, taking a pointer then a length */
+            data = (const uint8_t *)NEXT_ARG();
+            n = (uint32_t)NEXT_ARG();
+            for (i = 0; data != NULL && i < n; i++)
+            {
+                if (spaced && i > 0)
+                    put(&out, ' ');
+                to_digits(digits, data[i] >> 4, 16, false);
+                put(&out, digits[0]);
+                to_digits(digits, data[i] & 0xf, 16, false);
+                put(&out, digits[0]);
+            }
+            break;
+
+        case '%':
+            put(&out, '%');
+            break;
+
+        case '\0':
+            fmt--;
+            break;
+
+        default:
+            put(&out, '%');
+            put(&out, *fmt);
+            break;
+        }
+    }
+
+#undef NEXT_ARG
+
+    if (len > 0)
+        buf[out.pos < len ? out.pos : len - 1] = '\0';
+
+    return out.pos;
+}
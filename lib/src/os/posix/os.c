@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include "ws_os.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+
+/* Longest conversion specification we will pass through to vprintf */
+#define MAX_SPEC_LEN (32)
+
+/* Duration of a symbol */
+#define NS_PER_SYMBOL (16000)
+
+
+typedef struct
+{
+    /* Any code running in a critical section is protected by this
+     * (recursive) lock. Threads standing in for interrupt handlers must hold
+     * it while they run. */
+    pthread_mutex_t lock;
+
+    /* Signalled whenever the wakeup time changes, or an event is posted, so
+     * the main loop can recalculate how long to sleep for */
+    pthread_cond_t wakeup_changed;
+
+    /* Time the timer service has asked to be woken at */
+    uint32_t wakeup;
+
+    struct timespec epoch;
+    bool virtual_time;
+    uint32_t virtual_now;
+
+    uint32_t random;
+    bool running;
+    bool log_deferred;
+} os_t;
+
+static os_t os = {
+    .lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP,
+    .wakeup_changed = PTHREAD_COND_INITIALIZER,
+    .random = 0x2545f491,
+};
+
+
+static uint32_t
+get_symbol_time(void)
+{
+    struct timespec now;
+    uint64_t ns;
+
+    if (os.virtual_time)
+        return os.virtual_now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    ns = (uint64_t)(now.tv_sec - os.epoch.tv_sec) * 1000000000 +
+        (uint64_t)(now.tv_nsec - os.epoch.tv_nsec);
+
+    return (uint32_t)(ns / NS_PER_SYMBOL);
+}
+
+
+/* Sleep until the wakeup time, or until something changes it. Must be
+ * called from within a critical section */
+static void
+wait_for_wakeup(uint32_t delay)
+{
+    struct timespec deadline;
+    uint64_t ns;
+
+    if (os.virtual_time)
+    {
+        /* Nothing else can happen in the meantime, so skip ahead */
+        os.virtual_now += delay;
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+    ns = (uint64_t)deadline.tv_nsec + (uint64_t)delay * NS_PER_SYMBOL;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+
+    /* Use the monotonic clock so the wait isn't affected by changes to the
+     * wall clock */
+    pthread_cond_clockwait(&os.wakeup_changed, &os.lock,
+                           CLOCK_MONOTONIC, &deadline);
+}
+
+
+static void
+print_hex(const uint8_t *data, uint32_t len, bool spaced)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        if (spaced && i > 0)
+            putchar(' ');
+        printf("%02x", data[i]);
+    }
+}
+
+
+void
+ws_assert(int line, char *file, char *fmt, ...)
+{
+    va_list arg;
+
+    /* Anything logged before now might explain what went wrong */
+    ws_log_flush();
+
+    ws_os_printf("A: %s:%d ", file, line);
+
+    va_start(arg, fmt);
+    ws_os_vprintf(fmt, arg);
+    va_end(arg);
+
+    fflush(stdout);
+
+    abort();
+}
+
+
+void
+ws_enter_critical(void)
+{
+    pthread_mutex_lock(&os.lock);
+}
+
+
+void
+ws_exit_critical(void)
+{
+    pthread_mutex_unlock(&os.lock);
+}
+
+
+void
+ws_os_init(void)
+{
+    ws_enter_critical();
+
+    clock_gettime(CLOCK_MONOTONIC, &os.epoch);
+    os.virtual_now = 0;
+    os.running = false;
+
+    ws_log_init();
+    ws_trace_init();
+    ws_pool_init();
+    ws_pktbuf_pool_init();
+    ws_timer_init();
+    ws_event_init();
+
+    ws_exit_critical();
+}
+
+
+void
+ws_os_run(void)
+{
+    uint32_t delay;
+
+    ws_enter_critical();
+    os.running = true;
+
+    while (os.running)
+    {
+        /* Events and timers run outside of the critical section, the same
+         * as they would on the target */
+        ws_exit_critical();
+        ws_os_poll();
+        ws_enter_critical();
+
+        if (!os.running || ws_event_is_pending())
+            continue;
+
+        /* Sleep unless the wakeup time has already passed */
+        delay = (os.wakeup - get_symbol_time()) & WS_TIMER_HW_MASK;
+        if (delay > 0 && delay < WS_TIMER_MAX_SLEEP * 2)
+            wait_for_wakeup(delay);
+    }
+
+    ws_exit_critical();
+}
+
+
+uint32_t
+ws_os_poll(void)
+{
+    uint32_t count;
+
+    /* Events first, as they're deferred interrupt handlers */
+    count = ws_event_process();
+    count += ws_timer_process();
+
+    return count;
+}
+
+
+void
+ws_os_stop(void)
+{
+    ws_enter_critical();
+    os.running = false;
+    pthread_cond_signal(&os.wakeup_changed);
+    ws_exit_critical();
+}
+
+
+uint32_t
+ws_os_timer_get_hw_time(void)
+{
+    return get_symbol_time() & WS_TIMER_HW_MASK;
+}
+
+
+void
+ws_os_timer_set_wakeup(uint32_t hw_time)
+{
+    ws_enter_critical();
+    os.wakeup = hw_time;
+    pthread_cond_signal(&os.wakeup_changed);
+    ws_exit_critical();
+}
+
+
+void
+ws_os_event_wakeup(void)
+{
+    ws_enter_critical();
+    pthread_cond_signal(&os.wakeup_changed);
+    ws_exit_critical();
+}
+
+
+void
+ws_os_log_written(void)
+{
+    /* There's no timing to upset on a host, and printing straight away
+     * means the strings in the record are still valid */
+    if (!os.log_deferred)
+        ws_log_flush();
+}
+
+
+void
+ws_os_set_log_deferred(bool deferred)
+{
+    ws_enter_critical();
+    os.log_deferred = deferred;
+    ws_exit_critical();
+}
+
+
+void
+ws_os_seed_random(uint32_t seed)
+{
+    ws_enter_critical();
+
+    /* xorshift can't have a zero state */
+    os.random = seed != 0 ? seed : 0x2545f491;
+
+    ws_exit_critical();
+}
+
+
+uint8_t
+ws_os_get_random8(void)
+{
+    uint32_t x;
+
+    ws_enter_critical();
+
+    /* xorshift32 - quick, and repeatable for a given seed */
+    x = os.random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    os.random = x;
+
+    ws_exit_critical();
+
+    return (uint8_t)(x >> 24);
+}
+
+
+void
+ws_os_set_virtual_time(bool enable)
+{
+    ws_enter_critical();
+
+    os.virtual_time = enable;
+    os.virtual_now = 0;
+    clock_gettime(CLOCK_MONOTONIC, &os.epoch);
+
+    /* The clock has jumped, so start the timers again from scratch */
+    ws_timer_init();
+
+    ws_exit_critical();
+}
+
+
+bool
+ws_os_is_virtual_time(void)
+{
+    return os.virtual_time;
+}
+
+
+void
+ws_os_advance_time(uint32_t symbols)
+{
+    ASSERT(os.virtual_time, "advancing time without a virtual clock\n");
+
+    ws_enter_critical();
+    os.virtual_now += symbols;
+    ws_exit_critical();
+}
+
+
+void
+ws_os_printf(const char *fmt, ...)
+{
+    va_list arg;
+
+    va_start(arg, fmt);
+    ws_os_vprintf(fmt, arg);
+    va_end(arg);
+}
+
+
+void
+ws_os_vprintf(const char *fmt, va_list arg)
+{
+    const char *start;
+    char spec[MAX_SPEC_LEN];
+    size_t len;
+    bool spaced, is_long, is_long_long, is_size;
+    const uint8_t *data;
+
+    while (*fmt != '\0')
+    {
+        if (*fmt != '%')
+        {
+            putchar(*fmt++);
+            continue;
+        }
+
+        /* Find the end of the conversion specification */
+        start = fmt++;
+        spaced = false;
+        is_long = false;
+        is_long_long = false;
+        is_size = false;
+
+        while (*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != NULL)
+        {
+            if (*fmt == ' ')
+                spaced = true;
+            fmt++;
+        }
+
+        while (*fmt != '\0' && strchr("hlzjt", *fmt) != NULL)
+        {
+            if (*fmt == 'l')
+            {
+                is_long_long = is_long;
+                is_long = true;
+            }
+            else if (*fmt == 'z' || *fmt == 'j' || *fmt == 't')
+            {
+                is_size = true;
+            }
+            fmt++;
+        }
+
+        if (*fmt == '\0')
+        {
+            /* Truncated specification, so just print what's there */
+            fputs(start, stdout);
+            return;
+        }
+
+        len = (size_t)(fmt - start) + 1;
+        if (len >= MAX_SPEC_LEN)
+            len = MAX_SPEC_LEN - 1;
+        memcpy(spec, start, len);
+        spec[len] = '\0';
+
+        switch (*fmt++)
+        {
+        case '%':
+            putchar('%');
+            break;
+
+        case 'r':
+            data = va_arg(arg, const uint8_t *);
+            print_hex(data, va_arg(arg, unsigned int), spaced);
+            break;
+
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            if (is_long_long)
+                printf(spec, va_arg(arg, long long));
+            else if (is_long)
+                printf(spec, va_arg(arg, long));
+            else if (is_size)
+                printf(spec, va_arg(arg, size_t));
+            else
+                printf(spec, va_arg(arg, int));
+            break;
+
+        case 'c':
+            printf(spec, va_arg(arg, int));
+            break;
+
+        case 's':
+            printf(spec, va_arg(arg, const char *));
+            break;
+
+        case 'p':
+            printf(spec, va_arg(arg, void *));
+            break;
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            printf(spec, va_arg(arg, double));
+            break;
+
+        default:
+            /* Unknown conversion. Print it so the mistake is visible */
+            fputs(spec, stdout);
+            break;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_trace.h"
+
+
+/* Symbols are 16us long */
+#define US_PER_SYMBOL (16)
+
+
+static ws_trace_record_t records[WS_TRACE_BUFFER_LEN];
+
+
+bool
+ws_trace_export_json(FILE *f)
+{
+    static const char phases[] = {'B', 'E', 'i'};
+    ws_trace_record_t *r;
+    uint32_t n, i;
+
+    n = ws_trace_get_records(records, WS_TRACE_BUFFER_LEN);
+
+    /* Each trace point gets its own track, so overlapping points don't
+     * have to nest */
+    fprintf(f, "{\"traceEvents\":[\n");
+    for (i = 0; i < n; i++)
+    {
+        r = &records[i];
+        fprintf(f, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ","
+                "\"pid\":1,\"tid\":%u%s}%s\n",
+                ws_trace_get_name(r->point), phases[r->type],
+                (uint64_t)r->timestamp * US_PER_SYMBOL, r->point,
+                r->type == WS_TRACE_TYPE_MARK ? ",\"s\":\"t\"" : "",
+                i + 1 < n ? "," : "");
+    }
+    fprintf(f, "],\"displayTimeUnit\":\"ns\"}\n");
+
+    return !ferror(f);
+}
+
+
+bool
+ws_trace_export_vcd(FILE *f)
+{
+    ws_trace_record_t *r;
+    uint64_t time, last_time = 0;
+    uint32_t n, i;
+
+    n = ws_trace_get_records(records, WS_TRACE_BUFFER_LEN);
+
+    fprintf(f, "$timescale 1us $end\n");
+    fprintf(f, "$scope module wsn $end\n");
+    for (i = 0; i < WS_TRACE_POINT_COUNT; i++)
+        fprintf(f, "$var wire 1 %c %s $end\n", '!' + i, ws_trace_get_name(i));
+    fprintf(f, "$upscope $end\n");
+    fprintf(f, "$enddefinitions $end\n");
+
+    fprintf(f, "#0\n$dumpvars\n");
+    for (i = 0; i < WS_TRACE_POINT_COUNT; i++)
+        fprintf(f, "0%c\n", '!' + i);
+    fprintf(f, "$end\n");
+
+    for (i = 0; i < n; i++)
+    {
+        r = &records[i];
+        time = (uint64_t)r->timestamp * US_PER_SYMBOL;
+
+        /* Times can't go backwards, which they would after a pulse */
+        if (time < last_time)
+            time = last_time;
+
+        if (time != last_time)
+            fprintf(f, "#%" PRIu64 "\n", time);
+        last_time = time;
+
+        switch (r->type)
+        {
+        case WS_TRACE_TYPE_BEGIN:
+            fprintf(f, "1%c\n", '!' + r->point);
+            break;
+
+        case WS_TRACE_TYPE_END:
+            fprintf(f, "0%c\n", '!' + r->point);
+            break;
+
+        case WS_TRACE_TYPE_MARK:
+            /* A pulse one microsecond wide */
+            fprintf(f, "1%c\n#%" PRIu64 "\n0%c\n", '!' + r->point, time + 1,
+                    '!' + r->point);
+            last_time = time + 1;
+            break;
+        }
+    }
+
+    return !ferror(f);
+}
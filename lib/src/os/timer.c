@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_timer.h"
+
+
+/**
+ * Timer service state. Running timers are kept in a binary min-heap
+ * ordered by expiry time, so the next timer to fire is always at the front.
+ */
+typedef struct
+{
+    ws_timer_t *heap[WS_TIMER_MAX];
+    uint32_t count;
+
+    /* 32 bit time, extended from the hardware counter */
+    uint32_t now;
+    uint32_t last_hw;
+} timer_service_t;
+
+static timer_service_t timers;
+
+
+/* true if a expires before b. This is safe across the counter wrapping as
+ * long as the times are within 2^31 symbols of each other */
+static inline bool
+is_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+
+static inline void
+place(ws_timer_t *t, uint32_t index)
+{
+    timers.heap[index] = t;
+    t->index = (int16_t)index;
+}
+
+
+static void
+sift_up(uint32_t index)
+{
+    ws_timer_t *t = timers.heap[index];
+    uint32_t parent;
+
+    while (index > 0)
+    {
+        parent = (index - 1) / 2;
+        if (!is_before(t->expiry, timers.heap[parent]->expiry))
+            break;
+
+        place(timers.heap[parent], index);
+        index = parent;
+    }
+
+    place(t, index);
+}
+
+
+static void
+sift_down(uint32_t index)
+{
+    ws_timer_t *t = timers.heap[index];
+    uint32_t child;
+
+    while ((child = index * 2 + 1) < timers.count)
+    {
+        if (child + 1 < timers.count &&
+            is_before(timers.heap[child + 1]->expiry,
+                      timers.heap[child]->expiry))
+            child++;
+
+        if (!is_before(timers.heap[child]->expiry, t->expiry))
+            break;
+
+        place(timers.heap[child], index);
+        index = child;
+    }
+
+    place(t, index);
+}
+
+
+static ws_timer_t *
+pop(void)
+{
+    ws_timer_t *t = timers.heap[0];
+
+    t->index = -1;
+    timers.count--;
+
+    if (timers.count > 0)
+    {
+        place(timers.heap[timers.count], 0);
+        sift_down(0);
+    }
+
+    return t;
+}
+
+
+/* Must be called from within a critical section */
+static uint32_t
+update_time(void)
+{
+    uint32_t hw = ws_os_timer_get_hw_time();
+
+    timers.now += (hw - timers.last_hw) & WS_TIMER_HW_MASK;
+    timers.last_hw = hw;
+
+    return timers.now;
+}
+
+
+/* Must be called from within a critical section */
+static void
+program_wakeup(void)
+{
+    uint32_t now = update_time();
+    uint32_t wake = now + WS_TIMER_MAX_SLEEP;
+
+    if (timers.count > 0 && is_before(timers.heap[0]->expiry, wake))
+        wake = timers.heap[0]->expiry;
+
+    /* The hardware may only wake us when its counter equals the wakeup
+     * time, so one that has already gone by would never come. Keep it
+     * WS_TIMER_MIN_LEAD ahead, and check again once it's written in case
+     * the counter overtook it meanwhile. */
+    while (true)
+    {
+        if (is_before(wake, now + WS_TIMER_MIN_LEAD))
+            wake = now + WS_TIMER_MIN_LEAD;
+
+        ws_os_timer_set_wakeup((timers.last_hw + (wake - now)) &
+                               WS_TIMER_HW_MASK);
+
+        now = update_time();
+        if (WS_TIMER_MIN_LEAD == 0 || is_before(now, wake))
+            break;
+    }
+}
+
+
+void
+ws_timer_init(void)
+{
+    uint32_t i;
+
+    ENTER_CRITICAL();
+
+    for (i = 0; i < timers.count; i++)
+    {
+        timers.heap[i]->index = -1;
+        timers.heap[i]->active = false;
+    }
+
+    timers.count = 0;
+    timers.now = 0;
+    timers.last_hw = ws_os_timer_get_hw_time();
+
+    program_wakeup();
+
+    EXIT_CRITICAL();
+}
+
+
+void
+ws_timer_set(ws_timer_t *t, uint32_t symbols)
+{
+    uint32_t old_expiry;
+
+    ASSERT(t != NULL, "setting NULL timer\n");
+
+    ENTER_CRITICAL();
+
+    old_expiry = t->expiry;
+    t->expiry = update_time() + symbols;
+    t->active = true;
+
+    if (t->index < 0)
+    {
+        ASSERT(timers.count < WS_TIMER_MAX, "too many timers running\n");
+        place(t, timers.count++);
+        sift_up(t->index);
+    }
+    else if (is_before(t->expiry, old_expiry))
+    {
+        sift_up(t->index);
+    }
+    else
+    {
+        sift_down(t->index);
+    }
+
+    if (t->index == 0)
+        program_wakeup();
+
+    EXIT_CRITICAL();
+}
+
+
+void
+ws_timer_cancel(ws_timer_t *t)
+{
+    ASSERT(t != NULL, "cancelling NULL timer\n");
+
+    /* The timer stays in the heap until it reaches the front, where it is
+     * discarded. If it is set again before then, it is moved in place. */
+    t->active = false;
+}
+
+
+bool
+ws_timer_is_active(ws_timer_t *t)
+{
+    return t->active;
+}
+
+
+uint32_t
+ws_timer_process(void)
+{
+    ws_timer_t *t;
+    uint32_t now;
+    uint32_t budget;
+    uint32_t count = 0;
+
+    ENTER_CRITICAL();
+
+    now = update_time();
+
+    /* Only look at timers that were running when we started. Anything
+     * set by a callback to expire immediately will run next time, which
+     * stops a timer that keeps setting itself from starving the caller */
+    budget = timers.count;
+
+    while (budget-- > 0 && timers.count > 0 &&
+           !is_before(now, timers.heap[0]->expiry))
+    {
+        t = pop();
+        if (!t->active)
+            continue;
+
+        t->active = false;
+
+        EXIT_CRITICAL();
+        t->cb(t->arg);
+        count++;
+        ENTER_CRITICAL();
+    }
+
+    update_time();
+    program_wakeup();
+
+    EXIT_CRITICAL();
+
+    return count;
+}
+
+
+uint32_t
+ws_timer_get_time(void)
+{
+    uint32_t now;
+
+    ENTER_CRITICAL();
+    now = update_time();
+    EXIT_CRITICAL();
+
+    return now;
+}
@@ -29,44 +29,85 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "ws_os.h"
+#include "ws_trace.h"
 
-#include "interrupt.h"
 
-#include "bsp_led.h"
+#if (WS_TRACE_BUFFER_LEN & (WS_TRACE_BUFFER_LEN - 1)) != 0
+#error "WS_TRACE_BUFFER_LEN must be a power of two"
+#endif
 
 
-/* TODO: This should be folded into the application specific HAL */
+typedef struct
+{
+    ws_trace_record_t records[WS_TRACE_BUFFER_LEN];
+
+    /* Total number of records written. The newest record is at
+     * (count - 1) masked by the buffer length. */
+    uint32_t count;
+} trace_t;
+
+static trace_t trace;
+
+
+#define X(id, name) name,
+static const char *point_names[] = { WS_TRACE_POINTS };
+#undef X
 
 
 void
-ws_assert(int line, char *file, char *fmt, ...)
+ws_trace_init(void)
 {
-    va_list arg;
+    ENTER_CRITICAL();
+    trace.count = 0;
+    EXIT_CRITICAL();
+}
 
-    PRINTF("A: %s:%l ", file, line);
 
-    va_start(arg, fmt);
-    VPRINTF(fmt, arg);
-    va_end(arg);
+void
+ws_trace_write(ws_trace_point_t point, ws_trace_type_t type)
+{
+    ws_trace_record_t *r;
 
-    bspLedSet(BSP_LED_ALL);
+    ENTER_CRITICAL();
 
-    ws_enter_critical();
+    /* The oldest record is overwritten, so we always have the lead up to
+     * whatever is being looked at */
+    r = &trace.records[trace.count++ & (WS_TRACE_BUFFER_LEN - 1)];
+    r->timestamp = ws_timer_get_time();
+    r->point = (uint8_t)point;
+    r->type = (uint8_t)type;
 
-    while(1)
-        ;
+    EXIT_CRITICAL();
 }
 
-void
-ws_enter_critical(void)
+
+uint32_t
+ws_trace_get_records(ws_trace_record_t *records, uint32_t max)
 {
-    IntMasterDisable();
+    uint32_t first, n, i;
+
+    ENTER_CRITICAL();
+
+    n = trace.count < WS_TRACE_BUFFER_LEN ? trace.count : WS_TRACE_BUFFER_LEN;
+    if (n > max)
+        n = max;
+
+    /* Take the newest n */
+    first = trace.count - n;
+    for (i = 0; i < n; i++)
+        records[i] = trace.records[(first + i) & (WS_TRACE_BUFFER_LEN - 1)];
+
+    EXIT_CRITICAL();
+
+    return n;
 }
 
 
-void
-ws_exit_critical(void)
+const char *
+ws_trace_get_name(uint32_t point)
 {
-    IntMasterEnable();
+    if (point >= WS_TRACE_POINT_COUNT)
+        return NULL;
+
+    return point_names[point];
 }
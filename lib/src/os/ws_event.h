@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_EVENT_H
+#define _WS_EVENT_H
+
+
+#include "wsn.h"
+
+
+/**
+ * Event priorities, highest first. Pending events at a higher priority are
+ * always run before any at a lower priority, so a burst of received frames
+ * can't be held up behind application work.
+ */
+typedef enum
+{
+    /* Received frame processing and acknowledgement matching */
+    WS_EVENT_PRIORITY_RX = 0,
+    /* Building beacons, and channel access for outgoing frames */
+    WS_EVENT_PRIORITY_TX,
+    /* Everything else, including application callbacks */
+    WS_EVENT_PRIORITY_APP,
+
+    WS_EVENT_PRIORITY_COUNT
+} ws_event_priority_t;
+
+
+/* Declared events call a function without arguments. Events that belong to
+ * an object are embedded in it with WS_EVENT_INITIALISER instead, and are
+ * handed the object when they run. */
+#define WS_EVENT_DECLARE(id, priority) \
+    static void id(void);\
+    static void ws_event_cb_##id(void *arg) { UNUSED(arg); id(); }\
+    static ws_event_t ws_event_##id = \
+        WS_EVENT_INITIALISER(ws_event_cb_##id, NULL, priority)
+#define WS_EVENT_POST(id) ws_event_post(&ws_event_##id)
+#define WS_EVENT_IS_PENDING(id) (ws_event_##id.pending)
+
+
+/**
+ * Prepare the event scheduler. Any pending events are forgotten.
+ */
+extern void
+ws_event_init(void);
+
+
+/**
+ * Schedule an event to run from the main loop. This is O(1) and is safe to
+ * call from an interrupt. Posting an event that is already pending does
+ * nothing, so the callback must handle all of the work that is waiting
+ * rather than just one item.
+ * \param e the event
+ * \return true if the event was queued, false if it was already pending
+ */
+extern bool
+ws_event_post(ws_event_t *e);
+
+
+/**
+ * Run pending events, highest priority first. Each event runs to
+ * completion, and the highest priority queue is checked again after each
+ * one. No more events are run than were pending at the start, so an event
+ * that keeps posting itself can't starve the caller.
+ * \return the number of events that were run
+ */
+extern uint32_t
+ws_event_process(void);
+
+
+/**
+ * Test if there is any work waiting. This must be called from within a
+ * critical section if it is used to decide whether to sleep.
+ * \return true if any event is pending
+ */
+extern bool
+ws_event_is_pending(void);
+
+
+/*
+ * Port interface. This is implemented by the operating system port in
+ * os/<port>/os.c
+ */
+/**
+ * Wake the main loop because an event has been posted. This is called from
+ * within a critical section.
+ */
+extern void
+ws_os_event_wakeup(void);
+
+
+#endif /* _WS_EVENT_H */
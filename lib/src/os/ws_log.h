@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_LOG_H
+#define _WS_LOG_H
+
+
+#include "wsn.h"
+
+
+/* NOTE: Log calls don't format anything. They write a small binary record,
+ * holding the ID of the call site and the raw arguments, into a ring
+ * buffer. Formatting happens later, either by \see ws_log_flush from the
+ * main loop, or on a host by tools/log_decoder from a dump of the buffer.
+ * This makes logging cheap enough to leave on in interrupt handlers.
+ *
+ * Each source file can set its own level after its includes:
+ *
+ *     #undef WS_LOG_LEVEL
+ *     #define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+ *
+ * Calls below the level compile to nothing.
+ */
+
+
+#define WS_LOG_LEVEL_NONE  (0)
+#define WS_LOG_LEVEL_ERROR (1)
+#define WS_LOG_LEVEL_WARN  (2)
+#define WS_LOG_LEVEL_INFO  (3)
+#define WS_LOG_LEVEL_DEBUG (4)
+
+/**
+ * Level used by files that don't set their own
+ */
+#ifndef WS_LOG_LEVEL_DEFAULT
+#define WS_LOG_LEVEL_DEFAULT WS_LOG_LEVEL_DEBUG
+#endif
+
+#define WS_LOG_LEVEL WS_LOG_LEVEL_DEFAULT
+
+/**
+ * Size, in octets, of the log ring buffer
+ */
+#ifndef WS_LOG_BUFFER_LEN
+#define WS_LOG_BUFFER_LEN (1024)
+#endif
+
+/**
+ * Most arguments a single log call can take
+ */
+#define WS_LOG_MAX_ARGS (8)
+
+/**
+ * Every record starts with this octet, so a decoder can find the start of
+ * the next record in a stream that was joined part way through
+ */
+#define WS_LOG_SYNC (0xa5)
+
+
+/**
+ * Arguments are stored as raw words. Strings and buffers (%s and %r) are
+ * stored as addresses, so they can only be shown by ws_log_flush, or by the
+ * decoder if they point into flash.
+ */
+typedef uintptr_t ws_log_arg_t;
+
+
+/**
+ * Everything about a log call that is known at compile time. These are
+ * gathered into their own section, and a site's ID is its index within it.
+ * Sites are padded to a power of two so the compiler lays them out as an
+ * array.
+ */
+typedef struct
+{
+    const char *file;
+    const char *fmt;
+    uint16_t line;
+    uint8_t level;
+} __attribute__((aligned(4 * sizeof(void *)))) ws_log_site_t;
+
+
+/**
+ * The header of each record in the ring buffer, followed by nargs
+ * ws_log_arg_t
+ */
+typedef struct
+{
+    uint8_t sync;
+    uint8_t nargs;
+    uint16_t id;
+    uint32_t timestamp;
+} ws_log_record_t;
+
+
+#define WS_LOG(level, ...) \
+    do\
+    {\
+        if ((level) <= WS_LOG_LEVEL)\
+        {\
+            static const ws_log_site_t ws_log_site\
+                __attribute__((section("ws_log_sites"))) =\
+                { __FILE__, WS_LOG_FMT(__VA_ARGS__, 0), __LINE__, (level) };\
+            ws_log_write(&ws_log_site,\
+                         WS_LOG_COUNT(__VA_ARGS__)\
+                         WS_LOG_ARGS(__VA_ARGS__));\
+        }\
+    }\
+    while (0)
+
+#define WS_ERROR(...) WS_LOG(WS_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define WS_WARN(...) WS_LOG(WS_LOG_LEVEL_WARN, __VA_ARGS__)
+#define WS_INFO(...) WS_LOG(WS_LOG_LEVEL_INFO, __VA_ARGS__)
+#define WS_DEBUG(...) WS_LOG(WS_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+
+/* Helpers to split the format string from its arguments, and to cast each
+ * argument to a ws_log_arg_t */
+#define WS_LOG_FMT(fmt, ...) fmt
+#define WS_LOG_COUNT(...) \
+    WS_LOG_COUNT_(__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define WS_LOG_COUNT_(fmt, a1, a2, a3, a4, a5, a6, a7, a8, n, ...) n
+
+#define WS_LOG_CAT(a, b) WS_LOG_CAT_(a, b)
+#define WS_LOG_CAT_(a, b) a##b
+#define WS_LOG_ARGS(...) \
+    WS_LOG_CAT(WS_LOG_ARGS_, WS_LOG_COUNT(__VA_ARGS__))(__VA_ARGS__)
+
+#define WS_LOG_ARG(a) ((ws_log_arg_t)(a))
+#define WS_LOG_ARGS_0(f)
+#define WS_LOG_ARGS_1(f, a) , WS_LOG_ARG(a)
+#define WS_LOG_ARGS_2(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_1(f, __VA_ARGS__)
+#define WS_LOG_ARGS_3(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_2(f, __VA_ARGS__)
+#define WS_LOG_ARGS_4(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_3(f, __VA_ARGS__)
+#define WS_LOG_ARGS_5(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_4(f, __VA_ARGS__)
+#define WS_LOG_ARGS_6(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_5(f, __VA_ARGS__)
+#define WS_LOG_ARGS_7(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_6(f, __VA_ARGS__)
+#define WS_LOG_ARGS_8(f, a, ...) , WS_LOG_ARG(a) WS_LOG_ARGS_7(f, __VA_ARGS__)
+
+
+/**
+ * Prepare the log buffer. Anything in it is discarded.
+ */
+extern void
+ws_log_init(void);
+
+
+/**
+ * Write a record into the log buffer. This is normally only called through
+ * the WS_LOG macros. If there isn't room the record is dropped.
+ * \param site the call site
+ * \param nargs the number of arguments that follow, each a ws_log_arg_t
+ */
+extern void
+ws_log_write(const ws_log_site_t *site, uint32_t nargs, ...);
+
+
+/**
+ * Read raw records from the log buffer, for example to send them to a host
+ * running tools/log_decoder. Only whole records are read.
+ * \param buf memory to store the records
+ * \param len the size, in octets, of buf
+ * \return the number of octets read
+ */
+extern uint32_t
+ws_log_read(uint8_t *buf, uint32_t len);
+
+
+/**
+ * Format every record in the log buffer as text, and print it with PRINTF.
+ * Strings and buffers are read when the record is printed, not when it was
+ * written.
+ */
+extern void
+ws_log_flush(void);
+
+
+/**
+ * Get the number of records dropped because the buffer was full
+ * \return the number of dropped records
+ */
+extern uint32_t
+ws_log_get_dropped(void);
+
+
+/**
+ * Format a log message, supporting the same conversions as PRINTF
+ * \param buf memory to store the text, which is always terminated
+ * \param len the size, in octets, of buf
+ * \param fmt the format string
+ * \param args the arguments
+ * \param nargs the number of arguments
+ * \return the length of the text
+ */
+extern uint32_t
+ws_log_format(char *buf, uint32_t len, const char *fmt,
+              const ws_log_arg_t *args, uint32_t nargs);
+
+
+/*
+ * Port interface. This is implemented by the operating system port in
+ * os/<port>/os.c
+ */
+/**
+ * Called after a record is written. A port can flush the buffer straight
+ * away, or wake something to do it later. This is called from within a
+ * critical section, and possibly from an interrupt.
+ */
+extern void
+ws_os_log_written(void);
+
+
+#endif /* _WS_LOG_H */
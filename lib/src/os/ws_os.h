@@ -32,36 +32,67 @@
 #ifndef _WS_OS_H
 #define _WS_OS_H
 
-/* NOTE: This abstraction layer between the WSN library and an operating
- * system is lacking! This is due to a move from a proprietary OS that did
- * not permit linking with an Open Source project. The intention is to
- * add a very simplistic OS based on software timers and also use libc's
- * malloc and printf functions.
+/* NOTE: The abstraction layer between the WSN library and an operating
+ * system is selected at build time. Defining WS_OS_POSIX builds the library
+ * for a host machine (see os/posix/os.c), which uses libc and pthreads.
+ * Otherwise the target is assumed to be the CC2538 (see os/cc2538/os.c).
+ * Both ports share the software timer service in os/timer.c and the event
+ * scheduler in os/event.c, and only provide the clock and a way to sleep
+ * until there is something to do.
  */
 
 
 #include "wsn.h"
 
 
+#if defined(WS_OS_POSIX)
+
+#define PRINTF(...) ws_os_printf(__VA_ARGS__)
+#define VPRINTF(fmt, arg) ws_os_vprintf(fmt, arg)
+#define FFLUSH(f) fflush(f)
+
+#else
+
 #define PRINTF(...)
 #define VPRINTF(fmt, arg)
 #define FFLUSH(f)
 
-#define WS_INFO(...) \
-    PRINTF("INF %s:%d ", __FILE__, __LINE__);\
-    PRINTF(__VA_ARGS__)
-#define WS_WARN(...) \
-    PRINTF("WRN %s:%d ", __FILE__, __LINE__);\
-    PRINTF(__VA_ARGS__)
-#define WS_ERROR(...) \
-    PRINTF("ERR %s:%d ", __FILE__, __LINE__);\
-    PRINTF(__VA_ARGS__)
-#define WS_DEBUG(...) \
-    PRINTF("DBG %s:%d ", __FILE__, __LINE__);\
-    PRINTF(__VA_ARGS__)
-
-#define MALLOC(x) (NULL)
-#define FREE(x)
+#endif /* WS_OS_POSIX */
+
+#define WS_GET_RANDOM8() ws_os_get_random8()
+
+
+/* Memory comes from fixed size pools (see util/ws_pool.h), so it can't
+ * fragment. Host builds can use the C library instead, which is useful
+ * with tools like valgrind. */
+#if defined(WS_OS_POSIX) && defined(WS_OS_USE_LIBC_MALLOC)
+#define MALLOC(x) malloc(x)
+#define FREE(x) free(x)
+#else
+#define MALLOC(x) ws_pool_alloc(x)
+#define FREE(x) ws_pool_free(x)
+#endif
+
+
+/* Timer times are given in milliseconds, except for WS_TIMER_SET_SYMBOLS
+ * which is used where the MAC needs symbol accurate timing. Declared timers
+ * call a function without arguments; timers that belong to an object are
+ * embedded in it with WS_TIMER_INITIALISER instead. */
+#define WS_TIMER_DECLARE(id) \
+    static void id(void);\
+    static void ws_timer_cb_##id(void *arg) { UNUSED(arg); id(); }\
+    static ws_timer_t ws_timer_##id = \
+        WS_TIMER_INITIALISER(ws_timer_cb_##id, NULL)
+#define WS_TIMER_SET(id, time) \
+    ws_timer_set(&ws_timer_##id, WS_TIMER_MS_TO_SYMBOLS(time))
+#define WS_TIMER_SET_SYMBOLS(id, symbols) \
+    ws_timer_set(&ws_timer_##id, symbols)
+#define WS_TIMER_SET_NOW(id) ws_timer_set(&ws_timer_##id, 0)
+#define WS_TIMER_CANCEL(id) ws_timer_cancel(&ws_timer_##id)
+#define WS_TIMER_IS_ACTIVE(id) ws_timer_is_active(&ws_timer_##id)
+
+#define WS_TIME_GET_NOW() WS_TIMER_SYMBOLS_TO_MS(ws_timer_get_time())
+
 
 /* TODO: Abstract the BSP stuff into a cleaner interface */
 #define ASSERT(cond, ...) \
@@ -74,23 +105,25 @@
     }\
     while(0)
 
-#define WS_TIMER_DECLARE(id)
-#define WS_TIMER_SET(id, time)
-#define WS_TIMER_SET_NOW(id)
-#define WS_TIMER_CANCEL(id)
-
-#define WS_TIME_GET_NOW() (0)
-
-#define WS_GET_RANDOM8() (0)
-
 #define ENTER_CRITICAL() ws_enter_critical()
 #define EXIT_CRITICAL() ws_exit_critical()
 
+/* Hand data from an interrupt to the main loop, or between threads on the
+ * host, without a critical section. A load with acquire ordering that sees
+ * a value stored with release ordering also sees everything written before
+ * that store. These are the C11 atomic operations, through the compiler
+ * builtins so that gnu99 builds can use them. */
+#define WS_LOAD_ACQUIRE(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WS_STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
 
 extern void
 ws_assert(int line, char *file, char *fmt, ...);
 
 
+/**
+ * Disable interrupts. Critical sections may be nested.
+ */
 extern void
 ws_enter_critical(void);
 
@@ -99,4 +132,107 @@ extern void
 ws_exit_critical(void);
 
 
+/**
+ * Prepare the operating system. This must be called before any other
+ * part of the library is used.
+ */
+extern void
+ws_os_init(void);
+
+
+/**
+ * Run events and timers until \see ws_os_stop is called, sleeping while
+ * there is nothing to do. This is the main loop of the application.
+ */
+extern void
+ws_os_run(void);
+
+
+/**
+ * Run any pending events and timers that have expired, without waiting
+ * for more.
+ * \return the number of events and timers that were run
+ */
+extern uint32_t
+ws_os_poll(void);
+
+
+/**
+ * Make \see ws_os_run return. This can be called from a timer or from an
+ * interrupt.
+ */
+extern void
+ws_os_stop(void);
+
+
+/**
+ * Random numbers for CSMA-CA backoffs and sequence numbers. These aren't
+ * good enough for keys.
+ * \return a random byte
+ */
+extern uint8_t
+ws_os_get_random8(void);
+
+
+#if defined(WS_OS_POSIX)
+
+/**
+ * Seed the random number generator. Using the same seed makes runs
+ * repeatable.
+ * \param seed the new seed
+ */
+extern void
+ws_os_seed_random(uint32_t seed);
+
+
+/**
+ * By default log records are printed as soon as they are written. Deferring
+ * them leaves them in the log buffer, as they would be on the target.
+ * \param deferred true to leave records in the log buffer
+ */
+extern void
+ws_os_set_log_deferred(bool deferred);
+
+
+/**
+ * Switch between the wall clock and a virtual clock. With a virtual clock
+ * \see ws_os_run never sleeps, and instead jumps straight to the next timer.
+ * This makes host tests and simulations run as fast as possible and
+ * repeatably.
+ * \param enable true to use a virtual clock
+ */
+extern void
+ws_os_set_virtual_time(bool enable);
+
+
+/**
+ * \return true if the OS is running on a virtual clock
+ */
+extern bool
+ws_os_is_virtual_time(void);
+
+
+/**
+ * Move the virtual clock forwards. Timers are not run until the next call
+ * to \see ws_os_poll or \see ws_os_run.
+ * \param symbols the number of symbols to move forward by
+ */
+extern void
+ws_os_advance_time(uint32_t symbols);
+
+
+/**
+ * printf that also understands %r (and "% r") to print a buffer as hex.
+ * %r takes two arguments: a pointer to the data and its length.
+ */
+extern void
+ws_os_printf(const char *fmt, ...);
+
+
+extern void
+ws_os_vprintf(const char *fmt, va_list arg);
+
+#endif /* WS_OS_POSIX */
+
+
 #endif /* _WS_OS_H */
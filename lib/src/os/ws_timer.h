@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_TIMER_H
+#define _WS_TIMER_H
+
+
+#include "wsn.h"
+
+
+/**
+ * Maximum number of timers that can be running at once. Each timer declared
+ * with WS_TIMER_DECLARE uses at most one slot.
+ */
+#ifndef WS_TIMER_MAX
+#define WS_TIMER_MAX (32)
+#endif
+
+/**
+ * Width of the hardware symbol counter. This matches the CC2538 MAC timer
+ * overflow counter, and the host port emulates the same width.
+ */
+#define WS_TIMER_HW_MASK (0xffffff)
+
+/**
+ * Longest time, in symbols, the timer service will sleep for before reading
+ * the hardware counter again. This must be less than half of the hardware
+ * counter range so we never miss a wrap.
+ */
+#define WS_TIMER_MAX_SLEEP (0x400000)
+
+/**
+ * Fewest symbols ahead of the hardware counter that a wakeup is set for.
+ * The CC2538 compare only fires when the counter equals it exactly, so the
+ * wakeup has to be far enough ahead that the counter can't pass it while
+ * it's being written. The host wakes for any time that has passed.
+ */
+#if defined(WS_OS_POSIX)
+#define WS_TIMER_MIN_LEAD (0)
+#else
+#define WS_TIMER_MIN_LEAD (2)
+#endif
+
+/**
+ * Symbol rate is 62.5 ksym/s, so there are 62.5 symbols in a millisecond
+ */
+#define WS_TIMER_MS_TO_SYMBOLS(ms) (((uint32_t)(ms) * 125) / 2)
+#define WS_TIMER_SYMBOLS_TO_MS(sym) (((uint32_t)(sym) * 2) / 125)
+
+
+/**
+ * Prepare the timer service. Any running timers are forgotten.
+ */
+extern void
+ws_timer_init(void);
+
+
+/**
+ * Start a timer, or restart it if it's already running. This is
+ * O(log n) in the number of running timers, and can be called from an
+ * interrupt.
+ * \param t the timer
+ * \param symbols time until the timer expires, in symbols
+ */
+extern void
+ws_timer_set(ws_timer_t *t, uint32_t symbols);
+
+
+/**
+ * Stop a timer. Does nothing if the timer is not running. This is O(1), as
+ * the timer is only marked as stopped and is removed once it reaches the
+ * front of the queue.
+ * \param t the timer
+ */
+extern void
+ws_timer_cancel(ws_timer_t *t);
+
+
+/**
+ * Test if a timer is running
+ * \param t the timer
+ * \return true if the timer will fire in the future
+ */
+extern bool
+ws_timer_is_active(ws_timer_t *t);
+
+
+/**
+ * Run the callback for every timer that has expired. This must be called
+ * from the main loop, not from an interrupt.
+ * \return the number of timers that were run
+ */
+extern uint32_t
+ws_timer_process(void);
+
+
+/**
+ * Get the time of the timer service. This extends the hardware counter to
+ * 32 bits, so it will only wrap after about 19 hours.
+ * \return the current time in symbols
+ */
+extern uint32_t
+ws_timer_get_time(void);
+
+
+/*
+ * Port interface. These are implemented by the operating system port in
+ * os/<port>/os.c
+ */
+/**
+ * Read the hardware symbol counter
+ * \return the counter value, masked by WS_TIMER_HW_MASK
+ */
+extern uint32_t
+ws_os_timer_get_hw_time(void);
+
+
+/**
+ * Arrange for the main loop to be woken when the hardware counter reaches
+ * the given time. Only one wakeup is ever pending, and setting a new one
+ * replaces the last.
+ * \param hw_time the time to wake up, masked by WS_TIMER_HW_MASK
+ */
+extern void
+ws_os_timer_set_wakeup(uint32_t hw_time);
+
+
+#endif /* _WS_TIMER_H */
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_TRACE_H
+#define _WS_TRACE_H
+
+
+#include "wsn.h"
+
+
+/* NOTE: Trace points record when something starts and stops, timestamped
+ * by the MAC timer, into a ring buffer that always holds the most recent
+ * records. They are compiled in by defining WS_TRACE, and otherwise cost
+ * nothing. On a host the buffer can be exported for chrome://tracing (or
+ * Perfetto), or as a VCD file for a waveform viewer.
+ */
+
+
+/**
+ * Every trace point, as X(id, name)
+ */
+#define WS_TRACE_POINTS \
+    X(RX_ISR, "rx_isr") \
+    X(SLOT_TICK, "slot_tick") \
+    X(CSMA, "csma") \
+    X(TX_IN_FLIGHT, "tx_in_flight") \
+    X(BEACON_SYNC, "beacon_sync")
+
+#define X(id, name) WS_TRACE_##id,
+typedef enum
+{
+    WS_TRACE_POINTS
+    WS_TRACE_POINT_COUNT
+} ws_trace_point_t;
+#undef X
+
+
+/**
+ * Number of records kept. This must be a power of two.
+ */
+#ifndef WS_TRACE_BUFFER_LEN
+#define WS_TRACE_BUFFER_LEN (256)
+#endif
+
+
+typedef enum
+{
+    WS_TRACE_TYPE_BEGIN,
+    WS_TRACE_TYPE_END,
+    WS_TRACE_TYPE_MARK,
+} ws_trace_type_t;
+
+
+typedef struct
+{
+    /* Time in symbols */
+    uint32_t timestamp;
+    uint8_t point;
+    uint8_t type;
+} ws_trace_record_t;
+
+
+#if defined(WS_TRACE)
+#define WS_TRACE_BEGIN(id) ws_trace_write(WS_TRACE_##id, WS_TRACE_TYPE_BEGIN)
+#define WS_TRACE_END(id) ws_trace_write(WS_TRACE_##id, WS_TRACE_TYPE_END)
+#define WS_TRACE_MARK(id) ws_trace_write(WS_TRACE_##id, WS_TRACE_TYPE_MARK)
+#else
+#define WS_TRACE_BEGIN(id)
+#define WS_TRACE_END(id)
+#define WS_TRACE_MARK(id)
+#endif
+
+
+/**
+ * Discard all trace records
+ */
+extern void
+ws_trace_init(void);
+
+
+/**
+ * Record a trace point. This is normally only called through the
+ * WS_TRACE_* macros, and can be called from an interrupt.
+ * \param point the trace point
+ * \param type whether the point is starting, stopping or an instant
+ */
+extern void
+ws_trace_write(ws_trace_point_t point, ws_trace_type_t type);
+
+
+/**
+ * Copy the trace records, oldest first, leaving them in the buffer
+ * \param records memory to store the records
+ * \param max the number of records that fit in records
+ * \return the number of records copied
+ */
+extern uint32_t
+ws_trace_get_records(ws_trace_record_t *records, uint32_t max);
+
+
+/**
+ * Get the name of a trace point
+ * \param point the trace point
+ * \return the name, or NULL if the point doesn't exist
+ */
+extern const char *
+ws_trace_get_name(uint32_t point);
+
+
+#if defined(WS_OS_POSIX)
+
+/**
+ * Write the trace records in the Chrome trace event JSON format
+ * \param f the file to write to
+ * \return false if the file couldn't be written
+ */
+extern bool
+ws_trace_export_json(FILE *f);
+
+
+/**
+ * Write the trace records as a VCD file, with a signal for each trace point
+ * \param f the file to write to
+ * \return false if the file couldn't be written
+ */
+extern bool
+ws_trace_export_vcd(FILE *f);
+
+#endif /* WS_OS_POSIX */
+
+
+#endif /* _WS_TRACE_H */
@@ -40,12 +40,40 @@
 typedef struct
 {
     ws_radio_timer_callback_t timer_cb;
+    void *timer_arg;
     uint8_t superframe_order;
 } mactimer_t;
 
 static mactimer_t mactimer;
 
 
+static void
+mactimer_syncronise(void *dev)
+{
+    uint32_t time;
+
+    UNUSED(dev);
+
+    /* The counter and compare registers are reached through the one
+     * MTMSEL mux, which an interrupt reading the time could switch */
+    ENTER_CRITICAL();
+
+    HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CTR;
+    time = HWREG(RFCORE_SFR_MTMOVF0);
+    time |= HWREG(RFCORE_SFR_MTMOVF1) << 8;
+    time |= HWREG(RFCORE_SFR_MTMOVF2) << 16;
+
+    time += (WS_RADIO_SLOT_DURATION << mactimer.superframe_order);
+
+    HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CMP1;
+    HWREG(RFCORE_SFR_MTMOVF0) = time & 0xff;
+    HWREG(RFCORE_SFR_MTMOVF1) = (time >> 8) & 0xff;
+    HWREG(RFCORE_SFR_MTMOVF2) = (time >> 16) & 0xff;
+
+    EXIT_CRITICAL();
+}
+
+
 static void
 mactimer_handler(void)
 {
@@ -54,22 +82,35 @@ mactimer_handler(void)
     if (flags & RFCORE_SFR_MTIRQF_MACTIMER_OVF_COMPARE1F)
     {
         if (mactimer.timer_cb != NULL)
-            mactimer.timer_cb();
+            mactimer.timer_cb(mactimer.timer_arg);
 
-        ws_radio_timer_syncronise();
+        mactimer_syncronise(NULL);
 
         /* Clear the flag */
         HWREG(RFCORE_SFR_MTIRQF) &= ~RFCORE_SFR_MTIRQF_MACTIMER_OVF_COMPARE1F;
     }
+
+    if (flags & RFCORE_SFR_MTIRQF_MACTIMER_OVF_COMPARE2F)
+    {
+        /* Nothing to do here, the interrupt has already woken the OS main
+         * loop so it can run its timers */
+        HWREG(RFCORE_SFR_MTIRQF) &= ~RFCORE_SFR_MTIRQF_MACTIMER_OVF_COMPARE2F;
+    }
 }
 
 
 void
-ws_radio_timer_init(ws_radio_timer_callback_t cb)
+cc2538_mactimer_start(void)
 {
-    mactimer.timer_cb = cb;
+    /* The OS starts the timer before the MAC does, and resetting it now
+     * would make the OS timers jump */
+    if (HWREG(RFCORE_SFR_MTCTRL) & RFCORE_SFR_MTCTRL_RUN)
+        return;
+
     mactimer.superframe_order = 15;
 
+    ENTER_CRITICAL();
+
     /* Reset the MAC timer */
     HWREG(RFCORE_SFR_MTCTRL) &= ~RFCORE_SFR_MTCTRL_RUN;
     HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CTR |
@@ -97,68 +138,99 @@ ws_radio_timer_init(ws_radio_timer_callback_t cb)
     HWREG(RFCORE_SFR_MTM0) = 0x03;
     HWREG(RFCORE_SFR_MTM1) = 0x02;
 
-    /* Interrupt on overflow counter compare 1 */
-    HWREG(RFCORE_SFR_MTIRQM) |= RFCORE_SFR_MTIRQM_MACTIMER_OVF_COMPARE1M;
+    EXIT_CRITICAL();
+
+    /* Interrupt on overflow counter compare 2, which wakes the OS. The slot
+     * interrupt on compare 1 is enabled separately. */
+    HWREG(RFCORE_SFR_MTIRQM) |= RFCORE_SFR_MTIRQM_MACTIMER_OVF_COMPARE2M;
 
     IntRegister(INT_MACTIMR, &mactimer_handler);
+    IntEnable(INT_MACTIMR);
 
-    ws_radio_timer_syncronise();
+    mactimer_syncronise(NULL);
 
     HWREG(RFCORE_SFR_MTCTRL) |= RFCORE_SFR_MTCTRL_RUN;
 }
 
 
-void
-ws_radio_timer_syncronise(void)
+static void
+mactimer_init(void *dev, ws_radio_timer_callback_t cb, void *arg)
 {
-    uint32_t time;
+    UNUSED(dev);
 
-    HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CTR;
-    time = HWREG(RFCORE_SFR_MTMOVF0);
-    time |= HWREG(RFCORE_SFR_MTMOVF1) << 8;
-    time |= HWREG(RFCORE_SFR_MTMOVF2) << 16;
-
-    time += (WS_RADIO_SLOT_DURATION << mactimer.superframe_order);
+    mactimer.timer_cb = cb;
+    mactimer.timer_arg = arg;
 
-    HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CMP1;
-    HWREG(RFCORE_SFR_MTMOVF0) = time & 0xff;
-    HWREG(RFCORE_SFR_MTMOVF1) = (time >> 8) & 0xff;
-    HWREG(RFCORE_SFR_MTMOVF2) = (time >> 16) & 0xff;
+    cc2538_mactimer_start();
 }
 
 
-void
-ws_radio_timer_set_superframe_order(uint8_t superframe_order)
+static void
+mactimer_set_superframe_order(void *dev, uint8_t superframe_order)
 {
+    UNUSED(dev);
     mactimer.superframe_order = superframe_order;
 }
 
 
-void
-ws_radio_timer_enable_interrupts(void)
+static void
+mactimer_enable_interrupts(void *dev)
 {
+    UNUSED(dev);
     WS_DEBUG("enable interrupts\n");
-    IntEnable(INT_MACTIMR);
+    HWREG(RFCORE_SFR_MTIRQM) |= RFCORE_SFR_MTIRQM_MACTIMER_OVF_COMPARE1M;
 }
 
 
-void
-ws_radio_timer_disable_interrupts(void)
+static void
+mactimer_disable_interrupts(void *dev)
 {
-    IntDisable(INT_MACTIMR);
+    UNUSED(dev);
+    HWREG(RFCORE_SFR_MTIRQM) &= ~RFCORE_SFR_MTIRQM_MACTIMER_OVF_COMPARE1M;
 }
 
 
 uint32_t
-ws_radio_timer_get_time()
+cc2538_mactimer_get_time(void)
 {
     uint32_t time;
 
+    ENTER_CRITICAL();
     HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CTR;
     time = HWREG(RFCORE_SFR_MTMOVF0);
     time |= HWREG(RFCORE_SFR_MTMOVF1) << 8;
     time |= HWREG(RFCORE_SFR_MTMOVF2) << 16;
+    EXIT_CRITICAL();
 
     return time;
 }
 
+
+void
+cc2538_mactimer_set_compare(uint32_t time)
+{
+    ENTER_CRITICAL();
+    HWREG(RFCORE_SFR_MTMSEL) = CC2538_MACTIMER_SEL_OVF_CMP2;
+    HWREG(RFCORE_SFR_MTMOVF0) = time & 0xff;
+    HWREG(RFCORE_SFR_MTMOVF1) = (time >> 8) & 0xff;
+    HWREG(RFCORE_SFR_MTMOVF2) = (time >> 16) & 0xff;
+    EXIT_CRITICAL();
+}
+
+
+static uint32_t
+mactimer_get_time(void *dev)
+{
+    UNUSED(dev);
+    return cc2538_mactimer_get_time();
+}
+
+
+const ws_radio_timer_ops_t cc2538_mactimer_ops = {
+    .init = mactimer_init,
+    .syncronise = mactimer_syncronise,
+    .set_superframe_order = mactimer_set_superframe_order,
+    .enable_interrupts = mactimer_enable_interrupts,
+    .disable_interrupts = mactimer_disable_interrupts,
+    .get_time = mactimer_get_time,
+};
@@ -49,4 +49,35 @@
 #define CC2538_MACTIMER_SEL_CMP2 (0x4)
 
 
+/**
+ * The slot timer operations, used by \see ws_radio_cc2538
+ */
+extern const ws_radio_timer_ops_t cc2538_mactimer_ops;
+
+
+/**
+ * Start the MAC timer, if it isn't already running. The OS uses it as the
+ * clock for its timers, so starts it before the MAC does.
+ */
+extern void
+cc2538_mactimer_start(void);
+
+
+/**
+ * \return the current time, in symbols, of the MAC timer
+ */
+extern uint32_t
+cc2538_mactimer_get_time(void);
+
+
+/**
+ * Generate an interrupt when the MAC timer reaches a given time. This is
+ * separate from the slot interrupt, and is used by the operating system to
+ * wake up for the next software timer.
+ * \param time the time, in symbols, to interrupt at
+ */
+extern void
+cc2538_mactimer_set_compare(uint32_t time);
+
+
 #endif /* _CC2538_MACTIMER_H */
@@ -30,6 +30,7 @@
  */
 
 #include "rfcore.h"
+#include "mactimer.h"
 
 #include "hw_types.h"
 #include "hw_memmap.h"
@@ -39,6 +40,7 @@
 #include "hw_rfcore_sfr.h"
 #include "hw_rfcore_xreg.h"
 #include "hw_ana_regs.h"
+#include "hw_soc_adc.h"
 
 #include "sys_ctrl.h"
 #include "interrupt.h"
@@ -57,10 +59,22 @@
 #endif
 
 
+/* The RSSI the radio reports is this many dB above the signal strength
+ * in dBm, see the CC2538 user's guide */
+#define RSSI_OFFSET (73)
+
+/* Symbols to wait for a frame to leave before it's given up on. The
+ * longest frame takes (6 + 127) * 2 symbols with its SHR and PHR. */
+#define TXDONE_TIMEOUT ((6 + WS_RADIO_MAX_PACKET_LEN) * 2 * 2)
+
+
 struct
 {
     ws_radio_rx_callback_t cb;
+    void *arg;
     bool is_on;
+    volatile bool tx_active;
+    uint8_t channel;
 } radio_state;
 
 
@@ -89,20 +103,47 @@ csp_run_instruction(csp_opcode_t inst)
 }
 
 
+/* Empty the TX FIFO. Anything that was on the air has either gone or been
+ * cut off, and an aborted frame never raises TXDONE, so nothing is active
+ * afterwards. */
+static void
+tx_flush(void)
+{
+    csp_run_instruction(CSP_OPCODE_ISFLUSHTX);
+    radio_state.tx_active = false;
+
+    HWREG(RFCORE_SFR_RFIRQF1) &= ~RFCORE_SFR_RFIRQF1_TXDONE;
+}
+
+
 /*
  * Interrupts
  */
+static void
+tx_done(void)
+{
+    /* The frame has left, and the radio has gone back to RX by itself.
+     * Higher layer will handle re-transmissions. */
+    tx_flush();
+}
+
+
 static void
 rf_isr(void)
 {
     int i;
     uint8_t *buf, len;
     uint32_t flags;
+    ws_pktbuf_meta_t meta;
 
     flags = HWREG(RFCORE_SFR_RFIRQF0);
 
     if (flags & RFCORE_SFR_RFIRQF0_FIFOP)
     {
+        /* FIFOP goes off once the whole frame is in, so the SFD ended
+         * about as long ago as the rest of the frame took to arrive */
+        meta.timestamp = cc2538_mactimer_get_time();
+
         len = HWREG(RFCORE_XREG_RXFIFOCNT);
 
         /* Pull the data from the radio */
@@ -111,15 +152,24 @@ rf_isr(void)
             rx_buf[i] = (uint8_t)HWREG(RFCORE_SFR_RFDATA);
         }
 
-        /* Pass the data up the stack */
-        if (radio_state.cb != NULL)
+        /* Pass the data up the stack. The radio puts the RSSI, the CRC OK
+         * flag and the correlation value in place of the FCS. */
+        if (radio_state.cb != NULL && len > WS_RADIO_CHECKSUM_LEN)
         {
-            radio_state.cb(rx_buf, len);
+            meta.timestamp -= (uint32_t)len * 2;
+            meta.rssi = (int8_t)rx_buf[len - 2] - RSSI_OFFSET;
+            meta.lqi = WS_RADIO_LQI_FROM_CORRELATION(rx_buf[len - 1] & 0x7f);
+            meta.crc_ok = (rx_buf[len - 1] & 0x80) != 0;
+            meta.channel = radio_state.channel;
+            radio_state.cb(radio_state.arg, rx_buf, len, &meta);
         }
 
         /* Clear the flag */
         HWREG(RFCORE_SFR_RFIRQF0) &= ~RFCORE_SFR_RFIRQF0_FIFOP;
     }
+
+    if (HWREG(RFCORE_SFR_RFIRQF1) & RFCORE_SFR_RFIRQF1_TXDONE)
+        tx_done();
 }
 
 
@@ -147,7 +197,7 @@ rf_err_isr(void)
     }
     else if (flags & RFCORE_SFR_RFERRF_TXUNDERF)
     {
-        csp_run_instruction(CSP_OPCODE_ISFLUSHTX);
+        tx_flush();
     }
     else
     {
@@ -157,11 +207,14 @@ rf_err_isr(void)
 
 
 /*
- * Public API
+ * Radio operations. There's only the one radio core, so the device pointer
+ * isn't used.
  */
-void
-ws_radio_init(void)
+static void
+rfcore_init(void *dev)
 {
+    UNUSED(dev);
+
     WS_DEBUG("init\n");
 
     /* Reset state */
@@ -196,8 +249,9 @@ ws_radio_init(void)
     /* Set the TX output power */
     HWREG(RFCORE_XREG_TXPOWER) = CC2538_RFCORE_TX_POWER;
 
-    /* Interrupt wth FIFOP signal */
+    /* Interrupt wth FIFOP signal, and once a frame has been sent */
     HWREG(RFCORE_XREG_RFIRQM0) = 0x04;
+    HWREG(RFCORE_XREG_RFIRQM1) = RFCORE_XREG_RFIRQM1_TXDONE;
     IntRegister(INT_RFCORERTX, &rf_isr);
     IntEnable(INT_RFCORERTX);
 
@@ -215,25 +269,30 @@ ws_radio_init(void)
 }
 
 
-void
-ws_radio_set_channel(uint8_t channel)
+static void
+rfcore_set_channel(void *dev, uint8_t channel)
 {
+    UNUSED(dev);
+
     ASSERT(channel >= WS_RADIO_MIN_CHANNEL &&
            channel <= WS_RADIO_MAX_CHANNEL,
            "Invalid radio channel %u\n", channel);
 
     HWREG(RFCORE_XREG_FREQCTRL) = channel;
+    radio_state.channel = channel;
 
     csp_run_instruction(CSP_OPCODE_ISRXOFF);
-    csp_run_instruction(CSP_OPCODE_ISFLUSHTX);
+    tx_flush();
     csp_run_instruction(CSP_OPCODE_ISFLUSHRX);
     csp_run_instruction(CSP_OPCODE_ISRXON);
 }
 
 
-void
-ws_radio_set_power(bool on)
+static void
+rfcore_set_power(void *dev, bool on)
 {
+    UNUSED(dev);
+
     if (on)
     {
         csp_run_instruction(CSP_OPCODE_ISRXON);
@@ -241,22 +300,31 @@ ws_radio_set_power(bool on)
     else
     {
         csp_run_instruction(CSP_OPCODE_ISRXOFF);
+
+        /* That cuts off a frame on the air, which is lost. A frame still
+         * waiting in the FIFO is kept for when the radio is back on. */
+        if (radio_state.tx_active)
+            tx_flush();
     }
 
     radio_state.is_on = on;
 }
 
 
-void
-ws_radio_set_rx_callback(ws_radio_rx_callback_t cb)
+static void
+rfcore_set_rx_callback(void *dev, ws_radio_rx_callback_t cb, void *arg)
 {
+    UNUSED(dev);
     radio_state.cb = cb;
+    radio_state.arg = arg;
 }
 
 
-bool
-ws_radio_cca(void)
+static bool
+rfcore_cca(void *dev)
 {
+    UNUSED(dev);
+
 #if 0
     if (!radio_state.is_on)
         return false;
@@ -273,99 +341,138 @@ ws_radio_cca(void)
 }
 
 
-void
-ws_radio_prepare(ws_pktbuf_t *pkt)
+static void
+rfcore_prepare(void *dev, ws_pktbuf_t *pkt)
 {
     int i;
-    uint32_t len = ws_pktbuf_get_len(pkt);
-    uint8_t *data = ws_pktbuf_get_data(pkt);
+    uint32_t len = ws_pktbuf_get_chain_len(pkt);
+    uint32_t seg_len;
+    uint32_t start;
+    uint8_t *data;
+
+    UNUSED(dev);
 
     ASSERT(len <= WS_RADIO_MAX_PACKET_LEN, "invalid packet size: %u\n", len);
 
+    /* The FIFO is flushed once the frame on the air has gone, which would
+     * take this one with it. This may be called from an interrupt that
+     * holds off TXDONE, so poll the flag rather than wait for the handler.
+     * If the frame was cut off, TXDONE never comes, so don't wait for
+     * longer than any frame could take. */
+    if (radio_state.tx_active)
+    {
+        start = cc2538_mactimer_get_time();
+        while (!(HWREG(RFCORE_SFR_RFIRQF1) & RFCORE_SFR_RFIRQF1_TXDONE))
+        {
+            if (((cc2538_mactimer_get_time() - start) & 0xffffff) >
+                TXDONE_TIMEOUT)
+            {
+                WS_WARN("no TXDONE for the frame on the air\n");
+                break;
+            }
+        }
+        tx_flush();
+    }
+
     /* Copy the PHY len field */
     HWREG(RFCORE_SFR_RFDATA) = len + WS_RADIO_CHECKSUM_LEN;
 
-    /* Copy the data into the buffer */
-    for (i = 0; i < len; i++)
+    /* Copy the data into the buffer, a segment at a time */
+    for (; pkt != NULL; pkt = ws_pktbuf_get_next(pkt))
     {
-        HWREG(RFCORE_SFR_RFDATA) = data[i];
+        data = ws_pktbuf_get_data(pkt);
+        seg_len = ws_pktbuf_get_len(pkt);
+        for (i = 0; i < seg_len; i++)
+        {
+            HWREG(RFCORE_SFR_RFDATA) = data[i];
+        }
     }
 }
 
 
-void
-ws_radio_transmit(void)
+static void
+rfcore_transmit(void *dev)
 {
+    UNUSED(dev);
+
     ASSERT(radio_state.is_on, "Radio is not powered!\n");
 
     /* There's no data to be sent */
     if (HWREG(RFCORE_XREG_TXFIFOCNT) == 0)
         return;
 
-    /* Turn on the radio and wait for the data to be sent */
-    csp_run_instruction(CSP_OPCODE_ISTXON);
-
-    /* TODO: If the radio doesn't turn on we'll get stuck here! */
-    while (!(HWREG(RFCORE_XREG_FSMSTAT1) & RFCORE_XREG_FSMSTAT1_TX_ACTIVE))
-        ;
-    while (HWREG(RFCORE_XREG_FSMSTAT1) & RFCORE_XREG_FSMSTAT1_TX_ACTIVE)
-        ;
-
-    /* Higher layer will handle re-transmissions */
-    csp_run_instruction(CSP_OPCODE_ISFLUSHTX);
+    /* Only one frame can be on the air at a time */
+    if (radio_state.tx_active)
+        return;
 
-    /* Return to RX mode */
-    csp_run_instruction(CSP_OPCODE_ISRXON);
+    /* Send the frame without waiting for it to leave. The TXDONE interrupt
+     * flushes the FIFO afterwards, so the MAC can get on with other work
+     * for the airtime. */
+    radio_state.tx_active = true;
+    csp_run_instruction(CSP_OPCODE_ISTXON);
 }
 
 
-bool
-ws_radio_tx_has_data(void)
+static bool
+rfcore_tx_has_data(void *dev)
 {
     uint32_t fifo_len = HWREG(RFCORE_XREG_TXFIFOCNT);
-    return fifo_len > 0;
+
+    UNUSED(dev);
+
+    /* A frame on the air has already been sent, as far as the MAC cares */
+    return fifo_len > 0 && !radio_state.tx_active;
 }
 
-void
-ws_radio_tx_clear(void)
+static void
+rfcore_tx_clear(void *dev)
 {
-    csp_run_instruction(CSP_OPCODE_ISFLUSHTX);
+    UNUSED(dev);
+    tx_flush();
 }
 
 
-void
-ws_radio_enter_critical(void)
+static void
+rfcore_enter_critical(void *dev)
 {
+    UNUSED(dev);
     IntDisable(INT_RFCORERTX);
 }
 
 
-void
-ws_radio_exit_critical(void)
+static void
+rfcore_exit_critical(void *dev)
 {
+    UNUSED(dev);
     IntEnable(INT_RFCORERTX);
 }
 
 
-void
-ws_radio_set_pan_id(uint16_t pan_id)
+static void
+rfcore_set_pan_id(void *dev, uint16_t pan_id)
 {
+    UNUSED(dev);
+
     HWREG(RFCORE_FFSM_PAN_ID1) = (pan_id >> 8) & 0xff;
     HWREG(RFCORE_FFSM_PAN_ID0) = pan_id & 0xff;
 }
 
 
-void
-ws_radio_set_short_address(uint16_t short_addr)
+static void
+rfcore_set_short_address(void *dev, uint16_t short_addr)
 {
+    UNUSED(dev);
+
     HWREG(RFCORE_FFSM_SHORT_ADDR1) = (short_addr >> 8) & 0xff;
     HWREG(RFCORE_FFSM_SHORT_ADDR0) = short_addr & 0xff;
 }
 
 
-void
-ws_radio_set_extended_address(uint8_t *extended_addr)
+static void
+rfcore_set_extended_address(void *dev, uint8_t *extended_addr)
 {
+    UNUSED(dev);
+
     HWREG(RFCORE_FFSM_EXT_ADDR7) = extended_addr[7] & 0xff;
     HWREG(RFCORE_FFSM_EXT_ADDR6) = extended_addr[6] & 0xff;
     HWREG(RFCORE_FFSM_EXT_ADDR5) = extended_addr[5] & 0xff;
@@ -375,3 +482,64 @@ ws_radio_set_extended_address(uint8_t *extended_addr)
     HWREG(RFCORE_FFSM_EXT_ADDR1) = extended_addr[1] & 0xff;
     HWREG(RFCORE_FFSM_EXT_ADDR0) = extended_addr[0] & 0xff;
 }
+
+
+static const ws_radio_ops_t rfcore_ops = {
+    .init = rfcore_init,
+    .set_channel = rfcore_set_channel,
+    .set_rx_callback = rfcore_set_rx_callback,
+    .set_power = rfcore_set_power,
+    .cca = rfcore_cca,
+    .prepare = rfcore_prepare,
+    .transmit = rfcore_transmit,
+    .tx_has_data = rfcore_tx_has_data,
+    .tx_clear = rfcore_tx_clear,
+    .enter_critical = rfcore_enter_critical,
+    .exit_critical = rfcore_exit_critical,
+    .set_pan_id = rfcore_set_pan_id,
+    .set_short_address = rfcore_set_short_address,
+    .set_extended_address = rfcore_set_extended_address,
+};
+
+
+const ws_radio_t ws_radio_cc2538 = {
+    .ops = &rfcore_ops,
+    .dev = NULL,
+    .timer_ops = &cc2538_mactimer_ops,
+    .timer = NULL,
+};
+
+
+void
+cc2538_rfcore_seed_random(void)
+{
+    uint16_t seed = 0;
+    int i;
+
+    SysCtrlPeripheralEnable(SYS_CTRL_PERIPH_RFC);
+
+    /* Listen without looking for frames, until the RSSI is valid and the
+     * start up transients have died out, so that only noise is sampled */
+    HWREG(RFCORE_XREG_FRMCTRL0) = 2 << RFCORE_XREG_FRMCTRL0_RX_MODE_S;
+    csp_run_instruction(CSP_OPCODE_ISRXON);
+    while (!(HWREG(RFCORE_XREG_RSSISTAT) & RFCORE_XREG_RSSISTAT_RSSI_VALID))
+        ;
+
+    /* The low bit of the I channel ADC, one bit at a time */
+    for (i = 0; i < 16; i++)
+    {
+        seed = (seed << 1) |
+            (HWREG(RFCORE_XREG_RFRND) & RFCORE_XREG_RFRND_IRND);
+    }
+
+    csp_run_instruction(CSP_OPCODE_ISRXOFF);
+
+    /* The LFSR locks up with either of these */
+    if (seed == 0x0000 || seed == 0x8003)
+        seed = 0x2545;
+
+    /* Start the generator, and seed it high byte first */
+    HWREG(SOC_ADC_ADCCON1) &= ~SOC_ADC_ADCCON1_RCTRL_M;
+    HWREG(SOC_ADC_RNDL) = seed >> 8;
+    HWREG(SOC_ADC_RNDL) = seed & 0xff;
+}
@@ -51,4 +51,13 @@
 #define CC2538_RFCORE_TX_POWER (0xd5)
 
 
+/**
+ * Seed the SoC's random number generator from radio noise. This takes
+ * over the receiver for a moment, so it must be done before the radio is
+ * set up.
+ */
+extern void
+cc2538_rfcore_seed_random(void);
+
+
 #endif /* _CC2538_RFCORE_H */
@@ -0,0 +1,857 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "wsn.h"
+
+
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
+
+
+/* Link quality until a link is set up with ws_radio_sim_set_link */
+#define SIM_DEFAULT_RSSI (-50)
+
+/* Correlation value reported with every frame, as the CC2538 would for a
+ * clean signal */
+#define SIM_CORRELATION (108)
+
+/* See IEEE 802.15.4-2011 5.2.1.1 */
+#define FCF_FRAME_TYPE(fcf) ((fcf) & 0x07)
+#define FCF_ACK_REQ (1 << 5)
+#define FCF_PAN_ID_COMPRESSION (1 << 6)
+#define FCF_DEST_ADDR_MODE(fcf) (((fcf) >> 10) & 0x03)
+#define FCF_FRAME_VERSION(fcf) (((fcf) >> 12) & 0x03)
+#define FCF_SRC_ADDR_MODE(fcf) (((fcf) >> 14) & 0x03)
+
+#define FRAME_TYPE_BEACON (0x00)
+#define FRAME_TYPE_ACK (0x02)
+#define FRAME_TYPE_MAC (0x03)
+
+/* FCF and sequence number */
+#define ACK_LEN (3)
+
+
+typedef enum
+{
+    AIR_IDLE,                   /* Not transmitting */
+    AIR_TX,                     /* A frame from the TX FIFO is on the air */
+    AIR_ACK_WAIT,               /* Waiting for the turnaround time to ACK */
+    AIR_ACK,                    /* An ACK is on the air */
+} air_state_t;
+
+
+typedef struct
+{
+    uint8_t loss;
+    int8_t rssi;
+} link_t;
+
+
+struct ws_radio_sim_node_t
+{
+    uint16_t id;
+
+    /* Radio configuration */
+    bool is_on;
+    uint8_t channel;
+    uint16_t pan_id;
+    uint16_t short_addr;
+    uint8_t extended_addr[WS_MAC_ADDR_TYPE_EXTENDED_LEN];
+    ws_radio_rx_callback_t rx_cb;
+    void *rx_arg;
+
+    /* The TX FIFO */
+    uint8_t fifo[WS_RADIO_MAX_PACKET_LEN];
+    uint8_t fifo_len;
+
+    /* The frame this node has on the air, or the ACK it is about to send.
+     * A transmit while an ACK is due is held until the ACK has gone. */
+    air_state_t air_state;
+    uint8_t air[WS_RADIO_MAX_PACKET_LEN];
+    uint8_t air_len;
+    uint8_t air_channel;
+    uint32_t air_start;
+    bool tx_deferred;
+    ws_timer_t air_timer;
+
+    /* The frame this node is receiving. Anything else heard while it
+     * arrives destroys it. */
+    ws_radio_sim_node_t *rx_from;
+    bool rx_corrupt;
+
+    /* Slot timer */
+    ws_radio_timer_callback_t timer_cb;
+    void *timer_arg;
+    uint8_t superframe_order;
+    bool slot_enabled;
+    ws_timer_t slot_timer;
+    uint32_t last_time_read;
+
+    ws_radio_sim_stats_t stats;
+
+    /* Handed to the MAC, pointing back at this node */
+    ws_radio_t radio;
+};
+
+
+typedef struct
+{
+    ws_radio_sim_node_t nodes[WS_RADIO_SIM_MAX_NODES];
+    uint16_t node_cnt;
+
+    /* links[from][to] */
+    link_t links[WS_RADIO_SIM_MAX_NODES][WS_RADIO_SIM_MAX_NODES];
+
+    uint32_t random;
+} medium_t;
+
+static medium_t medium;
+
+
+static uint32_t
+sim_random(void)
+{
+    /* xorshift32, kept apart from the OS generator so that link losses
+     * don't change the MAC's backoffs */
+    uint32_t x = medium.random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    medium.random = x;
+
+    return x;
+}
+
+
+static inline bool
+is_transmitting(ws_radio_sim_node_t *node)
+{
+    return node->air_state == AIR_TX || node->air_state == AIR_ACK;
+}
+
+
+/* Can the frame a node is transmitting be heard by another? */
+static bool
+can_hear(ws_radio_sim_node_t *from, ws_radio_sim_node_t *to)
+{
+    return to->is_on && to->channel == from->air_channel &&
+        medium.links[from->id][to->id].loss < WS_RADIO_SIM_OUT_OF_RANGE;
+}
+
+
+/* Is anything other than ignore on the air where node can hear it? */
+static bool
+channel_busy(ws_radio_sim_node_t *node, ws_radio_sim_node_t *ignore)
+{
+    ws_radio_sim_node_t *n;
+    uint16_t i;
+
+    for (i = 0; i < medium.node_cnt; i++)
+    {
+        n = &medium.nodes[i];
+        if (n != node && n != ignore && is_transmitting(n) &&
+            can_hear(n, node))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+static uint8_t
+addr_len(uint8_t mode)
+{
+    switch (mode)
+    {
+    case WS_MAC_ADDR_TYPE_NONE:
+        return 0;
+    case WS_MAC_ADDR_TYPE_SHORT:
+        return 2;
+    case WS_MAC_ADDR_TYPE_EXTENDED:
+        return WS_MAC_ADDR_TYPE_EXTENDED_LEN;
+    default:
+        return 0xff;
+    }
+}
+
+
+/* Frame filtering as the CC2538 does it - see IEEE 802.15.4-2011 5.1.6.2.
+ * Sets send_ack if the frame should be acknowledged automatically */
+static bool
+accept_frame(ws_radio_sim_node_t *node, const uint8_t *data, uint8_t len,
+             bool *send_ack)
+{
+    const uint8_t *ptr;
+    uint16_t fcf, pan_id, short_addr;
+    uint8_t type, dest_mode, src_mode;
+    uint32_t needed;
+    bool broadcast = false;
+
+    *send_ack = false;
+
+    if (len < ACK_LEN)
+        return false;
+
+    fcf = data[0] | (data[1] << 8);
+    type = FCF_FRAME_TYPE(fcf);
+    dest_mode = FCF_DEST_ADDR_MODE(fcf);
+    src_mode = FCF_SRC_ADDR_MODE(fcf);
+
+    if (type > FRAME_TYPE_MAC ||
+        FCF_FRAME_VERSION(fcf) > WS_MAC_MAX_FRAME_VERSION)
+    {
+        return false;
+    }
+
+    /* ACKs carry no addresses */
+    if (type == FRAME_TYPE_ACK)
+        return true;
+
+    if (addr_len(dest_mode) == 0xff || addr_len(src_mode) == 0xff)
+        return false;
+
+    needed = ACK_LEN;
+    if (dest_mode != WS_MAC_ADDR_TYPE_NONE)
+        needed += 2 + addr_len(dest_mode);
+    if (src_mode != WS_MAC_ADDR_TYPE_NONE)
+    {
+        needed += addr_len(src_mode);
+        if (!(fcf & FCF_PAN_ID_COMPRESSION))
+            needed += 2;
+    }
+    if (needed > len)
+        return false;
+
+    ptr = data + ACK_LEN;
+
+    if (dest_mode != WS_MAC_ADDR_TYPE_NONE)
+    {
+        pan_id = ptr[0] | (ptr[1] << 8);
+        ptr += 2;
+        if (pan_id != 0xffff && pan_id != node->pan_id)
+            return false;
+
+        if (dest_mode == WS_MAC_ADDR_TYPE_SHORT)
+        {
+            short_addr = ptr[0] | (ptr[1] << 8);
+            broadcast = short_addr == 0xffff;
+            if (!broadcast && short_addr != node->short_addr)
+                return false;
+        }
+        else if (memcmp(ptr, node->extended_addr,
+                        WS_MAC_ADDR_TYPE_EXTENDED_LEN) != 0)
+        {
+            return false;
+        }
+
+        ptr += addr_len(dest_mode);
+    }
+
+    /* Beacons must come from our PAN, unless we haven't joined one */
+    if (type == FRAME_TYPE_BEACON)
+    {
+        if (src_mode == WS_MAC_ADDR_TYPE_NONE)
+            return false;
+
+        if (!(fcf & FCF_PAN_ID_COMPRESSION))
+        {
+            pan_id = ptr[0] | (ptr[1] << 8);
+            if (node->pan_id != 0xffff && pan_id != node->pan_id)
+                return false;
+        }
+    }
+
+    *send_ack = (fcf & FCF_ACK_REQ) &&
+        dest_mode != WS_MAC_ADDR_TYPE_NONE && !broadcast;
+
+    return true;
+}
+
+
+static void
+receive_frame(ws_radio_sim_node_t *from, ws_radio_sim_node_t *to)
+{
+    uint8_t buf[1 + WS_RADIO_MAX_PACKET_LEN + WS_RADIO_CHECKSUM_LEN];
+    link_t *link = &medium.links[from->id][to->id];
+    ws_pktbuf_meta_t meta;
+    bool send_ack;
+
+    if (to->rx_corrupt)
+    {
+        to->stats.rx_collisions++;
+        return;
+    }
+
+    if (link->loss > 0 && sim_random() % 100 < link->loss)
+    {
+        to->stats.rx_lost++;
+        return;
+    }
+
+    if (!accept_frame(to, from->air, from->air_len, &send_ack))
+    {
+        to->stats.rx_filtered++;
+        return;
+    }
+
+    /* The ACK goes out after the turnaround time, whatever the MAC makes of
+     * the frame */
+    if (send_ack && to->air_state == AIR_IDLE)
+    {
+        to->air[0] = FRAME_TYPE_ACK;
+        to->air[1] = 0;
+        to->air[2] = from->air[2];
+        to->air_len = ACK_LEN;
+        to->air_state = AIR_ACK_WAIT;
+        ws_timer_set(&to->air_timer, WS_RADIO_SIM_TURNAROUND);
+    }
+
+    to->stats.rx_frames++;
+
+    if (to->rx_cb == NULL)
+        return;
+
+    /* Pass the frame up as the CC2538 does: the PHY length first, then the
+     * frame, with the RSSI and the CRC OK flag and correlation value in
+     * place of the FCS */
+    buf[0] = from->air_len + WS_RADIO_CHECKSUM_LEN;
+    memcpy(&buf[1], from->air, from->air_len);
+    buf[1 + from->air_len] = (uint8_t)link->rssi;
+    buf[2 + from->air_len] = 0x80 | SIM_CORRELATION;
+
+    /* Every node shares the clock, so the SFD time is the same for all */
+    meta.timestamp = from->air_start + WS_RADIO_SHR_DURATION;
+    meta.rssi = link->rssi;
+    meta.lqi = WS_RADIO_LQI_FROM_CORRELATION(SIM_CORRELATION);
+    meta.channel = from->air_channel;
+    meta.crc_ok = true;
+
+    to->rx_cb(to->rx_arg, buf, from->air_len + 1 + WS_RADIO_CHECKSUM_LEN,
+              &meta);
+}
+
+
+static void
+start_frame(ws_radio_sim_node_t *node, air_state_t state)
+{
+    ws_radio_sim_node_t *n;
+    uint16_t i;
+
+    WS_DEBUG("node %u: start (len=%u, channel=%u)\n",
+             node->id, node->air_len, node->channel);
+
+    node->air_state = state;
+    node->air_channel = node->channel;
+    node->air_start = ws_timer_get_time();
+
+    /* The radio is half duplex, so anything it was receiving is lost */
+    node->rx_from = NULL;
+
+    for (i = 0; i < medium.node_cnt; i++)
+    {
+        n = &medium.nodes[i];
+        if (n == node || is_transmitting(n) || !can_hear(node, n))
+            continue;
+
+        if (n->rx_from != NULL)
+        {
+            /* Both frames are lost */
+            n->rx_corrupt = true;
+        }
+        else if (!channel_busy(n, node))
+        {
+            n->rx_from = node;
+            n->rx_corrupt = false;
+        }
+    }
+
+    ws_timer_set(&node->air_timer, WS_RADIO_SIM_AIRTIME(node->air_len));
+}
+
+
+static void
+send_fifo(ws_radio_sim_node_t *node)
+{
+    memcpy(node->air, node->fifo, node->fifo_len);
+    node->air_len = node->fifo_len;
+    node->fifo_len = 0;
+
+    node->stats.tx_frames++;
+    start_frame(node, AIR_TX);
+}
+
+
+static void
+end_frame(ws_radio_sim_node_t *node)
+{
+    ws_radio_sim_node_t *n;
+    uint16_t i;
+
+    WS_DEBUG("node %u: end\n", node->id);
+
+    node->air_state = AIR_IDLE;
+
+    for (i = 0; i < medium.node_cnt; i++)
+    {
+        n = &medium.nodes[i];
+        if (n->rx_from == node)
+        {
+            n->rx_from = NULL;
+            receive_frame(node, n);
+        }
+    }
+
+    if (node->tx_deferred && node->air_state == AIR_IDLE)
+    {
+        node->tx_deferred = false;
+        if (node->fifo_len > 0)
+            send_fifo(node);
+    }
+}
+
+
+static void
+air_timer_fired(void *arg)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)arg;
+
+    switch (node->air_state)
+    {
+    case AIR_ACK_WAIT:
+        if (!node->is_on)
+        {
+            node->air_state = AIR_IDLE;
+            break;
+        }
+        node->stats.tx_acks++;
+        start_frame(node, AIR_ACK);
+        break;
+
+    case AIR_TX:
+    case AIR_ACK:
+        end_frame(node);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+static void
+arm_slot_timer(ws_radio_sim_node_t *node)
+{
+    if (node->slot_enabled)
+    {
+        ws_timer_set(&node->slot_timer,
+                     WS_RADIO_SLOT_DURATION << node->superframe_order);
+    }
+}
+
+
+static void
+slot_timer_fired(void *arg)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)arg;
+
+    if (node->timer_cb != NULL)
+        node->timer_cb(node->timer_arg);
+
+    arm_slot_timer(node);
+}
+
+
+static void
+reset_radio(ws_radio_sim_node_t *node)
+{
+    ws_timer_cancel(&node->slot_timer);
+
+    node->is_on = false;
+    node->channel = WS_RADIO_MIN_CHANNEL;
+    node->pan_id = 0xffff;
+    node->short_addr = 0xffff;
+    memset(node->extended_addr, 0, WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+    node->rx_cb = NULL;
+    node->rx_arg = NULL;
+    node->fifo_len = 0;
+    node->tx_deferred = false;
+    node->rx_from = NULL;
+    node->timer_cb = NULL;
+    node->timer_arg = NULL;
+    node->superframe_order = 15;
+    node->slot_enabled = false;
+}
+
+
+/*
+ * Radio operations
+ */
+static void
+sim_init(void *dev)
+{
+    reset_radio((ws_radio_sim_node_t *)dev);
+}
+
+
+static void
+sim_set_channel(void *dev, uint8_t channel)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    ASSERT(channel >= WS_RADIO_MIN_CHANNEL &&
+           channel <= WS_RADIO_MAX_CHANNEL,
+           "Invalid radio channel %u\n", channel);
+
+    /* Retuning flushes both FIFOs */
+    node->channel = channel;
+    node->fifo_len = 0;
+    node->tx_deferred = false;
+    node->rx_from = NULL;
+}
+
+
+static void
+sim_set_rx_callback(void *dev, ws_radio_rx_callback_t cb, void *arg)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    node->rx_cb = cb;
+    node->rx_arg = arg;
+}
+
+
+static void
+sim_set_power(void *dev, bool on)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    node->is_on = on;
+    if (!on)
+        node->rx_from = NULL;
+}
+
+
+static bool
+sim_cca(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    if (!node->is_on || is_transmitting(node))
+        return false;
+
+    return !channel_busy(node, NULL);
+}
+
+
+static void
+sim_prepare(void *dev, ws_pktbuf_t *pkt)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+    uint32_t len = ws_pktbuf_get_chain_len(pkt);
+    uint32_t seg_len;
+    uint8_t *ptr = node->fifo;
+
+    ASSERT(len <= WS_RADIO_MAX_PACKET_LEN, "invalid packet size: %u\n", len);
+
+    for (; pkt != NULL; pkt = ws_pktbuf_get_next(pkt))
+    {
+        seg_len = ws_pktbuf_get_len(pkt);
+        memcpy(ptr, ws_pktbuf_get_data(pkt), seg_len);
+        ptr += seg_len;
+    }
+    node->fifo_len = (uint8_t)len;
+}
+
+
+static void
+sim_transmit(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    ASSERT(node->is_on, "Radio is not powered!\n");
+
+    /* There's no data to be sent */
+    if (node->fifo_len == 0)
+        return;
+
+    switch (node->air_state)
+    {
+    case AIR_IDLE:
+        send_fifo(node);
+        break;
+
+    case AIR_ACK_WAIT:
+    case AIR_ACK:
+        node->tx_deferred = true;
+        break;
+
+    default:
+        WS_WARN("node %u: already transmitting\n", node->id);
+        break;
+    }
+}
+
+
+static bool
+sim_tx_has_data(void *dev)
+{
+    return ((ws_radio_sim_node_t *)dev)->fifo_len > 0;
+}
+
+
+static void
+sim_tx_clear(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    node->fifo_len = 0;
+    node->tx_deferred = false;
+}
+
+
+static void
+sim_enter_critical(void *dev)
+{
+    /* Frames arrive from timers in the main loop, so there is nothing to
+     * hold off */
+    UNUSED(dev);
+}
+
+
+static void
+sim_exit_critical(void *dev)
+{
+    UNUSED(dev);
+}
+
+
+static void
+sim_set_pan_id(void *dev, uint16_t pan_id)
+{
+    ((ws_radio_sim_node_t *)dev)->pan_id = pan_id;
+}
+
+
+static void
+sim_set_short_address(void *dev, uint16_t short_addr)
+{
+    ((ws_radio_sim_node_t *)dev)->short_addr = short_addr;
+}
+
+
+static void
+sim_set_extended_address(void *dev, uint8_t *extended_addr)
+{
+    memcpy(((ws_radio_sim_node_t *)dev)->extended_addr, extended_addr,
+           WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+}
+
+
+/*
+ * Slot timer operations
+ */
+static void
+sim_timer_init(void *dev, ws_radio_timer_callback_t cb, void *arg)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    ws_timer_cancel(&node->slot_timer);
+    node->timer_cb = cb;
+    node->timer_arg = arg;
+    node->superframe_order = 15;
+    node->slot_enabled = false;
+}
+
+
+static void
+sim_timer_syncronise(void *dev)
+{
+    arm_slot_timer((ws_radio_sim_node_t *)dev);
+}
+
+
+static void
+sim_timer_set_superframe_order(void *dev, uint8_t superframe_order)
+{
+    ((ws_radio_sim_node_t *)dev)->superframe_order = superframe_order;
+}
+
+
+static void
+sim_timer_enable_interrupts(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    node->slot_enabled = true;
+    if (!ws_timer_is_active(&node->slot_timer))
+        arm_slot_timer(node);
+}
+
+
+static void
+sim_timer_disable_interrupts(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+
+    node->slot_enabled = false;
+    ws_timer_cancel(&node->slot_timer);
+}
+
+
+static uint32_t
+sim_timer_get_time(void *dev)
+{
+    ws_radio_sim_node_t *node = (ws_radio_sim_node_t *)dev;
+    uint32_t now = ws_timer_get_time();
+
+    /* A virtual clock only moves between events, so a caller polling it in
+     * a loop would wait forever. Reading it twice at the same instant
+     * costs a symbol, as the CPU would have spent spinning. */
+    if (ws_os_is_virtual_time() && now == node->last_time_read)
+    {
+        ws_os_advance_time(1);
+        now++;
+    }
+    node->last_time_read = now;
+
+    /* The CC2538 MAC timer overflow counter is 24 bits */
+    return now & 0xffffff;
+}
+
+
+static const ws_radio_ops_t sim_ops = {
+    .init = sim_init,
+    .set_channel = sim_set_channel,
+    .set_rx_callback = sim_set_rx_callback,
+    .set_power = sim_set_power,
+    .cca = sim_cca,
+    .prepare = sim_prepare,
+    .transmit = sim_transmit,
+    .tx_has_data = sim_tx_has_data,
+    .tx_clear = sim_tx_clear,
+    .enter_critical = sim_enter_critical,
+    .exit_critical = sim_exit_critical,
+    .set_pan_id = sim_set_pan_id,
+    .set_short_address = sim_set_short_address,
+    .set_extended_address = sim_set_extended_address,
+};
+
+
+static const ws_radio_timer_ops_t sim_timer_ops = {
+    .init = sim_timer_init,
+    .syncronise = sim_timer_syncronise,
+    .set_superframe_order = sim_timer_set_superframe_order,
+    .enable_interrupts = sim_timer_enable_interrupts,
+    .disable_interrupts = sim_timer_disable_interrupts,
+    .get_time = sim_timer_get_time,
+};
+
+
+/*
+ * Simulation API
+ */
+void
+ws_radio_sim_init(uint32_t seed)
+{
+    uint16_t i, j;
+
+    for (i = 0; i < medium.node_cnt; i++)
+    {
+        ws_timer_cancel(&medium.nodes[i].air_timer);
+        ws_timer_cancel(&medium.nodes[i].slot_timer);
+    }
+
+    memset(&medium, 0, sizeof(medium));
+    medium.random = seed != 0 ? seed : 0x2545f491;
+
+    for (i = 0; i < WS_RADIO_SIM_MAX_NODES; i++)
+    {
+        for (j = 0; j < WS_RADIO_SIM_MAX_NODES; j++)
+        {
+            medium.links[i][j].loss = 0;
+            medium.links[i][j].rssi = SIM_DEFAULT_RSSI;
+        }
+    }
+}
+
+
+ws_radio_sim_node_t *
+ws_radio_sim_add_node(void)
+{
+    ws_radio_sim_node_t *node;
+
+    if (medium.node_cnt == WS_RADIO_SIM_MAX_NODES)
+    {
+        WS_ERROR("simulated medium is full\n");
+        return NULL;
+    }
+
+    node = &medium.nodes[medium.node_cnt];
+    memset(node, 0, sizeof(ws_radio_sim_node_t));
+    node->id = medium.node_cnt++;
+    node->air_timer =
+        (ws_timer_t)WS_TIMER_INITIALISER(air_timer_fired, node);
+    node->slot_timer =
+        (ws_timer_t)WS_TIMER_INITIALISER(slot_timer_fired, node);
+    node->radio = (ws_radio_t){&sim_ops, node, &sim_timer_ops, node};
+    reset_radio(node);
+
+    return node;
+}
+
+
+const ws_radio_t *
+ws_radio_sim_get_radio(ws_radio_sim_node_t *node)
+{
+    return &node->radio;
+}
+
+
+void
+ws_radio_sim_set_link(ws_radio_sim_node_t *from, ws_radio_sim_node_t *to,
+                      uint8_t loss, int8_t rssi)
+{
+    ASSERT(loss <= WS_RADIO_SIM_OUT_OF_RANGE, "invalid loss %u\n", loss);
+
+    medium.links[from->id][to->id].loss = loss;
+    medium.links[from->id][to->id].rssi = rssi;
+}
+
+
+void
+ws_radio_sim_get_stats(ws_radio_sim_node_t *node,
+                       ws_radio_sim_stats_t *stats)
+{
+    *stats = node->stats;
+}
@@ -58,181 +58,317 @@
  */
 #define WS_RADIO_SLOT_DURATION (60)
 
+/**
+ * Symbols from the start of a frame to the end of its SFD: a 4 octet
+ * preamble and the SFD, at 2 symbols per octet
+ */
+#define WS_RADIO_SHR_DURATION (10)
+
+/**
+ * Link quality, from 0 to 255, for the chip correlation value the CC2538
+ * reports with each frame. This runs from about 50 for the weakest frames
+ * it can receive up to about 110.
+ */
+#define WS_RADIO_LQI_FROM_CORRELATION(corr) \
+    ((corr) <= 50 ? 0 : (corr) >= 110 ? 255 : \
+     (uint8_t)(((corr) - 50) * 255 / 60))
+
 
 /**
  * Used to pass data received by the radio to the packet scheduler
+ * \param arg the argument given with the callback
  * \param data the memory containing the data. This is freed when the
  *             callback returns.
  * \param len number of octets in the memory buffer
+ * \param meta what the radio measured while receiving the frame. This is
+ *             freed when the callback returns.
  */
-typedef void (*ws_radio_rx_callback_t)(const uint8_t *data, uint8_t len);
+typedef void (*ws_radio_rx_callback_t)(void *arg, const uint8_t *data,
+                                       uint8_t len,
+                                       const ws_pktbuf_meta_t *meta);
 
 
 /**
  * Used to inform the packet scheduler whenever the slot timer interrupts.
+ * \param arg the argument given with the callback
  */
-typedef void (*ws_radio_timer_callback_t)(void);
+typedef void (*ws_radio_timer_callback_t)(void *arg);
 
 
 /**
- * Prepare the radio for use. This must be called before any other
- * radio function
+ * Operations a radio backend provides. Each is handed the backend's own
+ * device pointer from \see ws_radio_t.
  */
-extern void
-ws_radio_init(void);
+typedef struct
+{
+    /**
+     * Prepare the radio for use. This must be called before any other
+     * radio operation
+     */
+    void (*init)(void *dev);
+
+    /**
+     * Set the IEEE 802.15.4 channel
+     * \param channel a number between 11 and 26 specifying the new channel
+     */
+    void (*set_channel)(void *dev, uint8_t channel);
+
+    /**
+     * Set a callback to receive data from the radio
+     * \param cb the function to call when data is received
+     * \param arg passed to cb
+     */
+    void (*set_rx_callback)(void *dev, ws_radio_rx_callback_t cb, void *arg);
+
+    /**
+     * Used to turn the radio on and off. When the radio is off, it should
+     * draw as little power as possible.
+     * \param on true to turn the radio on
+     */
+    void (*set_power)(void *dev, bool on);
+
+    /**
+     * Perform a clear channel assessment. If the radio is off, this will
+     * always return false to indicate the channel is not clear.
+     * \return true if the channel is clear
+     */
+    bool (*cca)(void *dev);
+
+    /**
+     * Copy data into the TX FIFO to be sent when transmit is called
+     * \param pkt pktbuf containing data to be sent. Chained pktbufs are
+     *            copied in segment by segment, as one frame
+     */
+    void (*prepare)(void *dev, ws_pktbuf_t *pkt);
+
+    /**
+     * Send the data in the TX FIFO
+     */
+    void (*transmit)(void *dev);
+
+    /**
+     * Query the state of the radio TX buffer
+     * \return true if there is data in the TX buffer
+     */
+    bool (*tx_has_data)(void *dev);
+
+    /**
+     * Clear the TX FIFO
+     */
+    void (*tx_clear)(void *dev);
+
+    /**
+     * Disable any interrupts that could cause the receive handler to be
+     * called.
+     */
+    void (*enter_critical)(void *dev);
+
+    /**
+     * Enable any interrupts that were disabled during the critical section
+     */
+    void (*exit_critical)(void *dev);
+
+    /**
+     * Inform the radio of the current PAN ID. This allows the radio to
+     * filter out packets in hardware or in software.
+     * \param pan_id the new PAN ID
+     */
+    void (*set_pan_id)(void *dev, uint16_t pan_id);
+
+    /**
+     * Inform the radio of the current short address. This allows the radio
+     * to filter out packets in hardware or in software.
+     * \param short_addr the new short address
+     */
+    void (*set_short_address)(void *dev, uint16_t short_addr);
+
+    /**
+     * Inform the radio of the current extended address. This allows the
+     * radio to filter out packets in hardware or in software.
+     * \param extended_addr the new extended address
+     */
+    void (*set_extended_address)(void *dev, uint8_t *extended_addr);
+} ws_radio_ops_t;
 
 
 /**
- * Set the IEEE 802.15.4 channel
- * \param channel a number between 11 and 26 specifying the new channel
+ * Operations on the radio's slot timer
  */
-extern void
-ws_radio_set_channel(uint8_t channel);
+typedef struct
+{
+    /**
+     * Prepare a timer used to generate interrupts every slot.
+     * \param cb Function to call at each slot interrupt. This is called
+     *           from an interrupt context.
+     * \param arg passed to cb
+     */
+    void (*init)(void *dev, ws_radio_timer_callback_t cb, void *arg);
+
+    /**
+     * Used to synchronise with the coordinator. Sets the slot timer
+     * interrupt to occur at the next slot
+     */
+    void (*syncronise)(void *dev);
+
+    /**
+     * Reconfigure the slot interrupt timing
+     */
+    void (*set_superframe_order)(void *dev, uint8_t superframe_order);
+
+    /**
+     * Enable interrupts at each slot
+     */
+    void (*enable_interrupts)(void *dev);
+
+    /**
+     * Disable interrupts at each slot
+     */
+    void (*disable_interrupts)(void *dev);
+
+    /**
+     * Get the current time, in symbols, of the radio timer
+     * \return the current time measured in symbols
+     */
+    uint32_t (*get_time)(void *dev);
+} ws_radio_timer_ops_t;
 
 
 /**
- * Set a callback to receive data from the radio
- * \param cb the function to call when data is received
+ * A radio backend, as handed to \see ws_mac_init. The MAC keeps a copy, so
+ * every operation costs a single indirect call.
  */
-extern void
-ws_radio_set_rx_callback(ws_radio_rx_callback_t cb);
+typedef struct
+{
+    const ws_radio_ops_t *ops;
+    void *dev;
+    const ws_radio_timer_ops_t *timer_ops;
+    void *timer;
+} ws_radio_t;
 
 
 /**
- * Used to turn the radio on and off. When the radio is off, it should draw
- * as little power as possible.
- * \param on true to turn the radio on
+ * Call a radio operation, e.g. WS_RADIO_CALL(radio, set_channel, 11)
  */
-extern void
-ws_radio_set_power(bool on);
-
+#define WS_RADIO_CALL(radio, op, ...) \
+    ((radio)->ops->op((radio)->dev, ##__VA_ARGS__))
 
 /**
- * Perform a clear channel assessment. If the radio is off, this will always
- * return false to indicate the channel is not clear.
- * \return true if the channel is clear
+ * Call a slot timer operation, e.g. WS_RADIO_TIMER_CALL(radio, get_time)
  */
-extern bool
-ws_radio_cca(void);
+#define WS_RADIO_TIMER_CALL(radio, op, ...) \
+    ((radio)->timer_ops->op((radio)->timer, ##__VA_ARGS__))
 
 
 /**
- * Copy data into the TX FIFO to be sent when \see ws_radio_transmit is called
- * \param pkt pktbuf containing data to be sent
+ * The CC2538 radio core and MAC timer
  */
-extern void
-ws_radio_prepare(ws_pktbuf_t *pkt);
-
+extern const ws_radio_t ws_radio_cc2538;
 
-/**
- * Send the data in the TX FIFO
- */
-extern void
-ws_radio_transmit(void);
 
+#if defined(WS_OS_POSIX)
 
-/**
- * Query the state of the radio TX buffer
- * \return true if there is data in the TX buffer
+/*
+ * Simulated radio medium
+ *
+ * On the host each node on the shared medium is a radio backend of its
+ * own. Frames take their real airtime on the OS timer clock, so a virtual
+ * clock (\see ws_os_set_virtual_time) runs a simulation as fast as
+ * possible and repeatably.
  */
-extern bool
-ws_radio_tx_has_data(void);
-
 
 /**
- * Clear the TX FIFO
+ * Maximum number of nodes on the simulated medium
  */
-extern void
-ws_radio_tx_clear(void);
-
+#ifndef WS_RADIO_SIM_MAX_NODES
+#define WS_RADIO_SIM_MAX_NODES (64)
+#endif
 
 /**
- * Disable any interrupts that could cause the receive handler to be called.
+ * Symbols between the end of a frame and the start of its ACK - see
+ * IEEE 802.15.4-2011 6.4.1 aTurnaroundTime
  */
-extern void
-ws_radio_enter_critical(void);
-
+#define WS_RADIO_SIM_TURNAROUND (12)
 
 /**
- * Enable any interrupts that were disabled during the critical section
+ * Symbols on the air for a frame of len octets, excluding the FCS. This
+ * includes the 5 octet synchronisation header, the PHY header and the FCS,
+ * at 2 symbols per octet.
  */
-extern void
-ws_radio_exit_critical(void);
-
+#define WS_RADIO_SIM_AIRTIME(len) \
+    ((uint32_t)(6 + (len) + WS_RADIO_CHECKSUM_LEN) * 2)
 
 /**
- * Inform the radio of the current PAN ID. This allows the radio to filter
- * out packets in hardware or in software.
- * \param pan_id the new PAN ID
+ * A link with this loss never delivers, and the transmitter can't be heard
+ * at all by CCA or as a collision.
  */
-extern void
-ws_radio_set_pan_id(uint16_t pan_id);
+#define WS_RADIO_SIM_OUT_OF_RANGE (100)
 
 
-/**
- * Inform the radio of the current short address. This allows the radio to
- * filter out packets in hardware or in software.
- * \param short_addr the new short address
- */
-extern void
-ws_radio_set_short_address(uint16_t short_addr);
+typedef struct ws_radio_sim_node_t ws_radio_sim_node_t;
 
 
-/**
- * Inform the radio of the current extended address. This allows the radio to
- * filter out packets in hardware or in software.
- * \param extended_addr the new extended address
- */
-extern void
-ws_radio_set_extended_address(uint8_t *extended_addr);
+typedef struct
+{
+    uint32_t tx_frames;         /* Frames sent, not counting ACKs */
+    uint32_t tx_acks;           /* ACKs sent automatically */
+    uint32_t rx_frames;         /* Frames passed to the rx callback */
+    uint32_t rx_filtered;       /* Frames dropped by address filtering */
+    uint32_t rx_collisions;     /* Frames destroyed by overlapping frames */
+    uint32_t rx_lost;           /* Frames dropped by link loss */
+} ws_radio_sim_stats_t;
+
 
-/*
- * Radio Timer
- */
 /**
- * Prepare a timer used to generate interrupts every slot.
- * \param cb Function to call at each slot interrupt. This is called from
- *           an interrupt context.
+ * Remove every node from the medium and reset the link table so that all
+ * nodes can hear each other perfectly. This must be called after
+ * \see ws_os_init, as that resets the timers the medium uses.
+ * \param seed seeds the link loss random numbers. The same seed gives the
+ *             same losses.
  */
 extern void
-ws_radio_timer_init(ws_radio_timer_callback_t cb);
+ws_radio_sim_init(uint32_t seed);
 
 
 /**
- * Used to synchronise with the coordinator. Sets the slot timer interrupt
- * to occur at the next slot
+ * Add a node to the medium. The new node's radio is off until it is set
+ * up through its radio operations.
+ * \return the new node, or NULL if the medium is full
  */
-extern void
-ws_radio_timer_syncronise(void);
+extern ws_radio_sim_node_t *
+ws_radio_sim_add_node(void);
 
 
 /**
- * Reconfigure the slot interrupt timing
+ * Get the radio backend for a node, to hand to \see ws_mac_init
+ * \param node the node
+ * \return the node's radio
  */
-extern void
-ws_radio_timer_set_superframe_order(uint8_t superframe_order);
+extern const ws_radio_t *
+ws_radio_sim_get_radio(ws_radio_sim_node_t *node);
 
 
 /**
- * Enable interrupts at each slot
+ * Set up the link from one node to another. Links are one way, so a
+ * symmetric link needs setting in both directions.
+ * \param from the transmitting node
+ * \param to the receiving node
+ * \param loss the percentage of frames lost, or WS_RADIO_SIM_OUT_OF_RANGE
+ * \param rssi the received signal strength in dBm
  */
 extern void
-ws_radio_timer_enable_interrupts(void);
+ws_radio_sim_set_link(ws_radio_sim_node_t *from, ws_radio_sim_node_t *to,
+                      uint8_t loss, int8_t rssi);
 
 
 /**
- * Disable interrupts at each slot
+ * \param node the node
+ * \param stats filled with the node's counters
  */
 extern void
-ws_radio_timer_disable_interrupts(void);
-
+ws_radio_sim_get_stats(ws_radio_sim_node_t *node,
+                       ws_radio_sim_stats_t *stats);
 
-/**
- * Get the current time, in symbols, of the radio timer
- * \return the current time measured in symbols
- */
-extern uint32_t
-ws_radio_timer_get_time();
+#endif /* WS_OS_POSIX */
 
 
 #endif /* _WS_RADIO_H */
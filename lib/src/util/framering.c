@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_framering.h"
+
+
+/* Each record starts with its length, padded to keep the records aligned.
+ * A length of WRAP means the rest of the block is unused and the next
+ * record is at the start. */
+#define HDR_LEN (4)
+#define WRAP (0xffffffff)
+
+#define HDR(fr, index) (*(uint32_t *)&(fr)->buffer[index])
+
+
+void
+ws_framering_init(ws_framering_t *fr, uint8_t *buf, uint32_t size)
+{
+    ASSERT(((uintptr_t)buf & 3) == 0 && (size & 3) == 0,
+           "frame ring must be aligned to 4 octets\n");
+
+    fr->buffer = buf;
+    fr->capacity = size;
+    fr->head = 0;
+    fr->tail = 0;
+    fr->reserved = 0;
+}
+
+
+uint8_t *
+ws_framering_reserve(ws_framering_t *fr, uint32_t len)
+{
+    uint32_t need = WS_FRAMERING_RECORD_SIZE(len);
+    uint32_t head = fr->head;
+    uint32_t tail = WS_LOAD_ACQUIRE(&fr->tail);
+    uint32_t pos;
+
+    /* The head may never catch up with the tail, as that would look like
+     * an empty ring */
+    if (head >= tail)
+    {
+        if (need < fr->capacity - head ||
+            (need == fr->capacity - head && tail != 0))
+        {
+            pos = head;
+        }
+        else if (need < tail)
+        {
+            /* Doesn't fit before the end, so start again at the front */
+            pos = 0;
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+    else if (need < tail - head)
+    {
+        pos = head;
+    }
+    else
+    {
+        return NULL;
+    }
+
+    fr->reserved = pos;
+
+    return &fr->buffer[pos + HDR_LEN];
+}
+
+
+void
+ws_framering_commit(ws_framering_t *fr, uint32_t len)
+{
+    uint32_t head = fr->head;
+    uint32_t pos = fr->reserved;
+    uint32_t next;
+
+    /* Records are aligned, so there's always room for the marker */
+    if (pos != head)
+        HDR(fr, head) = WRAP;
+
+    HDR(fr, pos) = len;
+
+    next = pos + WS_FRAMERING_RECORD_SIZE(len);
+    if (next == fr->capacity)
+        next = 0;
+
+    /* Hand the record over only once it's all in the ring */
+    WS_STORE_RELEASE(&fr->head, next);
+}
+
+
+uint8_t *
+ws_framering_peek(ws_framering_t *fr, uint32_t *len)
+{
+    uint32_t head = WS_LOAD_ACQUIRE(&fr->head);
+    uint32_t tail = fr->tail;
+
+    if (tail == head)
+        return NULL;
+
+    if (HDR(fr, tail) == WRAP)
+    {
+        tail = 0;
+        WS_STORE_RELEASE(&fr->tail, 0);
+        if (tail == head)
+            return NULL;
+    }
+
+    *len = HDR(fr, tail);
+
+    return &fr->buffer[tail + HDR_LEN];
+}
+
+
+void
+ws_framering_release(ws_framering_t *fr)
+{
+    uint32_t tail = fr->tail;
+    uint32_t next;
+
+    ASSERT(tail != WS_LOAD_ACQUIRE(&fr->head),
+           "releasing from an empty frame ring\n");
+
+    next = tail + WS_FRAMERING_RECORD_SIZE(HDR(fr, tail));
+    if (next == fr->capacity)
+        next = 0;
+
+    /* Give the space back only once the record has been read */
+    WS_STORE_RELEASE(&fr->tail, next);
+}
+
+
+bool
+ws_framering_is_empty(ws_framering_t *fr)
+{
+    uint32_t len;
+
+    return ws_framering_peek(fr, &len) == NULL;
+}
+
+
+void
+ws_framering_flush(ws_framering_t *fr)
+{
+    WS_STORE_RELEASE(&fr->tail, WS_LOAD_ACQUIRE(&fr->head));
+}
@@ -74,7 +74,7 @@ ws_list_add_sorted(ws_list_t *list, ws_list_t *new,
     }
 
     /* If the timer is smaller than the first element, add to the head */
-    if (cmp(new, list) < 1)
+    if (cmp(new, list->next) < 1)
     {
         ws_list_add_after(list, new);
         return;
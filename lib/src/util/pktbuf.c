@@ -32,10 +32,8 @@
 #include "ws_pktbuf.h"
 
 
-#if 1
-#undef WS_DEBUG
-#define WS_DEBUG(...)
-#endif
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_INFO
 
 
 struct ws_pktbuf_t
@@ -63,12 +61,98 @@ struct ws_pktbuf_t
     uint8_t *data_end;
 
     /* This holds the maximum capacity of the buffer. The size, in
-     * octets, as allocated by malloc.
+     * octets, as allocated by MALLOC.
      */
     uint32_t size;
+
+    /* Next segment of a chained pktbuf, which this pktbuf holds a
+     * reference to. While a pool buffer is not in use this is the next
+     * buffer on the pool free list instead.
+     */
+    struct ws_pktbuf_t *next;
+
+    /* Next pktbuf in the \see ws_pktbuf_queue_t this pktbuf is on */
+    struct ws_pktbuf_t *queue_next;
+
+    /* The buffer a clone shares its data with, or NULL if this pktbuf owns
+     * its data. A clone holds a reference to it.
+     */
+    struct ws_pktbuf_t *parent;
+
+    /* Number of references held. The buffer is freed when the last one is
+     * dropped.
+     */
+    uint16_t refs;
+
+    /* Filled in by the radio for a received frame */
+    ws_pktbuf_meta_t meta;
 };
 
 
+/**
+ * A buffer in the pktbuf pool, with the data stored right after the header
+ * as it is for buffers from \see ws_pktbuf_create
+ */
+typedef struct
+{
+    ws_pktbuf_t pkt;
+    uint8_t data[WS_PKTBUF_POOL_BUF_LEN];
+} pktbuf_pool_entry_t;
+
+
+typedef struct
+{
+    pktbuf_pool_entry_t entries[WS_PKTBUF_POOL_SIZE];
+    ws_pktbuf_t *free_list;
+    uint32_t used;
+    uint32_t high_water;
+    uint32_t failures;
+} pktbuf_pool_t;
+
+static pktbuf_pool_t pool;
+
+
+static bool
+is_pool_buffer(ws_pktbuf_t *p)
+{
+    return (uint8_t *)p >= (uint8_t *)&pool.entries[0] &&
+        (uint8_t *)p < (uint8_t *)&pool.entries[WS_PKTBUF_POOL_SIZE];
+}
+
+
+static void
+init_buffer(ws_pktbuf_t *p, uint32_t len)
+{
+    p->start = (uint8_t *)(p + 1);
+    p->data_start = p->start;
+    p->data_end = p->start;
+    p->end = p->start + len;
+    p->size = len;
+    p->next = NULL;
+    p->queue_next = NULL;
+    p->parent = NULL;
+    p->refs = 1;
+    memset(&p->meta, 0, sizeof(p->meta));
+}
+
+
+static void
+pool_put(ws_pktbuf_t *p)
+{
+    ws_pktbuf_reset(p);
+
+    ENTER_CRITICAL();
+
+    ASSERT(pool.used > 0, "pktbuf pool double release (%p)\n", p);
+
+    p->next = pool.free_list;
+    pool.free_list = p;
+    pool.used--;
+
+    EXIT_CRITICAL();
+}
+
+
 ws_pktbuf_t *
 ws_pktbuf_create(uint32_t len)
 {
@@ -79,11 +163,7 @@ ws_pktbuf_create(uint32_t len)
         return NULL;
     }
 
-    p->start = (uint8_t *)(p + sizeof(ws_pktbuf_t));
-    p->data_start = p->start;
-    p->data_end = p->start;
-    p->end = p->start + len;
-    p->size = len;
+    init_buffer(p, len);
 
     WS_DEBUG("created packet (pkt=%p)\n", p);
 
@@ -95,8 +175,332 @@ void
 ws_pktbuf_destroy(ws_pktbuf_t *p)
 {
     ASSERT(p != NULL, "freeing NULL pktbuf\n");
+    ws_pktbuf_unref(p);
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_ref(ws_pktbuf_t *p)
+{
+    ASSERT(p != NULL, "referencing NULL pktbuf\n");
+
+    ENTER_CRITICAL();
+    ASSERT(p->refs > 0 && p->refs < UINT16_MAX,
+           "bad pktbuf reference count (pkt=%p, refs=%u)\n", p, p->refs);
+    p->refs++;
+    EXIT_CRITICAL();
+
+    return p;
+}
+
+
+void
+ws_pktbuf_unref(ws_pktbuf_t *p)
+{
+    ws_pktbuf_t *parent;
+    ws_pktbuf_t *chain;
+    uint16_t refs;
+
+    if (p == NULL)
+        return;
+
+    ENTER_CRITICAL();
+    ASSERT(p->refs > 0, "pktbuf has no references (%p)\n", p);
+    refs = --p->refs;
+    EXIT_CRITICAL();
+
+    if (refs > 0)
+        return;
+
     WS_DEBUG("freeing packet (pkt=%p)\n", p);
-    FREE(p);
+
+    /* The rest of the chain is dropped once this segment is gone, as the
+     * free list reuses the link */
+    chain = p->next;
+    p->next = NULL;
+
+    parent = p->parent;
+    if (parent != NULL)
+    {
+        FREE(p);
+        ws_pktbuf_unref(parent);
+    }
+    else if (is_pool_buffer(p))
+    {
+        pool_put(p);
+    }
+    else
+    {
+        FREE(p);
+    }
+
+    ws_pktbuf_unref(chain);
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_clone(ws_pktbuf_t *p)
+{
+    ws_pktbuf_t *c;
+
+    ASSERT(p != NULL, "cloning NULL pktbuf\n");
+
+    c = (ws_pktbuf_t *)MALLOC(sizeof(ws_pktbuf_t));
+    if (c == NULL)
+    {
+        WS_ERROR("failed to allocate pktbuf clone\n");
+        return NULL;
+    }
+
+    /* Clones of clones share the original data, so there's never more
+     * than one level to walk when freeing. The clone keeps the frame's
+     * metadata, but isn't on whatever queue the original is on. */
+    memcpy(c, p, sizeof(ws_pktbuf_t));
+    c->next = p->next != NULL ? ws_pktbuf_ref(p->next) : NULL;
+    c->parent = ws_pktbuf_ref(p->parent != NULL ? p->parent : p);
+    c->queue_next = NULL;
+    c->refs = 1;
+
+    return c;
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_wrap(uint8_t *data, uint32_t len)
+{
+    ws_pktbuf_t *p;
+
+    p = (ws_pktbuf_t *)MALLOC(sizeof(ws_pktbuf_t));
+    if (p == NULL)
+    {
+        WS_ERROR("failed to allocate pktbuf\n");
+        return NULL;
+    }
+
+    /* Freeing the header doesn't touch the data, as it isn't stored
+     * after the header like the data of other pktbufs */
+    init_buffer(p, len);
+    p->start = data;
+    p->data_start = data;
+    p->data_end = data + len;
+    p->end = data + len;
+
+    return p;
+}
+
+
+void
+ws_pktbuf_chain(ws_pktbuf_t *p, ws_pktbuf_t *segment)
+{
+    ASSERT(p != NULL && segment != NULL, "chaining NULL pktbuf\n");
+
+    while (p->next != NULL)
+    {
+        ASSERT(p != segment, "pktbuf chained to itself (%p)\n", p);
+        p = p->next;
+    }
+    ASSERT(p != segment, "pktbuf chained to itself (%p)\n", p);
+
+    p->next = ws_pktbuf_ref(segment);
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_get_next(ws_pktbuf_t *p)
+{
+    ASSERT(p != NULL, "getting next segment of NULL pktbuf\n");
+    return p->next;
+}
+
+
+uint32_t
+ws_pktbuf_get_chain_len(ws_pktbuf_t *p)
+{
+    uint32_t len = 0;
+
+    for (; p != NULL; p = p->next)
+        len += (uint32_t)(p->data_end - p->data_start);
+
+    return len;
+}
+
+
+uint32_t
+ws_pktbuf_gather(ws_pktbuf_t *p)
+{
+    ws_pktbuf_t *seg;
+    uint32_t len;
+
+    ASSERT(p != NULL, "gathering NULL pktbuf\n");
+
+    len = ws_pktbuf_get_chain_len(p->next);
+    if ((uint32_t)(p->end - p->data_end) < len)
+        return 0;
+
+    for (seg = p->next; seg != NULL; seg = seg->next)
+    {
+        memcpy(p->data_end, seg->data_start,
+               (uint32_t)(seg->data_end - seg->data_start));
+        p->data_end += seg->data_end - seg->data_start;
+    }
+
+    ws_pktbuf_unref(p->next);
+    p->next = NULL;
+
+    return ws_pktbuf_get_len(p);
+}
+
+
+void
+ws_pktbuf_queue_init(ws_pktbuf_queue_t *q)
+{
+    q->head = NULL;
+    q->tail = NULL;
+    q->len = 0;
+}
+
+
+void
+ws_pktbuf_queue_push(ws_pktbuf_queue_t *q, ws_pktbuf_t *p)
+{
+    ASSERT(p->queue_next == NULL && q->tail != p,
+           "pktbuf is already on a queue\n");
+
+    if (q->tail != NULL)
+        q->tail->queue_next = p;
+    else
+        q->head = p;
+
+    q->tail = ws_pktbuf_ref(p);
+    q->len++;
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_queue_pop(ws_pktbuf_queue_t *q)
+{
+    ws_pktbuf_t *p = q->head;
+
+    if (p == NULL)
+        return NULL;
+
+    q->head = p->queue_next;
+    if (q->head == NULL)
+        q->tail = NULL;
+
+    p->queue_next = NULL;
+    q->len--;
+
+    return p;
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_queue_peek(ws_pktbuf_queue_t *q)
+{
+    return q->head;
+}
+
+
+uint32_t
+ws_pktbuf_queue_get_len(ws_pktbuf_queue_t *q)
+{
+    return q->len;
+}
+
+
+uint32_t
+ws_pktbuf_get_refs(ws_pktbuf_t *p)
+{
+    ASSERT(p != NULL, "getting references of NULL pktbuf\n");
+    return p->refs;
+}
+
+
+void
+ws_pktbuf_pool_init(void)
+{
+    uint32_t i;
+
+    ENTER_CRITICAL();
+
+    pool.free_list = NULL;
+    pool.used = 0;
+    pool.high_water = 0;
+    pool.failures = 0;
+
+    /* Build the free list backwards so buffers are handed out in
+     * address order */
+    for (i = WS_PKTBUF_POOL_SIZE; i > 0; i--)
+    {
+        ws_pktbuf_t *p = &pool.entries[i - 1].pkt;
+        init_buffer(p, WS_PKTBUF_POOL_BUF_LEN);
+        p->next = pool.free_list;
+        pool.free_list = p;
+    }
+
+    EXIT_CRITICAL();
+}
+
+
+ws_pktbuf_t *
+ws_pktbuf_pool_acquire(void)
+{
+    ws_pktbuf_t *p;
+
+    ENTER_CRITICAL();
+
+    p = pool.free_list;
+    if (p == NULL)
+    {
+        pool.failures++;
+        EXIT_CRITICAL();
+        return NULL;
+    }
+
+    pool.free_list = p->next;
+    pool.used++;
+    if (pool.used > pool.high_water)
+        pool.high_water = pool.used;
+
+    EXIT_CRITICAL();
+
+    /* Buffers are reset on release, so it's ready to use */
+    p->next = NULL;
+    p->refs = 1;
+
+    return p;
+}
+
+
+void
+ws_pktbuf_pool_release(ws_pktbuf_t *p)
+{
+    if (p == NULL)
+        return;
+
+    ASSERT(is_pool_buffer(p), "releasing pktbuf not from the pool (%p)\n", p);
+    ws_pktbuf_unref(p);
+}
+
+
+uint32_t
+ws_pktbuf_pool_available(void)
+{
+    return WS_PKTBUF_POOL_SIZE - pool.used;
+}
+
+
+void
+ws_pktbuf_pool_get_stats(ws_pool_stats_t *stats)
+{
+    ENTER_CRITICAL();
+    stats->block_size = sizeof(pktbuf_pool_entry_t);
+    stats->blocks = WS_PKTBUF_POOL_SIZE;
+    stats->used = pool.used;
+    stats->high_water = pool.high_water;
+    stats->failures = pool.failures;
+    EXIT_CRITICAL();
 }
 
 
@@ -104,8 +508,11 @@ void
 ws_pktbuf_reset(ws_pktbuf_t *p)
 {
     ASSERT(p != NULL, "resetting NULL pktbuf\n");
+    ws_pktbuf_unref(p->next);
+    p->next = NULL;
     p->data_start = p->start;
     p->data_end = p->start;
+    memset(&p->meta, 0, sizeof(p->meta));
 }
 
 
@@ -115,10 +522,11 @@ ws_pktbuf_reserve(ws_pktbuf_t *p, uint32_t len)
     uint32_t free_space;
 
     ASSERT(p != NULL, "reserving from NULL pktbuf\n");
-    ASSERT(p->start == p->end, "reserving from a non-empty pktbuf\n");
+    ASSERT(p->data_start == p->data_end,
+           "reserving from a non-empty pktbuf\n");
 
     /* Make sure we can reserve that much data */
-    free_space = p->size - (uint32_t)(p->data_end - p->data_start);
+    free_space = (uint32_t)(p->end - p->data_end);
     if (free_space < len)
         return 0;
 
@@ -262,8 +670,16 @@ ws_pktbuf_get_len(ws_pktbuf_t *p)
 }
 
 
+ws_pktbuf_meta_t *
+ws_pktbuf_get_meta(ws_pktbuf_t *p)
+{
+    ASSERT(p != NULL, "getting metadata of NULL pktbuf\n");
+    return &p->meta;
+}
+
+
 uint32_t
-ws_pktbuf_get_free_space_at_front(ws_pktbuf_t *p)
+ws_pktbuf_get_free_space_at_start(ws_pktbuf_t *p)
 {
     ASSERT(p != NULL, "getting space from NULL pktbuf\n");
     return (uint32_t)(p->data_start - p->start);
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ws_pool.h"
+
+
+/* Blocks are rounded up so every block is suitably aligned for any object */
+#define ALIGNMENT (8)
+#define ROUND_UP(size) (((size) + ALIGNMENT - 1) & ~(ALIGNMENT - 1))
+
+
+/* Free blocks hold a pointer to the next free block */
+typedef struct free_block_t
+{
+    struct free_block_t *next;
+} free_block_t;
+
+
+typedef struct
+{
+    uint32_t block_size;
+    uint32_t blocks;
+    uint8_t *start;
+    uint8_t *end;
+    free_block_t *free_list;
+
+    uint32_t used;
+    uint32_t high_water;
+    uint32_t failures;
+} pool_class_t;
+
+
+#define X(size, count) + ROUND_UP(size) * (count)
+static uint8_t storage[0 WS_POOL_CLASSES] __attribute__((aligned(ALIGNMENT)));
+#undef X
+
+#define X(size, count) { .block_size = ROUND_UP(size), .blocks = (count) },
+static pool_class_t classes[] = { WS_POOL_CLASSES };
+#undef X
+
+#define CLASS_COUNT (sizeof(classes) / sizeof(classes[0]))
+
+
+void
+ws_pool_init(void)
+{
+    pool_class_t *c;
+    uint8_t *ptr = storage;
+    uint32_t i, j;
+
+    ENTER_CRITICAL();
+
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        c = &classes[i];
+
+        ASSERT(i == 0 || c->block_size >= classes[i - 1].block_size,
+               "pool classes must be in order of size\n");
+
+        c->start = ptr;
+        c->end = ptr + c->block_size * c->blocks;
+        c->free_list = NULL;
+        c->used = 0;
+        c->high_water = 0;
+        c->failures = 0;
+
+        /* Build the free list backwards so blocks are handed out in
+         * address order */
+        for (j = c->blocks; j > 0; j--)
+        {
+            free_block_t *b = (free_block_t *)(ptr + (j - 1) * c->block_size);
+            b->next = c->free_list;
+            c->free_list = b;
+        }
+
+        ptr = c->end;
+    }
+
+    EXIT_CRITICAL();
+}
+
+
+void *
+ws_pool_alloc(uint32_t size)
+{
+    pool_class_t *c;
+    free_block_t *b;
+    uint32_t i;
+
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        if (classes[i].block_size >= size)
+            break;
+    }
+
+    if (i == CLASS_COUNT)
+    {
+        WS_ERROR("no pool for allocation (size=%u)\n", size);
+        return NULL;
+    }
+
+    c = &classes[i];
+
+    ENTER_CRITICAL();
+
+    /* Don't borrow from a larger class, as that's how a long running
+     * coordinator would eventually run out of packet buffers */
+    b = c->free_list;
+    if (b == NULL)
+    {
+        c->failures++;
+        EXIT_CRITICAL();
+        return NULL;
+    }
+
+    c->free_list = b->next;
+    c->used++;
+    if (c->used > c->high_water)
+        c->high_water = c->used;
+
+    EXIT_CRITICAL();
+
+    return b;
+}
+
+
+void
+ws_pool_free(void *ptr)
+{
+    pool_class_t *c;
+    free_block_t *b = (free_block_t *)ptr;
+    uint32_t i;
+
+    if (ptr == NULL)
+        return;
+
+    for (i = 0; i < CLASS_COUNT; i++)
+    {
+        c = &classes[i];
+        if ((uint8_t *)ptr >= c->start && (uint8_t *)ptr < c->end)
+            break;
+    }
+
+    ASSERT(i < CLASS_COUNT, "freeing memory not from a pool (%p)\n", ptr);
+    ASSERT(((uint8_t *)ptr - c->start) % c->block_size == 0,
+           "freeing misaligned block (%p)\n", ptr);
+
+    ENTER_CRITICAL();
+
+    ASSERT(c->used > 0, "pool double free (%p)\n", ptr);
+
+    b->next = c->free_list;
+    c->free_list = b;
+    c->used--;
+
+    EXIT_CRITICAL();
+}
+
+
+uint32_t
+ws_pool_get_class_count(void)
+{
+    return CLASS_COUNT;
+}
+
+
+bool
+ws_pool_get_stats(uint32_t class_index, ws_pool_stats_t *stats)
+{
+    pool_class_t *c;
+
+    if (class_index >= CLASS_COUNT)
+        return false;
+
+    c = &classes[class_index];
+
+    ENTER_CRITICAL();
+    stats->block_size = c->block_size;
+    stats->blocks = c->blocks;
+    stats->used = c->used;
+    stats->high_water = c->high_water;
+    stats->failures = c->failures;
+    EXIT_CRITICAL();
+
+    return true;
+}
@@ -32,41 +32,91 @@
 #include "ws_ringbuf.h"
 
 
-#define min(a, b) a > b ? b : a
+#define min(a, b) ((a) > (b) ? (b) : (a))
+
+
+/* The head and tail count on past the end of the buffer rather than
+ * wrapping at it, so a full buffer can be told from an empty one without
+ * a length that both sides would have to update. A power of two capacity
+ * lets them run freely, and only needs a mask to find the octet. Any
+ * other capacity wraps them at twice the capacity. */
+static uint32_t
+position(ws_ringbuf_t *rb, uint32_t index)
+{
+    if (rb->mask != 0)
+        return index & rb->mask;
+
+    return index >= rb->capacity ? index - rb->capacity : index;
+}
+
+
+/* Move an index on by n octets, where n is no more than the capacity */
+static uint32_t
+advance(ws_ringbuf_t *rb, uint32_t index, uint32_t n)
+{
+    index += n;
+
+    if (rb->mask != 0)
+        return index;
+
+    return index >= 2 * rb->capacity ? index - 2 * rb->capacity : index;
+}
+
+
+/* Octets between the tail and the head */
+static uint32_t
+used(ws_ringbuf_t *rb, uint32_t head, uint32_t tail)
+{
+    if (rb->mask != 0 || head >= tail)
+        return head - tail;
+
+    return head + 2 * rb->capacity - tail;
+}
+
+
+/* Copy len octets out of the buffer starting at index, in at most two
+ * pieces either side of the end of the buffer */
+static void
+copy_out(ws_ringbuf_t *rb, uint32_t index, uint8_t *data, uint32_t len)
+{
+    uint32_t pos = position(rb, index);
+    uint32_t first = min(len, rb->capacity - pos);
+
+    memcpy(data, &rb->buffer[pos], first);
+    memcpy(data + first, rb->buffer, len - first);
+}
 
 
 void
 ws_ringbuf_init(ws_ringbuf_t *rb, uint8_t *buf, uint32_t size)
 {
+    ASSERT(size > 0 && size <= 0x80000000, "invalid ring buffer size\n");
+
     rb->buffer = buf;
     rb->capacity = size;
+    rb->mask = (size > 1 && (size & (size - 1)) == 0) ? size - 1 : 0;
     rb->head = 0;
     rb->tail = 0;
-    rb->length = 0;
 }
 
 
 uint32_t
 ws_ringbuf_write(ws_ringbuf_t *rb, const uint8_t *data, uint32_t len)
 {
-    uint32_t freespace;
-    int i;
-
-    /* Calculate how much space there is in the buffer */
-    freespace = rb->capacity - rb->length;
+    uint32_t head = rb->head;
+    uint32_t pos = position(rb, head);
+    uint32_t first;
 
     /* Constrain length to the space in the buffer */
-    len = min(len, freespace);
+    len = min(len, rb->capacity - used(rb, head, WS_LOAD_ACQUIRE(&rb->tail)));
 
-    /* Copy the data into the buffer */
-    for (i = 0; i < len; i++)
-    {
-        rb->buffer[rb->head] = data[i];
-        rb->head = (rb->head + 1) % rb->capacity;
-    }
+    /* Copy the data into the buffer, wrapping around at most once */
+    first = min(len, rb->capacity - pos);
+    memcpy(&rb->buffer[pos], data, first);
+    memcpy(rb->buffer, data + first, len - first);
 
-    /* Update the buffer length */
-    rb->length += len;
+    /* Hand the data over only once it's all in the buffer */
+    WS_STORE_RELEASE(&rb->head, advance(rb, head, len));
 
     return len;
 }
@@ -75,20 +125,17 @@ ws_ringbuf_write(ws_ringbuf_t *rb, const uint8_t *data, uint32_t len)
 uint32_t
 ws_ringbuf_push(ws_ringbuf_t *rb, uint8_t data)
 {
-    uint32_t freespace;
+    uint32_t head = rb->head;
 
     /* Make sure there's space */
-    if ((rb->capacity - rb->length) == 0)
+    if (used(rb, head, WS_LOAD_ACQUIRE(&rb->tail)) == rb->capacity)
     {
         return 0;
     }
 
     /* Copy the data into the buffer */
-    rb->buffer[rb->head] = data;
-    rb->head = (rb->head + 1) % rb->capacity;
-
-    /* Update the buffer length */
-    rb->length++;
+    rb->buffer[position(rb, head)] = data;
+    WS_STORE_RELEASE(&rb->head, advance(rb, head, 1));
 
     return 1;
 }
@@ -97,26 +144,33 @@ ws_ringbuf_push(ws_ringbuf_t *rb, uint8_t data)
 uint32_t
 ws_ringbuf_read(ws_ringbuf_t *rb, uint8_t *data, uint32_t len)
 {
-    int i;
+    uint32_t tail = rb->tail;
 
-    /* Can't read from an empty buffer */
-    if (!ws_ringbuf_has_data(rb))
+    /* Calculate how many bytes we can read */
+    len = min(len, used(rb, WS_LOAD_ACQUIRE(&rb->head), tail));
+    if (len == 0)
     {
         return 0;
     }
 
-    /* Calculate how many bytes we can read */
-    len = min(len, rb->length);
+    /* Copy data from the buffer, then give the space back */
+    copy_out(rb, tail, data, len);
+    WS_STORE_RELEASE(&rb->tail, advance(rb, tail, len));
 
-    /* Copy data from the buffer */
-    for (i = 0; i < len; i++)
-    {
-        data[i] = rb->buffer[rb->tail];
-        rb->tail = (rb->tail + 1) % rb->capacity;
-    }
+    return len;
+}
 
-    /* Update the buffer length */
-    rb->length -= len;
+
+uint32_t
+ws_ringbuf_peek(ws_ringbuf_t *rb, uint8_t *data, uint32_t len)
+{
+    uint32_t tail = rb->tail;
+
+    /* Calculate how many bytes we can read */
+    len = min(len, used(rb, WS_LOAD_ACQUIRE(&rb->head), tail));
+
+    /* Copy data from the buffer, leaving the tail where it was */
+    copy_out(rb, tail, data, len);
 
     return len;
 }
@@ -125,18 +179,17 @@ ws_ringbuf_read(ws_ringbuf_t *rb, uint8_t *data, uint32_t len)
 uint32_t
 ws_ringbuf_pop(ws_ringbuf_t *rb, uint8_t *data)
 {
+    uint32_t tail = rb->tail;
+
     /* Can't read from an empty buffer */
-    if (!ws_ringbuf_has_data(rb))
+    if (tail == WS_LOAD_ACQUIRE(&rb->head))
     {
         return 0;
     }
 
     /* Copy data from the buffer */
-    *data = rb->buffer[rb->tail];
-    rb->tail = (rb->tail + 1) % rb->capacity;
-
-    /* Update the buffer length */
-    rb->length--;
+    *data = rb->buffer[position(rb, tail)];
+    WS_STORE_RELEASE(&rb->tail, advance(rb, tail, 1));
 
     return 1;
 }
@@ -145,39 +198,35 @@ ws_ringbuf_pop(ws_ringbuf_t *rb, uint8_t *data)
 void
 ws_ringbuf_flush(ws_ringbuf_t *rb)
 {
-    rb->head = 0;
-    rb->tail = 0;
-    rb->length = 0;
-    rb->buffer[0] = 0;
+    WS_STORE_RELEASE(&rb->tail, WS_LOAD_ACQUIRE(&rb->head));
 }
 
 
 uint32_t
 ws_ringbuf_get_len(ws_ringbuf_t *rb)
 {
-    return rb->length;
+    uint32_t tail = WS_LOAD_ACQUIRE(&rb->tail);
+
+    return used(rb, WS_LOAD_ACQUIRE(&rb->head), tail);
 }
 
 
 uint32_t
 ws_ringbuf_get_space(ws_ringbuf_t *rb)
 {
-    return rb->capacity - rb->length;
+    return rb->capacity - ws_ringbuf_get_len(rb);
 }
 
 
 bool
 ws_ringbuf_has_data(ws_ringbuf_t *rb)
 {
-    if (rb->length)
-        return true;
-
-    return false;
+    return ws_ringbuf_get_len(rb) != 0;
 }
 
 
 bool
 ws_ringbuf_is_full(ws_ringbuf_t *rb)
 {
-    return (rb->length == rb->capacity);
+    return ws_ringbuf_get_len(rb) == rb->capacity;
 }
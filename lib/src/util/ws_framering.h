@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_FRAMERING_H
+#define _WS_FRAMERING_H
+
+#include "wsn.h"
+
+
+/*
+ * A frame ring holds variable length records, such as received frames,
+ * one after another in a block of memory. A record is never split across
+ * the end of the block, so the producer can write a record and the
+ * consumer can parse it where it is, without either copying it through a
+ * buffer of their own.
+ *
+ * There may be one producer and one consumer, which need no lock between
+ * them, so the producer may be an interrupt handler or another thread. The
+ * producer reserves space for a record, writes it and commits it. The
+ * consumer peeks at the oldest record and releases it once it is done
+ * with it.
+ */
+
+
+/**
+ * Octets a record of the given length takes up in the ring, including its
+ * header. Use this to size the memory given to \see ws_framering_init.
+ */
+#define WS_FRAMERING_RECORD_SIZE(len) (((uint32_t)(len) + 4 + 3) & ~3u)
+
+
+/**
+ * Initialises a frame ring
+ * \param fr the frame ring structure
+ * \param buf a block of memory to use, aligned to 4 octets
+ * \param size the size, in octets, of the memory block. This must be a
+ *             multiple of 4.
+ */
+extern void
+ws_framering_init(ws_framering_t *fr, uint8_t *buf, uint32_t size);
+
+
+/**
+ * Reserve space for a record. Only one record can be reserved at a time,
+ * and it isn't seen by the consumer until it is committed.
+ * \param fr the frame ring structure
+ * \param len the size, in octets, of the record
+ * \return where to write the record, or NULL if the ring is too full
+ */
+extern uint8_t *
+ws_framering_reserve(ws_framering_t *fr, uint32_t len);
+
+
+/**
+ * Pass the reserved record on to the consumer
+ * \param fr the frame ring structure
+ * \param len the size, in octets, of the record, which can be less than was
+ *            reserved
+ */
+extern void
+ws_framering_commit(ws_framering_t *fr, uint32_t len);
+
+
+/**
+ * Get the oldest record without removing it
+ * \param fr the frame ring structure
+ * \param len set to the size, in octets, of the record
+ * \return the record, or NULL if the ring is empty
+ */
+extern uint8_t *
+ws_framering_peek(ws_framering_t *fr, uint32_t *len);
+
+
+/**
+ * Remove the record returned by \see ws_framering_peek, handing its space
+ * back to the producer
+ * \param fr the frame ring structure
+ */
+extern void
+ws_framering_release(ws_framering_t *fr);
+
+
+/**
+ * Test if the ring holds any committed records
+ * \param fr the frame ring structure
+ * \return true if there are no records
+ */
+extern bool
+ws_framering_is_empty(ws_framering_t *fr);
+
+
+/**
+ * Drop all records. This is called by the consumer, and records the
+ * producer commits at the same time may or may not be dropped.
+ * \param fr the frame ring structure
+ */
+extern void
+ws_framering_flush(ws_framering_t *fr);
+
+
+#endif /* _WS_FRAMERING_H */
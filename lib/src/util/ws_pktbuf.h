@@ -36,14 +36,221 @@
 #include "wsn.h"
 
 
+/**
+ * Number of full size frame buffers in the pktbuf pool. Every frame the MAC
+ * builds or receives comes from here, so this bounds the frames in flight
+ * across all MAC instances. This can be overridden at build time.
+ */
+#ifndef WS_PKTBUF_POOL_SIZE
+#define WS_PKTBUF_POOL_SIZE (16)
+#endif
+
+
+/**
+ * Capacity, in octets, of each buffer in the pktbuf pool
+ */
+#define WS_PKTBUF_POOL_BUF_LEN (WS_RADIO_MAX_PACKET_LEN)
+
+
 extern ws_pktbuf_t *
 ws_pktbuf_create(uint32_t len);
 
 
+/**
+ * Drop a reference to a pktbuf, the same as \see ws_pktbuf_unref
+ * \param p the pktbuf
+ */
 extern void
 ws_pktbuf_destroy(ws_pktbuf_t *p);
 
 
+/**
+ * Take another reference to a pktbuf. A new pktbuf holds one reference,
+ * and anything that keeps hold of a pktbuf after the call that handed it
+ * over (a queue, a retransmission, an operation in progress) should take
+ * its own.
+ * \param p the pktbuf
+ * \return p
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_ref(ws_pktbuf_t *p);
+
+
+/**
+ * Drop a reference to a pktbuf. The buffer is freed, or returned to the
+ * pktbuf pool, with the last reference. Unreferencing NULL does nothing.
+ * \param p the pktbuf
+ */
+extern void
+ws_pktbuf_unref(ws_pktbuf_t *p);
+
+
+/**
+ * Make a clone which shares the data of a pktbuf without copying it. The
+ * clone has its own view of where the data starts and ends, so a header
+ * can be stripped from it without touching the original, but writes to the
+ * data itself are seen through both. The data is freed once the original
+ * and all clones have been unreferenced.
+ * \param p the pktbuf
+ * \return the clone, holding one reference, or NULL if out of memory
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_clone(ws_pktbuf_t *p);
+
+
+/**
+ * Make a pktbuf which points at memory owned by the caller instead of
+ * holding its own copy. This is for chaining a payload onto a frame
+ * without copying it, so the memory must stay valid and unchanged until
+ * every reference to the pktbuf has been dropped.
+ * \param data the memory holding the data
+ * \param len the size, in octets, of the data
+ * \return the pktbuf, holding one reference, or NULL if out of memory
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_wrap(uint8_t *data, uint32_t len);
+
+
+/**
+ * Add a segment to the end of a pktbuf chain, so the chain holds the data
+ * of p followed by the data of segment. The chain takes its own reference
+ * to the segment, and drops it when p is freed.
+ * \param p the first pktbuf of the chain
+ * \param segment the pktbuf to add, which may itself be a chain
+ */
+extern void
+ws_pktbuf_chain(ws_pktbuf_t *p, ws_pktbuf_t *segment);
+
+
+/**
+ * Get the next segment of a pktbuf chain
+ * \param p a segment of the chain
+ * \return the next segment, or NULL if p is the last
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_get_next(ws_pktbuf_t *p);
+
+
+/**
+ * Get the length of a pktbuf chain
+ * \param p the first pktbuf of the chain
+ * \return the number of octets held by p and the segments following it
+ */
+extern uint32_t
+ws_pktbuf_get_chain_len(ws_pktbuf_t *p);
+
+
+/**
+ * Copy the data of the segments chained to a pktbuf onto its end and drop
+ * them, for code that needs the whole chain in one place
+ * \param p the first pktbuf of the chain
+ * \return the length of p, or 0 if there isn't room at the end of p for
+ * the rest of the chain, in which case the chain is left as it was
+ */
+extern uint32_t
+ws_pktbuf_gather(ws_pktbuf_t *p);
+
+
+/**
+ * Prepare an empty pktbuf queue
+ * \param q the queue
+ */
+extern void
+ws_pktbuf_queue_init(ws_pktbuf_queue_t *q);
+
+
+/**
+ * Add a pktbuf to the back of a queue. The queue links the pktbufs through
+ * their headers, so this needs no memory and can't fail, but a pktbuf can
+ * only be on one queue at a time. The queue takes its own reference.
+ * \param q the queue
+ * \param p the pktbuf
+ */
+extern void
+ws_pktbuf_queue_push(ws_pktbuf_queue_t *q, ws_pktbuf_t *p);
+
+
+/**
+ * Take the pktbuf at the front of a queue
+ * \param q the queue
+ * \return the pktbuf, along with the queue's reference to it, or NULL if
+ * the queue is empty
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_queue_pop(ws_pktbuf_queue_t *q);
+
+
+/**
+ * Get the pktbuf at the front of a queue, leaving it there
+ * \param q the queue
+ * \return the pktbuf, or NULL if the queue is empty
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_queue_peek(ws_pktbuf_queue_t *q);
+
+
+/**
+ * \param q the queue
+ * \return the number of pktbufs on the queue
+ */
+extern uint32_t
+ws_pktbuf_queue_get_len(ws_pktbuf_queue_t *q);
+
+
+/**
+ * Get the number of references held to a pktbuf
+ * \param p the pktbuf
+ * \return the reference count
+ */
+extern uint32_t
+ws_pktbuf_get_refs(ws_pktbuf_t *p);
+
+
+/**
+ * Prepare the pktbuf pool. All buffers are returned to the pool, so this
+ * must only be called before any have been acquired.
+ */
+extern void
+ws_pktbuf_pool_init(void);
+
+
+/**
+ * Take an empty buffer of \see WS_PKTBUF_POOL_BUF_LEN octets from the
+ * pktbuf pool. This is O(1) and can be called from an interrupt.
+ * \return the buffer, or NULL if the pool is exhausted. The failure is
+ * counted in the pool statistics, and callers must report it upwards (e.g.
+ * as a transaction overflow or a dropped frame) rather than carrying on.
+ */
+extern ws_pktbuf_t *
+ws_pktbuf_pool_acquire(void);
+
+
+/**
+ * Drop a reference to a buffer from the pktbuf pool, returning it to the
+ * pool with the last one. This is O(1) and can be called from an
+ * interrupt. Releasing NULL does nothing.
+ * \param p a buffer returned by \see ws_pktbuf_pool_acquire
+ */
+extern void
+ws_pktbuf_pool_release(ws_pktbuf_t *p);
+
+
+/**
+ * Get the number of buffers left in the pktbuf pool
+ * \return the number of free buffers
+ */
+extern uint32_t
+ws_pktbuf_pool_available(void);
+
+
+/**
+ * Get the usage statistics of the pktbuf pool
+ * \param stats filled with the statistics
+ */
+extern void
+ws_pktbuf_pool_get_stats(ws_pool_stats_t *stats);
+
+
 extern void
 ws_pktbuf_reset(ws_pktbuf_t *p);
 
@@ -84,6 +291,16 @@ extern uint32_t
 ws_pktbuf_get_len(ws_pktbuf_t *p);
 
 
+/**
+ * Get the receive metadata of a pktbuf. This is zeroed for a new or reset
+ * pktbuf, and filled in when the MAC takes a frame from the radio.
+ * \param p the pktbuf
+ * \return the metadata, which can be written through
+ */
+extern ws_pktbuf_meta_t *
+ws_pktbuf_get_meta(ws_pktbuf_t *p);
+
+
 extern uint32_t
 ws_pktbuf_get_free_space_at_start(ws_pktbuf_t *p);
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _WS_POOL_H
+#define _WS_POOL_H
+
+#include "wsn.h"
+
+
+/**
+ * Size classes for the pool allocator, as X(block size, number of blocks).
+ * These must be in order of increasing block size. Sizes are scaled by the
+ * size of a pointer so the same objects fit on both the target and a host.
+ * This can be overridden at build time to suit an application.
+ */
+#ifndef WS_POOL_CLASSES
+#define WS_POOL_CLASSES \
+    /* List nodes, queue entries and keys */ \
+    X(8 * sizeof(void *), 32) \
+    /* Enough devices to fill every device table, and scan results */ \
+    X(16 * sizeof(void *), WS_MAC_MAX_INSTANCES * WS_MAC_MAX_DEVICES + 8) \
+    /* Packet buffers that are not from the pktbuf pool */ \
+    X(WS_RADIO_MAX_PACKET_LEN + 12 * sizeof(void *), 4)
+#endif
+
+
+/**
+ * Prepare the pool allocator. All blocks are returned to the pool, so this
+ * must only be called before anything has been allocated.
+ */
+extern void
+ws_pool_init(void);
+
+
+/**
+ * Allocate a block from the smallest size class that will fit. This is O(1)
+ * and can be called from an interrupt.
+ * \param size the size, in octets, required
+ * \return the block, or NULL if there are none left in that class
+ */
+extern void *
+ws_pool_alloc(uint32_t size);
+
+
+/**
+ * Return a block to its pool. Freeing NULL does nothing.
+ * \param ptr a block returned by \see ws_pool_alloc
+ */
+extern void
+ws_pool_free(void *ptr);
+
+
+/**
+ * Get the number of size classes
+ * \return the number of size classes
+ */
+extern uint32_t
+ws_pool_get_class_count(void);
+
+
+/**
+ * Get the usage statistics of a size class
+ * \param class_index the size class, counting from the smallest
+ * \param stats filled with the statistics
+ * \return false if the class doesn't exist
+ */
+extern bool
+ws_pool_get_stats(uint32_t class_index, ws_pool_stats_t *stats);
+
+
+#endif /* _WS_POOL_H */
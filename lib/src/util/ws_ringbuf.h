@@ -35,8 +35,19 @@
 #include "wsn.h"
 
 
+/*
+ * A ring buffer may have one producer, which writes and pushes, and one
+ * consumer, which reads, peeks, pops and flushes. Each side only moves its
+ * own index, so they need no lock between them: the producer can be an
+ * interrupt handler or another thread. More producers or consumers than
+ * that must share a critical section.
+ */
+
+
 /**
- * Initialises a ring buffer
+ * Initialises a ring buffer. Data is copied in and out a block at a time,
+ * and a power of two size saves a division for each single octet push or
+ * pop.
  * \param rb the ring buffer structure
  * \param data a block of memory to use
  * \param size the size, in octets, of the memory block
@@ -77,6 +88,17 @@ extern uint32_t
 ws_ringbuf_read(ws_ringbuf_t *rb, uint8_t *data, uint32_t len);
 
 
+/**
+ * Reads data from a ring buffer without removing it
+ * \param rb the ring buffer structure
+ * \param data memory to store the read data
+ * \param len the size, in octets, of the data to read
+ * \return the number of octets read
+ */
+extern uint32_t
+ws_ringbuf_peek(ws_ringbuf_t *rb, uint8_t *data, uint32_t len);
+
+
 /**
  * Read a single byte from the buffer
  * \param rb the ring buffer structure
@@ -88,7 +110,8 @@ ws_ringbuf_pop(ws_ringbuf_t *rb, uint8_t *data);
 
 
 /**
- * Drops all data in the buffer
+ * Drops all data in the buffer. Data the producer writes at the same time
+ * may or may not be dropped.
  * \param rb the ring buffer structure
  */
 extern void
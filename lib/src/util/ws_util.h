@@ -36,6 +36,32 @@
 typedef struct ws_pktbuf_t ws_pktbuf_t;
 
 
+/**
+ * What the radio measured while receiving a frame. The radio backend fills
+ * this in, and it travels with the frame in its pktbuf.
+ */
+typedef struct
+{
+    uint32_t timestamp;     /* Radio timer, in symbols, at the SFD */
+    int8_t rssi;            /* Received signal strength in dBm */
+    uint8_t lqi;            /* Link quality, from 0 (worst) to 255 (best) */
+    uint8_t channel;
+    bool crc_ok;
+} ws_pktbuf_meta_t;
+
+
+/**
+ * A first in, first out queue of pktbufs, linked through the pktbufs
+ * themselves. See \see ws_pktbuf_queue_push
+ */
+typedef struct
+{
+    ws_pktbuf_t *head;
+    ws_pktbuf_t *tail;
+    uint32_t len;
+} ws_pktbuf_queue_t;
+
+
 typedef struct ws_list_t
 {
     struct ws_list_t *next;
@@ -43,16 +69,83 @@ typedef struct ws_list_t
 } ws_list_t;
 
 
+/**
+ * A ring of octets. See \see ws_ringbuf.h
+ */
 typedef struct
 {
     uint8_t *buffer;
-    volatile uint32_t head;
-    volatile uint32_t tail;
-    volatile uint32_t length;
+    uint32_t head;          /* Only moved by the producer */
+    uint32_t tail;          /* Only moved by the consumer */
     uint32_t capacity;
+    uint32_t mask;          /* capacity - 1 if a power of two, else 0 */
 } ws_ringbuf_t;
 
 
+/**
+ * A ring of variable length records, each kept in one piece. See
+ * \see ws_framering.h
+ */
+typedef struct
+{
+    uint8_t *buffer;
+    uint32_t capacity;
+    uint32_t head;              /* Only moved by the producer */
+    uint32_t tail;              /* Only moved by the consumer */
+    uint32_t reserved;          /* Where the reserved record starts */
+} ws_framering_t;
+
+
+/**
+ * Usage statistics for a fixed block pool, such as a size class of the
+ * pool allocator or the pktbuf pool
+ */
+typedef struct
+{
+    uint32_t block_size;
+    uint32_t blocks;
+    uint32_t used;
+    uint32_t high_water;
+    uint32_t failures;
+} ws_pool_stats_t;
+
+
+/**
+ * A software timer. These are created with WS_TIMER_DECLARE, and should
+ * only be used through the WS_TIMER_* macros or \see ws_timer.h
+ */
+typedef struct
+{
+    void (*cb)(void *arg);
+    void *arg;
+    uint32_t expiry;
+    int16_t index;
+    bool active;
+} ws_timer_t;
+
+#define WS_TIMER_INITIALISER(callback, argument) \
+    { .cb = (callback), .arg = (argument), .expiry = 0, .index = -1,\
+      .active = false }
+
+
+/**
+ * A deferred function call, used to get out of interrupt context. These are
+ * created with WS_EVENT_DECLARE \see ws_event.h
+ */
+typedef struct ws_event_t
+{
+    struct ws_event_t *next;
+    void (*cb)(void *arg);
+    void *arg;
+    uint8_t priority;
+    bool pending;
+} ws_event_t;
+
+#define WS_EVENT_INITIALISER(callback, argument, prio) \
+    { .next = NULL, .cb = (callback), .arg = (argument), .priority = (prio),\
+      .pending = false }
+
+
 #define UNUSED(x) (void)x
 
 
@@ -44,9 +44,15 @@
 #include "util/ws_util.h"
 #include "util/ws_pktbuf.h"
 #include "util/ws_ringbuf.h"
+#include "util/ws_framering.h"
 #include "util/ws_list.h"
+#include "util/ws_pool.h"
 
 #include "os/ws_os.h"
+#include "os/ws_timer.h"
+#include "os/ws_event.h"
+#include "os/ws_log.h"
+#include "os/ws_trace.h"
 
 #include "radio/ws_radio.h"
 #include "net/mac/ws_mac.h"
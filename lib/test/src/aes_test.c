@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "wsn.h"
+
+
+/* RFC 3610, packet vector #1 */
+static const uint8_t key[16] =
+{
+    0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+    0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+};
+static const uint8_t nonse[13] =
+{
+    0x00, 0x00, 0x00, 0x03, 0x02, 0x01, 0x00, 0xa0,
+    0xa1, 0xa2, 0xa3, 0xa4, 0xa5,
+};
+static const uint8_t ciphertext[31] =
+{
+    0x58, 0x8c, 0x97, 0x9a, 0x61, 0xc6, 0x63, 0xd2,
+    0xf0, 0x66, 0xd0, 0xc2, 0xc0, 0xf9, 0x89, 0x80,
+    0x6d, 0x5f, 0x6b, 0x61, 0xda, 0xc3, 0x84,
+    /* tag */
+    0x17, 0xe8, 0xd1, 0x2c, 0xfd, 0xf9, 0x26, 0xe0,
+};
+
+static ws_aes_status_t status;
+static uint8_t tag[8];
+static int done_cnt;
+
+
+static void
+done(ws_aes_status_t s, uint8_t *t, void *arg)
+{
+    status = s;
+    if (t != NULL)
+        memcpy(tag, t, sizeof(tag));
+    *(int *)arg += 1;
+}
+
+
+static void
+prepare(uint8_t *a, uint8_t *m)
+{
+    uint8_t i;
+
+    for (i = 0; i < 8; i++)
+        a[i] = i;
+    for (i = 0; i < 23; i++)
+        m[i] = i + 8;
+
+    ws_event_init();
+    ws_aes_init();
+    memset(tag, 0, sizeof(tag));
+    status = WS_AES_STATUS_KEY_READ_ERROR;
+    done_cnt = 0;
+}
+
+
+bool
+aes_ccm_vector(void)
+{
+    uint8_t a[8];
+    uint8_t m[23];
+
+    prepare(a, m);
+    ws_aes_ccm_encrypt(true, 8, 2, (uint8_t *)nonse, m, sizeof(m),
+                       a, sizeof(a), (uint8_t *)key, done, &done_cnt);
+
+    /* The result comes from the event loop, like the hardware interrupt */
+    if (done_cnt != 0)
+        return false;
+    ws_event_process();
+
+    return done_cnt == 1 &&
+           status == WS_AES_STATUS_SUCCESS &&
+           memcmp(m, ciphertext, sizeof(m)) == 0 &&
+           memcmp(tag, &ciphertext[sizeof(m)], sizeof(tag)) == 0;
+}
+
+
+bool
+aes_ccm_decrypt_checks_tag(void)
+{
+    uint8_t a[8];
+    uint8_t m[23];
+    uint8_t c[31];
+
+    prepare(a, m);
+    memcpy(c, ciphertext, sizeof(c));
+    ws_aes_ccm_decrypt(true, 8, 2, (uint8_t *)nonse, c, sizeof(c),
+                       a, sizeof(a), (uint8_t *)key, done, &done_cnt);
+    ws_event_process();
+    if (done_cnt != 1 || status != WS_AES_STATUS_SUCCESS ||
+        memcmp(c, m, sizeof(m)) != 0)
+        return false;
+
+    /* A modified header has to fail authentication */
+    memcpy(c, ciphertext, sizeof(c));
+    a[0] ^= 0x01;
+    ws_aes_ccm_decrypt(true, 8, 2, (uint8_t *)nonse, c, sizeof(c),
+                       a, sizeof(a), (uint8_t *)key, done, &done_cnt);
+    ws_event_process();
+
+    return done_cnt == 2 && status == WS_AES_STATUS_ENCRYPT_ERROR;
+}
@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+#include "mac_private.h"
+
+
+static ws_mac_ctx_t ctx;
+static mac_device_t devs[WS_MAC_MAX_DEVICES + 1];
+
+
+static void
+make_device(mac_device_t *dev, uint16_t short_addr, uint32_t id)
+{
+    memset(dev, 0, sizeof(*dev));
+    dev->addr.type = WS_MAC_ADDR_TYPE_SHORT;
+    dev->addr.short_addr = short_addr;
+    memcpy(dev->addr.extended_addr, &id, sizeof(id));
+}
+
+
+/* The bucket a short address hashes to is where it goes in an empty table */
+static uint32_t
+home_bucket(uint16_t short_addr)
+{
+    static ws_mac_ctx_t scratch;
+    mac_device_t dev;
+    uint32_t i;
+
+    mac_device_init(&scratch);
+    make_device(&dev, short_addr, 0);
+    mac_device_add(&scratch, &dev);
+
+    for (i = 0; i < MAC_DEVICE_BUCKETS; i++)
+    {
+        if (scratch.mac.devices.by_short[i] != 0)
+            return i;
+    }
+
+    return MAC_DEVICE_BUCKETS;
+}
+
+
+/* Make n devices whose short addresses all hash to the same bucket */
+static bool
+make_colliding(mac_device_t *dev, uint32_t bucket, int n)
+{
+    uint16_t short_addr;
+    int i = 0;
+
+    for (short_addr = 1; short_addr < 0xfffe && i < n; short_addr++)
+    {
+        if (home_bucket(short_addr) == bucket)
+        {
+            make_device(&dev[i], short_addr, 0x1000 + i);
+            i++;
+        }
+    }
+
+    return i == n;
+}
+
+
+static bool
+found(mac_device_t *dev)
+{
+    return mac_device_get_by_short(&ctx, dev->addr.short_addr) == dev &&
+        mac_device_get_by_extended(&ctx, dev->addr.extended_addr) == dev &&
+        mac_device_get_by_handle(&ctx, dev->handle) == dev;
+}
+
+
+static bool
+not_found(mac_device_t *dev)
+{
+    return mac_device_get_by_short(&ctx, dev->addr.short_addr) == NULL &&
+        mac_device_get_by_extended(&ctx, dev->addr.extended_addr) == NULL;
+}
+
+
+static uint32_t
+used_buckets(void)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < MAC_DEVICE_BUCKETS; i++)
+    {
+        if (ctx.mac.devices.by_short[i] != 0)
+            n++;
+    }
+
+    return n;
+}
+
+
+bool
+device_table_remove_in_chain(void)
+{
+    int i;
+
+    mac_device_init(&ctx);
+    if (!make_colliding(devs, 5, 4) || !make_colliding(&devs[4], 9, 1))
+        return false;
+    devs[4].addr.extended_addr[4] = 4;
+
+    /* Four form a run from their home bucket, up to one that's at home
+     * just after them */
+    for (i = 0; i < 5; i++)
+    {
+        mac_device_add(&ctx, &devs[i]);
+        if (ctx.mac.devices.by_short[5 + i] != devs[i].handle + 1)
+            return false;
+    }
+
+    /* Taking one from the middle or the head of the run must leave the
+     * rest reachable, with no hole left behind, and the one after in its
+     * own home */
+    mac_device_remove(&ctx, &devs[1]);
+    if (!not_found(&devs[1]) || !found(&devs[0]) || !found(&devs[2]) ||
+        !found(&devs[3]) || used_buckets() != 4 ||
+        ctx.mac.devices.by_short[9] != devs[4].handle + 1)
+    {
+        return false;
+    }
+
+    mac_device_remove(&ctx, &devs[0]);
+
+    return not_found(&devs[0]) && found(&devs[2]) && found(&devs[3]) &&
+        found(&devs[4]) && used_buckets() == 3 &&
+        ctx.mac.devices.count == 3;
+}
+
+
+bool
+device_table_wraps(void)
+{
+    uint32_t last = MAC_DEVICE_BUCKETS - 1;
+    int i;
+
+    mac_device_init(&ctx);
+    if (!make_colliding(devs, last, 2) || !make_colliding(&devs[2], 0, 1) ||
+        !make_colliding(&devs[3], 1, 1))
+    {
+        return false;
+    }
+    devs[2].addr.extended_addr[4] = 2;
+    devs[3].addr.extended_addr[4] = 3;
+
+    /* Two run from the last bucket round to the first, pushing the devices
+     * at home in the first two buckets along by one */
+    for (i = 0; i < 4; i++)
+        mac_device_add(&ctx, &devs[i]);
+
+    if (ctx.mac.devices.by_short[last] != devs[0].handle + 1 ||
+        ctx.mac.devices.by_short[2] != devs[3].handle + 1)
+    {
+        return false;
+    }
+
+    /* Removing the head moves each one back, across the wrap */
+    mac_device_remove(&ctx, &devs[0]);
+    if (ctx.mac.devices.by_short[last] != devs[1].handle + 1 ||
+        ctx.mac.devices.by_short[0] != devs[2].handle + 1 ||
+        ctx.mac.devices.by_short[1] != devs[3].handle + 1 ||
+        ctx.mac.devices.by_short[2] != 0)
+    {
+        return false;
+    }
+
+    /* The rest are home now, so they mustn't move back across it */
+    mac_device_remove(&ctx, &devs[1]);
+    if (ctx.mac.devices.by_short[last] != 0 ||
+        ctx.mac.devices.by_short[0] != devs[2].handle + 1 ||
+        ctx.mac.devices.by_short[1] != devs[3].handle + 1)
+    {
+        return false;
+    }
+
+    return not_found(&devs[0]) && not_found(&devs[1]) && found(&devs[2]) &&
+        found(&devs[3]);
+}
+
+
+bool
+device_table_reuses_handles(void)
+{
+    int i;
+
+    mac_device_init(&ctx);
+
+    /* Handles are given out from the lowest */
+    for (i = 0; i < 3; i++)
+    {
+        make_device(&devs[i], 0x100 + i, 0x2000 + i);
+        if (!mac_device_add(&ctx, &devs[i]) || devs[i].handle != i)
+            return false;
+    }
+
+    /* A removed device's handle goes to the next one added */
+    mac_device_remove(&ctx, &devs[1]);
+    if (mac_device_get_by_handle(&ctx, 1) != NULL)
+        return false;
+
+    make_device(&devs[3], 0x200, 0x3000);
+    if (!mac_device_add(&ctx, &devs[3]) || devs[3].handle != 1)
+        return false;
+
+    return found(&devs[0]) && found(&devs[2]) && found(&devs[3]) &&
+        not_found(&devs[1]) && ctx.mac.devices.count == 3;
+}
+
+
+bool
+device_table_full(void)
+{
+    mac_device_t *extra = &devs[WS_MAC_MAX_DEVICES];
+    uint16_t handle;
+    int i;
+
+    mac_device_init(&ctx);
+
+    for (i = 0; i < WS_MAC_MAX_DEVICES; i++)
+    {
+        make_device(&devs[i], 0x100 + i, 0x4000 + i);
+        if (!mac_device_add(&ctx, &devs[i]))
+            return false;
+    }
+
+    /* A full table refuses the device and is left as it was */
+    make_device(extra, 0x300, 0x5000);
+    if (mac_device_add(&ctx, extra) || !not_found(extra) ||
+        ctx.mac.devices.count != WS_MAC_MAX_DEVICES)
+    {
+        return false;
+    }
+
+    for (i = 0; i < WS_MAC_MAX_DEVICES; i++)
+    {
+        if (!found(&devs[i]))
+            return false;
+    }
+
+    /* Making room lets it in */
+    handle = devs[7].handle;
+    mac_device_remove(&ctx, &devs[7]);
+
+    return mac_device_add(&ctx, extra) && extra->handle == handle &&
+        found(extra) && not_found(&devs[7]) &&
+        ctx.mac.devices.count == WS_MAC_MAX_DEVICES;
+}
+
+
+bool
+device_table_set_short(void)
+{
+    mac_device_init(&ctx);
+
+    /* A device can join the table before it has a short address */
+    make_device(&devs[0], 0xfffe, 0x6000);
+    mac_device_add(&ctx, &devs[0]);
+    if (used_buckets() != 0 ||
+        mac_device_get_by_extended(&ctx, devs[0].addr.extended_addr) !=
+        &devs[0])
+    {
+        return false;
+    }
+
+    mac_device_set_short_addr(&ctx, &devs[0], 0x0042);
+    if (!found(&devs[0]))
+        return false;
+
+    /* and is only found by the address it has now */
+    mac_device_set_short_addr(&ctx, &devs[0], 0x0043);
+
+    return mac_device_get_by_short(&ctx, 0x0042) == NULL && found(&devs[0]) &&
+        used_buckets() == 1;
+}
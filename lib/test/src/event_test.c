@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "wsn.h"
+
+
+#define MAX_EVENTS (8)
+
+static int events[MAX_EVENTS];
+static int event_cnt;
+
+
+static void
+record(int id)
+{
+    if (event_cnt < MAX_EVENTS)
+        events[event_cnt] = id;
+    event_cnt++;
+}
+
+
+WS_EVENT_DECLARE(rx_event, WS_EVENT_PRIORITY_RX);
+WS_EVENT_DECLARE(tx_event, WS_EVENT_PRIORITY_TX);
+WS_EVENT_DECLARE(app_event, WS_EVENT_PRIORITY_APP);
+WS_EVENT_DECLARE(app_posts_rx_event, WS_EVENT_PRIORITY_APP);
+WS_EVENT_DECLARE(repost_event, WS_EVENT_PRIORITY_RX);
+WS_EVENT_DECLARE(stop_event, WS_EVENT_PRIORITY_APP);
+
+static void
+rx_event(void)
+{
+    record(1);
+}
+
+
+static void
+tx_event(void)
+{
+    record(2);
+}
+
+
+static void
+app_event(void)
+{
+    record(3);
+}
+
+
+static void
+app_posts_rx_event(void)
+{
+    record(4);
+    WS_EVENT_POST(rx_event);
+}
+
+
+static void
+repost_event(void)
+{
+    record(5);
+    WS_EVENT_POST(repost_event);
+}
+
+
+static void
+stop_event(void)
+{
+    ws_os_stop();
+}
+
+
+static void
+reset(void)
+{
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    event_cnt = 0;
+}
+
+
+bool
+event_priority_order(void)
+{
+    reset();
+
+    WS_EVENT_POST(app_event);
+    WS_EVENT_POST(tx_event);
+    WS_EVENT_POST(rx_event);
+
+    return ws_os_poll() == 3 && event_cnt == 3 &&
+        events[0] == 1 && events[1] == 2 && events[2] == 3;
+}
+
+
+bool
+event_higher_priority_runs_next(void)
+{
+    reset();
+
+    /* RX work posted while an app event runs jumps ahead of the other app
+     * events */
+    WS_EVENT_POST(app_posts_rx_event);
+    WS_EVENT_POST(app_event);
+
+    ws_os_poll();
+    ws_os_poll();
+
+    return event_cnt == 3 &&
+        events[0] == 4 && events[1] == 1 && events[2] == 3;
+}
+
+
+bool
+event_coalesce(void)
+{
+    reset();
+
+    if (!WS_EVENT_POST(rx_event) || WS_EVENT_POST(rx_event))
+        return false;
+
+    return ws_os_poll() == 1 && event_cnt == 1 &&
+        !WS_EVENT_IS_PENDING(rx_event);
+}
+
+
+bool
+event_repost_does_not_starve(void)
+{
+    reset();
+
+    WS_EVENT_POST(repost_event);
+
+    if (ws_os_poll() != 1 || ws_os_poll() != 1)
+        return false;
+
+    /* Drain it so it doesn't leak into the next test */
+    ws_event_init();
+
+    return event_cnt == 2;
+}
+
+
+static void *
+post_from_thread(void *arg)
+{
+    /* Interrupt handlers run inside a critical section */
+    ws_enter_critical();
+    WS_EVENT_POST(rx_event);
+    WS_EVENT_POST(stop_event);
+    ws_exit_critical();
+
+    return NULL;
+}
+
+
+bool
+event_wakes_main_loop(void)
+{
+    pthread_t thread;
+
+    reset();
+    ws_os_set_virtual_time(false);
+
+    /* Without a timer the main loop would sleep until the post */
+    pthread_create(&thread, NULL, post_from_thread, NULL);
+    ws_os_run();
+    pthread_join(thread, NULL);
+
+    return event_cnt == 1 && events[0] == 1;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "wsn.h"
+
+
+/* Records passed from one thread to the other by the stress test */
+#define STRESS_RECORDS (1 << 20)
+
+#define STRESS_LEN(n) (4 + (n) % 60)
+
+
+bool
+framering_records_in_order(void)
+{
+    uint32_t buf[64 / 4];
+    ws_framering_t fr;
+    uint8_t *rec;
+    uint32_t len;
+    uint32_t i;
+
+    ws_framering_init(&fr, (uint8_t *)buf, sizeof(buf));
+
+    if (!ws_framering_is_empty(&fr))
+        return false;
+
+    /* A record can be committed shorter than it was reserved */
+    for (i = 1; i <= 3; i++)
+    {
+        rec = ws_framering_reserve(&fr, 10);
+        if (rec == NULL)
+            return false;
+        memset(rec, (int)i, i);
+        ws_framering_commit(&fr, i);
+    }
+
+    for (i = 1; i <= 3; i++)
+    {
+        rec = ws_framering_peek(&fr, &len);
+        if (rec == NULL || len != i || rec[0] != i || rec[i - 1] != i)
+            return false;
+        ws_framering_release(&fr);
+    }
+
+    return ws_framering_is_empty(&fr);
+}
+
+
+bool
+framering_never_splits_records(void)
+{
+    uint32_t buf[64 / 4];
+    ws_framering_t fr;
+    uint8_t *rec;
+    uint32_t len;
+    uint32_t i, j;
+
+    ws_framering_init(&fr, (uint8_t *)buf, sizeof(buf));
+
+    /* Records of different sizes land all over the ring, and each must be
+     * in one piece inside the memory given to it */
+    for (i = 0; i < 200; i++)
+    {
+        len = 1 + (i * 7) % 20;
+        rec = ws_framering_reserve(&fr, len);
+        if (rec == NULL || rec + len > (uint8_t *)buf + sizeof(buf))
+            return false;
+        for (j = 0; j < len; j++)
+            rec[j] = (uint8_t)(i + j);
+        ws_framering_commit(&fr, len);
+
+        rec = ws_framering_peek(&fr, &len);
+        if (rec == NULL || len != 1 + (i * 7) % 20)
+            return false;
+        for (j = 0; j < len; j++)
+        {
+            if (rec[j] != (uint8_t)(i + j))
+                return false;
+        }
+        ws_framering_release(&fr);
+    }
+
+    return ws_framering_is_empty(&fr);
+}
+
+
+bool
+framering_full(void)
+{
+    uint32_t buf[64 / 4];
+    ws_framering_t fr;
+    uint32_t len;
+
+    ws_framering_init(&fr, (uint8_t *)buf, sizeof(buf));
+
+    /* A record with its header can't fill the ring completely, as that
+     * would look empty. The same goes for a 4th record of 16 octets. */
+    if (ws_framering_reserve(&fr, 56) == NULL ||
+        ws_framering_reserve(&fr, 57) != NULL)
+    {
+        return false;
+    }
+
+    ws_framering_reserve(&fr, 12);
+    ws_framering_commit(&fr, 12);
+    ws_framering_reserve(&fr, 12);
+    ws_framering_commit(&fr, 12);
+    ws_framering_reserve(&fr, 12);
+    ws_framering_commit(&fr, 12);
+    if (ws_framering_reserve(&fr, 12) != NULL)
+        return false;
+
+    /* Releasing the oldest makes room again at the front */
+    ws_framering_peek(&fr, &len);
+    ws_framering_release(&fr);
+    ws_framering_peek(&fr, &len);
+    ws_framering_release(&fr);
+
+    return ws_framering_reserve(&fr, 12) != NULL;
+}
+
+
+typedef struct
+{
+    ws_framering_t fr;
+    uint32_t buf[256 / 4];
+} stress_t;
+
+
+/* Each record holds its sequence number, followed by octets that depend
+ * on it */
+static void *
+stress_producer(void *arg)
+{
+    stress_t *s = (stress_t *)arg;
+    uint32_t seq = 0;
+    uint32_t len, i;
+    uint8_t *rec;
+
+    while (seq < STRESS_RECORDS)
+    {
+        len = STRESS_LEN(seq);
+        rec = ws_framering_reserve(&s->fr, len + 8);
+        if (rec == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(rec, &seq, sizeof(seq));
+        for (i = sizeof(seq); i < len; i++)
+            rec[i] = (uint8_t)(seq + i);
+        ws_framering_commit(&s->fr, len);
+        seq++;
+    }
+
+    return NULL;
+}
+
+
+bool
+framering_threads(void)
+{
+    static stress_t s;
+    pthread_t thread;
+    uint32_t seq = 0;
+    uint32_t got;
+    uint32_t len, i;
+    uint8_t *rec;
+    bool ok = true;
+
+    ws_framering_init(&s.fr, (uint8_t *)s.buf, sizeof(s.buf));
+    pthread_create(&thread, NULL, stress_producer, &s);
+
+    while (seq < STRESS_RECORDS)
+    {
+        rec = ws_framering_peek(&s.fr, &len);
+        if (rec == NULL)
+        {
+            sched_yield();
+            continue;
+        }
+
+        memcpy(&got, rec, sizeof(got));
+        if (got != seq || len != STRESS_LEN(seq))
+            ok = false;
+        for (i = sizeof(seq); ok && i < len; i++)
+        {
+            if (rec[i] != (uint8_t)(seq + i))
+                ok = false;
+        }
+
+        ws_framering_release(&s.fr);
+        seq++;
+    }
+
+    pthread_join(thread, NULL);
+
+    return ok && ws_framering_is_empty(&s.fr);
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+/* Log calls in this file below a warning should vanish */
+#undef WS_LOG_LEVEL
+#define WS_LOG_LEVEL WS_LOG_LEVEL_WARN
+
+
+static void
+reset(void)
+{
+    ws_os_init();
+    ws_os_set_log_deferred(true);
+}
+
+
+bool
+log_record_layout(void)
+{
+    uint8_t buf[64];
+    ws_log_record_t *hdr = (ws_log_record_t *)buf;
+    ws_log_arg_t *args = (ws_log_arg_t *)(hdr + 1);
+    uint32_t len;
+
+    reset();
+
+    WS_WARN("value %u, %d\n", 42, -1);
+    len = ws_log_read(buf, sizeof(buf));
+
+    ws_os_set_log_deferred(false);
+
+    return len == sizeof(ws_log_record_t) + 2 * sizeof(ws_log_arg_t) &&
+        hdr->sync == WS_LOG_SYNC && hdr->nargs == 2 &&
+        args[0] == 42 && (int32_t)args[1] == -1;
+}
+
+
+bool
+log_level_filter(void)
+{
+    uint8_t buf[64];
+    uint32_t len;
+
+    reset();
+
+    WS_DEBUG("not logged\n");
+    WS_INFO("not logged\n");
+    WS_ERROR("logged\n");
+    len = ws_log_read(buf, sizeof(buf));
+
+    ws_os_set_log_deferred(false);
+
+    return len == sizeof(ws_log_record_t);
+}
+
+
+bool
+log_drop_when_full(void)
+{
+    uint8_t buf[WS_LOG_BUFFER_LEN];
+    uint32_t record_len = sizeof(ws_log_record_t) + sizeof(ws_log_arg_t);
+    uint32_t i, len;
+
+    reset();
+
+    for (i = 0; i < WS_LOG_BUFFER_LEN; i++)
+        WS_WARN("%u\n", i);
+
+    /* Only whole records are kept */
+    len = ws_log_read(buf, sizeof(buf));
+
+    ws_os_set_log_deferred(false);
+
+    return len == (WS_LOG_BUFFER_LEN / record_len) * record_len &&
+        ws_log_get_dropped() == WS_LOG_BUFFER_LEN - len / record_len;
+}
+
+
+bool
+log_format_conversions(void)
+{
+    const uint8_t data[] = {0x01, 0xab, 0xff};
+    char text[128];
+    ws_log_arg_t args[] = {
+        7, (ws_log_arg_t)-12, 0xbeef, (ws_log_arg_t)"str", 'c',
+        (ws_log_arg_t)data, sizeof(data), (ws_log_arg_t)data, sizeof(data)
+    };
+
+    ws_log_format(text, sizeof(text), "%u %d %06X %-4s|%c %r % r %%",
+                  args, sizeof(args) / sizeof(args[0]));
+
+    return strcmp(text, "7 -12 00BEEF str |c 01abff 01 ab ff %") == 0;
+}
+
+
+bool
+log_format_truncates(void)
+{
+    ws_log_arg_t args[] = {123456};
+    char text[4];
+    uint32_t len;
+
+    len = ws_log_format(text, sizeof(text), "%u", args, 1);
+
+    return len == 6 && strcmp(text, "123") == 0;
+}
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "tests.h"
 
@@ -43,8 +44,22 @@ bool res;
 
 int main(int argc, char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        printf("\n-- Running Benchmarks --\n");
+
+#undef X
+#define X(name) RUN_BENCHMARK(name);
+        RUN_BENCHMARKS();
+
+        return 0;
+    }
+
     printf("\n-- Running Tests --\n");
 
+#undef X
+#define X(name) RUN_TEST(name);
+
     RUN_TESTS();
 
     printf("\n%d/%d tests passed\n", pass_cnt, test_cnt);
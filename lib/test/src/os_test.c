@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+#define MAX_EVENTS (8)
+
+static int events[MAX_EVENTS];
+static int event_cnt;
+
+
+static void
+record(int id)
+{
+    if (event_cnt < MAX_EVENTS)
+        events[event_cnt] = id;
+    event_cnt++;
+}
+
+
+WS_TIMER_DECLARE(timer_a);
+WS_TIMER_DECLARE(timer_b);
+WS_TIMER_DECLARE(timer_c);
+WS_TIMER_DECLARE(stop_timer);
+
+static void
+timer_a(void)
+{
+    record(1);
+}
+
+
+static void
+timer_b(void)
+{
+    record(2);
+}
+
+
+static void
+timer_c(void)
+{
+    record(3);
+}
+
+
+static void
+stop_timer(void)
+{
+    ws_os_stop();
+}
+
+
+static void
+reset(void)
+{
+    ws_os_set_virtual_time(false);
+    ws_os_init();
+    event_cnt = 0;
+}
+
+
+bool
+os_timers_fire_in_order(void)
+{
+    reset();
+
+    WS_TIMER_SET(timer_c, 30);
+    WS_TIMER_SET(timer_a, 10);
+    WS_TIMER_SET(timer_b, 20);
+    WS_TIMER_SET(stop_timer, 40);
+
+    ws_os_run();
+
+    return event_cnt == 3 &&
+        events[0] == 1 && events[1] == 2 && events[2] == 3;
+}
+
+
+bool
+os_timer_cancel(void)
+{
+    reset();
+
+    WS_TIMER_SET(timer_a, 5);
+    WS_TIMER_SET(timer_b, 10);
+    WS_TIMER_CANCEL(timer_a);
+    WS_TIMER_SET(stop_timer, 20);
+
+    ws_os_run();
+
+    return event_cnt == 1 && events[0] == 2;
+}
+
+
+bool
+os_timer_restart(void)
+{
+    reset();
+
+    /* Restarting a running timer should move it, not add it twice */
+    WS_TIMER_SET(timer_a, 50);
+    WS_TIMER_SET(timer_b, 10);
+    WS_TIMER_SET(timer_a, 5);
+    WS_TIMER_SET(stop_timer, 80);
+
+    ws_os_run();
+
+    return event_cnt == 2 && events[0] == 1 && events[1] == 2;
+}
+
+
+bool
+os_virtual_time(void)
+{
+    reset();
+    ws_os_set_virtual_time(true);
+
+    /* A minute passes without waiting for it */
+    WS_TIMER_SET(timer_a, 60000);
+    WS_TIMER_SET(stop_timer, 60000);
+
+    ws_os_run();
+
+    return event_cnt == 1 && events[0] == 1 && WS_TIME_GET_NOW() == 60000;
+}
@@ -0,0 +1,974 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+#include "mac_private.h"
+
+
+#define CHANNEL (15)
+#define PAN_ID (0x1234)
+#define NODE_ADDR (0x0001)
+#define PEER_ADDR (0x0002)
+
+/* Slots of 480 symbols, with no inactive period to sleep through */
+#define SUPERFRAME_ORDER (3)
+#define BEACON_INTERVAL (MAC_BASE_SUPERFRAME_DURATION << SUPERFRAME_ORDER)
+
+#define MAX_RECORDS (32)
+#define MAX_CCAS (64)
+
+
+typedef struct
+{
+    uint32_t cnt;
+    uint8_t type[MAX_RECORDS];
+    uint8_t sqn[MAX_RECORDS];
+    uint32_t start[MAX_RECORDS];    /* When the frame started on the air */
+    uint8_t len[MAX_RECORDS];       /* Without the FCS */
+} heard_t;
+
+typedef struct
+{
+    uint32_t cnt;
+    uint8_t handle[MAX_RECORDS];
+    ws_mac_mcps_status_t status[MAX_RECORDS];
+} confirmed_t;
+
+typedef struct
+{
+    uint32_t cnt;
+    uint32_t time[MAX_CCAS];        /* When the backoff before it ended */
+    uint8_t backoffs[MAX_CCAS];     /* NB and CW when it was done */
+    uint8_t cw[MAX_CCAS];
+    bool clear[MAX_CCAS];
+} ccas_t;
+
+static ws_mac_ctx_t *mac;
+static ws_radio_sim_node_t *mac_node;
+static ws_radio_sim_node_t *peer_node;
+static const ws_radio_t *peer;
+static heard_t heard;
+static confirmed_t confirmed;
+static uint8_t acks_to_drop;
+static ccas_t ccas;
+static uint8_t ccas_to_fail;
+
+/* The MAC's radio is its sim node's, with CCA passing through mac_cca */
+static ws_radio_ops_t mac_radio_ops;
+static ws_radio_t mac_radio;
+
+
+/* The peer is a bare radio, which acknowledges frames for it by itself.
+ * Link loss is decided when a frame ends, so cutting the link back to the
+ * MAC here loses exactly the ACK for this frame. */
+static void
+peer_receive(void *arg, const uint8_t *data, uint8_t len,
+             const ws_pktbuf_meta_t *meta)
+{
+    UNUSED(arg);
+    UNUSED(len);
+
+    if (heard.cnt < MAX_RECORDS)
+    {
+        heard.type[heard.cnt] = data[1] & 0x07;
+        heard.sqn[heard.cnt] = data[3];
+        heard.start[heard.cnt] =
+            (meta->timestamp - WS_RADIO_SHR_DURATION) & 0xffffff;
+        heard.len[heard.cnt] = data[0] - WS_RADIO_CHECKSUM_LEN;
+    }
+    heard.cnt++;
+
+    if (((const mac_fcf_t *)&data[1])->ack_req)
+    {
+        ws_radio_sim_set_link(peer_node, mac_node,
+                              acks_to_drop > 0 ? WS_RADIO_SIM_OUT_OF_RANGE : 0,
+                              0);
+        if (acks_to_drop > 0)
+            acks_to_drop--;
+    }
+}
+
+
+/* Log each CCA the MAC does, and find the channel busy for as many of
+ * them as the test asks. The sim charges a symbol for reading its clock
+ * twice at once, so a CCA is timed by the backoff it ends rather than by
+ * the clock. */
+static bool
+mac_cca(void *dev)
+{
+    bool clear;
+
+    if (ccas_to_fail > 0)
+    {
+        ccas_to_fail--;
+        clear = false;
+    }
+    else
+    {
+        clear = ws_radio_sim_get_radio(mac_node)->ops->cca(dev);
+    }
+
+    if (ccas.cnt < MAX_CCAS)
+    {
+        ccas.time[ccas.cnt] = mac->ps.csma_timer.expiry & 0xffffff;
+        ccas.backoffs[ccas.cnt] = mac->ps.csma_backoffs;
+        ccas.cw[ccas.cnt] = mac->ps.csma_cw;
+        ccas.clear[ccas.cnt] = clear;
+    }
+    ccas.cnt++;
+
+    return clear;
+}
+
+
+static void
+confirm(ws_mac_ctx_t *ctx, uint8_t handle, ws_mac_mcps_status_t status)
+{
+    UNUSED(ctx);
+
+    if (confirmed.cnt < MAX_RECORDS)
+    {
+        confirmed.handle[confirmed.cnt] = handle;
+        confirmed.status[confirmed.cnt] = status;
+    }
+    confirmed.cnt++;
+}
+
+
+WS_TIMER_DECLARE(stop);
+
+static void
+stop(void)
+{
+    ws_os_stop();
+}
+
+
+static void
+run_for(uint32_t symbols)
+{
+    WS_TIMER_SET_SYMBOLS(stop, symbols);
+    ws_os_run();
+}
+
+
+/* A device that has joined the peer's PAN, and the peer listening on the
+ * same channel. Each test takes a new MAC instance. */
+static void
+reset_orders(uint8_t beacon_order, uint8_t superframe_order)
+{
+    uint8_t ext_addr[WS_MAC_ADDR_TYPE_EXTENDED_LEN] = { 1, 2, 3, 4, 5, 6 };
+
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    ws_radio_sim_init(1);
+    memset(&heard, 0, sizeof(heard));
+    memset(&confirmed, 0, sizeof(confirmed));
+    memset(&ccas, 0, sizeof(ccas));
+    acks_to_drop = 0;
+    ccas_to_fail = 0;
+
+    mac_node = ws_radio_sim_add_node();
+    peer_node = ws_radio_sim_add_node();
+
+    peer = ws_radio_sim_get_radio(peer_node);
+    WS_RADIO_CALL(peer, init);
+    WS_RADIO_CALL(peer, set_rx_callback, peer_receive, NULL);
+    WS_RADIO_CALL(peer, set_power, true);
+    WS_RADIO_CALL(peer, set_channel, CHANNEL);
+    WS_RADIO_CALL(peer, set_pan_id, PAN_ID);
+    WS_RADIO_CALL(peer, set_short_address, PEER_ADDR);
+
+    mac_radio = *ws_radio_sim_get_radio(mac_node);
+    mac_radio_ops = *mac_radio.ops;
+    mac_radio_ops.cca = mac_cca;
+    mac_radio.ops = &mac_radio_ops;
+
+    mac = ws_mac_init(ext_addr, &mac_radio);
+    ws_mac_mcps_register_confirm_callback(mac, confirm);
+    ws_mac_mlme_set_short_address(mac, NODE_ADDR);
+
+    mac->mac.state = MAC_STATE_ASSOCIATED;
+    mac->mac.pan_id = PAN_ID;
+    mac->mac.beacon_order = beacon_order;
+    mac->mac.superframe_order = superframe_order;
+    mac->mac.current_channel = CHANNEL;
+    WS_RADIO_CALL(&mac->radio, set_channel, CHANNEL);
+    WS_RADIO_CALL(&mac->radio, set_pan_id, PAN_ID);
+
+    mac_packet_scheduler_set_superframe(mac);
+    WS_RADIO_TIMER_CALL(&mac->radio, enable_interrupts);
+    mac_packet_scheduler_sync(mac);
+}
+
+
+/* The peer's PAN is beacon-enabled */
+static void
+reset(void)
+{
+    reset_orders(SUPERFRAME_ORDER, SUPERFRAME_ORDER);
+}
+
+
+static uint8_t
+send_data_len(uint16_t dest, uint8_t len)
+{
+    uint8_t payload[80];
+    ws_mac_addr_t addr;
+
+    memset(payload, 0xa5, sizeof(payload));
+
+    addr.type = WS_MAC_ADDR_TYPE_SHORT;
+    addr.pan_id = PAN_ID;
+    addr.short_addr = dest;
+
+    return ws_mac_mcps_send_data(mac, payload, len, &addr, false);
+}
+
+
+static uint8_t
+send_data(uint16_t dest)
+{
+    return send_data_len(dest, 4);
+}
+
+
+/* A broadcast command, which isn't acknowledged */
+static bool
+send_command(void)
+{
+    uint8_t payload = MAC_COMMAND_BEACON_REQUEST;
+    ws_mac_addr_t dest;
+    ws_pktbuf_t *pkt;
+    bool queued;
+
+    dest.type = WS_MAC_ADDR_TYPE_SHORT;
+    dest.pan_id = WS_MAC_BROADCAST_ADDR;
+    dest.short_addr = WS_MAC_BROADCAST_ADDR;
+
+    pkt = mac_mlme_build_command(mac, mac_mlme_get_sqn(mac), false, &dest,
+                                 NULL, &payload, 1);
+    queued = mac_packet_scheduler_send_data(mac, pkt, MAC_TX_CLASS_COMMAND);
+    ws_pktbuf_unref(pkt);
+
+    return queued;
+}
+
+
+bool
+tx_no_ack_after_ack(void)
+{
+    ws_mac_stats_t stats;
+    uint8_t sqn;
+
+    reset();
+
+    /* An acknowledged frame, and then a long quiet spell */
+    send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+    if (confirmed.cnt != 1 || confirmed.status[0] != WS_MAC_MCPS_SUCCESS)
+        return false;
+
+    /* A frame without an ACK must be given its own time to get out, and
+     * the scheduler must be woken to check on it while it waits */
+    sqn = mac->mac.sqn;
+    send_command();
+    run_for(10);
+    send_command();
+    run_for(BEACON_INTERVAL);
+
+    ws_mac_mlme_get_stats(mac, &stats);
+
+    return heard.cnt == 3 && heard.sqn[1] == sqn &&
+        heard.sqn[2] == (uint8_t)(sqn + 1) && stats.tx_not_sent == 0 &&
+        stats.tx_frames == 3;
+}
+
+
+bool
+tx_class_order(void)
+{
+    uint8_t data_sqn[3];
+    uint8_t cmd_sqn[2];
+    int i;
+
+    reset();
+
+    /* Data is queued first, but commands go ahead of it */
+    for (i = 0; i < 3; i++)
+        data_sqn[i] = send_data(PEER_ADDR);
+    for (i = 0; i < 2; i++)
+    {
+        cmd_sqn[i] = mac->mac.sqn;
+        if (!send_command())
+            return false;
+    }
+
+    run_for(20000);
+
+    if (heard.cnt != 5)
+        return false;
+
+    for (i = 0; i < 5; i++)
+    {
+        if (heard.type[i] != (i < 2 ? MAC_FRAME_TYPE_MAC :
+                                      MAC_FRAME_TYPE_DATA) ||
+            heard.sqn[i] != (i < 2 ? cmd_sqn[i] : data_sqn[i - 2]))
+        {
+            return false;
+        }
+    }
+
+    return confirmed.cnt == 3 && confirmed.status[0] == WS_MAC_MCPS_SUCCESS &&
+        confirmed.handle[0] == data_sqn[0];
+}
+
+
+bool
+tx_class_full(void)
+{
+    ws_mac_stats_t stats;
+    uint8_t handles[MAC_TX_DEPTH_DATA];
+    int i;
+
+    reset();
+
+    /* Handles wrap through 0 on the way, which is never handed out */
+    mac->mac.sqn = 256 - MAC_TX_DEPTH_DATA / 2;
+
+    for (i = 0; i < MAC_TX_DEPTH_DATA; i++)
+    {
+        handles[i] = send_data(PEER_ADDR);
+        if (handles[i] == 0 || confirmed.cnt != 0)
+            return false;
+    }
+
+    /* The data class is full, and pushes back on the caller. The refusal
+     * is confirmed with a handle of its own. */
+    if (send_data(PEER_ADDR) != 0)
+        return false;
+
+    ws_mac_mlme_get_stats(mac, &stats);
+    if (confirmed.cnt != 1 || confirmed.handle[0] == 0 ||
+        confirmed.status[0] != WS_MAC_MCPS_TRANSACTION_OVERFLOW ||
+        stats.tx_overflows != 1)
+    {
+        return false;
+    }
+
+    for (i = 0; i < MAC_TX_DEPTH_DATA; i++)
+    {
+        if (handles[i] == confirmed.handle[0])
+            return false;
+    }
+
+    /* but the other classes still have room */
+    if (!send_command())
+        return false;
+
+    run_for(50000);
+
+    /* Everything that was accepted goes out, the command first */
+    if (heard.cnt != MAC_TX_DEPTH_DATA + 1 ||
+        heard.type[0] != MAC_FRAME_TYPE_MAC ||
+        confirmed.cnt != MAC_TX_DEPTH_DATA + 1)
+    {
+        return false;
+    }
+
+    for (i = 1; i <= MAC_TX_DEPTH_DATA; i++)
+    {
+        if (confirmed.handle[i] != handles[i - 1] ||
+            confirmed.status[i] != WS_MAC_MCPS_SUCCESS)
+            return false;
+    }
+
+    return true;
+}
+
+
+static ws_mac_association_status_t assoc_status;
+static uint32_t assoc_cnt;
+
+
+static void
+assoc_done(ws_mac_ctx_t *ctx, ws_mac_association_status_t status,
+           uint16_t short_addr)
+{
+    UNUSED(ctx);
+    UNUSED(short_addr);
+
+    assoc_status = status;
+    assoc_cnt++;
+}
+
+
+/* An MLME command that can't be queued is reported, rather than waited on
+ * forever */
+bool
+mlme_command_refused(void)
+{
+    ws_mac_pan_descriptor_t pan;
+    int i;
+
+    reset();
+    assoc_cnt = 0;
+
+    /* Fill the command class, with the first command already taken off it
+     * and waiting for the channel */
+    for (i = 0; i < MAC_TX_DEPTH_COMMAND; i++)
+    {
+        if (!send_command())
+            return false;
+    }
+
+    run_for(1);
+    if (!send_command() || mac_mlme_send_beacon_request(mac))
+        return false;
+
+    memset(&pan, 0, sizeof(pan));
+    pan.addr.type = WS_MAC_ADDR_TYPE_SHORT;
+    pan.addr.pan_id = PAN_ID;
+    pan.addr.short_addr = PEER_ADDR;
+    pan.channel = CHANNEL;
+    pan.superframe_spec.beacon_order = SUPERFRAME_ORDER;
+    pan.superframe_spec.superframe_order = SUPERFRAME_ORDER;
+
+    ws_mac_mlme_associate(mac, &pan, assoc_done);
+    run_for(100);
+
+    return assoc_cnt == 1 &&
+        assoc_status == WS_MAC_ASSOCIATION_CHANNEL_ACCESS_FAILURE;
+}
+
+
+bool
+ack_retry_recovers(void)
+{
+    ws_mac_stats_t stats;
+    uint8_t sqn;
+    int i;
+
+    reset();
+
+    /* The first two copies get through, but their ACKs don't */
+    acks_to_drop = 2;
+    sqn = send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+
+    ws_mac_mlme_get_stats(mac, &stats);
+    if (heard.cnt != 3 || confirmed.cnt != 1 ||
+        confirmed.handle[0] != sqn ||
+        confirmed.status[0] != WS_MAC_MCPS_SUCCESS ||
+        stats.tx_retries != 2 || stats.tx_no_ack != 0)
+    {
+        return false;
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        if (heard.sqn[i] != sqn)
+            return false;
+    }
+
+    return true;
+}
+
+
+bool
+ack_retry_exhausted(void)
+{
+    ws_mac_stats_t stats;
+    uint8_t sqn;
+
+    reset();
+
+    acks_to_drop = 0xff;
+    sqn = send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+
+    /* The frame and every retry are heard, but never acknowledged */
+    ws_mac_mlme_get_stats(mac, &stats);
+    if (heard.cnt != 1u + mac->mac.max_frame_retries ||
+        confirmed.cnt != 1 || confirmed.handle[0] != sqn ||
+        confirmed.status[0] != WS_MAC_MCPS_NO_ACK ||
+        stats.tx_retries != mac->mac.max_frame_retries ||
+        stats.tx_no_ack != 1)
+    {
+        return false;
+    }
+
+    /* Giving up leaves the scheduler ready for the next frame */
+    acks_to_drop = 0;
+    sqn = send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+
+    return confirmed.cnt == 2 && confirmed.handle[1] == sqn &&
+        confirmed.status[1] == WS_MAC_MCPS_SUCCESS;
+}
+
+
+static uint8_t late_ack_sqn;
+
+WS_TIMER_DECLARE(late_ack);
+
+static void
+late_ack(void)
+{
+    uint8_t frame[3] = { MAC_FRAME_TYPE_ACK, 0, late_ack_sqn };
+    ws_pktbuf_t *pkt = ws_pktbuf_create(sizeof(frame));
+
+    ws_pktbuf_add_to_end(pkt, frame, sizeof(frame));
+
+    WS_RADIO_CALL(peer, prepare, pkt);
+    WS_RADIO_CALL(peer, transmit);
+
+    ws_pktbuf_destroy(pkt);
+}
+
+
+/* Have the peer finish an ACK for the frame in flight at the given offset
+ * from when the MAC stops waiting for it, and check it's confirmed once */
+static bool
+ack_at(int32_t offset, uint32_t *retries)
+{
+    ws_mac_stats_t stats;
+    uint32_t start;
+    int i;
+
+    reset();
+
+    /* Nothing is listening at this address, so only the peer's late_ack
+     * can complete the frame */
+    late_ack_sqn = send_data(PEER_ADDR + 1);
+    for (i = 0; i < 20000 &&
+         mac->ps.tx_state != PACKET_SCHEDULER_TX_STATE_SENT; i++)
+    {
+        run_for(1);
+    }
+    if (mac->ps.tx_state != PACKET_SCHEDULER_TX_STATE_SENT)
+        return false;
+
+    start = mac->ps.ack_timer.expiry + offset - WS_RADIO_SIM_AIRTIME(3);
+    WS_TIMER_SET_SYMBOLS(late_ack, start - ws_timer_get_time());
+    run_for(4 * BEACON_INTERVAL);
+
+    ws_mac_mlme_get_stats(mac, &stats);
+    *retries = stats.tx_retries;
+
+    return confirmed.cnt == 1 && confirmed.handle[0] == late_ack_sqn &&
+        confirmed.status[0] == WS_MAC_MCPS_SUCCESS && stats.tx_no_ack == 0;
+}
+
+
+bool
+ack_races_timer(void)
+{
+    uint32_t retries;
+
+    /* Just in time */
+    if (!ack_at(-1, &retries) || retries != 0)
+        return false;
+
+    /* Together with the timer, which may or may not have retried */
+    if (!ack_at(0, &retries) || retries > 1)
+        return false;
+
+    /* Just too late, when the retry is waiting to go out */
+    return ack_at(1, &retries) && retries == 1;
+}
+
+
+bool
+superframe_orders(void)
+{
+    mac_superframe_t *sf;
+    uint32_t start;
+    uint8_t bo, so, eff;
+
+    reset();
+    sf = &mac->ps.sf;
+
+    for (bo = 0; bo <= 15; bo++)
+    {
+        for (so = 0; so <= 15; so++)
+        {
+            mac->mac.beacon_order = bo;
+            mac->mac.superframe_order = so;
+            mac_packet_scheduler_set_superframe(mac);
+
+            /* Without beacons, the slot timer runs at its slowest */
+            eff = bo == 15 ? 15 : (so > bo ? bo : so);
+            if (sf->beacon_enabled != (bo < 15) ||
+                sf->slot_duration != (uint32_t)WS_RADIO_SLOT_DURATION << eff)
+            {
+                return false;
+            }
+
+            if (bo == 15)
+            {
+                if (sf->beacon_interval != 0 || sf->slots_per_beacon != 0 ||
+                    sf->cap_end != UINT32_MAX || sf->inactive_duration != 0)
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            if (sf->beacon_interval !=
+                    (uint32_t)MAC_BASE_SUPERFRAME_DURATION << bo ||
+                sf->active_duration !=
+                    (uint32_t)MAC_BASE_SUPERFRAME_DURATION << eff ||
+                sf->slots_per_beacon * sf->slot_duration !=
+                    sf->beacon_interval ||
+                sf->cap_slots != MAC_NUM_SUPERFRAME_SLOTS ||
+                sf->cap_end != sf->active_duration ||
+                sf->inactive_duration !=
+                    sf->beacon_interval - sf->active_duration)
+            {
+                return false;
+            }
+        }
+    }
+
+    /* The longest inactive period there is. A device must keep to its
+     * superframe through the slot ticks in it. */
+    reset_orders(14, 0);
+    start = mac->ps.superframe_start;
+    run_for(64 * mac->ps.sf.slot_duration);
+
+    return mac->ps.superframe_start == start;
+}
+
+
+bool
+csma_unslotted_starts(void)
+{
+    uint8_t sqn;
+
+    /* Without beacons, there's no slot tick to wait for */
+    reset_orders(15, 15);
+    sqn = send_data(PEER_ADDR);
+    run_for(MAC_BASE_SUPERFRAME_DURATION);
+
+    return confirmed.cnt == 1 && confirmed.handle[0] == sqn &&
+        confirmed.status[0] == WS_MAC_MCPS_SUCCESS;
+}
+
+
+/* The channel is busy at every CCA, so CSMA-CA gives up on the frame and
+ * the layer above hears about it at once, rather than at a later slot */
+static bool
+channel_access_fails(uint8_t beacon_order, uint8_t superframe_order)
+{
+    ws_mac_stats_t stats;
+    uint8_t sqn;
+
+    reset_orders(beacon_order, superframe_order);
+
+    ccas_to_fail = 0xff;
+    sqn = send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+
+    ws_mac_mlme_get_stats(mac, &stats);
+    if (ccas.cnt != mac->mac.max_csma_backoffs + 1u || heard.cnt != 0 ||
+        confirmed.cnt != 1 || confirmed.handle[0] != sqn ||
+        confirmed.status[0] != WS_MAC_MCPS_CHANNEL_ACCESS_FAILURE ||
+        stats.csma_failures != 1 || stats.tx_not_sent != 1 ||
+        stats.tx_retries != 0)
+    {
+        return false;
+    }
+
+    /* and the next frame gets a fresh attempt */
+    ccas_to_fail = 0;
+    sqn = send_data(PEER_ADDR);
+    run_for(4 * BEACON_INTERVAL);
+
+    return heard.cnt == 1 && confirmed.cnt == 2 &&
+        confirmed.handle[1] == sqn &&
+        confirmed.status[1] == WS_MAC_MCPS_SUCCESS;
+}
+
+
+bool
+csma_channel_access_failure(void)
+{
+    return channel_access_fails(15, 15) &&
+        channel_access_fails(SUPERFRAME_ORDER, SUPERFRAME_ORDER);
+}
+
+
+/* A data frame from the peer to the MAC, which doesn't ask for an ACK */
+static void
+peer_send_data(uint8_t sqn)
+{
+    uint8_t frame[] = {
+        0x41, 0x88, sqn,
+        PAN_ID & 0xff, PAN_ID >> 8,
+        NODE_ADDR & 0xff, NODE_ADDR >> 8,
+        PEER_ADDR & 0xff, PEER_ADDR >> 8,
+        0xde, 0xad,
+    };
+    ws_pktbuf_t *pkt = ws_pktbuf_create(sizeof(frame));
+
+    ws_pktbuf_add_to_end(pkt, frame, sizeof(frame));
+
+    WS_RADIO_CALL(peer, prepare, pkt);
+    WS_RADIO_CALL(peer, transmit);
+
+    ws_pktbuf_destroy(pkt);
+}
+
+
+bool
+tx_long_beacon_interval(void)
+{
+    ws_mac_stats_t stats;
+    uint32_t slot;
+    uint8_t sqn;
+    int i;
+
+    /* The beacon interval is more than half the 24 bit radio timer's
+     * range, so a deadline a beacon interval away wraps it. The frame waits
+     * most of a slot for the next tick. */
+    reset_orders(14, 14);
+    slot = mac->ps.sf.slot_duration;
+    run_for(2 * slot + slot / 8);
+
+    sqn = send_data(PEER_ADDR);
+
+    /* Each frame received wakes the scheduler while it waits */
+    for (i = 0; i < 4; i++)
+    {
+        run_for(slot / 8);
+        peer_send_data(i);
+    }
+
+    run_for(2 * slot);
+
+    /* The peer's frames, and its ACK */
+    ws_mac_mlme_get_stats(mac, &stats);
+
+    return stats.rx_frames == 5 && heard.cnt == 1 && confirmed.cnt == 1 &&
+        confirmed.handle[0] == sqn &&
+        confirmed.status[0] == WS_MAC_MCPS_SUCCESS &&
+        stats.tx_retries == 0 && stats.tx_not_sent == 0;
+}
+
+
+/* The longest a backoff of this exponent can be */
+#define MAX_BACKOFF(be) ((((uint32_t)1 << (be)) - 1) * UNIT_BACKOFF_PERIOD)
+
+
+bool
+csma_backoff_exponent(void)
+{
+    uint32_t longest[5] = { 0 };
+    uint32_t sent, gap, i, j;
+    uint8_t be;
+
+    /* Unslotted, so the backoffs aren't rounded to the superframe */
+    reset_orders(15, 15);
+    ws_os_seed_random(1);
+    if (mac->mac.min_backoff_exponent != 3 ||
+        mac->mac.max_backoff_exponent != 5 ||
+        mac->mac.max_csma_backoffs != 4)
+    {
+        return false;
+    }
+
+    /* Every CCA finds the channel busy, so each frame has five backoffs,
+     * with BE 3, 4, 5, 5 and 5 */
+    for (i = 0; i < 10; i++)
+    {
+        ccas.cnt = 0;
+        ccas_to_fail = 0xff;
+        sent = ws_timer_get_time() & 0xffffff;
+        send_data(PEER_ADDR);
+        run_for(4000);
+
+        if (ccas.cnt != 5 || confirmed.cnt != i + 1 ||
+            confirmed.status[i] != WS_MAC_MCPS_CHANNEL_ACCESS_FAILURE)
+        {
+            return false;
+        }
+
+        for (j = 0; j < 5; j++)
+        {
+            gap = ccas.time[j] - (j == 0 ? sent : ccas.time[j - 1]);
+            be = j + 3 > 5 ? 5 : j + 3;
+
+            if (ccas.backoffs[j] != j || gap > MAX_BACKOFF(be))
+                return false;
+            if (gap > longest[j])
+                longest[j] = gap;
+        }
+    }
+
+    /* Backoffs longer than the exponent before would allow show that it
+     * grew, and that it stays at macMaxBE */
+    return longest[1] > MAX_BACKOFF(3) && longest[2] > MAX_BACKOFF(4) &&
+        longest[4] > MAX_BACKOFF(4);
+}
+
+
+bool
+csma_backoff_alignment(void)
+{
+    uint32_t start, i;
+
+    reset();
+    ws_os_seed_random(1);
+    start = mac->ps.superframe_start;
+
+    /* Lost ACKs start CSMA-CA again wherever the ACK wait ends, and busy
+     * CCAs back off from there */
+    for (i = 0; i < 4; i++)
+    {
+        acks_to_drop = 1;
+        ccas_to_fail = 2;
+        send_data(PEER_ADDR);
+        run_for(4 * BEACON_INTERVAL);
+    }
+
+    if (confirmed.cnt != 4 || ccas.cnt > MAX_CCAS)
+        return false;
+
+    /* Every CCA falls on a backoff period boundary of the superframe, and
+     * the second of the contention window follows a period after the
+     * first */
+    for (i = 0; i < ccas.cnt; i++)
+    {
+        if (((ccas.time[i] - start) & 0xffffff) % UNIT_BACKOFF_PERIOD != 0)
+            return false;
+
+        if (ccas.clear[i] && ccas.cw[i] == MAC_CW_0 &&
+            (i + 1 == ccas.cnt || ccas.cw[i + 1] != MAC_CW_0 - 1 ||
+             ccas.time[i + 1] != ccas.time[i] + UNIT_BACKOFF_PERIOD))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool
+csma_cap_deferral(void)
+{
+    mac_superframe_t *sf;
+    uint32_t start, offset, i;
+
+    /* Slots of 60 symbols, and frames that need four of them with their
+     * ACK */
+    reset_orders(0, 0);
+    ws_os_seed_random(1);
+    sf = &mac->ps.sf;
+    start = mac->ps.superframe_start;
+
+    for (i = 0; i < MAC_TX_DEPTH_DATA; i++)
+        send_data_len(PEER_ADDR, 80);
+    run_for(64 * sf->beacon_interval);
+
+    if (heard.cnt != MAC_TX_DEPTH_DATA ||
+        confirmed.cnt != MAC_TX_DEPTH_DATA)
+    {
+        return false;
+    }
+
+    /* None is sent if it and its ACK won't be done by the end of the CAP,
+     * so some have to wait for the next superframe */
+    for (i = 0; i < heard.cnt; i++)
+    {
+        offset = ((heard.start[i] - start) & 0xffffff) % sf->beacon_interval;
+        if (offset + MAC_FRAME_DURATION(heard.len[i]) +
+                MAC_ACK_WAIT_DURATION > sf->cap_end ||
+            confirmed.status[i] != WS_MAC_MCPS_SUCCESS)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/* The longest any frame waited from a slot boundary to its first CCA */
+static uint32_t
+longest_first_backoff(bool batt_life_extension)
+{
+    uint32_t start, longest, delay, i;
+
+    reset();
+    ws_os_seed_random(1);
+    mac->mac.batt_life_extension = batt_life_extension;
+    start = mac->ps.superframe_start;
+
+    /* Each frame is started at a slot tick, on a quiet channel */
+    for (i = 0; i < 8; i++)
+    {
+        send_data(PEER_ADDR);
+        run_for(BEACON_INTERVAL);
+    }
+
+    if (confirmed.cnt != 8)
+        return UINT32_MAX;
+
+    longest = 0;
+    for (i = 0; i < ccas.cnt && i < MAX_CCAS; i++)
+    {
+        if (ccas.backoffs[i] != 0 || ccas.cw[i] != MAC_CW_0)
+            continue;
+
+        delay = ((ccas.time[i] - start) & 0xffffff) %
+            mac->ps.sf.slot_duration;
+        if (delay > longest)
+            longest = delay;
+    }
+
+    return longest;
+}
+
+
+bool
+csma_batt_life_extension(void)
+{
+    /* BE starts at 2 rather than macMinBE */
+    return longest_first_backoff(true) <= MAX_BACKOFF(2) &&
+        longest_first_backoff(false) > MAX_BACKOFF(2);
+}
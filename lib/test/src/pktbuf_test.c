@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+bool
+pktbuf_ref_keeps_buffer(void)
+{
+    ws_pktbuf_t *pkt;
+    bool ok;
+
+    ws_os_init();
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+        return false;
+
+    ok = ws_pktbuf_get_refs(pkt) == 1 && ws_pktbuf_ref(pkt) == pkt &&
+        ws_pktbuf_get_refs(pkt) == 2;
+
+    /* The first holder letting go must not free it under the second */
+    ws_pktbuf_unref(pkt);
+    ok = ok && ws_pktbuf_get_refs(pkt) == 1 &&
+        ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE - 1;
+
+    ws_pktbuf_unref(pkt);
+
+    return ok && ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE;
+}
+
+
+bool
+pktbuf_clone_shares_data(void)
+{
+    uint8_t frame[] = { 0x41, 0x88, 0x01, 0xcd, 0xab, 0xff, 0xff };
+    ws_pktbuf_t *pkt, *clone, *clone2, *other;
+    ws_pktbuf_queue_t q, q2;
+    ws_pool_stats_t stats;
+    bool ok;
+
+    ws_os_init();
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+        return false;
+
+    ws_pktbuf_add_to_end(pkt, frame, sizeof(frame));
+
+    clone = ws_pktbuf_clone(pkt);
+    if (clone == NULL)
+        return false;
+
+    /* No copy is made, but each has its own view of the data */
+    ok = ws_pktbuf_get_data(clone) == ws_pktbuf_get_data(pkt) &&
+        ws_pktbuf_get_refs(pkt) == 2 && ws_pktbuf_get_refs(clone) == 1;
+
+    ws_pktbuf_remove_from_front(clone, 3);
+    ok = ok && ws_pktbuf_get_len(clone) == sizeof(frame) - 3 &&
+        ws_pktbuf_get_len(pkt) == sizeof(frame) &&
+        ws_pktbuf_get_data(clone)[0] == 0xcd;
+
+    /* A clone of a clone refers straight to the original */
+    clone2 = ws_pktbuf_clone(clone);
+    if (clone2 == NULL)
+        return false;
+
+    ok = ok && ws_pktbuf_get_refs(pkt) == 3 &&
+        ws_pktbuf_get_refs(clone) == 1 &&
+        ws_pktbuf_get_len(clone2) == ws_pktbuf_get_len(clone);
+
+    /* The data outlives the original's reference */
+    ws_pktbuf_unref(pkt);
+    ws_pktbuf_unref(clone);
+    ok = ok && ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE - 1 &&
+        memcmp(ws_pktbuf_get_data(clone2), &frame[3], 4) == 0;
+
+    ws_pktbuf_unref(clone2);
+
+    /* A clone of a frame waiting on a queue, ahead of another, can be
+     * queued elsewhere, as it would be to send it again */
+    pkt = ws_pktbuf_pool_acquire();
+    other = ws_pktbuf_pool_acquire();
+    if (pkt == NULL || other == NULL)
+        return false;
+
+    ws_pktbuf_queue_init(&q);
+    ws_pktbuf_queue_init(&q2);
+    ws_pktbuf_queue_push(&q, pkt);
+    ws_pktbuf_queue_push(&q, other);
+
+    clone = ws_pktbuf_clone(pkt);
+    if (clone == NULL)
+        return false;
+
+    ws_pktbuf_queue_push(&q2, clone);
+    ok = ok && ws_pktbuf_queue_pop(&q2) == clone &&
+        ws_pktbuf_queue_get_len(&q2) == 0 &&
+        ws_pktbuf_queue_get_len(&q) == 2;
+
+    /* Each queue's reference, and then our own */
+    ws_pktbuf_unref(clone);
+    ws_pktbuf_unref(clone);
+    ws_pktbuf_unref(ws_pktbuf_queue_pop(&q));
+    ws_pktbuf_unref(ws_pktbuf_queue_pop(&q));
+    ws_pktbuf_unref(pkt);
+    ws_pktbuf_unref(other);
+
+    /* The clones themselves came from the smallest pool */
+    ws_pool_get_stats(0, &stats);
+
+    return ok && ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE &&
+        stats.used == 0;
+}
+
+
+bool
+pktbuf_reserve_headroom(void)
+{
+    uint8_t header[] = { 0x41, 0x88, 0x01 };
+    uint8_t payload[] = { 0xde, 0xad, 0xbe, 0xef };
+    uint8_t frame[sizeof(header) + sizeof(payload)];
+    ws_pktbuf_t *pkt;
+    uint8_t *data;
+    bool ok;
+
+    ws_os_init();
+
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+        return false;
+
+    /* The payload is written in place, and the header goes in front of it
+     * without moving it */
+    ok = ws_pktbuf_reserve(pkt, 16) == 16 &&
+        ws_pktbuf_get_free_space_at_start(pkt) == 16 &&
+        ws_pktbuf_add_to_end(pkt, payload, sizeof(payload)) ==
+        sizeof(payload);
+
+    data = ws_pktbuf_get_data(pkt);
+    ok = ok && ws_pktbuf_add_to_front(pkt, header, sizeof(header)) ==
+        sizeof(header) && ws_pktbuf_get_data(pkt) == data - sizeof(header);
+
+    memcpy(frame, header, sizeof(header));
+    memcpy(&frame[sizeof(header)], payload, sizeof(payload));
+    ok = ok && ws_pktbuf_get_len(pkt) == sizeof(frame) &&
+        memcmp(ws_pktbuf_get_data(pkt), frame, sizeof(frame)) == 0;
+
+    /* Running out of headroom fails without touching the frame */
+    ok = ok && ws_pktbuf_increment_front(pkt, 14) == 0 &&
+        ws_pktbuf_get_len(pkt) == sizeof(frame);
+
+    ws_pktbuf_unref(pkt);
+
+    return ok;
+}
+
+
+bool
+pktbuf_chain_segments(void)
+{
+    uint8_t header[] = { 0x01, 0x02 };
+    uint8_t samples[] = { 0x10, 0x20, 0x30, 0x40, 0x50 };
+    uint8_t frame[sizeof(header) + sizeof(samples)];
+    ws_pktbuf_t *pkt;
+    ws_pktbuf_t *seg;
+    ws_pktbuf_t *clone;
+    bool ok;
+
+    ws_os_init();
+
+    pkt = ws_pktbuf_pool_acquire();
+    seg = ws_pktbuf_wrap(samples, sizeof(samples));
+    if (pkt == NULL || seg == NULL)
+        return false;
+
+    ws_pktbuf_add_to_end(pkt, header, sizeof(header));
+
+    /* The chain holds its own reference to the segment, which still points
+     * at our samples */
+    ws_pktbuf_chain(pkt, seg);
+    ok = ws_pktbuf_get_refs(seg) == 2 &&
+        ws_pktbuf_get_next(pkt) == seg &&
+        ws_pktbuf_get_data(seg) == samples &&
+        ws_pktbuf_get_len(pkt) == sizeof(header) &&
+        ws_pktbuf_get_chain_len(pkt) == sizeof(frame);
+    ws_pktbuf_unref(seg);
+
+    /* A clone shares the rest of the chain */
+    clone = ws_pktbuf_clone(pkt);
+    ok = ok && clone != NULL && ws_pktbuf_get_next(clone) == seg &&
+        ws_pktbuf_get_refs(seg) == 2;
+    ws_pktbuf_unref(clone);
+
+    /* Gathering copies the segments onto the end and drops them */
+    memcpy(frame, header, sizeof(header));
+    memcpy(&frame[sizeof(header)], samples, sizeof(samples));
+    ok = ok && ws_pktbuf_gather(pkt) == sizeof(frame) &&
+        ws_pktbuf_get_next(pkt) == NULL &&
+        memcmp(ws_pktbuf_get_data(pkt), frame, sizeof(frame)) == 0;
+
+    ws_pktbuf_unref(pkt);
+
+    return ok && ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE;
+}
+
+
+bool
+pktbuf_queue_fifo(void)
+{
+    ws_pktbuf_queue_t q;
+    ws_pktbuf_t *pkts[3];
+    uint32_t i;
+    bool ok = true;
+
+    ws_os_init();
+    ws_pktbuf_queue_init(&q);
+
+    for (i = 0; i < 3; i++)
+    {
+        pkts[i] = ws_pktbuf_pool_acquire();
+        if (pkts[i] == NULL)
+            return false;
+    }
+
+    /* The queue takes its own reference to each pktbuf, but no memory */
+    for (i = 0; i < 3; i++)
+    {
+        ws_pktbuf_queue_push(&q, pkts[i]);
+        ws_pktbuf_unref(pkts[i]);
+    }
+
+    ok = ws_pktbuf_queue_get_len(&q) == 3 &&
+        ws_pktbuf_queue_peek(&q) == pkts[0] &&
+        ws_pktbuf_get_refs(pkts[0]) == 1 &&
+        ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE - 3;
+
+    /* Popping hands the queue's reference over, in order */
+    for (i = 0; i < 3; i++)
+    {
+        ok = ok && ws_pktbuf_queue_pop(&q) == pkts[i] &&
+            ws_pktbuf_queue_get_len(&q) == 2 - i;
+    }
+
+    /* A pktbuf can go back on once it has come off */
+    ws_pktbuf_queue_push(&q, pkts[2]);
+    ws_pktbuf_queue_push(&q, pkts[1]);
+    ok = ok && ws_pktbuf_queue_pop(&q) == pkts[2] &&
+        ws_pktbuf_queue_pop(&q) == pkts[1] &&
+        ws_pktbuf_queue_pop(&q) == NULL &&
+        ws_pktbuf_queue_peek(&q) == NULL &&
+        ws_pktbuf_get_refs(pkts[1]) == 2;
+
+    ws_pktbuf_unref(pkts[1]);
+    ws_pktbuf_unref(pkts[2]);
+    for (i = 0; i < 3; i++)
+        ws_pktbuf_unref(pkts[i]);
+
+    return ok && ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE;
+}
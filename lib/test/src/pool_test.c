@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+static ws_pool_stats_t
+get_stats(uint32_t class_index)
+{
+    ws_pool_stats_t stats;
+
+    memset(&stats, 0, sizeof(stats));
+    ws_pool_get_stats(class_index, &stats);
+
+    return stats;
+}
+
+
+bool
+pool_smallest_class(void)
+{
+    ws_pool_stats_t small, large;
+    void *a, *b;
+
+    ws_os_init();
+
+    small = get_stats(0);
+    large = get_stats(1);
+
+    a = ws_pool_alloc(small.block_size);
+    b = ws_pool_alloc(small.block_size + 1);
+
+    small = get_stats(0);
+    large = get_stats(1);
+
+    ws_pool_free(a);
+    ws_pool_free(b);
+
+    return a != NULL && b != NULL && small.used == 1 && large.used == 1 &&
+        get_stats(0).used == 0 && get_stats(1).used == 0;
+}
+
+
+bool
+pool_exhaust_and_reuse(void)
+{
+    ws_pool_stats_t stats;
+    void *blocks[64];
+    uint32_t i, n;
+
+    ws_os_init();
+
+    stats = get_stats(0);
+    n = stats.blocks;
+    if (n > 64)
+        return false;
+
+    for (i = 0; i < n; i++)
+    {
+        blocks[i] = ws_pool_alloc(stats.block_size);
+        if (blocks[i] == NULL)
+            return false;
+    }
+
+    /* Full classes fail rather than borrowing from a larger one */
+    if (ws_pool_alloc(stats.block_size) != NULL)
+        return false;
+
+    /* Freeing every other block leaves holes that can all be reused */
+    for (i = 0; i < n; i += 2)
+        ws_pool_free(blocks[i]);
+    for (i = 0; i < n; i += 2)
+    {
+        blocks[i] = ws_pool_alloc(stats.block_size);
+        if (blocks[i] == NULL)
+            return false;
+    }
+
+    for (i = 0; i < n; i++)
+        ws_pool_free(blocks[i]);
+
+    stats = get_stats(0);
+
+    return stats.used == 0 && stats.high_water == n && stats.failures == 1;
+}
+
+
+bool
+pool_too_large(void)
+{
+    ws_pool_stats_t stats;
+
+    ws_os_init();
+
+    stats = get_stats(ws_pool_get_class_count() - 1);
+
+    return ws_pool_alloc(stats.block_size + 1) == NULL &&
+        !ws_pool_get_stats(ws_pool_get_class_count(), &stats);
+}
+
+
+bool
+pool_pktbuf(void)
+{
+    uint8_t frame[WS_RADIO_MAX_PACKET_LEN];
+    uint32_t pktbuf_class = ws_pool_get_class_count() - 1;
+    ws_pktbuf_t *pkt;
+    bool ok;
+
+    ws_os_init();
+
+    memset(frame, 0xa5, sizeof(frame));
+
+    /* A full size frame must fit in a block from the packet buffer pool */
+    pkt = ws_pktbuf_create(WS_RADIO_MAX_PACKET_LEN);
+    if (pkt == NULL)
+        return false;
+
+    ok = ws_pktbuf_add_to_end(pkt, frame, sizeof(frame)) == sizeof(frame) &&
+        memcmp(ws_pktbuf_get_data(pkt), frame, sizeof(frame)) == 0 &&
+        get_stats(pktbuf_class).used == 1;
+
+    ws_pktbuf_destroy(pkt);
+
+    return ok && get_stats(pktbuf_class).used == 0;
+}
+
+
+bool
+pktbuf_pool_exhaust_and_reuse(void)
+{
+    ws_pktbuf_t *pkts[WS_PKTBUF_POOL_SIZE];
+    ws_pool_stats_t stats;
+    ws_pktbuf_t *extra;
+    uint8_t frame[WS_PKTBUF_POOL_BUF_LEN];
+    uint32_t i;
+    bool ok = true;
+
+    ws_os_init();
+
+    memset(frame, 0x5a, sizeof(frame));
+
+    for (i = 0; i < WS_PKTBUF_POOL_SIZE; i++)
+    {
+        pkts[i] = ws_pktbuf_pool_acquire();
+        if (pkts[i] == NULL)
+            return false;
+
+        ok = ok && ws_pktbuf_get_len(pkts[i]) == 0 &&
+            ws_pktbuf_add_to_end(pkts[i], frame, sizeof(frame)) ==
+            sizeof(frame);
+    }
+
+    /* An empty pool is reported, not papered over with a larger block */
+    extra = ws_pktbuf_pool_acquire();
+    ws_pktbuf_pool_get_stats(&stats);
+    ok = ok && extra == NULL && ws_pktbuf_pool_available() == 0 &&
+        stats.failures == 1 && stats.used == WS_PKTBUF_POOL_SIZE;
+
+    /* A released buffer comes back empty */
+    ws_pktbuf_pool_release(pkts[0]);
+    extra = ws_pktbuf_pool_acquire();
+    ok = ok && extra == pkts[0] && ws_pktbuf_get_len(extra) == 0 &&
+        ws_pktbuf_get_free_space_at_end(extra) == WS_PKTBUF_POOL_BUF_LEN;
+
+    for (i = 0; i < WS_PKTBUF_POOL_SIZE; i++)
+        ws_pktbuf_pool_release(pkts[i]);
+
+    ws_pktbuf_pool_get_stats(&stats);
+
+    return ok && stats.used == 0 && stats.high_water == WS_PKTBUF_POOL_SIZE &&
+        ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE;
+}
+
+
+bool
+pktbuf_pool_destroy_releases(void)
+{
+    uint32_t pktbuf_class = ws_pool_get_class_count() - 1;
+    ws_pktbuf_t *pkt;
+
+    ws_os_init();
+
+    /* Destroying a pool buffer hands it back rather than freeing it */
+    pkt = ws_pktbuf_pool_acquire();
+    if (pkt == NULL)
+        return false;
+
+    ws_pktbuf_destroy(pkt);
+
+    return ws_pktbuf_pool_available() == WS_PKTBUF_POOL_SIZE &&
+        get_stats(pktbuf_class).used == 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+#define NODES (3)
+#define CHANNEL (15)
+#define PAN_ID (0x1234)
+
+/* A data frame with short addresses and PAN ID compression */
+#define FRAME_LEN (12)
+#define FCF_DATA (0x8841)
+#define FCF_ACK_REQ (0x0020)
+
+
+typedef struct
+{
+    uint32_t cnt;
+    uint32_t time;
+    uint8_t len;
+    uint8_t data[WS_RADIO_MAX_PACKET_LEN + 3];
+    ws_pktbuf_meta_t meta;
+} received_t;
+
+static ws_radio_sim_node_t *node[NODES];
+static const ws_radio_t *radio[NODES];
+static received_t received[NODES];
+
+
+static void
+record(void *arg, const uint8_t *data, uint8_t len,
+       const ws_pktbuf_meta_t *meta)
+{
+    received_t *r = (received_t *)arg;
+
+    r->cnt++;
+    r->time = ws_timer_get_time();
+    r->len = len;
+    memcpy(r->data, data, len);
+    r->meta = *meta;
+}
+
+
+WS_TIMER_DECLARE(stop);
+
+static void
+stop(void)
+{
+    ws_os_stop();
+}
+
+
+static void
+run_for(uint32_t symbols)
+{
+    WS_TIMER_SET_SYMBOLS(stop, symbols);
+    ws_os_run();
+}
+
+
+/* Three nodes on the same channel and PAN, with short addresses 1, 2 and 3 */
+static void
+reset(uint32_t seed)
+{
+    int i;
+
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    ws_radio_sim_init(seed);
+    memset(received, 0, sizeof(received));
+
+    for (i = 0; i < NODES; i++)
+    {
+        node[i] = ws_radio_sim_add_node();
+        radio[i] = ws_radio_sim_get_radio(node[i]);
+        WS_RADIO_CALL(radio[i], init);
+        WS_RADIO_CALL(radio[i], set_rx_callback, record, &received[i]);
+        WS_RADIO_CALL(radio[i], set_power, true);
+        WS_RADIO_CALL(radio[i], set_channel, CHANNEL);
+        WS_RADIO_CALL(radio[i], set_pan_id, PAN_ID);
+        WS_RADIO_CALL(radio[i], set_short_address, i + 1);
+    }
+}
+
+
+static void
+send(int from, uint16_t dest, uint16_t flags, uint8_t sqn)
+{
+    uint16_t fcf = FCF_DATA | flags;
+    uint8_t frame[FRAME_LEN] = {
+        fcf & 0xff, fcf >> 8,
+        sqn,
+        PAN_ID & 0xff, PAN_ID >> 8,
+        dest & 0xff, dest >> 8,
+        from + 1, 0,
+        0xde, 0xad, 0xbe,
+    };
+    ws_pktbuf_t *pkt = ws_pktbuf_create(FRAME_LEN);
+
+    ws_pktbuf_add_to_end(pkt, frame, FRAME_LEN);
+
+    WS_RADIO_CALL(radio[from], prepare, pkt);
+    WS_RADIO_CALL(radio[from], transmit);
+
+    ws_pktbuf_destroy(pkt);
+}
+
+
+bool
+radio_sim_delivery(void)
+{
+    ws_radio_sim_stats_t stats;
+
+    reset(1);
+    send(0, 2, 0, 7);
+    run_for(1000);
+
+    /* Only the addressed node takes the frame, once it has all arrived */
+    if (received[1].cnt != 1 || received[2].cnt != 0 ||
+        received[0].cnt != 0)
+    {
+        return false;
+    }
+
+    if (received[1].time != WS_RADIO_SIM_AIRTIME(FRAME_LEN))
+        return false;
+
+    /* PHY length, frame, then the RSSI and CRC OK in place of the FCS */
+    if (received[1].len != FRAME_LEN + 3 ||
+        received[1].data[0] != FRAME_LEN + WS_RADIO_CHECKSUM_LEN ||
+        received[1].data[3] != 7 ||
+        received[1].data[FRAME_LEN] != 0xbe ||
+        !(received[1].data[FRAME_LEN + 2] & 0x80))
+    {
+        return false;
+    }
+
+    ws_radio_sim_get_stats(node[2], &stats);
+    return stats.rx_filtered == 1;
+}
+
+
+bool
+radio_sim_rx_metadata(void)
+{
+    ws_pktbuf_meta_t *meta = &received[1].meta;
+    uint32_t start;
+
+    reset(1);
+    ws_radio_sim_set_link(node[0], node[1], 0, -72);
+
+    run_for(100);
+    start = ws_timer_get_time();
+    send(0, 2, 0, 1);
+    run_for(1000);
+
+    /* The radio reports the link's RSSI, and when the SFD went past */
+    return received[1].cnt == 1 &&
+        meta->rssi == -72 &&
+        meta->timestamp == start + WS_RADIO_SHR_DURATION &&
+        meta->channel == CHANNEL &&
+        meta->crc_ok &&
+        meta->lqi > 0;
+}
+
+
+bool
+radio_sim_channel_separation(void)
+{
+    reset(1);
+    WS_RADIO_CALL(radio[1], set_channel, CHANNEL + 1);
+
+    send(0, 0xffff, 0, 1);
+
+    /* Node 2 shares the channel and hears the frame, node 1 doesn't */
+    if (!WS_RADIO_CALL(radio[1], cca) || WS_RADIO_CALL(radio[2], cca))
+        return false;
+
+    run_for(1000);
+
+    return received[1].cnt == 0 && received[2].cnt == 1;
+}
+
+
+bool
+radio_sim_collision(void)
+{
+    ws_radio_sim_stats_t stats;
+
+    reset(1);
+
+    /* The second frame starts before the first has finished */
+    send(0, 0xffff, 0, 1);
+    ws_os_advance_time(WS_RADIO_SIM_AIRTIME(FRAME_LEN) / 2);
+    send(2, 0xffff, 0, 2);
+    run_for(1000);
+
+    ws_radio_sim_get_stats(node[1], &stats);
+    if (received[1].cnt != 0 || stats.rx_collisions != 1)
+        return false;
+
+    /* Back to back frames don't collide */
+    send(0, 0xffff, 0, 3);
+    run_for(WS_RADIO_SIM_AIRTIME(FRAME_LEN));
+    send(2, 0xffff, 0, 4);
+    run_for(1000);
+
+    return received[1].cnt == 2;
+}
+
+
+bool
+radio_sim_cca_busy(void)
+{
+    reset(1);
+
+    if (!WS_RADIO_CALL(radio[1], cca))
+        return false;
+
+    send(0, 0xffff, 0, 1);
+
+    /* Busy for the receiver, and the transmitter can't listen at all */
+    if (WS_RADIO_CALL(radio[1], cca) || WS_RADIO_CALL(radio[0], cca))
+        return false;
+
+    run_for(WS_RADIO_SIM_AIRTIME(FRAME_LEN));
+
+    if (!WS_RADIO_CALL(radio[1], cca))
+        return false;
+
+    /* A radio that is off never sees a clear channel */
+    WS_RADIO_CALL(radio[1], set_power, false);
+    return !WS_RADIO_CALL(radio[1], cca);
+}
+
+
+bool
+radio_sim_auto_ack(void)
+{
+    ws_radio_sim_stats_t stats;
+    uint32_t expected;
+
+    reset(1);
+    send(0, 2, FCF_ACK_REQ, 42);
+    run_for(1000);
+
+    expected = WS_RADIO_SIM_AIRTIME(FRAME_LEN) + WS_RADIO_SIM_TURNAROUND +
+        WS_RADIO_SIM_AIRTIME(3);
+
+    if (received[0].cnt != 1 || received[0].time != expected)
+        return false;
+
+    /* PHY length, ACK FCF and the sequence number being acknowledged */
+    if (received[0].data[0] != 3 + WS_RADIO_CHECKSUM_LEN ||
+        (received[0].data[1] & 0x07) != 0x02 ||
+        received[0].data[3] != 42)
+    {
+        return false;
+    }
+
+    /* Broadcasts are never acknowledged */
+    send(0, 0xffff, FCF_ACK_REQ, 43);
+    run_for(1000);
+
+    ws_radio_sim_get_stats(node[1], &stats);
+    return received[0].cnt == 1 && stats.tx_acks == 1;
+}
+
+
+static uint32_t
+count_delivered(uint32_t seed, uint8_t loss)
+{
+    int i;
+
+    reset(seed);
+    ws_radio_sim_set_link(node[0], node[1], loss, -80);
+
+    for (i = 0; i < 200; i++)
+    {
+        send(0, 0xffff, 0, i);
+        run_for(1000);
+    }
+
+    return received[1].cnt;
+}
+
+
+bool
+radio_sim_link_loss(void)
+{
+    uint32_t cnt;
+
+    /* Out of range: nothing arrives, and the channel sounds clear */
+    reset(1);
+    ws_radio_sim_set_link(node[0], node[1], WS_RADIO_SIM_OUT_OF_RANGE, 0);
+    send(0, 0xffff, 0, 1);
+    if (!WS_RADIO_CALL(radio[1], cca))
+        return false;
+    run_for(1000);
+    if (received[1].cnt != 0 || received[2].cnt != 1)
+        return false;
+
+    /* Lossy, but repeatable with the same seed */
+    cnt = count_delivered(5, 50);
+    if (cnt < 70 || cnt > 130)
+        return false;
+    if ((int8_t)received[1].data[FRAME_LEN + 1] != -80)
+        return false;
+
+    return count_delivered(5, 50) == cnt && received[2].cnt == 200;
+}
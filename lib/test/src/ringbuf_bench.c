@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "wsn.h"
+
+
+#define ROUNDS (100000)
+#define FRAME_LEN (WS_RADIO_MAX_PACKET_LEN)
+
+
+static uint8_t frame[FRAME_LEN];
+static uint8_t out[FRAME_LEN];
+static uint8_t storage[512];
+
+
+static uint64_t
+get_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+/* The ring buffer as it was, copying an octet at a time with a modulo for
+ * each, to compare against */
+static void
+bytewise_write(ws_ringbuf_t *rb, const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        rb->buffer[rb->head] = data[i];
+        rb->head = (rb->head + 1) % rb->capacity;
+    }
+}
+
+
+static void
+bytewise_read(ws_ringbuf_t *rb, uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        data[i] = rb->buffer[rb->tail];
+        rb->tail = (rb->tail + 1) % rb->capacity;
+    }
+}
+
+
+/* Cost of passing a full size frame through a ring buffer, as the radio
+ * interrupt and the packet scheduler did for every frame */
+static void
+bench_frame(uint32_t size, bool bytewise)
+{
+    ws_ringbuf_t rb;
+    uint64_t start, end;
+    uint32_t i;
+
+    ws_ringbuf_init(&rb, storage, size);
+
+    start = get_ns();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        if (bytewise)
+        {
+            bytewise_write(&rb, frame, FRAME_LEN);
+            bytewise_read(&rb, out, FRAME_LEN);
+        }
+        else
+        {
+            ws_ringbuf_write(&rb, frame, FRAME_LEN);
+            ws_ringbuf_read(&rb, out, FRAME_LEN);
+        }
+    }
+    end = get_ns();
+
+    ASSERT(memcmp(frame, out, FRAME_LEN) == 0, "frame corrupted\n");
+
+    printf("  %s, %3u octets: %6.1f ns/frame\n",
+           bytewise ? "bytewise" : "block   ", size,
+           (double)(end - start) / ROUNDS);
+}
+
+
+void
+ringbuf_bench(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < FRAME_LEN; i++)
+        frame[i] = (uint8_t)i;
+
+    bench_frame(256, true);
+    bench_frame(256, false);
+    bench_frame(300, true);
+    bench_frame(300, false);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "wsn.h"
+
+
+/* Octets passed from one thread to the other by each stress test */
+#define STRESS_LEN (1 << 22)
+
+/* The octet at a given place in the stream. A prime period shows up
+ * octets that are lost or out of order, even across a wrap. */
+#define STRESS_OCTET(n) ((uint8_t)((n) % 251))
+
+
+/* Push frames through a ring buffer of the given size so every write and
+ * read lands at a different offset, including across the end */
+static bool
+check_wrapping(uint32_t size)
+{
+    uint8_t buf[64];
+    uint8_t in[23];
+    uint8_t out[23];
+    ws_ringbuf_t rb;
+    uint32_t i, j;
+    uint8_t octet;
+
+    ws_ringbuf_init(&rb, buf, size);
+
+    for (i = 0; i < 50; i++)
+    {
+        for (j = 0; j < sizeof(in); j++)
+            in[j] = (uint8_t)(i * 31 + j);
+
+        if (ws_ringbuf_write(&rb, in, sizeof(in)) != sizeof(in) ||
+            ws_ringbuf_get_len(&rb) != sizeof(in))
+        {
+            return false;
+        }
+
+        /* Peek leaves the data where it is */
+        memset(out, 0, sizeof(out));
+        if (ws_ringbuf_peek(&rb, out, sizeof(out)) != sizeof(out) ||
+            memcmp(in, out, sizeof(out)) != 0)
+        {
+            return false;
+        }
+
+        /* Take the first octet alone, then the rest */
+        if (ws_ringbuf_pop(&rb, &octet) != 1 || octet != in[0])
+            return false;
+
+        memset(out, 0, sizeof(out));
+        if (ws_ringbuf_read(&rb, out, sizeof(out)) != sizeof(out) - 1 ||
+            memcmp(&in[1], out, sizeof(out) - 1) != 0 ||
+            ws_ringbuf_has_data(&rb))
+        {
+            return false;
+        }
+    }
+
+    /* Writes stop when the buffer is full */
+    for (i = 0; i < size; i++)
+        ws_ringbuf_push(&rb, (uint8_t)i);
+
+    return ws_ringbuf_is_full(&rb) &&
+        ws_ringbuf_push(&rb, 0) == 0 &&
+        ws_ringbuf_write(&rb, in, sizeof(in)) == 0 &&
+        ws_ringbuf_read(&rb, buf, 1) == 1 &&
+        ws_ringbuf_write(&rb, in, sizeof(in)) == 1;
+}
+
+
+bool
+ringbuf_wraps_power_of_two(void)
+{
+    return check_wrapping(32);
+}
+
+
+bool
+ringbuf_wraps_any_size(void)
+{
+    return check_wrapping(37);
+}
+
+
+typedef struct
+{
+    ws_ringbuf_t rb;
+    uint8_t buf[61];
+} stress_t;
+
+
+/* Writes the stream in pieces of 1 to 13 octets, pushing every 7th */
+static void *
+stress_producer(void *arg)
+{
+    stress_t *s = (stress_t *)arg;
+    uint8_t data[13];
+    uint32_t sent = 0;
+    uint32_t len, i;
+
+    while (sent < STRESS_LEN)
+    {
+        len = 1 + sent % 13;
+        if (len > STRESS_LEN - sent)
+            len = STRESS_LEN - sent;
+
+        for (i = 0; i < len; i++)
+            data[i] = STRESS_OCTET(sent + i);
+
+        if (len % 7 == 0)
+            len = ws_ringbuf_push(&s->rb, data[0]);
+        else
+            len = ws_ringbuf_write(&s->rb, data, len);
+
+        if (len == 0)
+            sched_yield();
+        sent += len;
+    }
+
+    return NULL;
+}
+
+
+/* Pass a stream through a ring buffer from another thread, reading it back
+ * in pieces of different sizes to the writes */
+static bool
+check_threads(uint32_t size)
+{
+    static stress_t s;
+    pthread_t thread;
+    uint8_t data[17];
+    uint32_t received = 0;
+    uint32_t len, i;
+    bool ok = true;
+
+    ws_ringbuf_init(&s.rb, s.buf, size);
+    pthread_create(&thread, NULL, stress_producer, &s);
+
+    while (ok && received < STRESS_LEN)
+    {
+        if (received % 5 == 0)
+            len = ws_ringbuf_pop(&s.rb, data);
+        else
+            len = ws_ringbuf_read(&s.rb, data, 1 + received % 17);
+
+        if (len == 0)
+            sched_yield();
+
+        for (i = 0; i < len; i++)
+        {
+            if (data[i] != STRESS_OCTET(received + i))
+                ok = false;
+        }
+        received += len;
+    }
+
+    /* Let the producer finish, whatever happened */
+    while (received < STRESS_LEN)
+        received += ws_ringbuf_read(&s.rb, data, sizeof(data));
+    pthread_join(thread, NULL);
+
+    return ok && !ws_ringbuf_has_data(&s.rb);
+}
+
+
+bool
+ringbuf_threads_power_of_two(void)
+{
+    return check_threads(32);
+}
+
+
+bool
+ringbuf_threads_any_size(void)
+{
+    return check_threads(61);
+}
@@ -47,7 +47,86 @@ extern bool res;
     X(list_count_elements) \
     X(list_test_empty) \
     X(list_test_first) \
-    X(list_test_last)
+    X(list_test_last) \
+    X(os_timers_fire_in_order) \
+    X(os_timer_cancel) \
+    X(os_timer_restart) \
+    X(os_virtual_time) \
+    X(timer_heap_order) \
+    X(timer_fires_on_time) \
+    X(timer_cancel_and_set) \
+    X(timer_rearm_does_not_starve) \
+    X(timer_long_delay) \
+    X(event_priority_order) \
+    X(event_higher_priority_runs_next) \
+    X(event_coalesce) \
+    X(event_repost_does_not_starve) \
+    X(event_wakes_main_loop) \
+    X(ringbuf_wraps_power_of_two) \
+    X(ringbuf_wraps_any_size) \
+    X(ringbuf_threads_power_of_two) \
+    X(ringbuf_threads_any_size) \
+    X(framering_records_in_order) \
+    X(framering_never_splits_records) \
+    X(framering_full) \
+    X(framering_threads) \
+    X(pool_smallest_class) \
+    X(pool_exhaust_and_reuse) \
+    X(pool_too_large) \
+    X(pool_pktbuf) \
+    X(pktbuf_pool_exhaust_and_reuse) \
+    X(pktbuf_pool_destroy_releases) \
+    X(pktbuf_ref_keeps_buffer) \
+    X(pktbuf_clone_shares_data) \
+    X(pktbuf_reserve_headroom) \
+    X(pktbuf_chain_segments) \
+    X(pktbuf_queue_fifo) \
+    X(log_record_layout) \
+    X(log_level_filter) \
+    X(log_drop_when_full) \
+    X(log_format_conversions) \
+    X(log_format_truncates) \
+    X(trace_records_in_order) \
+    X(trace_overwrites_oldest) \
+    X(trace_export_json) \
+    X(trace_export_vcd) \
+    X(radio_sim_delivery) \
+    X(radio_sim_rx_metadata) \
+    X(radio_sim_channel_separation) \
+    X(radio_sim_collision) \
+    X(radio_sim_cca_busy) \
+    X(radio_sim_auto_ack) \
+    X(radio_sim_link_loss) \
+    X(aes_ccm_vector) \
+    X(aes_ccm_decrypt_checks_tag) \
+    X(device_table_remove_in_chain) \
+    X(device_table_wraps) \
+    X(device_table_reuses_handles) \
+    X(device_table_full) \
+    X(device_table_set_short) \
+    X(tx_no_ack_after_ack) \
+    X(tx_class_order) \
+    X(tx_class_full) \
+    X(mlme_command_refused) \
+    X(ack_retry_recovers) \
+    X(ack_retry_exhausted) \
+    X(ack_races_timer) \
+    X(superframe_orders) \
+    X(csma_unslotted_starts) \
+    X(csma_channel_access_failure) \
+    X(tx_long_beacon_interval) \
+    X(csma_backoff_exponent) \
+    X(csma_backoff_alignment) \
+    X(csma_cap_deferral) \
+    X(csma_batt_life_extension)
+
+/**
+ * Benchmarks are only run with "tests bench", as their timings are not
+ * checked.
+ */
+#define BENCHMARKS\
+    X(timer_bench) \
+    X(ringbuf_bench)
 
 
 /* Prototypes */
@@ -57,6 +136,12 @@ extern bool res;
 TESTS;
 #undef X
 
+#define X(name)\
+    extern void\
+    name(void);
+BENCHMARKS;
+#undef X
+
 
 /* Test macros */
 #define RUN_TEST(test_name)\
@@ -76,6 +161,21 @@ TESTS;
         TESTS;\
     } while (0)
 
+/* Benchmarks print their own results. X has to be redefined to
+ * RUN_BENCHMARK before using this */
+#define RUN_BENCHMARK(bench_name)\
+    do\
+    {\
+        printf(#bench_name ":\n");\
+        bench_name();\
+    } while(0)
+
+#define RUN_BENCHMARKS()\
+    do\
+    {\
+        BENCHMARKS;\
+    } while (0)
+
 
 
 
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "wsn.h"
+
+
+#define ROUNDS (100000)
+
+
+static ws_timer_t timers[WS_TIMER_MAX];
+static uint32_t fired;
+
+
+static void
+count_fire(void *arg)
+{
+    UNUSED(arg);
+    fired++;
+}
+
+
+static uint64_t
+get_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+
+static void
+fill(uint32_t count)
+{
+    uint32_t i;
+
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    ws_os_seed_random(1);
+
+    for (i = 0; i < WS_TIMER_MAX; i++)
+        timers[i] = (ws_timer_t)WS_TIMER_INITIALISER(count_fire, NULL);
+
+    /* Background timers that are far enough away never to fire */
+    for (i = 1; i < count; i++)
+        ws_timer_set(&timers[i], 0x100000 + WS_GET_RANDOM8() * 16);
+}
+
+
+/* Cost of re-arming a timer, as the packet scheduler does for every
+ * received frame, with a number of other timers running */
+static void
+bench_rearm(uint32_t count)
+{
+    uint64_t start, end;
+    uint32_t i;
+
+    fill(count);
+
+    start = get_ns();
+    for (i = 0; i < ROUNDS; i++)
+        ws_timer_set(&timers[0], 1 + (i & 0xfffff));
+    end = get_ns();
+
+    printf("  rearm, %2u running: %6.1f ns\n", count,
+           (double)(end - start) / ROUNDS);
+}
+
+
+/* Cost of arming a timer and running it when it expires */
+static void
+bench_fire(uint32_t count)
+{
+    uint64_t start, end;
+    uint32_t i;
+
+    fill(count);
+    fired = 0;
+
+    start = get_ns();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        ws_timer_set(&timers[0], 1);
+        ws_os_advance_time(1);
+        ws_timer_process();
+    }
+    end = get_ns();
+
+    ASSERT(fired == ROUNDS, "timers missed\n");
+
+    printf("  arm+fire, %2u running: %6.1f ns\n", count,
+           (double)(end - start) / ROUNDS);
+}
+
+
+/* Cost of cancelling a timer and setting it again */
+static void
+bench_cancel(uint32_t count)
+{
+    uint64_t start, end;
+    uint32_t i;
+
+    fill(count);
+
+    start = get_ns();
+    for (i = 0; i < ROUNDS; i++)
+    {
+        ws_timer_set(&timers[0], 1000);
+        ws_timer_cancel(&timers[0]);
+    }
+    end = get_ns();
+
+    printf("  arm+cancel, %2u running: %6.1f ns\n", count,
+           (double)(end - start) / ROUNDS);
+}
+
+
+void
+timer_bench(void)
+{
+    uint32_t count;
+
+    for (count = 1; count <= WS_TIMER_MAX; count *= 2)
+    {
+        bench_rearm(count);
+        bench_fire(count);
+        bench_cancel(count);
+    }
+
+    ws_os_set_virtual_time(false);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+#define MANY_TIMERS (WS_TIMER_MAX - 1)
+
+static uint32_t fire_times[MANY_TIMERS];
+static int fire_cnt;
+
+
+static void
+record_time(void)
+{
+    if (fire_cnt < MANY_TIMERS)
+        fire_times[fire_cnt] = ws_timer_get_time();
+    fire_cnt++;
+}
+
+
+static ws_timer_t many[MANY_TIMERS];
+static bool bad_arg;
+
+
+static void
+many_fired(void *arg)
+{
+    /* Each timer is handed a pointer to itself */
+    ws_timer_t *t = (ws_timer_t *)arg;
+    if (t < &many[0] || t >= &many[MANY_TIMERS])
+        bad_arg = true;
+
+    record_time();
+}
+
+WS_TIMER_DECLARE(once);
+WS_TIMER_DECLARE(rearm);
+WS_TIMER_DECLARE(stop);
+
+static void
+once(void)
+{
+    record_time();
+}
+
+
+static void
+rearm(void)
+{
+    record_time();
+    WS_TIMER_SET_NOW(rearm);
+}
+
+
+static void
+stop(void)
+{
+    ws_os_stop();
+}
+
+
+static void
+reset(void)
+{
+    int i;
+
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    fire_cnt = 0;
+    bad_arg = false;
+
+    for (i = 0; i < MANY_TIMERS; i++)
+        many[i] = (ws_timer_t)WS_TIMER_INITIALISER(many_fired, &many[i]);
+}
+
+
+bool
+timer_heap_order(void)
+{
+    int i;
+
+    reset();
+    ws_os_seed_random(42);
+
+    for (i = 0; i < MANY_TIMERS; i++)
+        ws_timer_set(&many[i], 1 + WS_GET_RANDOM8() * 4);
+
+    /* Restart some of them so they move both ways within the heap */
+    for (i = 0; i < MANY_TIMERS; i += 3)
+        ws_timer_set(&many[i], 1 + WS_GET_RANDOM8() * 4);
+
+    WS_TIMER_SET(stop, 100);
+    ws_os_run();
+
+    if (fire_cnt != MANY_TIMERS || bad_arg)
+        return false;
+
+    for (i = 1; i < MANY_TIMERS; i++)
+    {
+        if (fire_times[i] < fire_times[i - 1])
+            return false;
+    }
+
+    return true;
+}
+
+
+bool
+timer_fires_on_time(void)
+{
+    reset();
+
+    WS_TIMER_SET_SYMBOLS(once, 100);
+
+    ws_os_advance_time(99);
+    if (ws_os_poll() != 0)
+        return false;
+
+    ws_os_advance_time(1);
+    if (ws_os_poll() != 1)
+        return false;
+
+    return fire_cnt == 1 && fire_times[0] == 100 &&
+        !WS_TIMER_IS_ACTIVE(once);
+}
+
+
+bool
+timer_cancel_and_set(void)
+{
+    reset();
+
+    /* Cancelling leaves the timer in the queue, so setting it again must
+     * move it rather than add it twice */
+    WS_TIMER_SET_SYMBOLS(once, 10);
+    WS_TIMER_CANCEL(once);
+    if (WS_TIMER_IS_ACTIVE(once))
+        return false;
+
+    WS_TIMER_SET_SYMBOLS(once, 20);
+
+    ws_os_advance_time(50);
+    ws_os_poll();
+
+    return fire_cnt == 1 && fire_times[0] == 50;
+}
+
+
+bool
+timer_rearm_does_not_starve(void)
+{
+    reset();
+
+    WS_TIMER_SET_NOW(rearm);
+
+    /* A timer that keeps setting itself runs once per poll */
+    if (ws_os_poll() != 1 || ws_os_poll() != 1)
+        return false;
+
+    WS_TIMER_CANCEL(rearm);
+
+    return ws_os_poll() == 0 && fire_cnt == 2;
+}
+
+
+bool
+timer_long_delay(void)
+{
+    uint32_t delay = WS_TIMER_HW_MASK * 3;
+
+    reset();
+
+    /* Longer than the hardware counter, so it has to wrap several times */
+    WS_TIMER_SET_SYMBOLS(once, delay);
+    WS_TIMER_SET_SYMBOLS(stop, delay + 1);
+
+    ws_os_run();
+
+    return fire_cnt == 1 && fire_times[0] == delay;
+}
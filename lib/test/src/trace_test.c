@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "wsn.h"
+
+
+static void
+reset(void)
+{
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+}
+
+
+/* A CSMA attempt lasting 10 symbols, followed by a beacon */
+static void
+trace_csma(void)
+{
+    WS_TRACE_BEGIN(CSMA);
+    ws_os_advance_time(10);
+    WS_TRACE_END(CSMA);
+    WS_TRACE_MARK(BEACON_SYNC);
+}
+
+
+bool
+trace_records_in_order(void)
+{
+    ws_trace_record_t r[4];
+
+    reset();
+    trace_csma();
+
+    return ws_trace_get_records(r, 4) == 3 &&
+        r[0].point == WS_TRACE_CSMA && r[0].type == WS_TRACE_TYPE_BEGIN &&
+        r[0].timestamp == 0 &&
+        r[1].point == WS_TRACE_CSMA && r[1].type == WS_TRACE_TYPE_END &&
+        r[1].timestamp == 10 &&
+        r[2].point == WS_TRACE_BEACON_SYNC &&
+        r[2].type == WS_TRACE_TYPE_MARK;
+}
+
+
+bool
+trace_overwrites_oldest(void)
+{
+    static ws_trace_record_t r[WS_TRACE_BUFFER_LEN];
+    uint32_t i;
+
+    reset();
+
+    for (i = 0; i < WS_TRACE_BUFFER_LEN + 5; i++)
+    {
+        WS_TRACE_MARK(SLOT_TICK);
+        ws_os_advance_time(1);
+    }
+
+    /* The newest records are kept */
+    return ws_trace_get_records(r, WS_TRACE_BUFFER_LEN) ==
+        WS_TRACE_BUFFER_LEN &&
+        r[0].timestamp == 5 &&
+        r[WS_TRACE_BUFFER_LEN - 1].timestamp == WS_TRACE_BUFFER_LEN + 4;
+}
+
+
+static char *
+export(bool (*exporter)(FILE *f))
+{
+    char *text = NULL;
+    size_t len;
+    FILE *f;
+
+    f = open_memstream(&text, &len);
+    if (f == NULL)
+        return NULL;
+
+    if (!exporter(f))
+    {
+        fclose(f);
+        free(text);
+        return NULL;
+    }
+
+    fclose(f);
+
+    return text;
+}
+
+
+bool
+trace_export_json(void)
+{
+    char *text;
+    bool ok;
+
+    reset();
+    trace_csma();
+
+    text = export(ws_trace_export_json);
+    if (text == NULL)
+        return false;
+
+    /* Symbols are 16us */
+    ok = strstr(text, "{\"name\":\"csma\",\"ph\":\"B\",\"ts\":0,") != NULL &&
+        strstr(text, "{\"name\":\"csma\",\"ph\":\"E\",\"ts\":160,") != NULL &&
+        strstr(text, "\"name\":\"beacon_sync\",\"ph\":\"i\"") != NULL;
+
+    free(text);
+
+    return ok;
+}
+
+
+bool
+trace_export_vcd(void)
+{
+    char *text;
+    bool ok;
+
+    reset();
+    trace_csma();
+
+    text = export(ws_trace_export_vcd);
+    if (text == NULL)
+        return false;
+
+    /* csma is the third signal, so is called '#' */
+    ok = strstr(text, "$var wire 1 # csma $end") != NULL &&
+        strstr(text, "$end\n1#\n#160\n0#\n1%\n#161\n0%\n") != NULL;
+
+    free(text);
+
+    return ok;
+}
@@ -0,0 +1,355 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Turns a dump of the WSN log buffer back into text.
+ *
+ *     log_decoder <firmware.elf> <dump.bin>
+ *
+ * The dump is the raw output of ws_log_read, for example captured from a
+ * UART. Log call sites are looked up in the ws_log_sites section of the
+ * firmware, and any string arguments that point into flash are read from
+ * it too. Only 32 bit little endian firmware is supported.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <elf.h>
+
+
+#define LOG_SYNC (0xa5)
+#define LOG_MAX_ARGS (8)
+#define LOG_HEADER_LEN (8)
+
+/* Layout of ws_log_site_t on the target */
+#define SITE_LEN (16)
+#define SITE_FILE (0)
+#define SITE_FMT (4)
+#define SITE_LINE (8)
+#define SITE_LEVEL (10)
+
+
+static uint8_t *elf;
+static long elf_len;
+static Elf32_Shdr *sections;
+static uint32_t section_cnt;
+
+static uint8_t *sites;
+static uint32_t site_cnt;
+
+static const char *level_names[] = {"???", "ERR", "WRN", "INF", "DBG"};
+
+
+static uint8_t *
+read_file(const char *path, long *len)
+{
+    FILE *f;
+    uint8_t *buf;
+
+    f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    buf = malloc(*len + 1);
+    if (buf == NULL || fread(buf, 1, *len, f) != (size_t)*len)
+    {
+        fprintf(stderr, "failed to read %s\n", path);
+        fclose(f);
+        free(buf);
+        return NULL;
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+
+static uint32_t
+get_u16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t
+get_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+/* Find what is at an address in the firmware, or NULL if it's not stored
+ * in the image (RAM, for example) */
+static const uint8_t *
+lookup(uint32_t addr)
+{
+    Elf32_Shdr *s;
+    uint32_t i;
+
+    for (i = 0; i < section_cnt; i++)
+    {
+        s = &sections[i];
+        if (!(s->sh_flags & SHF_ALLOC) || s->sh_type == SHT_NOBITS)
+            continue;
+
+        if (addr >= s->sh_addr && addr < s->sh_addr + s->sh_size)
+            return elf + s->sh_offset + (addr - s->sh_addr);
+    }
+
+    return NULL;
+}
+
+
+static bool
+load_elf(const char *path)
+{
+    Elf32_Ehdr *hdr;
+    const char *names;
+    uint32_t i;
+
+    elf = read_file(path, &elf_len);
+    if (elf == NULL)
+        return false;
+
+    hdr = (Elf32_Ehdr *)elf;
+    if (elf_len < sizeof(Elf32_Ehdr) ||
+        memcmp(hdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        hdr->e_ident[EI_CLASS] != ELFCLASS32 ||
+        hdr->e_ident[EI_DATA] != ELFDATA2LSB)
+    {
+        fprintf(stderr, "%s is not a 32 bit little endian ELF\n", path);
+        return false;
+    }
+
+    sections = (Elf32_Shdr *)(elf + hdr->e_shoff);
+    section_cnt = hdr->e_shnum;
+    names = (const char *)elf + sections[hdr->e_shstrndx].sh_offset;
+
+    for (i = 0; i < section_cnt; i++)
+    {
+        if (strcmp(names + sections[i].sh_name, "ws_log_sites") == 0)
+        {
+            sites = elf + sections[i].sh_offset;
+            site_cnt = sections[i].sh_size / SITE_LEN;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "%s has no ws_log_sites section\n", path);
+
+    return false;
+}
+
+
+static const char *
+lookup_string(uint32_t addr)
+{
+    const char *s = (const char *)lookup(addr);
+
+    return s != NULL ? s : "?";
+}
+
+
+/* Print a log message, with the same conversions as ws_log_format */
+static void
+print_message(const char *fmt, const uint32_t *args, uint32_t nargs)
+{
+    uint32_t arg = 0;
+    uint32_t addr, len, i;
+    const uint8_t *data;
+    const char *s;
+    char spec[16];
+    int n;
+
+#define NEXT_ARG() (arg < nargs ? args[arg++] : 0)
+
+    for (; *fmt != '\0'; fmt++)
+    {
+        if (*fmt != '%')
+        {
+            putchar(*fmt);
+            continue;
+        }
+
+        /* Copy the flags and width, dropping any length modifiers as all
+         * arguments are 32 bits */
+        n = 0;
+        spec[n++] = *fmt++;
+        while (*fmt != '\0' && strchr("-+ #0123456789", *fmt) != NULL &&
+               n < sizeof(spec) - 2)
+            spec[n++] = *fmt++;
+        while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z' || *fmt == 't')
+            fmt++;
+        spec[n++] = *fmt;
+        spec[n] = '\0';
+
+        switch (*fmt)
+        {
+        case 'd':
+        case 'i':
+            printf(spec, (int32_t)NEXT_ARG());
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'c':
+            printf(spec, NEXT_ARG());
+            break;
+
+        case 'p':
+            printf("0x%08x", NEXT_ARG());
+            break;
+
+        case 's':
+            printf(spec, lookup_string(NEXT_ARG()));
+            break;
+
+        case 'r':
+            addr = NEXT_ARG();
+            len = NEXT_ARG();
+            data = lookup(addr);
+            if (data == NULL)
+            {
+                printf("<%u octets at 0x%08x>", len, addr);
+                break;
+            }
+            for (i = 0; i < len; i++)
+                printf(spec[1] == ' ' && i > 0 ? " %02x" : "%02x", data[i]);
+            break;
+
+        case '%':
+            putchar('%');
+            break;
+
+        case '\0':
+            fmt--;
+            break;
+
+        default:
+            fputs(spec, stdout);
+            break;
+        }
+    }
+
+#undef NEXT_ARG
+}
+
+
+static void
+decode(const uint8_t *dump, long len)
+{
+    const uint8_t *p = dump;
+    const uint8_t *site;
+    uint32_t args[LOG_MAX_ARGS];
+    uint32_t nargs, id, timestamp, level, i;
+    uint32_t skipped = 0;
+
+    while (p + LOG_HEADER_LEN <= dump + len)
+    {
+        nargs = p[1];
+        id = get_u16(p + 2);
+
+        /* Look for the start of the next record */
+        if (p[0] != LOG_SYNC || nargs > LOG_MAX_ARGS || id >= site_cnt ||
+            p + LOG_HEADER_LEN + nargs * 4 > dump + len)
+        {
+            p++;
+            skipped++;
+            continue;
+        }
+
+        if (skipped > 0)
+        {
+            printf("-- skipped %u octets --\n", skipped);
+            skipped = 0;
+        }
+
+        timestamp = get_u32(p + 4);
+        for (i = 0; i < nargs; i++)
+            args[i] = get_u32(p + LOG_HEADER_LEN + i * 4);
+
+        site = sites + id * SITE_LEN;
+        level = site[SITE_LEVEL];
+
+        /* Timestamps are in 16us symbols */
+        printf("[%8u.%03u] %s %s:%u ",
+               timestamp / 62500, (timestamp % 62500) * 16 / 1000,
+               level_names[level < 5 ? level : 0],
+               lookup_string(get_u32(site + SITE_FILE)),
+               get_u16(site + SITE_LINE));
+        print_message(lookup_string(get_u32(site + SITE_FMT)), args, nargs);
+
+        p += LOG_HEADER_LEN + nargs * 4;
+    }
+
+    if (skipped > 0 || p != dump + len)
+        printf("-- skipped %ld octets --\n", skipped + (long)(dump + len - p));
+}
+
+
+int
+main(int argc, char **argv)
+{
+    uint8_t *dump;
+    long dump_len;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <firmware.elf> <dump.bin>\n", argv[0]);
+        return 1;
+    }
+
+    if (!load_elf(argv[1]))
+        return 1;
+
+    dump = read_file(argv[2], &dump_len);
+    if (dump == NULL)
+        return 1;
+
+    decode(dump, dump_len);
+
+    free(dump);
+    free(elf);
+
+    return 0;
+}
@@ -0,0 +1,772 @@
+/*
+ * Copyright (c) 2015, Dan Collins
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright
+ * notice, this list of conditions and the following disclaimer in the
+ * documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ * contributors may be used to endorse or promote products derived from this
+ * software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Runs a whole PAN on the simulated radio medium and reports how it
+ * performed. One coordinator, behaving as app/simple_coordinator, and a
+ * number of sensors, behaving as app/sensor_*, run through the real MAC on
+ * a virtual clock, so a run is repeatable and takes a fraction of the time
+ * it simulates.
+ *
+ *     pan_sim [-n nodes[,nodes...]] [-t seconds] [-w warmup] [-p period]
+ *             [-s seed] [-v]
+ *
+ *     -n  sensors in the PAN. A list runs each size in turn (default 1,2,4,8)
+ *     -t  simulated seconds to measure for (default 60)
+ *     -w  simulated seconds to let the sensors join first (default 20)
+ *     -p  milliseconds between readings from each sensor (default 1000)
+ *     -s  seed for the radio medium and the MAC (default 1)
+ *     -v  keep the library log on stdout
+ *
+ * Each PAN size prints one CSV row under a fixed header, so results can be
+ * compared between releases with diff. All times are in symbols (16 us).
+ *
+ *     nodes, seconds, seed         the run
+ *     connected                    sensors that finished joining
+ *     sent                         readings handed to the MAC
+ *     delivered                    readings the coordinator received
+ *     delivered_per_s              delivered / seconds
+ *     confirm_ok, confirm_fail     MCPS-DATA.confirm results
+ *     latency_p50/p90/p99/max      send to MCPS-DATA.confirm
+ *     tx_frames, retries, no_ack,  MAC counters summed over every node,
+ *     csma_failures, cca_busy      see ws_mac_stats_t
+ *     beacons                      beacons received by the sensors
+ *     beacon_jitter                worst spread of beacon intervals seen by
+ *                                  one sensor, over the whole run
+ *
+ * Every count except beacon_jitter only covers the measurement period.
+ *
+ * A short period loads the channel far more heavily than the sensor apps
+ * do, which makes a benchmark for channel access. For example
+ *
+ *     pan_sim -n 8,16,32 -p 100
+ *
+ * where cca_busy against tx_frames is the rate of contention.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "wsn.h"
+
+
+/* Matches app/simple_coordinator */
+#define PAN_ID (0xdc00)
+#define PAN_CHANNEL (11)
+#define COORD_SHORT_ADDR (0xaabb)
+#define BEACON_ORDER (5)
+#define SUPERFRAME_ORDER (4)
+
+/* Matches app/sensor_* */
+#define PSK "gouda"
+#define SCAN_DURATION (4)
+#define AUTH_TIMEOUT (5000)
+
+/* Sensors are switched on at random within this many milliseconds */
+#define POWER_ON_SPREAD (2000)
+
+/* Sleep after a failed scan, in milliseconds */
+#define RESCAN_DELAY (1000)
+
+#define MAX_SENSORS (WS_RADIO_SIM_MAX_NODES - 1)
+#define MAX_IN_FLIGHT (4)
+#define MAX_LATENCIES (1 << 16)
+
+#define CSV_HEADER \
+    "nodes,seconds,seed,connected,sent,delivered,delivered_per_s," \
+    "confirm_ok,confirm_fail,latency_p50,latency_p90,latency_p99," \
+    "latency_max,tx_frames,retries,no_ack,csma_failures,cca_busy," \
+    "beacons,beacon_jitter\n"
+
+
+/* The message layout used by app/sensor_* */
+#define MSG_PREAMBLE (0xaa)
+
+typedef enum
+{
+    MSG_ID_TEST_ENCRYPTION = 0,
+    MSG_ID_LIGHT_SENSOR = 1,
+    MSG_ID_KNOCK_SENSOR = 2,
+    MSG_ID_TEMP_SENSOR = 3,
+} msg_id_t;
+
+typedef struct __attribute__((packed))
+{
+    unsigned preamble:8;
+    unsigned id:8;
+    unsigned value:16;
+} msg_t;
+
+
+typedef enum
+{
+    SENSOR_STATE_INIT,
+    SENSOR_STATE_SCANNING,
+    SENSOR_STATE_ASSOCIATING,
+    SENSOR_STATE_AUTHENTICATING,
+    SENSOR_STATE_CONNECTED,
+} sensor_state_t;
+
+
+typedef struct
+{
+    bool used;
+    uint8_t handle;
+    uint32_t sent_at;
+} in_flight_t;
+
+
+typedef struct
+{
+    ws_mac_ctx_t *mac;
+    msg_id_t type;
+    sensor_state_t state;
+    ws_mac_pan_descriptor_t pan;
+
+    /* Drives joining, then takes readings once connected */
+    ws_timer_t timer;
+
+    uint8_t auth_handle;
+    in_flight_t in_flight[MAX_IN_FLIGHT];
+
+    ws_mac_stats_t baseline;
+} sensor_t;
+
+
+typedef struct
+{
+    /* Configuration */
+    uint16_t nodes;
+    uint32_t seconds;
+    uint32_t warmup;
+    uint32_t period;
+    uint32_t seed;
+
+    ws_mac_ctx_t *coord;
+    ws_mac_stats_t coord_baseline;
+    sensor_t sensors[MAX_SENSORS];
+
+    /* Results, counted once measuring */
+    bool measuring;
+    uint32_t sent;
+    uint32_t delivered;
+    uint32_t confirm_ok;
+    uint32_t confirm_fail;
+    uint32_t latencies[MAX_LATENCIES];
+    uint32_t latency_cnt;
+
+    ws_timer_t phase_timer;
+    uint32_t random;
+} pan_t;
+
+static pan_t pan;
+
+
+static uint32_t
+pan_random(void)
+{
+    /* xorshift32, so sensor behaviour only depends on the seed */
+    pan.random ^= pan.random << 13;
+    pan.random ^= pan.random >> 17;
+    pan.random ^= pan.random << 5;
+    return pan.random;
+}
+
+
+static sensor_t *
+find_sensor(ws_mac_ctx_t *ctx)
+{
+    uint16_t i;
+
+    for (i = 0; i < pan.nodes; i++)
+    {
+        if (pan.sensors[i].mac == ctx)
+            return &pan.sensors[i];
+    }
+
+    return NULL;
+}
+
+
+static void
+make_extended_address(uint16_t id, uint8_t *addr)
+{
+    memset(addr, 0, WS_MAC_ADDR_TYPE_EXTENDED_LEN);
+    addr[0] = 0x00;
+    addr[1] = 0x12;
+    addr[2] = 0x4b;
+    addr[6] = (uint8_t)(id >> 8);
+    addr[7] = (uint8_t)id;
+}
+
+
+/* ---------------------------------------------------------------------
+ *   Coordinator
+ * --------------------------------------------------------------------- */
+static void
+coord_receive_handler(ws_mac_ctx_t *ctx,
+                      const uint8_t *data, uint8_t len,
+                      ws_mac_addr_t *src_addr,
+                      const ws_pktbuf_meta_t *meta)
+{
+    msg_t msg;
+
+    if (len != sizeof(msg_t))
+        return;
+    memcpy(&msg, data, sizeof(msg));
+    if (msg.preamble != MSG_PREAMBLE)
+        return;
+
+    /* Sensors wait for their test message to come back before they
+     * start sending readings */
+    if (msg.id == MSG_ID_TEST_ENCRYPTION)
+    {
+        ws_mac_mcps_send_data(ctx, (uint8_t *)&msg, sizeof(msg),
+                              src_addr, true);
+        return;
+    }
+
+    if (pan.measuring)
+        pan.delivered++;
+}
+
+
+static void
+coord_confirm_handler(ws_mac_ctx_t *ctx,
+                      uint8_t handle, ws_mac_mcps_status_t status)
+{
+}
+
+
+static void
+coord_associate_handler(ws_mac_ctx_t *ctx, ws_mac_addr_t *addr)
+{
+    /* simple_coordinator leaves this to a gateway. Here every sensor
+     * shares the PSK. */
+    ws_mac_security_add_device_key(ctx, addr, (uint8_t *)PSK, strlen(PSK));
+}
+
+
+/* ---------------------------------------------------------------------
+ *   Sensors
+ * --------------------------------------------------------------------- */
+static void
+send_message(sensor_t *s, msg_id_t id, uint16_t value)
+{
+    msg_t msg;
+    uint8_t i;
+
+    msg.preamble = MSG_PREAMBLE;
+    msg.id = id;
+    msg.value = value;
+
+    if (id == MSG_ID_TEST_ENCRYPTION)
+    {
+        s->auth_handle = ws_mac_mcps_send_data(s->mac, (uint8_t *)&msg,
+                                               sizeof(msg), &s->pan.addr,
+                                               true);
+
+        /* A refused message was confirmed before its handle was known */
+        if (s->auth_handle == 0)
+            ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(AUTH_TIMEOUT));
+        return;
+    }
+
+    for (i = 0; i < MAX_IN_FLIGHT; i++)
+    {
+        if (!s->in_flight[i].used)
+            break;
+    }
+
+    /* The MAC still has all our earlier readings, so skip this one */
+    if (i == MAX_IN_FLIGHT)
+        return;
+
+    s->in_flight[i].used = true;
+    s->in_flight[i].sent_at = ws_timer_get_time();
+    s->in_flight[i].handle = ws_mac_mcps_send_data(s->mac, (uint8_t *)&msg,
+                                                   sizeof(msg), &s->pan.addr,
+                                                   true);
+    if (pan.measuring)
+        pan.sent++;
+
+    /* A refused reading was confirmed before its handle was known */
+    if (s->in_flight[i].handle == 0)
+    {
+        s->in_flight[i].used = false;
+        if (pan.measuring)
+            pan.confirm_fail++;
+    }
+}
+
+
+static void
+sensor_receive_handler(ws_mac_ctx_t *ctx,
+                       const uint8_t *data, uint8_t len,
+                       ws_mac_addr_t *src_addr,
+                       const ws_pktbuf_meta_t *meta)
+{
+    sensor_t *s = find_sensor(ctx);
+    msg_t msg;
+
+    if (s == NULL || len != sizeof(msg_t))
+        return;
+    memcpy(&msg, data, sizeof(msg));
+
+    if (s->state == SENSOR_STATE_AUTHENTICATING &&
+        msg.preamble == MSG_PREAMBLE &&
+        msg.id == MSG_ID_TEST_ENCRYPTION)
+    {
+        s->state = SENSOR_STATE_CONNECTED;
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(
+                         pan_random() % pan.period));
+    }
+}
+
+
+static void
+sensor_confirm_handler(ws_mac_ctx_t *ctx,
+                       uint8_t handle, ws_mac_mcps_status_t status)
+{
+    sensor_t *s = find_sensor(ctx);
+    in_flight_t *f;
+    uint8_t i;
+
+    if (s == NULL)
+        return;
+
+    if (s->state == SENSOR_STATE_AUTHENTICATING && handle == s->auth_handle)
+    {
+        /* As the sensor apps: wait for the reply, or try again at once */
+        ws_timer_set(&s->timer, status == WS_MAC_MCPS_SUCCESS ?
+                     WS_TIMER_MS_TO_SYMBOLS(AUTH_TIMEOUT) : 0);
+        return;
+    }
+
+    for (i = 0; i < MAX_IN_FLIGHT; i++)
+    {
+        f = &s->in_flight[i];
+        if (!f->used || f->handle != handle)
+            continue;
+
+        f->used = false;
+        if (!pan.measuring)
+            return;
+
+        if (status == WS_MAC_MCPS_SUCCESS)
+            pan.confirm_ok++;
+        else
+            pan.confirm_fail++;
+
+        if (pan.latency_cnt < MAX_LATENCIES)
+            pan.latencies[pan.latency_cnt++] =
+                ws_timer_get_time() - f->sent_at;
+        return;
+    }
+}
+
+
+static void
+sensor_scan_callback(ws_mac_ctx_t *ctx,
+                     ws_mac_scan_status_t status,
+                     ws_mac_scan_type_t type,
+                     ws_list_t *scan_results)
+{
+    sensor_t *s = find_sensor(ctx);
+    ws_mac_scan_result_t *res;
+
+    if (s == NULL)
+        return;
+
+    if (ws_list_count(scan_results) == 0)
+    {
+        s->state = SENSOR_STATE_INIT;
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(RESCAN_DELAY));
+        return;
+    }
+
+    /* Try to associate with the first one we find */
+    res = ws_list_get_data(scan_results->next, ws_mac_scan_result_t, list);
+    memcpy(&s->pan, &res->pan_desc, sizeof(s->pan));
+    s->state = SENSOR_STATE_ASSOCIATING;
+    ws_timer_set(&s->timer, 0);
+}
+
+
+static void
+sensor_associate_callback(ws_mac_ctx_t *ctx,
+                          ws_mac_association_status_t status,
+                          uint16_t short_addr)
+{
+    sensor_t *s = find_sensor(ctx);
+
+    if (s == NULL)
+        return;
+
+    switch (status)
+    {
+    case WS_MAC_ASSOCIATION_SUCCESS:
+        s->state = SENSOR_STATE_AUTHENTICATING;
+        ws_timer_set(&s->timer, 0);
+        break;
+
+    case WS_MAC_ASSOCIATION_NO_ACK:
+    case WS_MAC_ASSOCIATION_NO_DATA:
+    case WS_MAC_ASSOCIATION_CHANNEL_ACCESS_FAILURE:
+        /* Back off a little, so sensors that collided spread out */
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(
+                         pan_random() % 256));
+        break;
+
+    default:
+        s->state = SENSOR_STATE_INIT;
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(RESCAN_DELAY));
+        break;
+    }
+}
+
+
+static void
+sensor_timer(void *arg)
+{
+    sensor_t *s = (sensor_t *)arg;
+    uint32_t next;
+
+    switch (s->state)
+    {
+    case SENSOR_STATE_INIT:
+        s->state = SENSOR_STATE_SCANNING;
+        ws_mac_mlme_scan(s->mac, WS_MAC_SCAN_TYPE_PASSIVE,
+                         1 << (PAN_CHANNEL - WS_RADIO_MIN_CHANNEL),
+                         SCAN_DURATION, sensor_scan_callback);
+        break;
+
+    case SENSOR_STATE_ASSOCIATING:
+        ws_mac_mlme_associate(s->mac, &s->pan, sensor_associate_callback);
+        break;
+
+    case SENSOR_STATE_AUTHENTICATING:
+        send_message(s, MSG_ID_TEST_ENCRYPTION, 0);
+        break;
+
+    case SENSOR_STATE_CONNECTED:
+        send_message(s, s->type, (uint16_t)pan_random());
+
+        /* Knocks come whenever they like, the others are sampled */
+        next = pan.period;
+        if (s->type == MSG_ID_KNOCK_SENSOR)
+            next = pan.period / 2 + pan_random() % pan.period;
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(next));
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+/* ---------------------------------------------------------------------
+ *   Simulation
+ * --------------------------------------------------------------------- */
+static int
+compare_latency(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a;
+    uint32_t y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+static uint32_t
+percentile(uint32_t pct)
+{
+    if (pan.latency_cnt == 0)
+        return 0;
+    return pan.latencies[(pan.latency_cnt - 1) * pct / 100];
+}
+
+
+static void
+add_stats(ws_mac_stats_t *total, ws_mac_ctx_t *ctx, ws_mac_stats_t *baseline)
+{
+    ws_mac_stats_t stats;
+
+    ws_mac_mlme_get_stats(ctx, &stats);
+    total->tx_frames += stats.tx_frames - baseline->tx_frames;
+    total->tx_retries += stats.tx_retries - baseline->tx_retries;
+    total->tx_no_ack += stats.tx_no_ack - baseline->tx_no_ack;
+    total->csma_failures += stats.csma_failures - baseline->csma_failures;
+    total->csma_busy += stats.csma_busy - baseline->csma_busy;
+    total->beacons_rx += stats.beacons_rx - baseline->beacons_rx;
+
+    /* The spread is over the whole run, so it isn't baselined */
+    if (stats.beacon_interval_max - stats.beacon_interval_min >
+        total->beacon_interval_max)
+        total->beacon_interval_max =
+            stats.beacon_interval_max - stats.beacon_interval_min;
+}
+
+
+static void
+report(FILE *out)
+{
+    ws_mac_stats_t total;
+    uint16_t connected = 0;
+    uint16_t i;
+
+    memset(&total, 0, sizeof(total));
+    add_stats(&total, pan.coord, &pan.coord_baseline);
+    for (i = 0; i < pan.nodes; i++)
+    {
+        add_stats(&total, pan.sensors[i].mac, &pan.sensors[i].baseline);
+        if (pan.sensors[i].state == SENSOR_STATE_CONNECTED)
+            connected++;
+    }
+
+    qsort(pan.latencies, pan.latency_cnt, sizeof(uint32_t), compare_latency);
+
+    fprintf(out, "%u,%u,%u,%u,%u,%u,%u.%02u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,"
+            "%u,%u,%u\n",
+            pan.nodes, pan.seconds, pan.seed, connected,
+            pan.sent, pan.delivered,
+            pan.delivered / pan.seconds,
+            pan.delivered * 100 / pan.seconds % 100,
+            pan.confirm_ok, pan.confirm_fail,
+            percentile(50), percentile(90), percentile(99), percentile(100),
+            total.tx_frames, total.tx_retries, total.tx_no_ack,
+            total.csma_failures, total.csma_busy, total.beacons_rx,
+            total.beacon_interval_max);
+    fflush(out);
+}
+
+
+static void
+phase_timer(void *arg)
+{
+    uint16_t i;
+
+    if (pan.measuring)
+    {
+        ws_os_stop();
+        return;
+    }
+
+    /* Warm up is over. Anything already in flight isn't counted. */
+    ws_mac_mlme_get_stats(pan.coord, &pan.coord_baseline);
+    for (i = 0; i < pan.nodes; i++)
+    {
+        ws_mac_mlme_get_stats(pan.sensors[i].mac, &pan.sensors[i].baseline);
+        memset(pan.sensors[i].in_flight, 0,
+               sizeof(pan.sensors[i].in_flight));
+    }
+
+    pan.measuring = true;
+    ws_timer_set(&pan.phase_timer,
+                 WS_TIMER_MS_TO_SYMBOLS(pan.seconds * 1000));
+}
+
+
+static void
+run_pan(FILE *out)
+{
+    uint8_t addr[WS_MAC_ADDR_TYPE_EXTENDED_LEN];
+    ws_radio_sim_node_t *node;
+    sensor_t *s;
+    uint16_t i;
+
+    ws_os_set_virtual_time(true);
+    ws_os_init();
+    ws_os_seed_random(pan.seed);
+    ws_radio_sim_init(pan.seed);
+    ws_aes_init();
+    pan.random = pan.seed ? pan.seed : 1;
+
+    /* Coordinator */
+    node = ws_radio_sim_add_node();
+    make_extended_address(0, addr);
+    pan.coord = ws_mac_init(addr, ws_radio_sim_get_radio(node));
+    ASSERT(pan.coord != NULL, "no MAC instance for the coordinator\n");
+
+    ws_mac_mcps_register_rx_callback(pan.coord, coord_receive_handler);
+    ws_mac_mcps_register_confirm_callback(pan.coord, coord_confirm_handler);
+    ws_mac_mlme_set_short_address(pan.coord, COORD_SHORT_ADDR);
+    ws_mac_mlme_start(pan.coord, PAN_ID, PAN_CHANNEL, BEACON_ORDER,
+                      SUPERFRAME_ORDER, true, coord_associate_handler);
+
+    /* Sensors, taking turns at being each kind */
+    for (i = 0; i < pan.nodes; i++)
+    {
+        s = &pan.sensors[i];
+        node = ws_radio_sim_add_node();
+        make_extended_address(i + 1, addr);
+        s->mac = ws_mac_init(addr, ws_radio_sim_get_radio(node));
+        ASSERT(s->mac != NULL, "no MAC instance for sensor %u\n", i);
+
+        s->type = (msg_id_t[]){MSG_ID_TEMP_SENSOR,
+                               MSG_ID_LIGHT_SENSOR,
+                               MSG_ID_KNOCK_SENSOR}[i % 3];
+        s->state = SENSOR_STATE_INIT;
+        s->timer = (ws_timer_t)WS_TIMER_INITIALISER(sensor_timer, s);
+
+        ws_mac_security_add_own_key(s->mac, (uint8_t *)PSK, strlen(PSK));
+        ws_mac_mcps_register_rx_callback(s->mac, sensor_receive_handler);
+        ws_mac_mcps_register_confirm_callback(s->mac, sensor_confirm_handler);
+
+        ws_timer_set(&s->timer, WS_TIMER_MS_TO_SYMBOLS(
+                         pan_random() % POWER_ON_SPREAD));
+    }
+
+    pan.phase_timer = (ws_timer_t)WS_TIMER_INITIALISER(phase_timer, NULL);
+    ws_timer_set(&pan.phase_timer, WS_TIMER_MS_TO_SYMBOLS(pan.warmup * 1000));
+
+    ws_os_run();
+
+    report(out);
+}
+
+
+/**
+ * Runs one PAN size in a child process, as MAC instances can't be freed
+ * \return false if the child failed
+ */
+static bool
+run_child(uint16_t nodes, bool verbose)
+{
+    FILE *out;
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        /* The library logs to stdout, so keep our own copy of it */
+        out = fdopen(dup(STDOUT_FILENO), "w");
+        if (out == NULL || (!verbose && freopen("/dev/null", "w", stdout)
+                            == NULL))
+            exit(EXIT_FAILURE);
+
+        pan.nodes = nodes;
+        run_pan(out);
+        exit(EXIT_SUCCESS);
+    }
+
+    if (waitpid(pid, &status, 0) < 0 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+    {
+        fprintf(stderr, "run with %u nodes failed\n", nodes);
+        return false;
+    }
+
+    return true;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *node_list = "1,2,4,8";
+    bool verbose = false;
+    bool ok = true;
+    char *end;
+    long nodes;
+    int opt;
+
+    pan.seconds = 60;
+    pan.warmup = 20;
+    pan.period = 1000;
+    pan.seed = 1;
+
+    while ((opt = getopt(argc, argv, "n:t:w:p:s:v")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            node_list = optarg;
+            break;
+        case 't':
+            pan.seconds = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            pan.warmup = strtoul(optarg, NULL, 0);
+            break;
+        case 'p':
+            pan.period = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            pan.seed = strtoul(optarg, NULL, 0);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n nodes[,nodes...]] [-t seconds] "
+                    "[-w warmup] [-p period] [-s seed] [-v]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (pan.seconds == 0 || pan.period == 0)
+    {
+        fprintf(stderr, "seconds and period must be non-zero\n");
+        return EXIT_FAILURE;
+    }
+
+    printf(CSV_HEADER);
+
+    while (*node_list != '\0')
+    {
+        nodes = strtol(node_list, &end, 0);
+        if (end == node_list || nodes < 1 || nodes > MAX_SENSORS)
+        {
+            fprintf(stderr, "node counts must be 1 to %u\n", MAX_SENSORS);
+            return EXIT_FAILURE;
+        }
+
+        ok &= run_child((uint16_t)nodes, verbose);
+
+        node_list = (*end == ',') ? end + 1 : end;
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}